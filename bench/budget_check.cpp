@@ -0,0 +1,424 @@
+/*
+ --------------------------------------------------------------------------
+ budget_check.cpp
+
+ Response-size and allocation budgets of the operations.
+
+ Calls every implemented read-only operation in-process (see ServiceHarness,
+ a fixed config), serializes the response like the daemon sends it and
+ compares the XML bytes, soap_malloc blocks and operator new allocations
+ with the budgets checked in (bench/budgets.txt). A value over its
+ budget + tolerance fails the check (exit code 1), so a change that bloats
+ GetProfiles or GetCapabilities is seen before it reaches the devices
+ on slow links. An operation without a budget (or with '-') fails too,
+ a new operation gets its budget with the change that adds it. Only a file
+ without any recorded budget (a new tree, see --update) is skipped: there
+ is nothing to compare with yet, it is reported, not failed.
+
+ After an intended change the budgets are rewritten by --update,
+ the diff of budgets.txt goes to the review with the change.
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "service_harness.h"
+#include "soapDeviceBindingService.h"
+#include "soapMediaBindingService.h"
+#include "soapPTZBindingService.h"
+#include "soapEventBindingService.h"
+
+
+
+
+
+#ifndef BUDGETS_FILE
+#define BUDGETS_FILE "budgets.txt"
+#endif
+
+
+static const char *help_str =
+        "Usage: onvif_budget_check [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --budgets      [value] Budgets file               (default = " BUDGETS_FILE ")\n"
+        "       --tolerance    [value] Allowed growth in percent  (default = 10)\n"
+        "       --update               Write the measured values to the budgets file\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        budgets = 1,
+        tolerance,
+        update
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",      no_argument,       NULL, LongOpts::help      },
+    { "budgets",   required_argument, NULL, LongOpts::budgets   },
+    { "tolerance", required_argument, NULL, LongOpts::tolerance },
+    { "update",    no_argument,       NULL, LongOpts::update    },
+    { NULL,        no_argument,       NULL, 0                   }
+};
+
+
+
+
+
+struct BenchConfig
+{
+    std::string  budgets;
+    unsigned int tolerance;     // %
+    bool         update;
+};
+
+
+static BenchConfig cfg;
+
+
+
+// the measured costs of one operation (one request)
+enum BudgetValue
+{
+    BUDGET_XML,             // bytes of the serialized Envelope
+    BUDGET_SOAP_ALLOCS,     // soap_malloc
+    BUDGET_NEW_ALLOCS,      // operator new (C++ objects, std::string)
+
+    BUDGET_CNT_VALUES
+};
+
+
+static const char *value_names[BUDGET_CNT_VALUES] = { "xml_bytes", "soap_allocs", "new_allocs" };
+
+
+struct Budget
+{
+    long long val[BUDGET_CNT_VALUES];   // -1 - not recorded
+};
+
+
+
+struct Operation
+{
+    const char                              *name;
+    std::function<int(ServiceHarness &h)>    run;
+};
+
+
+static DeviceBindingService *device;
+static MediaBindingService  *media;
+static PTZBindingService    *ptz;
+static EventBindingService  *events;
+
+
+static const char *TOKEN = "RTSP"; // the profile of ServiceHarness
+
+
+
+// call the handler of the service and serialize its response
+#define OPERATION(_service, _inst, _prefix, _op, _setup)                            \
+    { #_service "." #_op, [](ServiceHarness &h) {                                   \
+        _##_prefix##__##_op           req;                                          \
+        _##_prefix##__##_op##Response res;                                          \
+        _setup;                                                                     \
+        int err = _inst->_op(&req, res);                                            \
+        return err ? err : h.serialize(res, #_prefix ":" #_op "Response");          \
+    }}
+
+
+// only the operations without side effects (no users, files, processes)
+static const std::vector<Operation> operations =
+{
+    OPERATION(Device, device, tds, GetServices,               req.IncludeCapability = true),
+    OPERATION(Device, device, tds, GetServiceCapabilities,    (void)0),
+    OPERATION(Device, device, tds, GetDeviceInformation,      (void)0),
+    OPERATION(Device, device, tds, GetSystemDateAndTime,      (void)0),
+    OPERATION(Device, device, tds, GetScopes,                 (void)0),
+    OPERATION(Device, device, tds, GetWsdlUrl,                (void)0),
+    OPERATION(Device, device, tds, GetUsers,                  (void)0),
+    OPERATION(Device, device, tds, GetIPAddressFilter,        (void)0),
+    OPERATION(Device, device, tds, GetCapabilities,           (void)0),
+    OPERATION(Device, device, tds, GetNetworkInterfaces,      (void)0),
+
+    OPERATION(Media,  media,  trt, GetServiceCapabilities,        (void)0),
+    OPERATION(Media,  media,  trt, GetVideoSources,               (void)0),
+    OPERATION(Media,  media,  trt, GetProfile,                    req.ProfileToken = TOKEN),
+    OPERATION(Media,  media,  trt, GetProfiles,                   (void)0),
+    OPERATION(Media,  media,  trt, GetStreamUri,                  req.ProfileToken = TOKEN),
+    OPERATION(Media,  media,  trt, GetSnapshotUri,                req.ProfileToken = TOKEN),
+    OPERATION(Media,  media,  trt, GetVideoSourceConfigurations,  (void)0),
+    OPERATION(Media,  media,  trt, GetVideoEncoderConfigurations, (void)0),
+    OPERATION(Media,  media,  trt, GetVideoSourceConfiguration,   req.ConfigurationToken = TOKEN),
+    OPERATION(Media,  media,  trt, GetVideoEncoderConfiguration,  req.ConfigurationToken = TOKEN),
+    OPERATION(Media,  media,  trt, GetGuaranteedNumberOfVideoEncoderInstances, req.ConfigurationToken = TOKEN),
+
+    OPERATION(PTZ,    ptz,    tptz, GetNodes,                 (void)0),
+    OPERATION(PTZ,    ptz,    tptz, GetNode,                  req.NodeToken = "PTZNodeToken"),
+    OPERATION(PTZ,    ptz,    tptz, ContinuousMove,           req.ProfileToken = TOKEN),
+    OPERATION(PTZ,    ptz,    tptz, Stop,                     req.ProfileToken = TOKEN),
+
+    OPERATION(Events, events, tev, GetServiceCapabilities,    (void)0),
+    OPERATION(Events, events, tev, GetEventProperties,        (void)0),
+};
+
+
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    cfg.budgets   = BUDGETS_FILE;
+    cfg.tolerance = 10;
+    cfg.update    = false;
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::budgets:
+                        cfg.budgets = optarg;
+                        break;
+
+            case LongOpts::tolerance:
+                        cfg.tolerance = atoi(optarg);
+                        break;
+
+            case LongOpts::update:
+                        cfg.update = true;
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+
+
+// ------------------------------- Budgets file -------------------------------
+
+
+
+
+// "name xml_bytes soap_allocs new_allocs" per line, '-' - not recorded, '#' - comment
+static std::map<std::string, Budget> load_budgets(const std::string &path)
+{
+    std::map<std::string, Budget> budgets;
+
+    FILE *fp = fopen(path.c_str(), "r");
+    if( !fp )
+        return budgets;
+
+
+    char line[256];
+
+    while( fgets(line, sizeof(line), fp) )
+    {
+        char name[128], val[BUDGET_CNT_VALUES][32];
+
+        if( (line[0] == '#') ||
+            (sscanf(line, "%127s %31s %31s %31s", name, val[0], val[1], val[2]) != 1 + BUDGET_CNT_VALUES) )
+            continue;
+
+        Budget &budget = budgets[name];
+
+        for(int i = 0; i < BUDGET_CNT_VALUES; i++)
+            budget.val[i] = (val[i][0] == '-') ? -1 : atoll(val[i]);
+    }
+
+    fclose(fp);
+
+    return budgets;
+}
+
+
+
+static bool save_budgets(const std::string &path, const std::vector<Budget> &measured)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if( !fp )
+        return false;
+
+    fprintf(fp, "# Budgets of the responses for onvif_budget_check (one request, the fixed config of ServiceHarness)\n"
+                "# update: onvif_budget_check --update, the diff is reviewed with the change\n"
+                "#\n"
+                "# %-52s %10s %12s %12s\n", "operation", value_names[0], value_names[1], value_names[2]);
+
+    for(size_t i = 0; i < operations.size(); i++)
+    {
+        fprintf(fp, "%-54s", operations[i].name);
+
+        for(int v = 0; v < BUDGET_CNT_VALUES; v++)
+        {
+            if( measured[i].val[v] < 0 )
+                fprintf(fp, " %*s", v ? 12 : 10, "-");  // the operation failed
+            else
+                fprintf(fp, " %*lld", v ? 12 : 10, measured[i].val[v]);
+        }
+
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+
+    ServiceHarness harness;
+
+    if( !harness.init("lo") )
+    {
+        fprintf(stderr, "Can't init harness: %s\n", harness.get_cstr_err());
+        return EXIT_FAILURE;
+    }
+
+    DeviceBindingService device_inst(harness.get_soap());
+    MediaBindingService  media_inst(harness.get_soap());
+    PTZBindingService    ptz_inst(harness.get_soap());
+    EventBindingService  events_inst(harness.get_soap());
+
+    device = &device_inst;
+    media  = &media_inst;
+    ptz    = &ptz_inst;
+    events = &events_inst;
+
+
+    std::map<std::string, Budget> budgets = load_budgets(cfg.budgets);
+    std::vector<Budget>           measured(operations.size(), Budget{ { -1, -1, -1 } });
+
+    bool recorded = false;
+    for(const auto &budget : budgets)
+        recorded = recorded || (budget.second.val[BUDGET_XML] >= 0);
+
+    int failed = 0, missing = 0;
+
+    printf("%-54s %10s %12s %12s  %s\n", "operation", value_names[0], value_names[1], value_names[2], "(budget)");
+
+
+    for(size_t i = 0; i < operations.size(); i++)
+    {
+        const Operation &op = operations[i];
+
+        // the first call does the static allocations (std::string of the context, ...)
+        op.run(harness);
+        harness.end_request();
+
+
+        harness.begin();
+        int err = op.run(harness);
+        HarnessStat stat = harness.end();
+        harness.end_request();
+
+        if( err != SOAP_OK )
+        {
+            printf("%-54s FAIL: soap error %d\n", op.name, err);
+            failed++;
+            continue;
+        }
+
+
+        Budget &cur = measured[i];
+        cur.val[BUDGET_XML]         = stat.out_bytes;
+        cur.val[BUDGET_SOAP_ALLOCS] = stat.soap_allocs;
+        cur.val[BUDGET_NEW_ALLOCS]  = stat.heap_allocs;
+
+        printf("%-54s %10lld %12lld %12lld", op.name, cur.val[0], cur.val[1], cur.val[2]);
+
+
+        auto it = budgets.find(op.name);
+        if( (it == budgets.end()) ||
+            (it->second.val[BUDGET_XML] < 0) || (it->second.val[BUDGET_SOAP_ALLOCS] < 0) || (it->second.val[BUDGET_NEW_ALLOCS] < 0) )
+        {
+            printf("  FAIL: no budget\n");
+            missing++;
+            continue;
+        }
+
+
+        const Budget &budget = it->second;
+        std::string   over;
+
+        printf("  (%lld %lld %lld)", budget.val[0], budget.val[1], budget.val[2]);
+
+        for(int v = 0; v < BUDGET_CNT_VALUES; v++)
+        {
+            if( cur.val[v] * 100 > budget.val[v] * (100 + cfg.tolerance) )
+                over += std::string(" ") + value_names[v];
+        }
+
+        if( !over.empty() )
+        {
+            printf("  FAIL: over the budget:%s\n", over.c_str());
+            failed++;
+        }
+        else
+        {
+            printf("\n");
+        }
+    }
+
+
+    if( cfg.update )
+    {
+        if( !save_budgets(cfg.budgets, measured) )
+        {
+            fprintf(stderr, "Can't write budgets: %s\n", cfg.budgets.c_str());
+            return EXIT_FAILURE;
+        }
+
+        printf("\nbudgets are written: %s\n", cfg.budgets.c_str());
+        return EXIT_SUCCESS;
+    }
+
+
+    printf("\n%zu operations, %d over the budget (tolerance %u%%), %d without a budget (see --update)\n",
+           operations.size(), failed, cfg.tolerance, missing);
+
+    if( !recorded && !failed )
+    {
+        printf("SKIP: no budget is recorded in %s, record them by --update on a reference build\n", cfg.budgets.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    return (failed || missing) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,812 @@
+/*
+ --------------------------------------------------------------------------
+ discovery_bench.cpp
+
+ WS-Discovery load generator and latency benchmark.
+
+ Fires Probe messages at a discovery responder at a fixed (open-loop) rate
+ with a configurable mix of Types/Scopes filters, matches ProbeMatches
+ replies by RelatesTo and reports reply latency percentiles, the drop rate
+ and the CPU time spent by the responder process (see --pid).
+
+ Everything goes over loopback (or multicast with loopback enabled),
+ so the benchmark needs no real network.
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_discovery_bench [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --target       [value] Responder address ip:port  (default = 127.0.0.1:3702)\n"
+        "                              a multicast address (239.255.255.250:3702) is sent\n"
+        "                              with multicast loopback enabled\n"
+        "       --if_addr      [value] Interface for multicast    (default = 127.0.0.1)\n"
+        "       --rate         [value] Probes per second          (default = 200)\n"
+        "       --duration     [value] Test duration in seconds   (default = 10)\n"
+        "       --timeout      [value] Reply timeout in ms        (default = 1000)\n"
+        "       --mix          [value] Filter mix, list of kind:weight (default = any:1)\n"
+        "                              kinds: any   - Probe without Types and Scopes\n"
+        "                                     type  - Probe with Types (see --types)\n"
+        "                                     scope - Probe with matching Scopes (see --scope)\n"
+        "                                     miss  - Probe with not matching Scopes\n"
+        "                                             (a reply is not expected)\n"
+        "       --types        [value] Types for 'type' probes    (default = dn:NetworkVideoTransmitter)\n"
+        "       --scope        [value] Scope for 'scope' probes   (default = onvif://www.onvif.org/Profile/Streaming)\n"
+        "       --pid          [value] PID of the responder, to report its CPU time\n"
+        "       --max_drop     [value] Fail (exit 1) if the drop rate is over it, %\n"
+        "       --max_p99      [value] Fail (exit 1) if the p99 latency is over it, us\n"
+        "       --responder            Start a built-in reference responder on the target\n"
+        "                              (calibrates the harness itself, no daemon needed)\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        target = 1,
+        if_addr,
+        rate,
+        duration,
+        timeout,
+        mix,
+        types,
+        scope,
+        pid,
+        responder,
+        max_drop,
+        max_p99
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",      no_argument,       NULL, LongOpts::help      },
+    { "target",    required_argument, NULL, LongOpts::target    },
+    { "if_addr",   required_argument, NULL, LongOpts::if_addr   },
+    { "rate",      required_argument, NULL, LongOpts::rate      },
+    { "duration",  required_argument, NULL, LongOpts::duration  },
+    { "timeout",   required_argument, NULL, LongOpts::timeout   },
+    { "mix",       required_argument, NULL, LongOpts::mix       },
+    { "types",     required_argument, NULL, LongOpts::types     },
+    { "scope",     required_argument, NULL, LongOpts::scope     },
+    { "pid",       required_argument, NULL, LongOpts::pid       },
+    { "responder", no_argument,       NULL, LongOpts::responder },
+    { "max_drop",  required_argument, NULL, LongOpts::max_drop  },
+    { "max_p99",   required_argument, NULL, LongOpts::max_p99   },
+    { NULL,        no_argument,       NULL, 0                   }
+};
+
+
+
+
+
+enum ProbeKind
+{
+    PROBE_ANY,
+    PROBE_TYPE,
+    PROBE_SCOPE,
+    PROBE_MISS,
+
+    PROBE_CNT_KINDS
+};
+
+
+static const char *kind_names[PROBE_CNT_KINDS] = { "any", "type", "scope", "miss" };
+
+
+// Scope that no responder is expected to have (used by 'miss' probes)
+static const char *MISS_SCOPE = "onvif://www.onvif.org/name/onvif_discovery_bench_no_such_device";
+
+
+// MessageID of every Probe is MSG_ID_PREFIX + sequence number (12 hex digits)
+static const char *MSG_ID_PREFIX = "urn:uuid:0b5eb3c4-d15c-4e7a-9a11-";
+
+
+
+struct BenchConfig
+{
+    struct sockaddr_in target;
+    struct in_addr     if_addr;
+
+    unsigned int rate;
+    unsigned int duration;
+    unsigned int timeout_ms;
+
+    std::vector<ProbeKind> mix;   //one entry per weight unit
+    std::string types;
+    std::string scope;
+
+    pid_t pid;
+    bool  responder;
+
+    double max_drop;   //%, < 0 - no check
+    double max_p99;    //us, <= 0 - no check
+};
+
+
+static BenchConfig cfg;
+
+static std::unique_ptr<std::atomic<uint64_t>[]> send_ts;  //ns, 0 - not sent
+static std::unique_ptr<std::atomic<uint64_t>[]> reply_ts; //ns, 0 - no reply
+static std::unique_ptr<uint8_t[]>               probe_kind;
+
+static std::atomic<bool> receiving(true);
+static std::atomic<bool> responding(true);
+static std::atomic<uint64_t> unmatched(0);
+static std::atomic<pid_t>    responder_tid(0);
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+        ;
+}
+
+
+
+static void error_exit(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    exit(EXIT_FAILURE);
+}
+
+
+
+static bool parse_addr(const char *str, struct sockaddr_in *addr)
+{
+    std::string s(str);
+    auto pos = s.rfind(':');
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(3702);
+
+    if( pos != std::string::npos )
+    {
+        addr->sin_port = htons(atoi(s.c_str() + pos + 1));
+        s.resize(pos);
+    }
+
+    return inet_pton(AF_INET, s.c_str(), &addr->sin_addr) == 1;
+}
+
+
+
+static bool parse_mix(const char *str)
+{
+    cfg.mix.clear();
+
+    std::string spec(str);
+    size_t start = 0;
+
+    while( start < spec.size() )
+    {
+        size_t end = spec.find(',', start);
+        if( end == std::string::npos )
+            end = spec.size();
+
+        std::string item = spec.substr(start, end - start);
+        std::string name = item.substr(0, item.find(':'));
+        int weight       = 1;
+
+        if( item.find(':') != std::string::npos )
+            weight = atoi(item.c_str() + item.find(':') + 1);
+
+        int kind = 0;
+        while( (kind < PROBE_CNT_KINDS) && (name != kind_names[kind]) )
+            ++kind;
+
+        if( (kind == PROBE_CNT_KINDS) || (weight <= 0) )
+            return false;
+
+        cfg.mix.insert(cfg.mix.end(), weight, static_cast<ProbeKind>(kind));
+        start = end + 1;
+    }
+
+    return !cfg.mix.empty();
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    parse_addr("127.0.0.1:3702", &cfg.target);
+    inet_pton(AF_INET, "127.0.0.1", &cfg.if_addr);
+    cfg.rate       = 200;
+    cfg.duration   = 10;
+    cfg.timeout_ms = 1000;
+    cfg.types      = "dn:NetworkVideoTransmitter";
+    cfg.scope      = "onvif://www.onvif.org/Profile/Streaming";
+    cfg.pid        = 0;
+    cfg.responder  = false;
+    cfg.max_drop   = -1;
+    cfg.max_p99    = 0;
+    parse_mix("any:1");
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::target:
+                        if( !parse_addr(optarg, &cfg.target) )
+                            error_exit("Bad target address: %s\n", optarg);
+                        break;
+
+            case LongOpts::if_addr:
+                        if( inet_pton(AF_INET, optarg, &cfg.if_addr) != 1 )
+                            error_exit("Bad interface address: %s\n", optarg);
+                        break;
+
+            case LongOpts::rate:
+                        cfg.rate = atoi(optarg);
+                        break;
+
+            case LongOpts::duration:
+                        cfg.duration = atoi(optarg);
+                        break;
+
+            case LongOpts::timeout:
+                        cfg.timeout_ms = atoi(optarg);
+                        break;
+
+            case LongOpts::mix:
+                        if( !parse_mix(optarg) )
+                            error_exit("Bad filter mix: %s\n", optarg);
+                        break;
+
+            case LongOpts::types:
+                        cfg.types = optarg;
+                        break;
+
+            case LongOpts::scope:
+                        cfg.scope = optarg;
+                        break;
+
+            case LongOpts::pid:
+                        cfg.pid = atoi(optarg);
+                        break;
+
+            case LongOpts::responder:
+                        cfg.responder = true;
+                        break;
+
+            case LongOpts::max_drop:
+                        cfg.max_drop = atof(optarg);
+                        break;
+
+            case LongOpts::max_p99:
+                        cfg.max_p99 = atof(optarg);
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( !cfg.rate || !cfg.duration || !cfg.timeout_ms )
+        error_exit("rate, duration and timeout must be > 0\n");
+}
+
+
+
+
+// ------------------------------- Probe/Reply -------------------------------
+
+
+
+
+static int build_probe(char *buf, size_t size, uint64_t seq, ProbeKind kind)
+{
+    std::string filter;
+
+    switch( kind )
+    {
+        case PROBE_TYPE:
+            filter = "<d:Types>" + cfg.types + "</d:Types>";
+            break;
+
+        case PROBE_SCOPE:
+            filter = "<d:Scopes>" + cfg.scope + "</d:Scopes>";
+            break;
+
+        case PROBE_MISS:
+            filter = std::string("<d:Scopes>") + MISS_SCOPE + "</d:Scopes>";
+            break;
+
+        default:
+            break;
+    }
+
+
+    return snprintf(buf, size,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\""
+        " xmlns:a=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\""
+        " xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\""
+        " xmlns:dn=\"http://www.onvif.org/ver10/network/wsdl\">"
+        "<s:Header>"
+        "<a:MessageID>%s%012llx</a:MessageID>"
+        "<a:To>urn:schemas-xmlsoap-org:ws:2005:04:discovery</a:To>"
+        "<a:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/Probe</a:Action>"
+        "</s:Header>"
+        "<s:Body><d:Probe>%s</d:Probe></s:Body>"
+        "</s:Envelope>",
+        MSG_ID_PREFIX, (unsigned long long)seq, filter.c_str());
+}
+
+
+
+// Find "<prefix>" + hex seq after the tag 'tag' (MessageID or RelatesTo)
+static bool find_seq(const char *msg, const char *tag, uint64_t *seq)
+{
+    const char *p = strstr(msg, tag);
+    if( !p )
+        return false;
+
+    p = strstr(p, MSG_ID_PREFIX);
+    if( !p )
+        return false;
+
+    char *end;
+    *seq = strtoull(p + strlen(MSG_ID_PREFIX), &end, 16);
+
+    return end != p + strlen(MSG_ID_PREFIX);
+}
+
+
+
+static int open_socket(void)
+{
+    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+
+    if( IN_MULTICAST(ntohl(cfg.target.sin_addr.s_addr)) )
+    {
+        unsigned char loop = 1, ttl = 1;
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL,  &ttl,  sizeof(ttl));
+
+        if( setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, &cfg.if_addr, sizeof(cfg.if_addr)) != 0 )
+            error_exit("Can't set multicast interface: %s\n", strerror(errno));
+    }
+
+    return sd;
+}
+
+
+
+static void receiver(int sd, uint64_t total)
+{
+    char buf[8192];
+
+    while( receiving )
+    {
+        struct pollfd pfd = { sd, POLLIN, 0 };
+        if( poll(&pfd, 1, 50) <= 0 )
+            continue;
+
+        ssize_t len = recv(sd, buf, sizeof(buf) - 1, 0);
+        if( len <= 0 )
+            continue;
+
+        uint64_t ts = now_ns();
+        uint64_t seq;
+        buf[len] = '\0';
+
+        if( !strstr(buf, "ProbeMatches") || !find_seq(buf, "RelatesTo", &seq) || (seq >= total) )
+        {
+            unmatched++;
+            continue;
+        }
+
+        uint64_t expected = 0;
+        reply_ts[seq].compare_exchange_strong(expected, ts); //count only the first reply
+    }
+}
+
+
+
+
+// ------------------------------- Reference responder -------------------------------
+
+
+
+
+/*
+ * Minimal WS-Discovery responder. It answers every Probe, except probes
+ * with a scope it does not have, just like a real device does. It has no
+ * XML parser, so it shows the overhead of the harness and the loopback path.
+ */
+static void reference_responder(int sd)
+{
+    char buf[8192];
+    char rsp[2048];
+
+    responder_tid = (pid_t)syscall(SYS_gettid);
+
+    while( responding )
+    {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+
+        struct pollfd pfd = { sd, POLLIN, 0 };
+        if( poll(&pfd, 1, 50) <= 0 )
+            continue;
+
+        ssize_t len = recvfrom(sd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&peer, &peer_len);
+        if( len <= 0 )
+            continue;
+
+        uint64_t seq;
+        buf[len] = '\0';
+
+        if( !strstr(buf, "Probe") || !find_seq(buf, "MessageID", &seq) || strstr(buf, MISS_SCOPE) )
+            continue;
+
+        int rsp_len = snprintf(rsp, sizeof(rsp),
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+            "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\""
+            " xmlns:a=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\""
+            " xmlns:d=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\">"
+            "<s:Header>"
+            "<a:Action>http://schemas.xmlsoap.org/ws/2005/04/discovery/ProbeMatches</a:Action>"
+            "<a:RelatesTo>%s%012llx</a:RelatesTo>"
+            "</s:Header>"
+            "<s:Body><d:ProbeMatches><d:ProbeMatch>"
+            "<a:EndpointReference><a:Address>urn:uuid:onvif_discovery_bench</a:Address></a:EndpointReference>"
+            "<d:Types>%s</d:Types><d:Scopes>%s</d:Scopes>"
+            "<d:XAddrs>http://127.0.0.1:1000/onvif/device_service</d:XAddrs>"
+            "<d:MetadataVersion>1</d:MetadataVersion>"
+            "</d:ProbeMatch></d:ProbeMatches></s:Body></s:Envelope>",
+            MSG_ID_PREFIX, (unsigned long long)seq, cfg.types.c_str(), cfg.scope.c_str());
+
+        sendto(sd, rsp, rsp_len, 0, (struct sockaddr *)&peer, peer_len);
+    }
+}
+
+
+
+static int open_responder_socket(void)
+{
+    int sd  = socket(AF_INET, SOCK_DGRAM, 0);
+    int set = 1;
+
+    if( sd < 0 )
+        error_exit("Can't create responder socket: %s\n", strerror(errno));
+
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set));
+
+
+    struct sockaddr_in addr = cfg.target;
+    if( IN_MULTICAST(ntohl(cfg.target.sin_addr.s_addr)) )
+    {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = cfg.target.sin_addr;
+        mreq.imr_interface = cfg.if_addr;
+
+        if( setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0 )
+            error_exit("Can't join multicast group: %s\n", strerror(errno));
+    }
+
+    if( bind(sd, (struct sockaddr *)&addr, sizeof(addr)) != 0 )
+        error_exit("Can't bind responder socket: %s\n", strerror(errno));
+
+    return sd;
+}
+
+
+
+
+// ------------------------------- Report -------------------------------
+
+
+
+
+// utime + stime of the process (or thread) in ms, -1 if it is unknown
+static long long process_cpu_ms(pid_t pid, bool thread = false)
+{
+    char path[64];
+    char buf[1024];
+
+    if( thread )
+        snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)pid);
+    else
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *fp = fopen(path, "r");
+    if( !fp )
+        return -1;
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+
+    // skip "pid (comm) " - comm can contain spaces
+    const char *p = strrchr(buf, ')');
+    if( !p )
+        return -1;
+
+    unsigned long long utime, stime;
+    if( sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2 )
+        return -1;
+
+    return (long long)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    if( sorted.empty() )
+        return 0;
+
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+    return sorted[idx] / 1000.0; //us
+}
+
+
+
+// returns false if the drop rate or p99 is over --max_drop/--max_p99
+static bool report(uint64_t total, double elapsed_s, long long cpu_ms)
+{
+    std::vector<uint64_t> lat[PROBE_CNT_KINDS];
+    uint64_t sent[PROBE_CNT_KINDS]    = {0};
+    uint64_t replied[PROBE_CNT_KINDS] = {0};
+    std::vector<uint64_t> all;
+
+
+    for(uint64_t i = 0; i < total; ++i)
+    {
+        uint64_t s = send_ts[i].load();
+        uint64_t r = reply_ts[i].load();
+        int kind   = probe_kind[i];
+
+        if( !s )
+            continue;
+
+        sent[kind]++;
+
+        if( r && (r - s <= cfg.timeout_ms * 1000000ull) )
+        {
+            replied[kind]++;
+            lat[kind].push_back(r - s);
+            all.push_back(r - s);
+        }
+    }
+
+
+    uint64_t sent_sum = 0, expected_sum = 0, replied_sum = 0, silent_ok = 0;
+
+    printf("\n%-6s %10s %10s %8s %10s %10s %10s %10s %10s\n",
+           "kind", "sent", "replied", "drop%", "p50,us", "p90,us", "p99,us", "p99.9,us", "max,us");
+
+    for(int k = 0; k < PROBE_CNT_KINDS; ++k)
+    {
+        if( !sent[k] )
+            continue;
+
+        std::sort(lat[k].begin(), lat[k].end());
+        sent_sum += sent[k];
+
+        // a 'miss' probe is answered correctly by silence
+        if( k == PROBE_MISS )
+        {
+            silent_ok = sent[k] - replied[k];
+            printf("%-6s %10llu %10llu %8s (%llu unexpected replies)\n", kind_names[k],
+                   (unsigned long long)sent[k], (unsigned long long)replied[k], "-",
+                   (unsigned long long)replied[k]);
+            continue;
+        }
+
+        expected_sum += sent[k];
+        replied_sum  += replied[k];
+
+        printf("%-6s %10llu %10llu %8.2f %10.1f %10.1f %10.1f %10.1f %10.1f\n", kind_names[k],
+               (unsigned long long)sent[k], (unsigned long long)replied[k],
+               100.0 * (sent[k] - replied[k]) / sent[k],
+               percentile(lat[k], 50), percentile(lat[k], 90), percentile(lat[k], 99),
+               percentile(lat[k], 99.9), lat[k].empty() ? 0 : lat[k].back() / 1000.0);
+    }
+
+
+    std::sort(all.begin(), all.end());
+
+    double drop = expected_sum ? 100.0 * (expected_sum - replied_sum) / expected_sum : 0.0;
+    double p99  = percentile(all, 99);
+
+    printf("\nprobes sent:        %llu (%.1f/s)\n", (unsigned long long)sent_sum, sent_sum / elapsed_s);
+    printf("replies expected:   %llu\n", (unsigned long long)expected_sum);
+    printf("replies received:   %llu\n", (unsigned long long)replied_sum);
+    printf("drop rate:          %.3f%%\n", drop);
+    printf("silent (miss) ok:   %llu\n", (unsigned long long)silent_ok);
+    printf("unmatched replies:  %llu\n", (unsigned long long)unmatched.load());
+    printf("latency p50/p99:    %.1f / %.1f us\n", percentile(all, 50), p99);
+
+    if( cpu_ms >= 0 )
+    {
+        printf("responder CPU time: %lld ms (%.1f%% of one core, %.1f us/probe)\n", cpu_ms,
+               100.0 * cpu_ms / (elapsed_s * 1000.0),
+               sent_sum ? cpu_ms * 1000.0 / sent_sum : 0.0);
+    }
+
+
+    bool ok = true;
+
+    if( (cfg.max_drop >= 0) && (drop > cfg.max_drop) )
+    {
+        printf("FAIL: drop rate %.3f%% > %.3f%%\n", drop, cfg.max_drop);
+        ok = false;
+    }
+
+    if( (cfg.max_p99 > 0) && (p99 > cfg.max_p99) )
+    {
+        printf("FAIL: p99 latency %.1f us > %.1f us\n", p99, cfg.max_p99);
+        ok = false;
+    }
+
+    return ok;
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+    const uint64_t total = (uint64_t)cfg.rate * cfg.duration;
+
+    send_ts.reset(new std::atomic<uint64_t>[total]);
+    reply_ts.reset(new std::atomic<uint64_t>[total]);
+    probe_kind.reset(new uint8_t[total]);
+
+    for(uint64_t i = 0; i < total; ++i)
+    {
+        send_ts[i]    = 0;
+        reply_ts[i]   = 0;
+        probe_kind[i] = cfg.mix[i % cfg.mix.size()];
+    }
+
+
+    std::thread responder_thread;
+    int responder_sd = -1;
+
+    if( cfg.responder )
+    {
+        responder_sd     = open_responder_socket();
+        responder_thread = std::thread(reference_responder, responder_sd);
+
+        while( !responder_tid )
+            usleep(1000);
+
+        cfg.pid = responder_tid;
+    }
+
+
+    int sd = open_socket();
+    std::thread receiver_thread(receiver, sd, total);
+
+    char target_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cfg.target.sin_addr, target_str, sizeof(target_str));
+    printf("target %s:%d, %u probes/s for %u s, reply timeout %u ms\n",
+           target_str, ntohs(cfg.target.sin_port), cfg.rate, cfg.duration, cfg.timeout_ms);
+
+
+    long long cpu_start = cfg.pid ? process_cpu_ms(cfg.pid, cfg.responder) : -1;
+    uint64_t  interval  = 1000000000ull / cfg.rate;
+    uint64_t  start     = now_ns();
+    char      probe[4096];
+
+    // open-loop: probe i is due at start + i*interval, regardless of replies
+    for(uint64_t i = 0; i < total; ++i)
+    {
+        sleep_until_ns(start + i * interval);
+
+        int len = build_probe(probe, sizeof(probe), i, static_cast<ProbeKind>(probe_kind[i]));
+
+        send_ts[i] = now_ns();
+        if( sendto(sd, probe, len, 0, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) != len )
+            send_ts[i] = 0;
+    }
+
+    double elapsed_s = (now_ns() - start) / 1e9;
+
+
+    // wait for the late replies
+    usleep(cfg.timeout_ms * 1000);
+
+    long long cpu_end = cfg.pid ? process_cpu_ms(cfg.pid, cfg.responder) : -1;
+
+    receiving = false;
+    receiver_thread.join();
+
+    if( cfg.responder )
+    {
+        responding = false;
+        responder_thread.join();
+        close(responder_sd);
+    }
+
+    close(sd);
+
+
+    bool ok = report(total, elapsed_s, (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1);
+
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
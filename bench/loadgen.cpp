@@ -0,0 +1,1173 @@
+/*
+ --------------------------------------------------------------------------
+ loadgen.cpp
+
+ ONVIF SOAP load generator.
+
+ Replays a configurable mix of the requests a VMS sends (GetCapabilities,
+ GetProfiles, GetStreamUri, GetSystemDateAndTime, PTZ moves) against
+ a running daemon over N concurrent HTTP connections, optionally with
+ WS-UsernameToken (PasswordDigest) in every request.
+
+ With --rate the requests are due at fixed times (open-loop), the latency
+ is counted from the due time, so a request that waits for a busy
+ connection shows the queueing too (no coordinated omission). Without
+ --rate every connection sends the next request after the reply
+ (closed-loop, the maximum throughput).
+
+ Reports throughput, latency percentiles per request kind, the CPU time
+ and the RSS of the daemon (see --pid): over a long run the RSS must stay
+ flat (a leak of the blocks of a request shows here).
+
+ With --digest_check it checks HTTP Digest of --user instead of the load:
+ one nonce for POSTs to two paths and a GET /metrics (the method and the
+ uri of every request are in the response), exits with 1 on a 401.
+ A GET /metrics without credentials must not be served (200).
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+#include "sha1.h"
+#include "md5.h"
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_loadgen [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --target       [value] Daemon address ip:port     (default = 127.0.0.1:1000)\n"
+        "       --conns        [value] Concurrent connections     (default = 4)\n"
+        "       --rate         [value] Requests per second, open-loop (default = closed-loop)\n"
+        "       --duration     [value] Test duration in seconds   (default = 10)\n"
+        "       --timeout      [value] Reply timeout in ms        (default = 1000)\n"
+        "       --mix          [value] Request mix, list of kind:weight\n"
+        "                              (default = caps:1,profiles:2,stream_uri:2,time:2,ptz_move:1,ptz_stop:1)\n"
+        "                              kinds: caps       - GetCapabilities (All)\n"
+        "                                     profiles   - GetProfiles\n"
+        "                                     stream_uri - GetStreamUri (see --profile)\n"
+        "                                     time       - GetSystemDateAndTime\n"
+        "                                     ptz_move   - ContinuousMove\n"
+        "                                     ptz_stop   - Stop\n"
+        "                                     ptz_rel    - RelativeMove (runs --move_* of the daemon)\n"
+        "       --profile      [value] Profile token for Media/PTZ (default = RTSP)\n"
+        "       --user         [value] Add WS-UsernameToken of the user (default don't add)\n"
+        "       --password     [value] Password of the user       (default = admin)\n"
+        "       --no_keepalive         New connection for every request (default = keep-alive)\n"
+        "       --pid          [value] PID of the daemon, to report its CPU time and RSS\n"
+        "       --digest_check         Check HTTP Digest of --user (two paths and a GET), no load\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        target = 1,
+        conns,
+        rate,
+        duration,
+        timeout,
+        mix,
+        profile,
+        user,
+        password,
+        no_keepalive,
+        pid,
+        digest_check
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",         no_argument,       NULL, LongOpts::help         },
+    { "target",       required_argument, NULL, LongOpts::target       },
+    { "conns",        required_argument, NULL, LongOpts::conns        },
+    { "rate",         required_argument, NULL, LongOpts::rate         },
+    { "duration",     required_argument, NULL, LongOpts::duration     },
+    { "timeout",      required_argument, NULL, LongOpts::timeout      },
+    { "mix",          required_argument, NULL, LongOpts::mix          },
+    { "profile",      required_argument, NULL, LongOpts::profile      },
+    { "user",         required_argument, NULL, LongOpts::user         },
+    { "password",     required_argument, NULL, LongOpts::password     },
+    { "no_keepalive", no_argument,       NULL, LongOpts::no_keepalive },
+    { "pid",          required_argument, NULL, LongOpts::pid          },
+    { "digest_check", no_argument,       NULL, LongOpts::digest_check },
+    { NULL,           no_argument,       NULL, 0                      }
+};
+
+
+
+
+
+enum RequestKind
+{
+    REQ_CAPS,
+    REQ_PROFILES,
+    REQ_STREAM_URI,
+    REQ_TIME,
+    REQ_PTZ_MOVE,
+    REQ_PTZ_STOP,
+    REQ_PTZ_REL,
+
+    REQ_CNT_KINDS
+};
+
+
+
+struct RequestType
+{
+    const char *name;
+    const char *path;
+    const char *body;   // %s - profile token
+};
+
+
+static const RequestType request_types[REQ_CNT_KINDS] =
+{
+    { "caps",       "/onvif/device_service",
+      "<tds:GetCapabilities><tds:Category>All</tds:Category></tds:GetCapabilities>" },
+
+    { "profiles",   "/onvif/media_service",
+      "<trt:GetProfiles/>" },
+
+    { "stream_uri", "/onvif/media_service",
+      "<trt:GetStreamUri><trt:StreamSetup><tt:Stream>RTP-Unicast</tt:Stream>"
+      "<tt:Transport><tt:Protocol>RTSP</tt:Protocol></tt:Transport></trt:StreamSetup>"
+      "<trt:ProfileToken>%s</trt:ProfileToken></trt:GetStreamUri>" },
+
+    { "time",       "/onvif/device_service",
+      "<tds:GetSystemDateAndTime/>" },
+
+    { "ptz_move",   "/onvif/ptz_service",
+      "<tptz:ContinuousMove><tptz:ProfileToken>%s</tptz:ProfileToken>"
+      "<tptz:Velocity><tt:PanTilt x=\"0.5\" y=\"0\"/></tptz:Velocity></tptz:ContinuousMove>" },
+
+    { "ptz_stop",   "/onvif/ptz_service",
+      "<tptz:Stop><tptz:ProfileToken>%s</tptz:ProfileToken>"
+      "<tptz:PanTilt>true</tptz:PanTilt><tptz:Zoom>true</tptz:Zoom></tptz:Stop>" },
+
+    { "ptz_rel",    "/onvif/ptz_service",
+      "<tptz:RelativeMove><tptz:ProfileToken>%s</tptz:ProfileToken>"
+      "<tptz:Translation><tt:PanTilt x=\"0.1\" y=\"0\"/></tptz:Translation></tptz:RelativeMove>" }
+};
+
+
+
+struct BenchConfig
+{
+    struct sockaddr_in target;
+
+    unsigned int conns;
+    unsigned int rate;        // 0 - closed-loop
+    unsigned int duration;
+    unsigned int timeout_ms;
+
+    std::vector<RequestKind> mix;   //one entry per weight unit (shuffled)
+    std::string profile;
+    std::string user;
+    std::string password;
+    bool        keepalive;
+
+    pid_t pid;
+    bool  digest_check;
+};
+
+
+static BenchConfig cfg;
+
+
+
+// result of one request
+struct Sample
+{
+    uint8_t  kind;
+    int16_t  status;      // HTTP status, -1 - timeout or connection error
+    uint64_t latency_ns;  // from the due time (open-loop) or the send
+    uint64_t service_ns;  // from the send
+};
+
+
+struct WorkerStat
+{
+    std::vector<Sample> samples;
+    uint64_t connects;
+    uint64_t late;        // sent more than 1 ms after the due time
+};
+
+
+static std::atomic<uint64_t> next_seq(0);
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+        ;
+}
+
+
+
+static void error_exit(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    exit(EXIT_FAILURE);
+}
+
+
+
+static bool parse_addr(const char *str, struct sockaddr_in *addr)
+{
+    std::string s(str);
+    auto pos = s.rfind(':');
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(1000);
+
+    if( pos != std::string::npos )
+    {
+        addr->sin_port = htons(atoi(s.c_str() + pos + 1));
+        s.resize(pos);
+    }
+
+    return inet_pton(AF_INET, s.c_str(), &addr->sin_addr) == 1;
+}
+
+
+
+static bool parse_mix(const char *str)
+{
+    cfg.mix.clear();
+
+    std::string spec(str);
+    size_t start = 0;
+
+    while( start < spec.size() )
+    {
+        size_t end = spec.find(',', start);
+        if( end == std::string::npos )
+            end = spec.size();
+
+        std::string item = spec.substr(start, end - start);
+        std::string name = item.substr(0, item.find(':'));
+        int weight       = 1;
+
+        if( item.find(':') != std::string::npos )
+            weight = atoi(item.c_str() + item.find(':') + 1);
+
+        int kind = 0;
+        while( (kind < REQ_CNT_KINDS) && (name != request_types[kind].name) )
+            ++kind;
+
+        if( (kind == REQ_CNT_KINDS) || (weight <= 0) )
+            return false;
+
+        cfg.mix.insert(cfg.mix.end(), weight, static_cast<RequestKind>(kind));
+        start = end + 1;
+    }
+
+
+    // the kinds are interleaved, the same sequence every run
+    std::mt19937 rng(1);
+    std::shuffle(cfg.mix.begin(), cfg.mix.end(), rng);
+
+    return !cfg.mix.empty();
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    parse_addr("127.0.0.1:1000", &cfg.target);
+    cfg.conns      = 4;
+    cfg.rate       = 0;
+    cfg.duration   = 10;
+    cfg.timeout_ms = 1000;
+    cfg.profile    = "RTSP";
+    cfg.password   = "admin";
+    cfg.keepalive  = true;
+    cfg.pid        = 0;
+    cfg.digest_check = false;
+    parse_mix("caps:1,profiles:2,stream_uri:2,time:2,ptz_move:1,ptz_stop:1");
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::target:
+                        if( !parse_addr(optarg, &cfg.target) )
+                            error_exit("Bad target address: %s\n", optarg);
+                        break;
+
+            case LongOpts::conns:
+                        cfg.conns = atoi(optarg);
+                        break;
+
+            case LongOpts::rate:
+                        cfg.rate = atoi(optarg);
+                        break;
+
+            case LongOpts::duration:
+                        cfg.duration = atoi(optarg);
+                        break;
+
+            case LongOpts::timeout:
+                        cfg.timeout_ms = atoi(optarg);
+                        break;
+
+            case LongOpts::mix:
+                        if( !parse_mix(optarg) )
+                            error_exit("Bad request mix: %s\n", optarg);
+                        break;
+
+            case LongOpts::profile:
+                        cfg.profile = optarg;
+                        break;
+
+            case LongOpts::user:
+                        cfg.user = optarg;
+                        break;
+
+            case LongOpts::password:
+                        cfg.password = optarg;
+                        break;
+
+            case LongOpts::no_keepalive:
+                        cfg.keepalive = false;
+                        break;
+
+            case LongOpts::pid:
+                        cfg.pid = atoi(optarg);
+                        break;
+
+            case LongOpts::digest_check:
+                        cfg.digest_check = true;
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( !cfg.conns || !cfg.duration || !cfg.timeout_ms )
+        error_exit("conns, duration and timeout must be > 0\n");
+
+    if( cfg.digest_check && cfg.user.empty() )
+        error_exit("digest_check needs --user\n");
+}
+
+
+
+
+// ------------------------------- Request -------------------------------
+
+
+
+
+static std::string base64_encode(const uint8_t *data, size_t len)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string out;
+
+    for(size_t i = 0; i < len; i += 3)
+    {
+        uint32_t val = (uint32_t)data[i] << 16;
+
+        if( i + 1 < len ) val |= (uint32_t)data[i + 1] << 8;
+        if( i + 2 < len ) val |= data[i + 2];
+
+        out += table[(val >> 18) & 0x3F];
+        out += table[(val >> 12) & 0x3F];
+        out += (i + 1 < len) ? table[(val >> 6) & 0x3F] : '=';
+        out += (i + 2 < len) ? table[val & 0x3F]        : '=';
+    }
+
+    return out;
+}
+
+
+
+// WS-UsernameToken with PasswordDigest = Base64(SHA1(nonce + created + password))
+static std::string build_security(std::mt19937_64 &rng)
+{
+    uint8_t nonce[16];
+    uint64_t r1 = rng(), r2 = rng();
+    memcpy(nonce, &r1, 8);
+    memcpy(nonce + 8, &r2, 8);
+
+
+    char      created[32];
+    time_t    now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(created, sizeof(created), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    Sha1    sha1;
+    sha1.update(nonce, sizeof(nonce));
+    sha1.update(created, strlen(created));
+    sha1.update(cfg.password.data(), cfg.password.size());
+    sha1.final(digest);
+
+
+    return "<s:Header><wsse:Security s:mustUnderstand=\"1\""
+           " xmlns:wsse=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-wssecurity-secext-1.0.xsd\""
+           " xmlns:wsu=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-wssecurity-utility-1.0.xsd\">"
+           "<wsse:UsernameToken><wsse:Username>" + cfg.user + "</wsse:Username>"
+           "<wsse:Password Type=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-username-token-profile-1.0#PasswordDigest\">" +
+           base64_encode(digest, sizeof(digest)) + "</wsse:Password>"
+           "<wsse:Nonce EncodingType=\"http://docs.oasis-open.org/wss/2004/01/oasis-200401-wss-soap-message-security-1.0#Base64Binary\">" +
+           base64_encode(nonce, sizeof(nonce)) + "</wsse:Nonce>"
+           "<wsu:Created>" + created + "</wsu:Created>"
+           "</wsse:UsernameToken></wsse:Security></s:Header>";
+}
+
+
+
+static std::string build_body(RequestKind kind, bool security, std::mt19937_64 &rng)
+{
+    const RequestType &type = request_types[kind];
+
+    char op[1024];
+    snprintf(op, sizeof(op), type.body, cfg.profile.c_str());
+
+
+    std::string body =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\""
+        " xmlns:tt=\"http://www.onvif.org/ver10/schema\""
+        " xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\""
+        " xmlns:trt=\"http://www.onvif.org/ver10/media/wsdl\""
+        " xmlns:tptz=\"http://www.onvif.org/ver20/ptz/wsdl\">";
+
+    if( security )
+        body += build_security(rng);
+
+    body += std::string("<s:Body>") + op + "</s:Body></s:Envelope>";
+
+    return body;
+}
+
+
+
+static void build_request(std::string &out, RequestKind kind, std::mt19937_64 &rng)
+{
+    const RequestType &type = request_types[kind];
+    std::string        body = build_body(kind, !cfg.user.empty(), rng);
+
+
+    char header[512];
+    snprintf(header, sizeof(header),
+             "POST %s HTTP/1.1\r\n"
+             "Host: %s:%d\r\n"
+             "Content-Type: application/soap+xml; charset=utf-8\r\n"
+             "Content-Length: %zu\r\n"
+             "Connection: %s\r\n\r\n",
+             type.path, inet_ntoa(cfg.target.sin_addr), ntohs(cfg.target.sin_port),
+             body.size(), cfg.keepalive ? "keep-alive" : "close");
+
+    out  = header;
+    out += body;
+}
+
+
+
+
+// ------------------------------- Connection -------------------------------
+
+
+
+
+static int open_connection(void)
+{
+    int sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+    int on = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+
+    if( (connect(sd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) != 0) && (errno != EINPROGRESS) )
+    {
+        close(sd);
+        return -1;
+    }
+
+    struct pollfd pfd = { sd, POLLOUT, 0 };
+    int       err     = 0;
+    socklen_t len     = sizeof(err);
+
+    if( (poll(&pfd, 1, cfg.timeout_ms) <= 0) ||
+        (getsockopt(sd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) || err )
+    {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+
+
+static bool wait_fd(int sd, short events, uint64_t deadline)
+{
+    uint64_t now = now_ns();
+    if( now >= deadline )
+        return false;
+
+    struct pollfd pfd = { sd, events, 0 };
+
+    return poll(&pfd, 1, (int)((deadline - now) / 1000000 + 1)) > 0;
+}
+
+
+
+static bool send_all(int sd, const std::string &data, uint64_t deadline)
+{
+    size_t sent = 0;
+
+    while( sent < data.size() )
+    {
+        ssize_t len = send(sd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if( len > 0 )
+        {
+            sent += len;
+            continue;
+        }
+
+        if( (len < 0) && (errno != EAGAIN) && (errno != EINTR) )
+            return false;
+
+        if( !wait_fd(sd, POLLOUT, deadline) )
+            return false;
+    }
+
+    return true;
+}
+
+
+
+// value of the header (name with ':'), npos - no such header
+static size_t find_header(const std::string &head, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    for(size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2))
+    {
+        if( !strncasecmp(head.c_str() + pos + 2, name, name_len) )
+            return head.find_first_not_of(" \t", pos + 2 + name_len);
+    }
+
+    return std::string::npos;
+}
+
+
+
+/*
+ * Read the reply: the body ends by Content-Length, the last chunk or
+ * the close of the connection. Returns the HTTP status, -1 - error or timeout.
+ * keep is false if the server closes the connection.
+ * head - the status line and the headers (if it is given).
+ */
+static int read_reply(int sd, uint64_t deadline, bool &keep, std::string *head_out = nullptr)
+{
+    std::string buf;
+    char        chunk[16384];
+    size_t      head_len = 0;
+    size_t      body_len = 0;       // npos - up to the last chunk, 0 - up to the close
+    bool        chunked  = false;
+    int         status   = -1;
+
+    keep = false;
+
+    for(;;)
+    {
+        ssize_t len = recv(sd, chunk, sizeof(chunk), 0);
+
+        if( len > 0 )
+        {
+            buf.append(chunk, len);
+        }
+        else if( len == 0 )
+        {
+            // the end of the body without Content-Length
+            return (head_len && !body_len && !chunked) ? status : -1;
+        }
+        else
+        {
+            if( (errno != EAGAIN) && (errno != EINTR) )
+                return -1;
+
+            if( !wait_fd(sd, POLLIN, deadline) )
+                return -1;
+
+            continue;
+        }
+
+
+        if( !head_len )
+        {
+            size_t end = buf.find("\r\n\r\n");
+            if( end == std::string::npos )
+                continue;
+
+            head_len = end + 4;
+
+            std::string head = buf.substr(0, end);
+
+            if( head_out )
+                *head_out = head;
+
+            if( sscanf(head.c_str(), "HTTP/%*d.%*d %d", &status) != 1 )
+                return -1;
+
+
+            size_t pos = find_header(head, "Content-Length:");
+            if( pos != std::string::npos )
+                body_len = strtoul(head.c_str() + pos, NULL, 10);
+
+            pos = find_header(head, "Transfer-Encoding:");
+            chunked = (pos != std::string::npos) && !strncasecmp(head.c_str() + pos, "chunked", 7);
+
+            pos  = find_header(head, "Connection:");
+            keep = cfg.keepalive &&
+                   ((pos != std::string::npos) ? strncasecmp(head.c_str() + pos, "close", 5) != 0
+                                               : head.compare(0, 8, "HTTP/1.1") == 0);
+
+            if( !body_len && !chunked )
+                keep = false; // the body ends by the close
+        }
+
+
+        if( chunked )
+        {
+            if( (buf.size() >= head_len + 5) && !buf.compare(buf.size() - 5, 5, "0\r\n\r\n") )
+                return status;
+        }
+        else if( body_len && (buf.size() >= head_len + body_len) )
+        {
+            return status;
+        }
+    }
+}
+
+
+
+
+// ------------------------------- Workers -------------------------------
+
+
+
+
+static void worker(WorkerStat *stat, unsigned int idx, uint64_t start)
+{
+    std::mt19937_64 rng(now_ns() ^ ((uint64_t)idx << 48));
+    std::string     request;
+    int             sd = -1;
+
+    const uint64_t interval = cfg.rate ? 1000000000ull / cfg.rate : 0;
+    const uint64_t total    = (uint64_t)cfg.rate * cfg.duration;
+    const uint64_t end      = start + (uint64_t)cfg.duration * 1000000000ull;
+
+    for(;;)
+    {
+        uint64_t seq = next_seq++;
+        uint64_t due;
+
+        if( cfg.rate )
+        {
+            // open-loop: request seq is due at start + seq*interval, regardless of replies
+            if( seq >= total )
+                break;
+
+            due = start + seq * interval;
+            sleep_until_ns(due);
+        }
+        else
+        {
+            due = now_ns();
+            if( due >= end )
+                break;
+        }
+
+
+        RequestKind kind = cfg.mix[seq % cfg.mix.size()];
+        build_request(request, kind, rng);
+
+
+        uint64_t send_start = now_ns();
+        uint64_t deadline   = send_start + cfg.timeout_ms * 1000000ull;
+        bool     keep       = false;
+        int      status     = -1;
+
+        if( send_start > due + 1000000 )
+            stat->late++;
+
+        if( sd < 0 )
+        {
+            sd = open_connection();
+            stat->connects++;
+        }
+
+        if( (sd >= 0) && send_all(sd, request, deadline) )
+            status = read_reply(sd, deadline, keep);
+
+
+        uint64_t done = now_ns();
+        stat->samples.push_back({ (uint8_t)kind, (int16_t)status, done - due, done - send_start });
+
+
+        if( !keep && (sd >= 0) )
+        {
+            close(sd);
+            sd = -1;
+        }
+    }
+
+
+    if( sd >= 0 )
+        close(sd);
+}
+
+
+
+
+// ------------------------------- Digest check -------------------------------
+
+
+
+
+// param of the Digest challenge (name="value"), empty - there is no one
+static std::string get_challenge_param(const std::string &head, const char *name)
+{
+    size_t pos = find_header(head, "WWW-Authenticate:");
+    if( pos == std::string::npos )
+        return "";
+
+    std::string key   = std::string(" ") + name + "=\"";
+    size_t      start = head.find(key, pos);
+    if( start == std::string::npos )
+        return "";
+
+    start += key.size();
+
+    size_t end = head.find('"', start);
+
+    return (end == std::string::npos) ? "" : head.substr(start, end - start);
+}
+
+
+
+static std::string md5_hex(const std::string &str)
+{
+    char hex[MD5_DIGEST_SIZE*2 + 1];
+    Md5  md5;
+
+    md5.update(str.data(), str.size());
+    md5.final_hex(hex);
+
+    return hex;
+}
+
+
+
+// one request on its own connection, returns the HTTP status (-1 - error)
+static int send_check_request(const char *method, const char *path, const std::string &body,
+                              const std::string &auth, std::string *head)
+{
+    char host[64];
+    snprintf(host, sizeof(host), "%s:%d", inet_ntoa(cfg.target.sin_addr), ntohs(cfg.target.sin_port));
+
+    std::string request = std::string(method) + " " + path + " HTTP/1.1\r\n"
+                          "Host: " + host + "\r\n";
+
+    if( !auth.empty() )
+        request += "Authorization: " + auth + "\r\n";
+
+    if( !body.empty() )
+        request += "Content-Type: application/soap+xml; charset=utf-8\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n";
+
+    request += "Connection: close\r\n\r\n" + body;
+
+
+    int sd = open_connection();
+    if( sd < 0 )
+        return -1;
+
+    uint64_t deadline = now_ns() + cfg.timeout_ms * 1000000ull;
+    bool     keep;
+    int      status   = send_all(sd, request, deadline) ? read_reply(sd, deadline, keep, head) : -1;
+
+    close(sd);
+
+    return status;
+}
+
+
+
+/*
+ * HTTP Digest of --user with one nonce: the method and the uri are in the
+ * response, so a daemon that checks them against another request line
+ * (a previous path, always POST) answers 401 here.
+ */
+static int digest_check(void)
+{
+    std::mt19937_64 rng(now_ns());
+    std::string     head;
+
+
+    // the challenge: a request without credentials
+    int status = send_check_request("POST", request_types[REQ_CAPS].path, build_body(REQ_CAPS, false, rng), "", &head);
+
+    std::string realm = get_challenge_param(head, "realm");
+    std::string nonce = get_challenge_param(head, "nonce");
+
+    if( (status != 401) || realm.empty() || nonce.empty() )
+    {
+        printf("FAIL: no Digest challenge (HTTP %d), the daemon must run with users\n", status);
+        return EXIT_FAILURE;
+    }
+
+
+    // the statistics are not served without credentials
+    status  = send_check_request("GET", "/metrics", "", "", nullptr);
+    bool ok = (status != 200);
+    printf("%-4s %-4s %-24s HTTP %d (no credentials)\n", ok ? "ok" : "FAIL", "GET", "/metrics", status);
+
+
+    struct Check
+    {
+        const char  *method;
+        const char  *path;
+        RequestKind  kind;      // REQ_CNT_KINDS - no body
+    };
+
+    const Check checks[] =
+    {
+        { "POST", request_types[REQ_CAPS].path,     REQ_CAPS      },
+        { "POST", request_types[REQ_PROFILES].path, REQ_PROFILES  },
+        { "GET",  "/metrics",                       REQ_CNT_KINDS },
+        { "POST", request_types[REQ_CAPS].path,     REQ_CAPS      }   // after a GET
+    };
+
+
+    std::string ha1 = md5_hex(cfg.user + ":" + realm + ":" + cfg.password);
+
+    for(size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        const Check &check = checks[i];
+
+        char nc[16], cnonce[32];
+        snprintf(nc,     sizeof(nc),     "%08zx", i + 1);
+        snprintf(cnonce, sizeof(cnonce), "%016llx", (unsigned long long)rng());
+
+        std::string ha2      = md5_hex(std::string(check.method) + ":" + check.path);
+        std::string response = md5_hex(ha1 + ":" + nonce + ":" + nc + ":" + cnonce + ":auth:" + ha2);
+
+        std::string auth = "Digest username=\"" + cfg.user + "\", realm=\"" + realm + "\", nonce=\"" + nonce +
+                           "\", uri=\"" + check.path + "\", qop=auth, nc=" + nc + ", cnonce=\"" + cnonce +
+                           "\", response=\"" + response + "\", algorithm=MD5";
+
+        std::string body = (check.kind < REQ_CNT_KINDS) ? build_body(check.kind, false, rng) : "";
+
+        status = send_check_request(check.method, check.path, body, auth, nullptr);
+
+        bool pass = (status > 0) && (status != 401);
+        printf("%-4s %-4s %-24s HTTP %d\n", pass ? "ok" : "FAIL", check.method, check.path, status);
+
+        ok = ok && pass;
+    }
+
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+
+
+// ------------------------------- Report -------------------------------
+
+
+
+
+// utime + stime of the process in ms, -1 if it is unknown
+static long long process_cpu_ms(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *fp = fopen(path, "r");
+    if( !fp )
+        return -1;
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+
+    // skip "pid (comm) " - comm can contain spaces
+    const char *p = strrchr(buf, ')');
+    if( !p )
+        return -1;
+
+    unsigned long long utime, stime;
+    if( sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2 )
+        return -1;
+
+    return (long long)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+
+
+// VmRSS of the process in KB, -1 if it is unknown
+static long long process_rss_kb(pid_t pid)
+{
+    char path[64];
+    char line[256];
+    long long rss = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+
+    FILE *fp = fopen(path, "r");
+    if( !fp )
+        return -1;
+
+    while( fgets(line, sizeof(line), fp) )
+    {
+        if( sscanf(line, "VmRSS: %lld kB", &rss) == 1 )
+            break;
+    }
+
+    fclose(fp);
+
+    return rss;
+}
+
+
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    if( sorted.empty() )
+        return 0;
+
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+    return sorted[idx] / 1000.0; //us
+}
+
+
+
+static void report(const std::vector<WorkerStat> &stats, double elapsed_s, long long cpu_ms)
+{
+    std::vector<uint64_t> lat[REQ_CNT_KINDS];
+    uint64_t sent[REQ_CNT_KINDS]   = {0};
+    uint64_t ok[REQ_CNT_KINDS]     = {0};
+    uint64_t fault[REQ_CNT_KINDS]  = {0};
+    uint64_t failed[REQ_CNT_KINDS] = {0};
+    std::vector<uint64_t> all;
+    std::vector<uint64_t> service;
+    uint64_t connects = 0, late = 0;
+
+
+    for(const WorkerStat &stat : stats)
+    {
+        connects += stat.connects;
+        late     += stat.late;
+
+        for(const Sample &s : stat.samples)
+        {
+            sent[s.kind]++;
+
+            if( s.status < 0 )
+            {
+                failed[s.kind]++;
+                continue;
+            }
+
+            if( s.status == 200 )
+                ok[s.kind]++;
+            else
+                fault[s.kind]++; // 500 - SOAP fault, 401, 503, ...
+
+            lat[s.kind].push_back(s.latency_ns);
+            all.push_back(s.latency_ns);
+            service.push_back(s.service_ns);
+        }
+    }
+
+
+    uint64_t sent_sum = 0, ok_sum = 0, fault_sum = 0, failed_sum = 0;
+
+    printf("\n%-10s %9s %9s %8s %8s %10s %10s %10s %10s %10s\n",
+           "kind", "sent", "ok", "fault", "failed", "p50,us", "p90,us", "p99,us", "p99.9,us", "max,us");
+
+    for(int k = 0; k < REQ_CNT_KINDS; ++k)
+    {
+        if( !sent[k] )
+            continue;
+
+        std::sort(lat[k].begin(), lat[k].end());
+
+        sent_sum   += sent[k];
+        ok_sum     += ok[k];
+        fault_sum  += fault[k];
+        failed_sum += failed[k];
+
+        printf("%-10s %9llu %9llu %8llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", request_types[k].name,
+               (unsigned long long)sent[k], (unsigned long long)ok[k],
+               (unsigned long long)fault[k], (unsigned long long)failed[k],
+               percentile(lat[k], 50), percentile(lat[k], 90), percentile(lat[k], 99),
+               percentile(lat[k], 99.9), lat[k].empty() ? 0 : lat[k].back() / 1000.0);
+    }
+
+
+    std::sort(all.begin(), all.end());
+    std::sort(service.begin(), service.end());
+
+    printf("\nrequests sent:      %llu (%.1f/s)\n", (unsigned long long)sent_sum, sent_sum / elapsed_s);
+    printf("throughput (200):   %.1f/s\n", ok_sum / elapsed_s);
+    printf("not 200 / failed:   %llu / %llu (timeouts, connection errors)\n",
+           (unsigned long long)fault_sum, (unsigned long long)failed_sum);
+    printf("connections:        %llu (%.2f requests per connection)\n", (unsigned long long)connects,
+           connects ? (double)sent_sum / connects : 0.0);
+    printf("latency p50/p99:    %.1f / %.1f us\n", percentile(all, 50), percentile(all, 99));
+
+    if( cfg.rate )
+    {
+        printf("service p50/p99:    %.1f / %.1f us (from the send, without the queueing)\n",
+               percentile(service, 50), percentile(service, 99));
+        printf("late sends:         %llu (all connections were busy, see --conns)\n", (unsigned long long)late);
+    }
+
+    if( cpu_ms >= 0 )
+    {
+        printf("daemon CPU time:    %lld ms (%.1f%% of one core, %.1f us/request)\n", cpu_ms,
+               100.0 * cpu_ms / (elapsed_s * 1000.0),
+               sent_sum ? cpu_ms * 1000.0 / sent_sum : 0.0);
+    }
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+    if( cfg.digest_check )
+        return digest_check();
+
+
+    char target_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cfg.target.sin_addr, target_str, sizeof(target_str));
+
+    if( cfg.rate )
+        printf("target %s:%d, %u connections, %u requests/s (open-loop) for %u s, %s%s\n",
+               target_str, ntohs(cfg.target.sin_port), cfg.conns, cfg.rate, cfg.duration,
+               cfg.keepalive ? "keep-alive" : "connection per request", cfg.user.empty() ? "" : ", UsernameToken");
+    else
+        printf("target %s:%d, %u connections (closed-loop) for %u s, %s%s\n",
+               target_str, ntohs(cfg.target.sin_port), cfg.conns, cfg.duration,
+               cfg.keepalive ? "keep-alive" : "connection per request", cfg.user.empty() ? "" : ", UsernameToken");
+
+
+    std::vector<WorkerStat>  stats(cfg.conns);
+    std::vector<std::thread> workers;
+
+    long long cpu_start = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+    long long rss_start = cfg.pid ? process_rss_kb(cfg.pid) : -1;
+    uint64_t  start     = now_ns();
+
+    for(unsigned int i = 0; i < cfg.conns; ++i)
+    {
+        stats[i].connects = 0;
+        stats[i].late     = 0;
+        workers.emplace_back(worker, &stats[i], i, start);
+    }
+
+    for(std::thread &t : workers)
+        t.join();
+
+    double    elapsed_s = (now_ns() - start) / 1e9;
+    long long cpu_end   = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+    long long rss_end   = cfg.pid ? process_rss_kb(cfg.pid) : -1;
+
+
+    report(stats, elapsed_s, (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1);
+
+    if( (rss_start >= 0) && (rss_end >= 0) )
+        printf("daemon RSS:         %lld KB -> %lld KB (%+lld KB)\n", rss_start, rss_end, rss_end - rss_start);
+
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,729 @@
+/*
+ --------------------------------------------------------------------------
+ replay.cpp
+
+ Deterministic replay of the traffic captured by the daemon (--record FILE).
+
+ Every recorded request (raw HTTP header and body, as the client sent it)
+ is sent again on a new connection at its original offset from the first
+ record, divided by --speed (2 - twice as fast), or back-to-back with
+ --speed 0. The requests are due at fixed times (open-loop), the latency
+ is counted from the due time, so a stall of the daemon shows in the
+ percentiles like it did for the real clients.
+
+ Requests of the HTTPS listener are replayed over plain HTTP (they are
+ recorded after TLS). WS-UsernameToken has a nonce and Created time
+ (HTTP Digest has a nonce too): replayed, they are rejected, so replay
+ against a daemon with --no_auth to compare the handlers.
+
+ Reports latency percentiles, HTTP statuses, errors, the number of
+ distinct clients of the capture and the CPU time of the daemon (see --pid).
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "traffic_record.h"
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_replay [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --file         [value] Record file of the daemon (--record)\n"
+        "       --target       [value] Daemon address ip:port     (default = 127.0.0.1:1000)\n"
+        "       --speed        [value] Speed factor, 0 - as fast as possible (default = 1)\n"
+        "       --conns        [value] Max concurrent connections (default = 16)\n"
+        "       --timeout      [value] Reply timeout in ms        (default = 1000)\n"
+        "       --pid          [value] PID of the daemon, to report its CPU time\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        file = 1,
+        target,
+        speed,
+        conns,
+        timeout,
+        pid
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",         no_argument,       NULL, LongOpts::help         },
+    { "file",         required_argument, NULL, LongOpts::file         },
+    { "target",       required_argument, NULL, LongOpts::target       },
+    { "speed",        required_argument, NULL, LongOpts::speed        },
+    { "conns",        required_argument, NULL, LongOpts::conns        },
+    { "timeout",      required_argument, NULL, LongOpts::timeout      },
+    { "pid",          required_argument, NULL, LongOpts::pid          },
+    { NULL,           no_argument,       NULL, 0                      }
+};
+
+
+
+
+
+struct BenchConfig
+{
+    std::string        file;
+    struct sockaddr_in target;
+
+    double       speed;       // 0 - back-to-back
+    unsigned int conns;
+    unsigned int timeout_ms;
+
+    pid_t pid;
+};
+
+
+static BenchConfig cfg;
+
+
+
+// one request of the record file
+struct Record
+{
+    TrafficRecordHeader header;
+    std::string         data;
+    uint64_t            offset_ns;   // from the first record, divided by the speed
+};
+
+
+static std::vector<Record> records;
+
+
+
+// result of one request
+struct Sample
+{
+    int16_t  status;      // HTTP status, -1 - timeout or connection error
+    uint64_t latency_ns;  // from the due time
+    uint64_t service_ns;  // from the connect
+};
+
+
+struct WorkerStat
+{
+    std::vector<Sample> samples;
+    uint64_t late;        // sent more than 1 ms after the due time
+};
+
+
+static std::atomic<size_t> next_record(0);
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+        ;
+}
+
+
+
+static void error_exit(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    exit(EXIT_FAILURE);
+}
+
+
+
+static bool parse_addr(const char *str, struct sockaddr_in *addr)
+{
+    std::string s(str);
+    auto pos = s.rfind(':');
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(1000);
+
+    if( pos != std::string::npos )
+    {
+        addr->sin_port = htons(atoi(s.c_str() + pos + 1));
+        s.resize(pos);
+    }
+
+    return inet_pton(AF_INET, s.c_str(), &addr->sin_addr) == 1;
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    parse_addr("127.0.0.1:1000", &cfg.target);
+    cfg.speed      = 1;
+    cfg.conns      = 16;
+    cfg.timeout_ms = 1000;
+    cfg.pid        = 0;
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::file:
+                        cfg.file = optarg;
+                        break;
+
+            case LongOpts::target:
+                        if( !parse_addr(optarg, &cfg.target) )
+                            error_exit("Bad target address: %s\n", optarg);
+                        break;
+
+            case LongOpts::speed:
+                        cfg.speed = atof(optarg);
+                        break;
+
+            case LongOpts::conns:
+                        cfg.conns = atoi(optarg);
+                        break;
+
+            case LongOpts::timeout:
+                        cfg.timeout_ms = atoi(optarg);
+                        break;
+
+            case LongOpts::pid:
+                        cfg.pid = atoi(optarg);
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( cfg.file.empty() )
+        error_exit("record file is not set (see --file)\n");
+
+    if( !cfg.conns || !cfg.timeout_ms || (cfg.speed < 0) )
+        error_exit("conns and timeout must be > 0, speed must be >= 0\n");
+}
+
+
+
+
+// ------------------------------- Record file -------------------------------
+
+
+
+
+// returns the number of skipped (truncated) records
+static size_t load_records(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if( !fp )
+        error_exit("Can't open record file: %s - %s\n", path.c_str(), strerror(errno));
+
+
+    TrafficFileHeader file_header;
+
+    if( (fread(&file_header, sizeof(file_header), 1, fp) != 1) ||
+        memcmp(file_header.magic, TRAFFIC_FILE_MAGIC, sizeof(file_header.magic)) )
+        error_exit("Not a record file: %s\n", path.c_str());
+
+    if( file_header.version != TRAFFIC_FILE_VERSION )
+        error_exit("Unsupported version of record file: %u\n", file_header.version);
+
+
+    size_t skipped = 0;
+    Record rec;
+
+    while( fread(&rec.header, sizeof(rec.header), 1, fp) == 1 )
+    {
+        if( rec.header.len > TrafficRecorder::MAX_REQUEST )
+            error_exit("Broken record file: record %zu is %u bytes\n", records.size() + skipped, rec.header.len);
+
+        rec.data.resize(rec.header.len);
+
+        if( rec.header.len && (fread(&rec.data[0], rec.header.len, 1, fp) != 1) )
+            break; // the daemon is still writing it (or it was killed)
+
+        // the rest of the body is not known, the daemon would wait for it
+        if( rec.header.flags & TRAFFIC_TRUNCATED )
+        {
+            skipped++;
+            continue;
+        }
+
+        records.push_back(rec);
+    }
+
+    fclose(fp);
+
+
+    if( records.empty() )
+        return skipped;
+
+
+    // several runs of the daemon can append to the file: the order is by the time
+    std::stable_sort(records.begin(), records.end(), [](const Record &a, const Record &b) {
+        return a.header.time_us < b.header.time_us;
+    });
+
+    for(Record &r : records)
+    {
+        uint64_t offset_us = r.header.time_us - records.front().header.time_us;
+        r.offset_ns = cfg.speed ? (uint64_t)(offset_us * 1000.0 / cfg.speed) : 0;
+    }
+
+    return skipped;
+}
+
+
+
+
+// ------------------------------- Connection -------------------------------
+
+
+
+
+static int open_connection(uint64_t deadline)
+{
+    int sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+    int on = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+
+    if( (connect(sd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) != 0) && (errno != EINPROGRESS) )
+    {
+        close(sd);
+        return -1;
+    }
+
+    struct pollfd pfd = { sd, POLLOUT, 0 };
+    int       err     = 0;
+    socklen_t len     = sizeof(err);
+    uint64_t  now     = now_ns();
+
+    if( (now >= deadline) ||
+        (poll(&pfd, 1, (int)((deadline - now) / 1000000 + 1)) <= 0) ||
+        (getsockopt(sd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) || err )
+    {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+
+
+static bool wait_fd(int sd, short events, uint64_t deadline)
+{
+    uint64_t now = now_ns();
+    if( now >= deadline )
+        return false;
+
+    struct pollfd pfd = { sd, events, 0 };
+
+    return poll(&pfd, 1, (int)((deadline - now) / 1000000 + 1)) > 0;
+}
+
+
+
+static bool send_all(int sd, const std::string &data, uint64_t deadline)
+{
+    size_t sent = 0;
+
+    while( sent < data.size() )
+    {
+        ssize_t len = send(sd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if( len > 0 )
+        {
+            sent += len;
+            continue;
+        }
+
+        if( (len < 0) && (errno != EAGAIN) && (errno != EINTR) )
+            return false;
+
+        if( !wait_fd(sd, POLLOUT, deadline) )
+            return false;
+    }
+
+    return true;
+}
+
+
+
+// value of the header (name with ':'), npos - no such header
+static size_t find_header(const std::string &head, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    for(size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2))
+    {
+        if( !strncasecmp(head.c_str() + pos + 2, name, name_len) )
+            return head.find_first_not_of(" \t", pos + 2 + name_len);
+    }
+
+    return std::string::npos;
+}
+
+
+
+/*
+ * Read the reply: the body ends by Content-Length, the last chunk or
+ * the close of the connection. Returns the HTTP status, -1 - error or timeout.
+ */
+static int read_reply(int sd, uint64_t deadline)
+{
+    std::string buf;
+    char        chunk[16384];
+    size_t      head_len = 0;
+    size_t      body_len = 0;       // 0 - up to the close (or the last chunk)
+    bool        chunked  = false;
+    int         status   = -1;
+
+    for(;;)
+    {
+        ssize_t len = recv(sd, chunk, sizeof(chunk), 0);
+
+        if( len > 0 )
+        {
+            buf.append(chunk, len);
+        }
+        else if( len == 0 )
+        {
+            // the end of the body without Content-Length
+            return (head_len && !body_len && !chunked) ? status : -1;
+        }
+        else
+        {
+            if( (errno != EAGAIN) && (errno != EINTR) )
+                return -1;
+
+            if( !wait_fd(sd, POLLIN, deadline) )
+                return -1;
+
+            continue;
+        }
+
+
+        if( !head_len )
+        {
+            size_t end = buf.find("\r\n\r\n");
+            if( end == std::string::npos )
+                continue;
+
+            head_len = end + 4;
+
+            std::string head = buf.substr(0, end);
+
+            if( sscanf(head.c_str(), "HTTP/%*d.%*d %d", &status) != 1 )
+                return -1;
+
+
+            size_t pos = find_header(head, "Content-Length:");
+            if( pos != std::string::npos )
+                body_len = strtoul(head.c_str() + pos, NULL, 10);
+
+            pos = find_header(head, "Transfer-Encoding:");
+            chunked = (pos != std::string::npos) && !strncasecmp(head.c_str() + pos, "chunked", 7);
+        }
+
+
+        if( chunked )
+        {
+            if( (buf.size() >= head_len + 5) && !buf.compare(buf.size() - 5, 5, "0\r\n\r\n") )
+                return status;
+        }
+        else if( body_len && (buf.size() >= head_len + body_len) )
+        {
+            return status;
+        }
+    }
+}
+
+
+
+
+// ------------------------------- Workers -------------------------------
+
+
+
+
+// the workers take the records in order, a record is sent at start + its offset
+static void worker(WorkerStat *stat, uint64_t start)
+{
+    for(;;)
+    {
+        size_t idx = next_record++;
+        if( idx >= records.size() )
+            break;
+
+        const Record &rec = records[idx];
+        uint64_t      due = start + rec.offset_ns;
+
+        if( cfg.speed )
+            sleep_until_ns(due);
+        else
+            due = now_ns(); // back-to-back: the latency is from the send
+
+
+        uint64_t send_start = now_ns();
+        uint64_t deadline   = send_start + cfg.timeout_ms * 1000000ull;
+        int      status     = -1;
+
+        if( cfg.speed && (send_start > due + 1000000) )
+            stat->late++;
+
+        // the daemon serves one request per connection
+        int sd = open_connection(deadline);
+
+        if( sd >= 0 )
+        {
+            if( send_all(sd, rec.data, deadline) )
+                status = read_reply(sd, deadline);
+
+            close(sd);
+        }
+
+
+        uint64_t done = now_ns();
+        stat->samples.push_back({ (int16_t)status, done - due, done - send_start });
+    }
+}
+
+
+
+
+// ------------------------------- Report -------------------------------
+
+
+
+
+// utime + stime of the process in ms, -1 if it is unknown
+static long long process_cpu_ms(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *fp = fopen(path, "r");
+    if( !fp )
+        return -1;
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+
+    // skip "pid (comm) " - comm can contain spaces
+    const char *p = strrchr(buf, ')');
+    if( !p )
+        return -1;
+
+    unsigned long long utime, stime;
+    if( sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2 )
+        return -1;
+
+    return (long long)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    if( sorted.empty() )
+        return 0;
+
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+    return sorted[idx] / 1000.0; //us
+}
+
+
+
+static void report(const std::vector<WorkerStat> &stats, double elapsed_s, long long cpu_ms)
+{
+    std::vector<uint64_t> all;
+    std::vector<uint64_t> service;
+    std::map<int, uint64_t> statuses;
+    uint64_t failed = 0, late = 0;
+
+
+    for(const WorkerStat &stat : stats)
+    {
+        late += stat.late;
+
+        for(const Sample &s : stat.samples)
+        {
+            if( s.status < 0 )
+            {
+                failed++;
+                continue;
+            }
+
+            statuses[s.status]++;
+            all.push_back(s.latency_ns);
+            service.push_back(s.service_ns);
+        }
+    }
+
+
+    std::sort(all.begin(), all.end());
+    std::sort(service.begin(), service.end());
+
+    uint64_t sent = all.size() + failed;
+
+    printf("\nrequests sent:      %llu (%.1f/s)\n", (unsigned long long)sent, sent / elapsed_s);
+
+    for(const auto &it : statuses)
+        printf("  HTTP %d:         %llu\n", it.first, (unsigned long long)it.second);
+
+    printf("failed:             %llu (timeouts, connection errors)\n", (unsigned long long)failed);
+    printf("latency p50/p90/p99/p99.9/max: %.1f / %.1f / %.1f / %.1f / %.1f us\n",
+           percentile(all, 50), percentile(all, 90), percentile(all, 99), percentile(all, 99.9),
+           all.empty() ? 0 : all.back() / 1000.0);
+
+    if( cfg.speed )
+    {
+        printf("service p50/p99:    %.1f / %.1f us (from the send, without the queueing)\n",
+               percentile(service, 50), percentile(service, 99));
+        printf("late sends:         %llu (all connections were busy, see --conns)\n", (unsigned long long)late);
+    }
+
+    if( cpu_ms >= 0 )
+    {
+        printf("daemon CPU time:    %lld ms (%.1f%% of one core, %.1f us/request)\n", cpu_ms,
+               100.0 * cpu_ms / (elapsed_s * 1000.0),
+               sent ? cpu_ms * 1000.0 / sent : 0.0);
+    }
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+
+    size_t skipped = load_records(cfg.file);
+
+    if( records.empty() )
+        error_exit("No requests in record file: %s\n", cfg.file.c_str());
+
+
+    std::set<std::string> clients;
+    size_t                tls = 0;
+
+    for(const Record &r : records)
+    {
+        clients.insert(std::string((const char *)r.header.addr, sizeof(r.header.addr)) + (char)r.header.family);
+
+        if( r.header.flags & TRAFFIC_TLS )
+            tls++;
+    }
+
+
+    char target_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cfg.target.sin_addr, target_str, sizeof(target_str));
+
+    printf("%zu requests of %zu clients (%zu of HTTPS, %zu truncated are skipped), %.1f s of capture\n",
+           records.size(), clients.size(), tls, skipped,
+           (records.back().header.time_us - records.front().header.time_us) / 1e6);
+
+    if( cfg.speed )
+        printf("target %s:%d, up to %u connections, speed x%g\n", target_str, ntohs(cfg.target.sin_port), cfg.conns, cfg.speed);
+    else
+        printf("target %s:%d, up to %u connections, as fast as possible\n", target_str, ntohs(cfg.target.sin_port), cfg.conns);
+
+
+    std::vector<WorkerStat>  stats(cfg.conns);
+    std::vector<std::thread> workers;
+
+    long long cpu_start = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+    uint64_t  start     = now_ns();
+
+    for(unsigned int i = 0; i < cfg.conns; ++i)
+    {
+        stats[i].late = 0;
+        workers.emplace_back(worker, &stats[i], start);
+    }
+
+    for(std::thread &t : workers)
+        t.join();
+
+    double    elapsed_s = (now_ns() - start) / 1e9;
+    long long cpu_end   = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+
+
+    report(stats, elapsed_s, (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1);
+
+
+    return EXIT_SUCCESS;
+}
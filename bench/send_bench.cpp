@@ -0,0 +1,519 @@
+/*
+ --------------------------------------------------------------------------
+ send_bench.cpp
+
+ Latency of the output of a response over loopback: the HTTP header and
+ the body by two send() (like gsoap writes the header and the stored blocks)
+ or the whole response by one send() of ResponseWriter (--single_send of
+ the daemon).
+
+ A server thread answers every request by a SOAP-sized response (--body),
+ a client sends the requests one by one and measures the time up to the
+ last byte of the response:
+   keep-alive - all requests on one connection (write-write-read of the
+                server meets the delayed ACK of the client, Nagle holds
+                the body up to 40 ms)
+   close      - one request per connection (like the daemon serves them),
+                the connect is in the latency
+
+ The modes of the server output:
+   split         - header, body by two send(), Nagle is on
+   split_nodelay - header, body by two send(), TCP_NODELAY
+   single        - one send() of ResponseWriter, TCP_NODELAY
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "response_writer.h"
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_send_bench [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --requests     [value] Requests of every mode      (default = 200)\n"
+        "       --body         [value] Bytes of the response body  (default = 2048)\n"
+        "       --mode         [value] split|split_nodelay|single  (default = all)\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        requests = 1,
+        body,
+        mode
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",         no_argument,       NULL, LongOpts::help         },
+    { "requests",     required_argument, NULL, LongOpts::requests     },
+    { "body",         required_argument, NULL, LongOpts::body         },
+    { "mode",         required_argument, NULL, LongOpts::mode         },
+    { NULL,           no_argument,       NULL, 0                      }
+};
+
+
+
+
+
+enum SendMode
+{
+    SEND_SPLIT,
+    SEND_SPLIT_NODELAY,
+    SEND_SINGLE,
+
+    SEND_MODE_CNT
+};
+
+
+static const char *send_mode_names[SEND_MODE_CNT] =
+{
+    "split",
+    "split_nodelay",
+    "single"
+};
+
+
+
+struct BenchConfig
+{
+    unsigned int requests;
+    size_t       body_size;
+    int          mode;        // -1 - all
+};
+
+
+static BenchConfig cfg;
+
+
+
+static const char request_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\">"
+    "<s:Body><GetCapabilities xmlns=\"http://www.onvif.org/ver10/device/wsdl\">"
+    "<Category>All</Category></GetCapabilities></s:Body></s:Envelope>";
+
+
+static std::string request;
+static std::string response_header;
+static std::string response_body;
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void error_exit(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    exit(EXIT_FAILURE);
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    cfg.requests  = 200;
+    cfg.body_size = 2048;
+    cfg.mode      = -1;
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::requests:
+                        cfg.requests = atoi(optarg);
+                        break;
+
+            case LongOpts::body:
+                        cfg.body_size = atoi(optarg);
+                        break;
+
+            case LongOpts::mode:
+                        for(cfg.mode = 0; cfg.mode < SEND_MODE_CNT; cfg.mode++)
+                            if( !strcmp(optarg, send_mode_names[cfg.mode]) )
+                                break;
+
+                        if( cfg.mode == SEND_MODE_CNT )
+                            error_exit("Bad mode: %s\n", optarg);
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( !cfg.requests || !cfg.body_size )
+        error_exit("requests and body must be > 0\n");
+}
+
+
+
+static void init_messages(void)
+{
+    request = "POST /onvif/device_service HTTP/1.1\r\n"
+              "Host: 127.0.0.1\r\n"
+              "Content-Type: application/soap+xml; charset=utf-8\r\n"
+              "Content-Length: " + std::to_string(sizeof(request_body) - 1) + "\r\n\r\n";
+    request += request_body;
+
+
+    // a SOAP-like body of the size
+    response_body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\"><SOAP-ENV:Body>";
+
+    while( response_body.size() + 40 < cfg.body_size )
+        response_body += "<tt:XAddr>http://127.0.0.1/onvif</tt:XAddr>";
+
+    response_body += "</SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+
+    response_header = "HTTP/1.1 200 OK\r\n"
+                      "Server: gSOAP/2.8\r\n"
+                      "Content-Type: application/soap+xml; charset=utf-8\r\n"
+                      "Content-Length: " + std::to_string(response_body.size()) + "\r\n"
+                      "Connection: keep-alive\r\n\r\n";
+}
+
+
+
+
+// ------------------------------- Socket I/O -------------------------------
+
+
+
+
+static bool send_all(int sd, const char *data, size_t len)
+{
+    while( len )
+    {
+        ssize_t res = send(sd, data, len, MSG_NOSIGNAL);
+
+        if( res < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        data += res;
+        len  -= res;
+    }
+
+    return true;
+}
+
+
+
+// one HTTP message: header up to "\r\n\r\n" and the body by Content-Length
+static bool read_message(int sd, std::string &buf)
+{
+    char   chunk[16384];
+    size_t head_len = 0;
+    size_t body_len = 0;
+
+    buf.clear();
+
+    for(;;)
+    {
+        ssize_t len = recv(sd, chunk, sizeof(chunk), 0);
+
+        if( len < 0 && errno == EINTR )
+            continue;
+
+        if( len <= 0 )
+            return false;
+
+        buf.append(chunk, len);
+
+
+        if( !head_len )
+        {
+            size_t end = buf.find("\r\n\r\n");
+            if( end == std::string::npos )
+                continue;
+
+            head_len = end + 4;
+
+            size_t pos = buf.find("Content-Length: ");
+            if( pos < end )
+                body_len = strtoul(buf.c_str() + pos + 16, NULL, 10);
+        }
+
+        if( buf.size() >= head_len + body_len )
+            return true;
+    }
+}
+
+
+
+static void set_nodelay(int sd, int on)
+{
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+
+
+
+// ------------------------------- Server -------------------------------
+
+
+
+
+static void send_response(int sd, SendMode mode, ResponseWriter &writer)
+{
+    if( mode != SEND_SINGLE )
+    {
+        // gsoap in SOAP_IO_STORE mode: the header, then the stored body
+        send_all(sd, response_header.data(), response_header.size());
+        send_all(sd, response_body.data(),   response_body.size());
+        return;
+    }
+
+
+    writer.append(response_header.data(), response_header.size());
+    writer.append(response_body.data(),   response_body.size());
+
+    size_t sent = writer.send(sd);
+
+    if( sent < writer.size() )
+        send_all(sd, writer.data() + sent, writer.size() - sent);
+
+    writer.clear();
+}
+
+
+
+// the connections one by one, every one up to its close by the client
+static void server(int listen_sd, SendMode mode)
+{
+    ResponseWriter writer;
+    std::string    buf;
+
+    for(;;)
+    {
+        int sd = accept(listen_sd, NULL, NULL);
+        if( sd < 0 )
+            return; // the listener is closed: the end of the mode
+
+        set_nodelay(sd, mode != SEND_SPLIT);
+
+        while( read_message(sd, buf) )
+            send_response(sd, mode, writer);
+
+        close(sd);
+    }
+}
+
+
+
+static int open_listener(struct sockaddr_in *addr)
+{
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port        = 0;
+
+    socklen_t len = sizeof(*addr);
+
+    if( bind(sd, (struct sockaddr *)addr, sizeof(*addr)) ||
+        listen(sd, 16) ||
+        getsockname(sd, (struct sockaddr *)addr, &len) )
+        error_exit("Can't listen on loopback: %s\n", strerror(errno));
+
+    return sd;
+}
+
+
+
+
+// ------------------------------- Client -------------------------------
+
+
+
+
+static int open_connection(const struct sockaddr_in *addr)
+{
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+    set_nodelay(sd, 1);
+
+    if( connect(sd, (const struct sockaddr *)addr, sizeof(*addr)) )
+        error_exit("Can't connect: %s\n", strerror(errno));
+
+    return sd;
+}
+
+
+
+// latencies in ns of the requests
+static std::vector<uint64_t> run_client(const struct sockaddr_in *addr, bool keep_alive)
+{
+    std::vector<uint64_t> samples;
+    std::string           buf;
+    int                   sd = keep_alive ? open_connection(addr) : -1;
+
+    for(unsigned int i = 0; i < cfg.requests; i++)
+    {
+        uint64_t start = now_ns();
+
+        if( !keep_alive )
+            sd = open_connection(addr);
+
+        if( !send_all(sd, request.data(), request.size()) || !read_message(sd, buf) )
+            error_exit("Request %u is failed\n", i);
+
+        samples.push_back(now_ns() - start);
+
+        if( !keep_alive )
+            close(sd);
+    }
+
+    if( keep_alive )
+        close(sd);
+
+    std::sort(samples.begin(), samples.end());
+
+    return samples;
+}
+
+
+
+
+// ------------------------------- Report -------------------------------
+
+
+
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+    return sorted[idx] / 1000.0; //us
+}
+
+
+
+static void report(SendMode mode, bool keep_alive, const std::vector<uint64_t> &samples)
+{
+    uint64_t sum     = 0;
+    size_t   stalled = 0;
+
+    for(uint64_t s : samples)
+    {
+        sum += s;
+
+        if( s > 20000000 )  // 20 ms: the delayed ACK
+            stalled++;
+    }
+
+    printf("%-14s %-11s %10.1f %10.1f %10.1f %10.1f %8zu\n",
+           send_mode_names[mode], keep_alive ? "keep-alive" : "close",
+           percentile(samples, 50), percentile(samples, 99), samples.back() / 1000.0,
+           sum / 1000.0 / samples.size(), stalled);
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+    init_messages();
+
+
+    printf("%u requests per line, response: %zu bytes of header + %zu bytes of body\n\n",
+           cfg.requests, response_header.size(), response_body.size());
+
+    printf("%-14s %-11s %10s %10s %10s %10s %8s\n", "mode", "connection", "p50 us", "p99 us", "max us", "mean us", ">20ms");
+
+
+    for(int m = 0; m < SEND_MODE_CNT; m++)
+    {
+        if( (cfg.mode >= 0) && (cfg.mode != m) )
+            continue;
+
+        auto mode = static_cast<SendMode>(m);
+
+        struct sockaddr_in addr;
+        int listen_sd = open_listener(&addr);
+
+        std::thread server_thread(server, listen_sd, mode);
+
+
+        for(bool keep_alive : { true, false })
+            report(mode, keep_alive, run_client(&addr, keep_alive));
+
+
+        shutdown(listen_sd, SHUT_RDWR);    // accept of the server returns
+        close(listen_sd);
+        server_thread.join();
+    }
+
+
+    return EXIT_SUCCESS;
+}
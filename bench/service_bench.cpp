@@ -0,0 +1,362 @@
+/*
+ --------------------------------------------------------------------------
+ service_bench.cpp
+
+ Microbenchmarks of the response builders of ServiceContext and of the
+ handlers of the services, with and without the gSOAP serialization.
+
+ Everything runs in-process (see ServiceHarness): a soap context like
+ the one of the daemon writes to a memory sink, no sockets are involved.
+ Every iteration is one "request": build (+ serialize), then
+ soap_destroy + soap_end like the main loop.
+
+ Reports per operation: ns/op, allocations/op and bytes/op (operator new
+ and soap_malloc) and the size of the XML, so a regression of a single
+ function is visible.
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "service_harness.h"
+#include "soapDeviceBindingService.h"
+#include "soapMediaBindingService.h"
+#include "soapPTZBindingService.h"
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_service_bench [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --iterations   [value] Iterations per benchmark   (default = 20000)\n"
+        "       --filter       [value] Run only benchmarks with the substring in the name\n"
+        "       --if           [value] Interface for getNetworkInterface (default = lo)\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        iterations = 1,
+        filter,
+        ifs
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",       no_argument,       NULL, LongOpts::help       },
+    { "iterations", required_argument, NULL, LongOpts::iterations },
+    { "filter",     required_argument, NULL, LongOpts::filter     },
+    { "if",         required_argument, NULL, LongOpts::ifs        },
+    { NULL,         no_argument,       NULL, 0                    }
+};
+
+
+
+
+
+struct BenchConfig
+{
+    unsigned int iterations;
+    std::string  filter;
+    std::string  if_name;
+};
+
+
+static BenchConfig cfg;
+
+
+
+// one iteration, returns SOAP_OK or the error of soap
+struct BenchCase
+{
+    const char                              *name;
+    std::function<int(ServiceHarness &h)>    run;
+};
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    cfg.iterations = 20000;
+    cfg.if_name    = "lo";
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::iterations:
+                        cfg.iterations = atoi(optarg);
+                        break;
+
+            case LongOpts::filter:
+                        cfg.filter = optarg;
+                        break;
+
+            case LongOpts::ifs:
+                        cfg.if_name = optarg;
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( !cfg.iterations )
+    {
+        fprintf(stderr, "iterations must be > 0\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+
+// ------------------------------- Benchmarks -------------------------------
+
+
+
+
+static std::vector<BenchCase> make_cases(ServiceHarness &harness)
+{
+    auto soap = harness.get_soap();
+    auto ctx  = harness.get_ctx();
+
+    // the generated services share the soap of the harness (soapcpp2 -j)
+    static DeviceBindingService device(soap);
+    static MediaBindingService  media(soap);
+    static PTZBindingService    ptz(soap);
+
+    std::vector<BenchCase> cases;
+
+
+    // ---- builders of ServiceContext ----
+
+    cases.push_back({ "get_profile", [](ServiceHarness &h) {
+        return h.get_profile().get_profile(h.get_soap()) ? SOAP_OK : SOAP_EOM;
+    }});
+
+    cases.push_back({ "get_profile+xml", [](ServiceHarness &h) {
+        auto res = h.get_profile().get_profile(h.get_soap());
+        return res ? h.serialize(*res, "tt:Profile") : SOAP_EOM;
+    }});
+
+    cases.push_back({ "get_video_enc_cfg", [](ServiceHarness &h) {
+        return h.get_profile().get_video_enc_cfg(h.get_soap()) ? SOAP_OK : SOAP_EOM;
+    }});
+
+    cases.push_back({ "get_video_enc_cfg+xml", [](ServiceHarness &h) {
+        auto res = h.get_profile().get_video_enc_cfg(h.get_soap());
+        return res ? h.serialize(*res, "tt:Configurations") : SOAP_EOM;
+    }});
+
+    cases.push_back({ "getDeviceServiceCapabilities", [ctx](ServiceHarness &h) {
+        return ctx->getDeviceServiceCapabilities(h.get_soap()) ? SOAP_OK : SOAP_EOM;
+    }});
+
+    cases.push_back({ "getDeviceServiceCapabilities+xml", [ctx](ServiceHarness &h) {
+        auto res = ctx->getDeviceServiceCapabilities(h.get_soap());
+        return res ? h.serialize(*res, "tds:Capabilities") : SOAP_EOM;
+    }});
+
+    cases.push_back({ "get_SystemDateAndTime", [ctx](ServiceHarness &h) {
+        return ctx->get_SystemDateAndTime(h.get_soap()) ? SOAP_OK : SOAP_EOM;
+    }});
+
+    cases.push_back({ "get_SystemDateAndTime+xml", [ctx](ServiceHarness &h) {
+        auto res = ctx->get_SystemDateAndTime(h.get_soap());
+        return res ? h.serialize(*res, "tds:SystemDateAndTime") : SOAP_EOM;
+    }});
+
+    if( !ctx->eth_ifs.empty() )
+    {
+        cases.push_back({ "getNetworkInterface", [ctx](ServiceHarness &h) {
+            return ctx->getNetworkInterface(h.get_soap(), ctx->eth_ifs[0]) ? SOAP_OK : SOAP_EOM;
+        }});
+
+        cases.push_back({ "getNetworkInterface+xml", [ctx](ServiceHarness &h) {
+            auto res = ctx->getNetworkInterface(h.get_soap(), ctx->eth_ifs[0]);
+            return res ? h.serialize(*res, "tds:NetworkInterfaces") : SOAP_EOM;
+        }});
+    }
+
+    cases.push_back({ "get_stream_uri", [ctx](ServiceHarness &h) {
+        return ctx->get_stream_uri(h.get_profile().get_url(), htonl(h.get_soap()->ip)).empty() ? SOAP_EOM : SOAP_OK;
+    }});
+
+
+    // ---- handlers, the response is serialized like the daemon sends it ----
+
+    cases.push_back({ "Device.GetCapabilities+xml", [](ServiceHarness &h) {
+        _tds__GetCapabilities         req;
+        _tds__GetCapabilitiesResponse res;
+        int err = device.GetCapabilities(&req, res);
+        return err ? err : h.serialize(res, "tds:GetCapabilitiesResponse");
+    }});
+
+    cases.push_back({ "Device.GetSystemDateAndTime+xml", [](ServiceHarness &h) {
+        _tds__GetSystemDateAndTime         req;
+        _tds__GetSystemDateAndTimeResponse res;
+        int err = device.GetSystemDateAndTime(&req, res);
+        return err ? err : h.serialize(res, "tds:GetSystemDateAndTimeResponse");
+    }});
+
+    cases.push_back({ "Device.GetNetworkInterfaces+xml", [](ServiceHarness &h) {
+        _tds__GetNetworkInterfaces         req;
+        _tds__GetNetworkInterfacesResponse res;
+        int err = device.GetNetworkInterfaces(&req, res);
+        return err ? err : h.serialize(res, "tds:GetNetworkInterfacesResponse");
+    }});
+
+    cases.push_back({ "Media.GetProfiles+xml", [](ServiceHarness &h) {
+        _trt__GetProfiles         req;
+        _trt__GetProfilesResponse res;
+        int err = media.GetProfiles(&req, res);
+        return err ? err : h.serialize(res, "trt:GetProfilesResponse");
+    }});
+
+    cases.push_back({ "Media.GetStreamUri+xml", [](ServiceHarness &h) {
+        _trt__GetStreamUri         req;
+        _trt__GetStreamUriResponse res;
+        req.ProfileToken = h.get_profile().get_name();
+        int err = media.GetStreamUri(&req, res);
+        return err ? err : h.serialize(res, "trt:GetStreamUriResponse");
+    }});
+
+    cases.push_back({ "Media.GetVideoEncoderConfigurations+xml", [](ServiceHarness &h) {
+        _trt__GetVideoEncoderConfigurations         req;
+        _trt__GetVideoEncoderConfigurationsResponse res;
+        int err = media.GetVideoEncoderConfigurations(&req, res);
+        return err ? err : h.serialize(res, "trt:GetVideoEncoderConfigurationsResponse");
+    }});
+
+    cases.push_back({ "PTZ.GetNodes+xml", [](ServiceHarness &h) {
+        _tptz__GetNodes         req;
+        _tptz__GetNodesResponse res;
+        int err = ptz.GetNodes(&req, res);
+        return err ? err : h.serialize(res, "tptz:GetNodesResponse");
+    }});
+
+
+    return cases;
+}
+
+
+
+static bool run_case(ServiceHarness &harness, const BenchCase &bench)
+{
+    // warm up: the caches, the first allocations of std::string and gSOAP
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        bench.run(harness);
+        harness.end_request();
+    }
+
+
+    harness.begin();
+    uint64_t start = now_ns();
+
+    for(unsigned int i = 0; i < cfg.iterations; ++i)
+    {
+        if( bench.run(harness) != SOAP_OK )
+        {
+            printf("%-42s failed: soap error %d\n", bench.name, harness.get_soap()->error);
+            harness.end_request();
+            return false;
+        }
+
+        harness.end_request();
+    }
+
+    uint64_t    elapsed = now_ns() - start;
+    HarnessStat stat    = harness.end();
+    double      n       = cfg.iterations;
+
+
+    printf("%-42s %10.0f %8.1f %8.1f %10.0f %10.0f\n", bench.name,
+           elapsed / n,
+           stat.heap_allocs / n, stat.soap_allocs / n,
+           (stat.heap_bytes + stat.soap_bytes) / n,
+           stat.out_bytes / n);
+
+    return true;
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+
+    ServiceHarness harness;
+
+    if( !harness.init(cfg.if_name.empty() ? nullptr : cfg.if_name.c_str()) )
+    {
+        fprintf(stderr, "Can't init harness: %s\n", harness.get_cstr_err());
+        return EXIT_FAILURE;
+    }
+
+
+    printf("%u iterations per benchmark, allocs: operator new / soap_malloc\n\n", cfg.iterations);
+    printf("%-42s %10s %8s %8s %10s %10s\n", "benchmark", "ns/op", "new/op", "malloc/op", "bytes/op", "xml/op");
+
+
+    bool ok = true;
+
+    for(const BenchCase &bench : make_cases(harness))
+    {
+        if( !cfg.filter.empty() && !strstr(bench.name, cfg.filter.c_str()) )
+            continue;
+
+        ok &= run_case(harness, bench);
+    }
+
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <new>
+
+#include "service_harness.h"
+#include "DeviceBinding.nsmap"
+
+
+
+
+
+static uint64_t heap_allocs = 0;
+static uint64_t heap_bytes  = 0;
+static uint64_t soap_allocs = 0;
+static uint64_t soap_bytes  = 0;
+static uint64_t out_bytes   = 0;
+
+static std::string *sink = nullptr;   // the output of the harness
+
+
+
+// the heap of the process is counted: C++ objects of gSOAP (SOAP_NEW), std::string, ...
+void* operator new(size_t size)
+{
+    heap_allocs++;
+    heap_bytes += size;
+
+    void *ptr = malloc(size ? size : 1);
+    if( !ptr )
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void* operator new[](size_t size)                                   { return operator new(size); }
+void* operator new  (size_t size, const std::nothrow_t&) noexcept   { heap_allocs++; heap_bytes += size; return malloc(size ? size : 1); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept   { heap_allocs++; heap_bytes += size; return malloc(size ? size : 1); }
+void  operator delete  (void *ptr) noexcept                         { free(ptr); }
+void  operator delete[](void *ptr) noexcept                         { free(ptr); }
+void  operator delete  (void *ptr, const std::nothrow_t&) noexcept  { free(ptr); }
+void  operator delete[](void *ptr, const std::nothrow_t&) noexcept  { free(ptr); }
+
+
+
+
+
+ServiceHarness::ServiceHarness():
+    soap(nullptr)
+{
+}
+
+
+
+ServiceHarness::~ServiceHarness()
+{
+    if( !soap )
+        return;
+
+    soap_destroy(soap);
+    soap_end(soap);
+    soap_free(soap);
+    sink = nullptr;
+}
+
+
+
+bool ServiceHarness::init(const char *if_name)
+{
+    StreamProfile profile;
+
+    if( !profile.set_name("RTSP")                         ||
+        !profile.set_width("1280")                        ||
+        !profile.set_height("720")                        ||
+        !profile.set_url("rtsp://%s:554/unicast")         ||
+        !profile.set_snapurl("http://%s/snapshot.jpg")    ||
+        !profile.set_type("H264") )
+    {
+        str_err = "profile: " + profile.get_str_err();
+        return false;
+    }
+
+    if( !ctx.add_profile(profile) )
+    {
+        str_err = ctx.get_str_err();
+        return false;
+    }
+
+
+    if( !ctx.get_user_store()->init(ctx.get_http_digest()->get_realm(), ctx.user, ctx.password) )
+    {
+        str_err = "users: " + ctx.get_user_store()->get_str_err();
+        return false;
+    }
+
+
+    ctx.get_ptz_node()->enable = true;
+    ctx.scopes.push_back("onvif://www.onvif.org/name/Bench");
+    ctx.scopes.push_back("onvif://www.onvif.org/Profile/Streaming");
+
+    if( if_name )
+    {
+        ctx.eth_ifs.push_back(Eth_Dev_Param());
+
+        if( ctx.eth_ifs.back().open(if_name) != 0 )
+        {
+            str_err = std::string("can't open interface: ") + if_name;
+            return false;
+        }
+    }
+
+
+    soap = soap_new();
+    if( !soap )
+    {
+        str_err = "can't get mem for SOAP";
+        return false;
+    }
+
+    soap_set_namespaces(soap, namespaces);
+
+    soap->user    = (void*)&ctx;
+    soap->ip      = 0x7F000001;      // the client is 127.0.0.1
+    soap->fsend   = sink_send;
+    soap->fmalloc = count_malloc;
+
+    out.reserve(64 * 1024);
+    sink = &out;
+
+    return true;
+}
+
+
+
+void ServiceHarness::begin()
+{
+    heap_allocs = 0;
+    heap_bytes  = 0;
+    soap_allocs = 0;
+    soap_bytes  = 0;
+    out_bytes   = 0;
+}
+
+
+
+HarnessStat ServiceHarness::end() const
+{
+    return { heap_allocs, heap_bytes, soap_allocs, soap_bytes, out_bytes };
+}
+
+
+
+void ServiceHarness::end_request()
+{
+    soap_destroy(soap);
+    soap_end(soap);
+    out.clear();
+}
+
+
+
+int ServiceHarness::sink_send(struct soap *soap, const char *buf, size_t len)
+{
+    (void)soap;
+    sink->append(buf, len);
+    out_bytes += len;
+    return SOAP_OK;
+}
+
+
+
+void* ServiceHarness::count_malloc(struct soap *soap, size_t size)
+{
+    soap_allocs++;
+    soap_bytes += size;
+
+    // like the daemon: a block of fmalloc is not in soap->alist (soap_end would not free it)
+    soap->fmalloc = nullptr;
+    void *ptr     = soap_malloc(soap, size);
+    soap->fmalloc = count_malloc;
+
+    return ptr;
+}
@@ -0,0 +1,111 @@
+#ifndef SERVICE_HARNESS_H
+#define SERVICE_HARNESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "ServiceContext.h"
+
+
+
+
+
+// what a piece of work costs (see ServiceHarness::begin/end)
+struct HarnessStat
+{
+    uint64_t heap_allocs;   // operator new (C++ objects of gSOAP, std::string, ...)
+    uint64_t heap_bytes;
+    uint64_t soap_allocs;   // soap_malloc (the fmalloc hook)
+    uint64_t soap_bytes;
+    uint64_t out_bytes;     // serialized XML (the memory sink)
+};
+
+
+
+
+
+/*
+ * In-process harness of the services for the benchmarks and checks:
+ * a ServiceContext with a fixed config (one profile, PTZ, the admin, an interface)
+ * and a soap context like the daemon has, but its output is a memory sink
+ * (the fsend hook), so no sockets are involved.
+ *
+ * The handlers of the generated services take the soap of the harness:
+ *
+ *   MediaBindingService media(harness.get_soap());
+ *
+ * Everything is single threaded, the counters are global (operator new
+ * of the process is counted).
+ */
+class ServiceHarness
+{
+    public:
+
+        ServiceHarness();
+       ~ServiceHarness();
+
+        ServiceHarness(const ServiceHarness&) = delete;
+        ServiceHarness& operator=(const ServiceHarness&) = delete;
+
+
+        // if_name: the interface for getNetworkInterface, nullptr - none
+        bool init(const char *if_name);
+
+        struct soap*          get_soap()    { return soap;     }
+        ServiceContext*       get_ctx()     { return &ctx;     }
+        const StreamProfile&  get_profile() { return ctx.get_profiles().begin()->second; }
+        const std::string&    get_out()     { return out;      }
+
+
+        // the counters are zeroed by begin and read by end (for all requests between)
+        void begin();
+        HarnessStat end() const;
+
+        // soap_destroy + soap_end like the main loop, the sink (get_out) is cleared
+        void end_request();
+
+
+        // the response element in the SOAP Envelope, like the generated serve_ does
+        template<typename T>
+        int serialize(const T &obj, const char *tag)
+        {
+            soap_serializeheader(soap);
+            obj.soap_serialize(soap);
+
+            if( soap_begin_send(soap)            ||
+                soap_envelope_begin_out(soap)    ||
+                soap_putheader(soap)             ||
+                soap_body_begin_out(soap)        ||
+                obj.soap_put(soap, tag, "")      ||
+                soap_body_end_out(soap)          ||
+                soap_envelope_end_out(soap)      ||
+                soap_end_send(soap) )
+                return soap->error;
+
+            return SOAP_OK;
+        }
+
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        ServiceContext  ctx;
+        struct soap    *soap;
+        std::string     out;
+
+        std::string     str_err;
+
+
+        static int   sink_send(struct soap *soap, const char *buf, size_t len);
+        static void* count_malloc(struct soap *soap, size_t size);
+};
+
+
+
+
+
+#endif // SERVICE_HARNESS_H
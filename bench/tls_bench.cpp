@@ -0,0 +1,543 @@
+/*
+ --------------------------------------------------------------------------
+ tls_bench.cpp
+
+ TLS handshake benchmark: full vs resumed handshakes.
+
+ Opens connections to the HTTPS listener of the daemon (see --tls_port)
+ one by one, every connection does the handshake and one SOAP request
+ (GetSystemDateAndTime, it needs no credentials), like a VMS that polls
+ the device. First with a fresh session every time (full handshake),
+ then resuming the last session (session ticket or session ID).
+
+ Reports handshake latency percentiles, connections per second and
+ the CPU time spent by the daemon (see --pid) per connection,
+ so it is the tool to measure the cost of TLS on the target (ARM) board.
+-----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+
+
+
+
+static const char *help_str =
+        "Usage: onvif_tls_bench [options]\n\n"
+        "Options:                      description:\n\n"
+        "       --target       [value] HTTPS listener ip:port     (default = 127.0.0.1:1443)\n"
+        "       --count        [value] Connections per mode       (default = 500)\n"
+        "       --tls12                Use TLS 1.2 only           (default = TLS 1.2 or 1.3)\n"
+        "       --no_ticket            Resume by session ID, not by ticket (TLS 1.2 only)\n"
+        "       --cipher       [value] TLS 1.2 cipher list        (default = OpenSSL default)\n"
+        "       --pid          [value] PID of the daemon, to report its CPU time\n"
+        "  -h,  --help                 Display this help\n\n";
+
+
+
+
+namespace LongOpts
+{
+    enum
+    {
+        help = 'h',
+
+        target = 1,
+        count,
+        tls12,
+        no_ticket,
+        cipher,
+        pid
+    };
+}
+
+
+
+static const struct option long_opts[] =
+{
+    { "help",      no_argument,       NULL, LongOpts::help      },
+    { "target",    required_argument, NULL, LongOpts::target    },
+    { "count",     required_argument, NULL, LongOpts::count     },
+    { "tls12",     no_argument,       NULL, LongOpts::tls12     },
+    { "no_ticket", no_argument,       NULL, LongOpts::no_ticket },
+    { "cipher",    required_argument, NULL, LongOpts::cipher    },
+    { "pid",       required_argument, NULL, LongOpts::pid       },
+    { NULL,        no_argument,       NULL, 0                   }
+};
+
+
+
+
+
+static const char *REQUEST_BODY =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\""
+        " xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\">"
+        "<s:Body><tds:GetSystemDateAndTime/></s:Body></s:Envelope>";
+
+
+
+struct BenchConfig
+{
+    struct sockaddr_in target;
+
+    unsigned int count;
+    bool         tls12;
+    bool         no_ticket;
+    std::string  cipher;
+
+    pid_t pid;
+};
+
+
+static BenchConfig cfg;
+
+static SSL_SESSION *last_session = NULL;  // the newest session of the server
+
+
+
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void error_exit(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+
+    exit(EXIT_FAILURE);
+}
+
+
+
+static bool parse_addr(const char *str, struct sockaddr_in *addr)
+{
+    std::string s(str);
+    auto pos = s.rfind(':');
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(1443);
+
+    if( pos != std::string::npos )
+    {
+        addr->sin_port = htons(atoi(s.c_str() + pos + 1));
+        s.resize(pos);
+    }
+
+    return inet_pton(AF_INET, s.c_str(), &addr->sin_addr) == 1;
+}
+
+
+
+static void processing_cmd(int argc, char *argv[])
+{
+    int opt;
+
+    parse_addr("127.0.0.1:1443", &cfg.target);
+    cfg.count     = 500;
+    cfg.tls12     = false;
+    cfg.no_ticket = false;
+    cfg.pid       = 0;
+
+
+    while( (opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1 )
+    {
+        switch( opt )
+        {
+            case LongOpts::help:
+                        puts(help_str);
+                        exit(EXIT_SUCCESS);
+
+            case LongOpts::target:
+                        if( !parse_addr(optarg, &cfg.target) )
+                            error_exit("Bad target address: %s\n", optarg);
+                        break;
+
+            case LongOpts::count:
+                        cfg.count = atoi(optarg);
+                        break;
+
+            case LongOpts::tls12:
+                        cfg.tls12 = true;
+                        break;
+
+            case LongOpts::no_ticket:
+                        cfg.no_ticket = true;
+                        break;
+
+            case LongOpts::cipher:
+                        cfg.cipher = optarg;
+                        break;
+
+            case LongOpts::pid:
+                        cfg.pid = atoi(optarg);
+                        break;
+
+            default:
+                        puts("for more detail see help\n\n");
+                        exit(EXIT_FAILURE);
+        }
+    }
+
+
+    if( !cfg.count )
+        error_exit("count must be > 0\n");
+
+    if( cfg.no_ticket && !cfg.tls12 )
+        error_exit("--no_ticket needs --tls12 (TLS 1.3 resumes only by ticket)\n");
+}
+
+
+
+
+// ------------------------------- Connection -------------------------------
+
+
+
+
+// a new session (TLS 1.3: it comes after the handshake, with the reply)
+static int new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    (void)ssl;
+
+    if( last_session )
+        SSL_SESSION_free(last_session);
+
+    last_session = session;
+
+    return 1; // we keep the reference
+}
+
+
+
+static SSL_CTX *create_ctx(void)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if( !ctx )
+        error_exit("Can't create SSL context\n");
+
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    if( cfg.tls12 )
+        SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+
+    if( cfg.no_ticket )
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+
+    if( !cfg.cipher.empty() && (SSL_CTX_set_cipher_list(ctx, cfg.cipher.c_str()) != 1) )
+        error_exit("Bad cipher list: %s\n", cfg.cipher.c_str());
+
+
+    // the device has a self-signed cert as a rule, we measure, not check it
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+
+    return ctx;
+}
+
+
+
+struct ConnResult
+{
+    bool     ok;
+    bool     reused;
+    uint64_t handshake_ns;  // TCP connect + TLS handshake
+    uint64_t total_ns;      // + request/reply
+};
+
+
+
+static ConnResult do_connection(SSL_CTX *ctx, bool resume)
+{
+    ConnResult res = { false, false, 0, 0 };
+
+    uint64_t start = now_ns();
+
+
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if( sd < 0 )
+        error_exit("Can't create socket: %s\n", strerror(errno));
+
+    int on = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if( connect(sd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) != 0 )
+    {
+        close(sd);
+        return res;
+    }
+
+
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, sd);
+
+    if( resume && last_session )
+        SSL_set_session(ssl, last_session);
+
+
+    if( SSL_connect(ssl) == 1 )
+    {
+        res.handshake_ns = now_ns() - start;
+        res.reused       = SSL_session_reused(ssl);
+
+
+        char   request[1024];
+        size_t body_len = strlen(REQUEST_BODY);
+        int    len      = snprintf(request, sizeof(request),
+                                   "POST /onvif/device_service HTTP/1.1\r\n"
+                                   "Host: %s\r\n"
+                                   "Content-Type: application/soap+xml; charset=utf-8\r\n"
+                                   "Content-Length: %zu\r\n"
+                                   "Connection: close\r\n\r\n%s",
+                                   inet_ntoa(cfg.target.sin_addr), body_len, REQUEST_BODY);
+
+        if( SSL_write(ssl, request, len) == len )
+        {
+            char buf[4096];
+            int  reply_len = 0;
+            int  n;
+
+            while( (n = SSL_read(ssl, buf, sizeof(buf))) > 0 )
+                reply_len += n;
+
+            res.ok = (reply_len > 0);
+        }
+
+        res.total_ns = now_ns() - start;
+
+        SSL_shutdown(ssl);
+    }
+
+
+    SSL_free(ssl);
+    close(sd);
+
+    return res;
+}
+
+
+
+
+// ------------------------------- Report -------------------------------
+
+
+
+
+// utime + stime of the process in ms, -1 if it is unknown
+static long long process_cpu_ms(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    FILE *fp = fopen(path, "r");
+    if( !fp )
+        return -1;
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+
+    // skip "pid (comm) " - comm can contain spaces
+    const char *p = strrchr(buf, ')');
+    if( !p )
+        return -1;
+
+    unsigned long long utime, stime;
+    if( sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2 )
+        return -1;
+
+    return (long long)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+
+
+static double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    if( sorted.empty() )
+        return 0;
+
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+    return sorted[idx] / 1000.0; //us
+}
+
+
+
+struct ModeResult
+{
+    const char *name;
+    unsigned    ok;
+    unsigned    failed;
+    unsigned    reused;
+    double      elapsed_s;
+    long long   cpu_ms;     // daemon
+    long long   self_cpu_ms;
+
+    std::vector<uint64_t> handshake;
+    std::vector<uint64_t> total;
+};
+
+
+
+static ModeResult run_mode(SSL_CTX *ctx, const char *name, bool resume)
+{
+    ModeResult r;
+
+    r.name   = name;
+    r.ok     = 0;
+    r.failed = 0;
+    r.reused = 0;
+
+
+    // the session to resume from
+    if( resume )
+        do_connection(ctx, false);
+
+
+    long long cpu_start  = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+    long long self_start = process_cpu_ms(getpid());
+    uint64_t  start      = now_ns();
+
+    for(unsigned int i = 0; i < cfg.count; ++i)
+    {
+        ConnResult c = do_connection(ctx, resume);
+
+        if( !c.ok )
+        {
+            r.failed++;
+            continue;
+        }
+
+        r.ok++;
+        r.reused += c.reused;
+        r.handshake.push_back(c.handshake_ns);
+        r.total.push_back(c.total_ns);
+    }
+
+    r.elapsed_s = (now_ns() - start) / 1e9;
+
+    long long cpu_end  = cfg.pid ? process_cpu_ms(cfg.pid) : -1;
+    long long self_end = process_cpu_ms(getpid());
+
+    r.cpu_ms      = (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1;
+    r.self_cpu_ms = (self_start >= 0 && self_end >= 0) ? self_end - self_start : -1;
+
+
+    std::sort(r.handshake.begin(), r.handshake.end());
+    std::sort(r.total.begin(), r.total.end());
+
+    return r;
+}
+
+
+
+static void report(const ModeResult &full, const ModeResult &resumed)
+{
+    printf("\n%-8s %8s %8s %8s %10s %10s %10s %10s %12s %10s\n",
+           "mode", "ok", "failed", "reused", "hs p50,us", "hs p90,us", "hs p99,us", "hs max,us",
+           "call p50,us", "conn/s");
+
+    for(const ModeResult *r : { &full, &resumed })
+    {
+        printf("%-8s %8u %8u %8u %10.1f %10.1f %10.1f %10.1f %12.1f %10.1f\n",
+               r->name, r->ok, r->failed, r->reused,
+               percentile(r->handshake, 50), percentile(r->handshake, 90),
+               percentile(r->handshake, 99), r->handshake.empty() ? 0 : r->handshake.back() / 1000.0,
+               percentile(r->total, 50), r->ok / r->elapsed_s);
+    }
+
+
+    printf("\n");
+
+    for(const ModeResult *r : { &full, &resumed })
+    {
+        if( r->cpu_ms >= 0 )
+            printf("%-8s daemon CPU time: %lld ms (%.1f us/conn)", r->name, r->cpu_ms,
+                   r->ok ? r->cpu_ms * 1000.0 / r->ok : 0.0);
+        else
+            printf("%-8s daemon CPU time: - (see --pid)", r->name);
+
+        printf(", bench CPU time: %lld ms\n", r->self_cpu_ms);
+    }
+
+
+    if( !full.handshake.empty() && !resumed.handshake.empty() )
+        printf("\nresumed/full handshake p50: %.2f\n",
+               percentile(resumed.handshake, 50) / percentile(full.handshake, 50));
+
+    if( resumed.ok && (resumed.reused != resumed.ok) )
+        printf("WARNING: %u of %u resumed connections did a full handshake\n",
+               resumed.ok - resumed.reused, resumed.ok);
+}
+
+
+
+
+// ------------------------------- main -------------------------------
+
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+
+    SSL_CTX *ctx = create_ctx();
+
+
+    char target_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cfg.target.sin_addr, target_str, sizeof(target_str));
+    printf("target %s:%d, %u connections per mode, %s%s\n", target_str, ntohs(cfg.target.sin_port),
+           cfg.count, cfg.tls12 ? "TLS 1.2" : "TLS 1.2/1.3",
+           cfg.no_ticket ? ", resume by session ID" : ", resume by ticket");
+
+
+    ModeResult full    = run_mode(ctx, "full",    false);
+    ModeResult resumed = run_mode(ctx, "resumed", true);
+
+    report(full, resumed);
+
+
+    if( last_session )
+        SSL_SESSION_free(last_session);
+
+    SSL_CTX_free(ctx);
+
+
+    return (full.ok && resumed.ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
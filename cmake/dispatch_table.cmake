@@ -0,0 +1,80 @@
+cmake_minimum_required(VERSION 3.15)
+
+# Appends the dispatch table of every service to its generated file:
+#
+#   const SoapOperation <Service>_operations[] = { { "tds:GetServices", <serve of it> }, ..., { nullptr, nullptr } };
+#
+# The table is taken from the dispatch() of the service (soap_match_tag + serve_),
+# the serve_ functions are static in the generated file, so the table must be there too.
+# The daemon builds one hash table of all services from them (see soap_dispatch.h).
+#
+# GENERATED_DIR - dir of soapcpp2 output
+# SERVICES      - names of services, comma separated (DeviceBindingService,MediaBindingService,...)
+
+
+
+set(TABLE_MARKER "dispatch table (cmake/dispatch_table.cmake)")
+
+
+
+function(append_dispatch_table SERVICE)
+
+    set(SERVICE_FILE "${GENERATED_DIR}/soap${SERVICE}.cpp")
+
+    if(NOT EXISTS "${SERVICE_FILE}")
+        message(FATAL_ERROR "No generated file of service: ${SERVICE_FILE}")
+    endif()
+
+    file(READ "${SERVICE_FILE}" CONTENT)
+
+
+    # soapcpp2 writes the file again every run, the table is appended once
+    string(FIND "${CONTENT}" "${TABLE_MARKER}" MARKER_POS)
+    if(NOT MARKER_POS EQUAL -1)
+        return()
+    endif()
+
+
+    #   if (!soap_match_tag(soap, soap->tag, "tds:GetServices"))
+    #           return serve___tds__GetServices(soap, this);
+    # (without ";", MATCHALL returns a list)
+    set(MATCH_REGEX "soap_match_tag\\(soap, soap->tag, \"([^\"]+)\"\\)\\)[ \t\r\n]*return (serve_[A-Za-z0-9_]+)\\(([^);]*)\\)")
+
+    string(REGEX MATCHALL "${MATCH_REGEX}" MATCHES "${CONTENT}")
+
+
+    set(TABLE "\n\n\n/* ${TABLE_MARKER} */\n\n#include \"soap_dispatch.h\"\n\n")
+    string(APPEND TABLE "extern const SoapOperation ${SERVICE}_operations[];\n\nconst SoapOperation ${SERVICE}_operations[] =\n{\n")
+
+    set(OPS_CNT 0)
+
+    foreach(MATCH IN LISTS MATCHES)
+        string(REGEX REPLACE "${MATCH_REGEX}" "\\1" TAG   "${MATCH}")
+        string(REGEX REPLACE "${MATCH_REGEX}" "\\2" SERVE "${MATCH}")
+        string(REGEX REPLACE "${MATCH_REGEX}" "\\3" ARGS  "${MATCH}")
+
+        # the service is the instance that is registered with the table
+        string(REGEX REPLACE "(^|[^A-Za-z0-9_])this([^A-Za-z0-9_]|$)" "\\1(${SERVICE}*)service\\2" ARGS "${ARGS}")
+
+        string(APPEND TABLE "    { \"${TAG}\", [](struct soap *soap, void *service) { (void)soap; (void)service; return ${SERVE}(${ARGS}); } },\n")
+        math(EXPR OPS_CNT "${OPS_CNT} + 1")
+    endforeach()
+
+    string(APPEND TABLE "    { nullptr, nullptr }\n};\n")
+
+
+    if(OPS_CNT EQUAL 0)
+        message(WARNING "No operations are found in ${SERVICE_FILE}, ${SERVICE} is dispatched by its dispatch()")
+    endif()
+
+    file(APPEND "${SERVICE_FILE}" "${TABLE}")
+
+endfunction()
+
+
+
+string(REPLACE "," ";" SERVICES "${SERVICES}")
+
+foreach(SERVICE IN LISTS SERVICES)
+    append_dispatch_table(${SERVICE})
+endforeach()
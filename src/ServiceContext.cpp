@@ -15,6 +15,7 @@ ServiceContext::ServiceContext():
     port     ( 1000    ),
     user     ( "admin" ),
     password ( "admin" ),
+    auth     ( true    ),
 
 
     //Device Information
@@ -186,7 +187,11 @@ std::string ServiceContext::getXAddr(struct soap *soap) const
 {
     std::ostringstream os;
 
-    os << "http://" << getServerIpFromClientIp(htonl(soap->ip)) << ":" << port;
+    // a client of HTTPS listener gets HTTPS addresses
+    if( TlsServer::is_secure(soap) )
+        os << "https://" << getServerIpFromClientIp(htonl(soap->ip)) << ":" << tls_server.get_port();
+    else
+        os << "http://"  << getServerIpFromClientIp(htonl(soap->ip)) << ":" << port;
 
     return os.str();
 }
@@ -237,7 +242,7 @@ tds__DeviceServiceCapabilities *ServiceContext::getDeviceServiceCapabilities(str
     auto net_caps = soap_new_req_tds__NetworkCapabilities(soap);
     if(net_caps)
     {
-        net_caps->IPFilter            = soap_new_ptr(soap, false);
+        net_caps->IPFilter            = soap_new_ptr(soap, true);
         net_caps->ZeroConfiguration   = soap_new_ptr(soap, false);
         net_caps->IPVersion6          = soap_new_ptr(soap, false);
         net_caps->DynDNS              = soap_new_ptr(soap, false);
@@ -254,7 +259,7 @@ tds__DeviceServiceCapabilities *ServiceContext::getDeviceServiceCapabilities(str
     {
         sec_caps->TLS1_x002e0          = soap_new_ptr(soap, false);
         sec_caps->TLS1_x002e1          = soap_new_ptr(soap, false);
-        sec_caps->TLS1_x002e2          = soap_new_ptr(soap, false);
+        sec_caps->TLS1_x002e2          = soap_new_ptr(soap, tls_server.is_enabled());
         sec_caps->OnboardKeyGeneration = soap_new_ptr(soap, false);
         sec_caps->AccessPolicyConfig   = soap_new_ptr(soap, false);
         sec_caps->DefaultAccessPolicy  = soap_new_ptr(soap, false);
@@ -263,12 +268,12 @@ tds__DeviceServiceCapabilities *ServiceContext::getDeviceServiceCapabilities(str
         sec_caps->X_x002e509Token      = soap_new_ptr(soap, false);
         sec_caps->SAMLToken            = soap_new_ptr(soap, false);
         sec_caps->KerberosToken        = soap_new_ptr(soap, false);
-        sec_caps->UsernameToken        = soap_new_ptr(soap, false);
-        sec_caps->HttpDigest           = soap_new_ptr(soap, false);
+        sec_caps->UsernameToken        = soap_new_ptr(soap, auth);
+        sec_caps->HttpDigest           = soap_new_ptr(soap, auth);
         sec_caps->RELToken             = soap_new_ptr(soap, false);
-        sec_caps->MaxUsers             = soap_new_ptr(soap, 0);
-        sec_caps->MaxUserNameLength    = soap_new_ptr(soap, 0);
-        sec_caps->MaxPasswordLength    = soap_new_ptr(soap, 0);
+        sec_caps->MaxUsers             = soap_new_ptr(soap, (int)UserList::MAX_USERS);
+        sec_caps->MaxUserNameLength    = soap_new_ptr(soap, USER_NAME_LEN - 1);
+        sec_caps->MaxPasswordLength    = soap_new_ptr(soap, USER_PASSWORD_LEN - 1);
     }
 
 
@@ -343,6 +348,24 @@ tptz__Capabilities *ServiceContext::getPTZServiceCapabilities(struct soap *soap)
 
 
 
+tev__Capabilities *ServiceContext::getEventServiceCapabilities(struct soap *soap)
+{
+    auto caps = soap_new_tev__Capabilities(soap);
+    if(caps)
+    {
+        caps->WSSubscriptionPolicySupport                   = soap_new_ptr(soap, false);
+        caps->WSPullPointSupport                            = soap_new_ptr(soap, true);
+        caps->WSPausableSubscriptionManagerInterfaceSupport = soap_new_ptr(soap, false);
+        caps->PersistentNotificationStorage                 = soap_new_ptr(soap, false);
+        caps->MaxPullPoints                                 = soap_new_ptr(soap, (int)EventBroker::MAX_SUBSCRIPTIONS);
+        caps->MaxNotificationProducers                      = soap_new_ptr(soap, (int)EventPusher::MAX_CONSUMERS);
+    }
+
+    return caps;
+}
+
+
+
 tt__DeviceCapabilities *ServiceContext::getDeviceCapabilities(struct soap *soap, const std::string &XAddr) const
 {
     auto dev_caps = soap_new_req_tt__DeviceCapabilities(soap, XAddr);
@@ -366,6 +389,9 @@ tt__DeviceCapabilities *ServiceContext::getDeviceCapabilities(struct soap *soap,
 
     dev_caps->IO       = soap_new_req_tt__IOCapabilities(soap);
     dev_caps->Network  = soap_new_req_tt__NetworkCapabilities(soap);
+    if(dev_caps->Network)
+        dev_caps->Network->IPFilter = soap_new_ptr(soap, true);
+
     dev_caps->Security = soap_new_tt__SecurityCapabilities(soap);
 
     return dev_caps;
@@ -398,6 +424,13 @@ tt__PTZCapabilities *ServiceContext::getPTZCapabilities(struct soap *soap, const
 
 
 
+tt__EventCapabilities *ServiceContext::getEventCapabilities(struct soap *soap, const std::string &XAddr) const
+{
+    return soap_new_req_tt__EventCapabilities(soap, XAddr, false, true, false);
+}
+
+
+
 tt__NetworkInterface *ServiceContext::getNetworkInterface(struct soap *soap, const Eth_Dev_Param &eth_param) const
 {
     char tmp_buf[20] = {0};
@@ -746,3 +779,106 @@ bool PTZNode::set_str_value(const char* new_val, std::string& value)
     value = new_val;
     return true;
 }
+
+
+
+wsnt__NotificationMessageHolderType *ServiceContext::getNotificationMessage(struct soap *soap, const EventMessage &msg) const
+{
+    if(msg.topic >= EVENT_TOPIC_CNT)
+        return nullptr;
+
+
+    auto topic = soap_new_wsnt__TopicExpressionType(soap);
+    if(!topic)
+        return nullptr;
+
+    topic->Dialect = "http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet";
+    topic->__mixed = soap_strdup(soap, event_topics[msg.topic].path);
+
+
+    auto tt_msg = soap_new__tt__Message(soap);
+    if(!tt_msg)
+        return nullptr;
+
+    tt_msg->UtcTime = msg.utc_time;
+
+    switch(msg.property_op)
+    {
+        case EventMessage::PROP_INITIALIZED:
+            tt_msg->PropertyOperation = soap_new_ptr(soap, tt__PropertyOperation::Initialized);
+            break;
+
+        case EventMessage::PROP_CHANGED:
+            tt_msg->PropertyOperation = soap_new_ptr(soap, tt__PropertyOperation::Changed);
+            break;
+
+        case EventMessage::PROP_DELETED:
+            tt_msg->PropertyOperation = soap_new_ptr(soap, tt__PropertyOperation::Deleted);
+            break;
+
+        default:
+            break;
+    }
+
+
+    tt_msg->Source = soap_new_tt__ItemList(soap);
+    tt_msg->Data   = soap_new_tt__ItemList(soap);
+    if(!tt_msg->Source || !tt_msg->Data)
+        return nullptr;
+
+    for(int i = 0; i < msg.item_cnt; i++)
+    {
+        _tt__ItemList_SimpleItem item;
+        item.Name  = msg.items[i].name;
+        item.Value = msg.items[i].value;
+
+        if(i < msg.source_cnt)
+            tt_msg->Source->SimpleItem.push_back(item);
+        else
+            tt_msg->Data->SimpleItem.push_back(item);
+    }
+
+
+    auto notify_msg = soap_new_wsnt__NotificationMessageHolderType(soap);
+    if(!notify_msg)
+        return nullptr;
+
+    notify_msg->Topic               = topic;
+    notify_msg->Message.tt__Message = tt_msg;
+
+    return notify_msg;
+}
+
+
+
+UserLevel ServiceContext::get_user_level(struct soap *soap)
+{
+    if( !soap->header || !soap->header->wsse__Security ||
+        !soap->header->wsse__Security->UsernameToken )
+        return http_digest.get_request_level();
+
+
+    const _wsse__UsernameToken *token = soap->header->wsse__Security->UsernameToken;
+
+    const UserAccount *account = user_store.find(token->Username);
+    if( !account )
+    {
+        LOG_D(LOG_MOD_AUTH, "Auth: unknown user");
+        return USER_LEVEL_ANONYMOUS;
+    }
+
+
+    auto res = wsse_auth.verify(token->Password ? token->Password->Type   : nullptr,
+                                token->Password ? token->Password->__item : nullptr,
+                                token->Nonce    ? token->Nonce->__item    : nullptr,
+                                token->wsu__Created, account->password, time(NULL));
+
+    if( res != WsseAuth::AUTH_OK )
+    {
+        LOG_D(LOG_MOD_AUTH, "Auth: %s: %s", token->Username, WsseAuth::get_result_str(res));
+        return USER_LEVEL_ANONYMOUS;
+    }
+
+
+    return account->level;
+}
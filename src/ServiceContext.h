@@ -8,6 +8,23 @@
 
 #include "soapH.h"
 #include "eth_dev_param.h"
+#include "event_broker.h"
+#include "event_push.h"
+#include "event_ingest.h"
+#include "access_policy.h"
+#include "wsse_auth.h"
+#include "http_digest.h"
+#include "user_store.h"
+#include "tls_server.h"
+#include "ip_filter.h"
+#include "rate_limiter.h"
+#include "metrics.h"
+#include "request_trace.h"
+#include "alloc_profile.h"
+#include "soap_arena.h"
+#include "traffic_record.h"
+#include "request_limits.h"
+#include "response_writer.h"
 
 
 
@@ -140,8 +157,13 @@ class ServiceContext
 
 
         int         port;
-        std::string user;
+        std::string user;       // the first Administrator, if there is no users file
         std::string password;
+        bool        auth;       // check credentials of requests (see opt --no_auth)
+
+        // fds of the main loop (listeners, SIGHUP, control socket): a long poll
+        // of a handler (PullMessages) returns when one of them is readable
+        std::vector<int> wake_fds;
 
 
         //Device Information
@@ -181,17 +203,38 @@ class ServiceContext
 
         const std::map<std::string, StreamProfile> &get_profiles(void) { return profiles; }
         PTZNode* get_ptz_node(void) { return &ptz_node; }
+        EventBroker* get_event_broker(void) { return &event_broker; }
+        EventPusher* get_event_pusher(void) { return &event_pusher; }
+        EventIngest* get_event_ingest(void) { return &event_ingest; }
+        WsseAuth*    get_wsse_auth(void)    { return &wsse_auth;    }
+        HttpDigest*  get_http_digest(void)  { return &http_digest;  }
+        UserStore*   get_user_store(void)   { return &user_store;   }
+        TlsServer*   get_tls_server(void)   { return &tls_server;   }
+        IpFilter*    get_ip_filter(void)    { return &ip_filter;    }
+        RateLimiter* get_rate_limiter(void) { return &rate_limiter; }
+        Metrics*     get_metrics(void)      { return &metrics;      }
+        RequestTracer* get_tracer(void)     { return &tracer;       }
+        AllocProfiler* get_alloc_profiler(void) { return &alloc_profiler; }
+        SoapArena*     get_arena(void)          { return &arena;          }
+        TrafficRecorder* get_recorder(void)     { return &recorder;       }
+        RequestLimits*   get_request_limits(void) { return &request_limits; }
+        ResponseWriter*  get_response_writer(void) { return &response_writer; }
+
+
+        // level of client by wsse:UsernameToken (header is parsed by soap_begin_serve)
+        // or by HTTP Digest (it is checked while HTTP headers are parsed)
+        UserLevel get_user_level(struct soap* soap);
 
         // service capabilities
         tds__DeviceServiceCapabilities* getDeviceServiceCapabilities(struct soap* soap);
         trt__Capabilities*  getMediaServiceCapabilities    (struct soap* soap);
         tptz__Capabilities* getPTZServiceCapabilities      (struct soap* soap);
+        tev__Capabilities*  getEventServiceCapabilities    (struct soap* soap);
 //        timg__Capabilities* getImagingServiceCapabilities  (struct soap* soap);
 //        trc__Capabilities*  getRecordingServiceCapabilities(struct soap* soap);
 //        tse__Capabilities*  getSearchServiceCapabilities   (struct soap* soap);
 //        trv__Capabilities*  getReceiverServiceCapabilities (struct soap* soap);
 //        trp__Capabilities*  getReplayServiceCapabilities   (struct soap* soap);
-//        tev__Capabilities*  getEventServiceCapabilities    (struct soap* soap);
 //        tls__Capabilities*  getDisplayServiceCapabilities  (struct soap* soap);
 //        tmd__Capabilities*  getDeviceIOServiceCapabilities (struct soap* soap);
 
@@ -199,13 +242,32 @@ class ServiceContext
         tt__DeviceCapabilities* getDeviceCapabilities(struct soap* soap, const std::string &XAddr) const;
         tt__MediaCapabilities*  getMediaCapabilities (struct soap* soap, const std::string &XAddr) const;
         tt__PTZCapabilities*    getPTZCapabilities   (struct soap* soap, const std::string &XAddr) const;
+        tt__EventCapabilities*  getEventCapabilities (struct soap* soap, const std::string &XAddr) const;
 
         tt__NetworkInterface*   getNetworkInterface(struct soap* soap, const Eth_Dev_Param& eth_param) const;
 
+        wsnt__NotificationMessageHolderType* getNotificationMessage(struct soap* soap, const EventMessage& msg) const;
+
     private:
 
         std::map<std::string, StreamProfile> profiles;
         PTZNode ptz_node;
+        EventBroker event_broker;
+        EventPusher event_pusher;
+        EventIngest event_ingest;
+        WsseAuth    wsse_auth;
+        HttpDigest  http_digest;
+        UserStore   user_store;
+        TlsServer   tls_server;
+        IpFilter    ip_filter;
+        RateLimiter rate_limiter;
+        Metrics     metrics;
+        RequestTracer tracer;
+        AllocProfiler alloc_profiler;
+        SoapArena     arena;
+        TrafficRecorder recorder;
+        RequestLimits   request_limits;
+        ResponseWriter  response_writer;
 
         TimeZoneForamt tz_format;
 
@@ -22,7 +22,7 @@ int DeviceBindingService::GetServices(
     _tds__GetServices         *tds__GetServices,
     _tds__GetServicesResponse &tds__GetServicesResponse)
 {
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx   = (ServiceContext*)soap->user;
     auto XAddr = ctx->getXAddr(soap);
@@ -72,6 +72,28 @@ int DeviceBindingService::GetServices(
     tds__GetServicesResponse.Service.emplace_back(med_svc);
 
 
+    //Event Service
+    auto evt_svc = soap_new_tds__Service(soap);
+    if(evt_svc)
+    {
+        evt_svc->soap_default(soap);
+        evt_svc->Namespace = SOAP_NAMESPACE_OF_tev;
+        evt_svc->XAddr     = XAddr;
+        evt_svc->Version   = soap_new_req_tt__OnvifVersion(soap, 2, 6);
+
+        if( tds__GetServices->IncludeCapability )
+        {
+            auto evt_caps         = ctx->getEventServiceCapabilities(soap);
+            auto svc_caps         = soap_new_req__tev__GetServiceCapabilitiesResponse(soap, evt_caps);
+            evt_svc->Capabilities = soap_new_req__tds__Service_Capabilities(soap);
+
+            if(evt_svc->Capabilities)
+                evt_svc->Capabilities->__any.set(svc_caps, SOAP_TYPE__tev__GetServiceCapabilitiesResponse);
+        }
+    }
+    tds__GetServicesResponse.Service.emplace_back(evt_svc);
+
+
     if(ctx->get_ptz_node()->enable)
         return SOAP_OK;
 
@@ -107,7 +129,7 @@ int DeviceBindingService::GetServiceCapabilities(
     _tds__GetServiceCapabilitiesResponse &tds__GetServiceCapabilitiesResponse)
 {
     UNUSED(tds__GetServiceCapabilities);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx = (ServiceContext*)soap->user;
     tds__GetServiceCapabilitiesResponse.Capabilities = ctx->getDeviceServiceCapabilities(soap);
@@ -122,7 +144,7 @@ int DeviceBindingService::GetDeviceInformation(
     _tds__GetDeviceInformationResponse &tds__GetDeviceInformationResponse)
 {
     UNUSED(tds__GetDeviceInformation);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
 
     auto ctx = (ServiceContext*)soap->user;
@@ -142,7 +164,7 @@ int DeviceBindingService::GetSystemDateAndTime(
     _tds__GetSystemDateAndTimeResponse &tds__GetSystemDateAndTimeResponse)
 {
     UNUSED(tds__GetSystemDateAndTime);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx = (ServiceContext*)soap->user;
 
@@ -158,7 +180,7 @@ int DeviceBindingService::GetScopes(
     _tds__GetScopesResponse &tds__GetScopesResponse)
 {
     UNUSED(tds__GetScopes);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx = (ServiceContext*)soap->user;
 
@@ -177,7 +199,7 @@ int DeviceBindingService::GetWsdlUrl(
     _tds__GetWsdlUrlResponse &tds__GetWsdlUrlResponse)
 {
     UNUSED(tds__GetWsdlUrl);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     tds__GetWsdlUrlResponse.WsdlUrl = soap->endpoint;
 
@@ -186,18 +208,124 @@ int DeviceBindingService::GetWsdlUrl(
 
 
 
+static UserLevel get_user_level(tt__UserLevel level)
+{
+    switch(level)
+    {
+        case tt__UserLevel::Administrator: return USER_LEVEL_ADMINISTRATOR;
+        case tt__UserLevel::Operator:      return USER_LEVEL_OPERATOR;
+        case tt__UserLevel::User:          return USER_LEVEL_USER;
+        default:                           return USER_LEVEL_ANONYMOUS;
+    }
+}
+
+
+
+static tt__UserLevel get_tt_user_level(UserLevel level)
+{
+    switch(level)
+    {
+        case USER_LEVEL_ADMINISTRATOR: return tt__UserLevel::Administrator;
+        case USER_LEVEL_OPERATOR:      return tt__UserLevel::Operator;
+        case USER_LEVEL_USER:          return tt__UserLevel::User;
+        default:                       return tt__UserLevel::Anonymous;
+    }
+}
+
+
+
+static std::vector<UserStore::Change> get_user_changes(const std::vector<tt__User *> &users)
+{
+    std::vector<UserStore::Change> changes;
+
+    for(const tt__User *user : users)
+    {
+        if( !user )
+            continue;
+
+        UserStore::Change change;
+        change.name         = user->Username;
+        change.has_password = (user->Password != nullptr);
+        change.password     = user->Password ? *user->Password : "";
+        change.level        = get_user_level(user->UserLevel);
+
+        changes.push_back(change);
+    }
+
+    return changes;
+}
+
+
+
+// the second level of Subcode, gsoap sets only the first one (SOAP 1.2 only)
+static void add_fault_subcode(struct soap *soap, const char *detail)
+{
+    if( detail && soap->fault && soap->fault->SOAP_ENV__Code && soap->fault->SOAP_ENV__Code->SOAP_ENV__Subcode )
+    {
+        auto code = soap_new_SOAP_ENV__Code(soap);
+        if( code )
+        {
+            code->SOAP_ENV__Value = (char *)detail;
+            soap->fault->SOAP_ENV__Code->SOAP_ENV__Subcode->SOAP_ENV__Subcode = code;
+        }
+    }
+}
+
+
+
+// fault of user management: env:Code/ter:subcode/ter:detail (ONVIF Core, 8.4)
+static int user_fault(struct soap *soap, UserStore::Result res)
+{
+    bool        sender  = true;
+    const char *subcode = "ter:OperationProhibited";
+    const char *detail  = nullptr;
+
+    switch(res)
+    {
+        case UserStore::USER_BAD_NAME:          detail = "ter:UsernameTooShort";     break;
+        case UserStore::USER_NAME_TOO_LONG:     detail = "ter:UsernameTooLong";      break;
+        case UserStore::USER_BAD_PASSWORD:      detail = "ter:Password";             break;
+        case UserStore::USER_PASSWORD_TOO_LONG: detail = "ter:PasswordTooLong";      break;
+        case UserStore::USER_BAD_LEVEL:         detail = "ter:AnonymousNotAllowed";  break;
+        case UserStore::USER_EXISTS:            detail = "ter:UsernameClash";        break;
+        case UserStore::USER_NOT_FOUND:         subcode = "ter:InvalidArgVal";
+                                                detail  = "ter:UsernameMissing";     break;
+        case UserStore::USER_FIXED:             subcode = "ter:InvalidArgVal";
+                                                detail  = "ter:FixedUser";           break;
+        case UserStore::USER_TOO_MANY:          sender  = false;
+                                                subcode = "ter:Action";
+                                                detail  = "ter:TooManyUsers";        break;
+        default:                                sender  = false;
+                                                subcode = "ter:Action";              break;
+    }
+
+
+    const char *reason = UserStore::get_result_str(res);
+    int         err    = sender ? soap_sender_fault_subcode  (soap, subcode, reason, nullptr)
+                                : soap_receiver_fault_subcode(soap, subcode, reason, nullptr);
+
+
+    add_fault_subcode(soap, detail);
+
+    return err;
+}
+
+
+
 int DeviceBindingService::GetUsers(
     _tds__GetUsers         *tds__GetUsers,
     _tds__GetUsersResponse &tds__GetUsersResponse)
 {
     UNUSED(tds__GetUsers);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
-    auto ctx = (ServiceContext*)soap->user;
+    auto ctx   = (ServiceContext*)soap->user;
+    auto users = ctx->get_user_store()->get_users();
 
-    if( !ctx->user.empty() )
+    // passwords are never returned
+    for(size_t i = 0; i < users->cnt; i++)
     {
-        auto rsp_user = soap_new_req_tt__User(soap, ctx->user, tt__UserLevel::User);
+        auto rsp_user = soap_new_req_tt__User(soap, users->users[i].name, get_tt_user_level(users->users[i].level));
         tds__GetUsersResponse.User.push_back(rsp_user);
     }
 
@@ -206,11 +334,252 @@ int DeviceBindingService::GetUsers(
 
 
 
+int DeviceBindingService::CreateUsers(
+    _tds__CreateUsers         *tds__CreateUsers,
+    _tds__CreateUsersResponse &tds__CreateUsersResponse)
+{
+    UNUSED(tds__CreateUsersResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+    auto res = ctx->get_user_store()->create_users(get_user_changes(tds__CreateUsers->User));
+
+    if( res != UserStore::USER_OK )
+        return user_fault(soap, res);
+
+    return SOAP_OK;
+}
+
+
+
+int DeviceBindingService::DeleteUsers(
+    _tds__DeleteUsers         *tds__DeleteUsers,
+    _tds__DeleteUsersResponse &tds__DeleteUsersResponse)
+{
+    UNUSED(tds__DeleteUsersResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+    auto res = ctx->get_user_store()->delete_users(tds__DeleteUsers->Username);
+
+    if( res != UserStore::USER_OK )
+        return user_fault(soap, res);
+
+    return SOAP_OK;
+}
+
+
+
+int DeviceBindingService::SetUser(
+    _tds__SetUser         *tds__SetUser,
+    _tds__SetUserResponse &tds__SetUserResponse)
+{
+    UNUSED(tds__SetUserResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+    auto res = ctx->get_user_store()->set_users(get_user_changes(tds__SetUser->User));
+
+    if( res != UserStore::USER_OK )
+        return user_fault(soap, res);
+
+    return SOAP_OK;
+}
+
+
+
+static int ip_filter_fault(struct soap *soap, IpFilter::Result res, bool ipv6)
+{
+    const char *reason = IpFilter::get_result_str(res);
+
+    switch(res)
+    {
+        case IpFilter::IP_FILTER_TOO_MANY:
+            soap_receiver_fault_subcode(soap, "ter:Action", reason, nullptr);
+            add_fault_subcode(soap, "ter:IPFilterListIsFull");
+            break;
+
+        case IpFilter::IP_FILTER_BAD_ADDRESS:
+        case IpFilter::IP_FILTER_BAD_PREFIX:
+            soap_sender_fault_subcode(soap, "ter:InvalidArgVal", reason, nullptr);
+            add_fault_subcode(soap, ipv6 ? "ter:InvalidIPv6Address" : "ter:InvalidIPv4Address");
+            break;
+
+        default:
+            soap_sender_fault_subcode(soap, "ter:InvalidArgVal", reason, nullptr);
+            break;
+    }
+
+    return SOAP_FAULT;
+}
+
+
+
+// addresses of tt:IPAddressFilter, on error the fault is set
+static int get_ip_prefixes(struct soap *soap, const tt__IPAddressFilter *filter, std::vector<IpPrefix> &prefixes)
+{
+    if( !filter )
+        return soap_sender_fault_subcode(soap, "ter:InvalidArgVal", "IPAddressFilter is missing", nullptr);
+
+
+    IpPrefix prefix;
+
+    for(const tt__PrefixedIPv4Address *addr : filter->IPv4Address)
+    {
+        if( !addr )
+            continue;
+
+        auto res = IpFilter::parse_prefix(addr->Address, addr->PrefixLength, false, prefix);
+        if( res != IpFilter::IP_FILTER_OK )
+            return ip_filter_fault(soap, res, false);
+
+        prefixes.push_back(prefix);
+    }
+
+
+    for(const tt__PrefixedIPv6Address *addr : filter->IPv6Address)
+    {
+        if( !addr )
+            continue;
+
+        auto res = IpFilter::parse_prefix(addr->Address, addr->PrefixLength, true, prefix);
+        if( res != IpFilter::IP_FILTER_OK )
+            return ip_filter_fault(soap, res, true);
+
+        prefixes.push_back(prefix);
+    }
+
+
+    return SOAP_OK;
+}
+
+
+
+// is the entry that failed (see IpFilter::set/add/remove) IPv6
+static bool is_failed_ipv6(const std::vector<IpPrefix> &prefixes, size_t failed)
+{
+    return (failed < prefixes.size()) && prefixes[failed].ipv6;
+}
+
+
+
+int DeviceBindingService::GetIPAddressFilter(
+    _tds__GetIPAddressFilter         *tds__GetIPAddressFilter,
+    _tds__GetIPAddressFilterResponse &tds__GetIPAddressFilterResponse)
+{
+    UNUSED(tds__GetIPAddressFilter);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx    = (ServiceContext*)soap->user;
+    auto filter = soap_new_tt__IPAddressFilter(soap);
+
+    if( !filter )
+        return SOAP_FAULT;
+
+    filter->soap_default(soap);
+    filter->Type = ctx->get_ip_filter()->is_allow_type() ? tt__IPAddressFilterType::Allow
+                                                         : tt__IPAddressFilterType::Deny;
+
+    for(const IpPrefix &prefix : ctx->get_ip_filter()->get_prefixes())
+    {
+        if( prefix.ipv6 )
+            filter->IPv6Address.push_back(soap_new_req_tt__PrefixedIPv6Address(soap, prefix.str, prefix.prefix_len));
+        else
+            filter->IPv4Address.push_back(soap_new_req_tt__PrefixedIPv4Address(soap, prefix.str, prefix.prefix_len));
+    }
+
+    tds__GetIPAddressFilterResponse.IPAddressFilter = filter;
+
+    return SOAP_OK;
+}
+
+
+
+int DeviceBindingService::SetIPAddressFilter(
+    _tds__SetIPAddressFilter         *tds__SetIPAddressFilter,
+    _tds__SetIPAddressFilterResponse &tds__SetIPAddressFilterResponse)
+{
+    UNUSED(tds__SetIPAddressFilterResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx    = (ServiceContext*)soap->user;
+    auto filter = tds__SetIPAddressFilter->IPAddressFilter;
+
+    std::vector<IpPrefix> prefixes;
+
+    if( get_ip_prefixes(soap, filter, prefixes) != SOAP_OK )
+        return SOAP_FAULT;
+
+
+    size_t failed = 0;
+    auto   res    = ctx->get_ip_filter()->set(filter->Type == tt__IPAddressFilterType::Allow, prefixes, &failed);
+
+    if( res != IpFilter::IP_FILTER_OK )
+        return ip_filter_fault(soap, res, is_failed_ipv6(prefixes, failed));
+
+    return SOAP_OK;
+}
+
+
+
+int DeviceBindingService::AddIPAddressFilter(
+    _tds__AddIPAddressFilter         *tds__AddIPAddressFilter,
+    _tds__AddIPAddressFilterResponse &tds__AddIPAddressFilterResponse)
+{
+    UNUSED(tds__AddIPAddressFilterResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+
+    std::vector<IpPrefix> prefixes;
+
+    // Type of the request is ignored, the addresses go to the current filter
+    if( get_ip_prefixes(soap, tds__AddIPAddressFilter->IPAddressFilter, prefixes) != SOAP_OK )
+        return SOAP_FAULT;
+
+
+    size_t failed = 0;
+    auto   res    = ctx->get_ip_filter()->add(prefixes, &failed);
+
+    if( res != IpFilter::IP_FILTER_OK )
+        return ip_filter_fault(soap, res, is_failed_ipv6(prefixes, failed));
+
+    return SOAP_OK;
+}
+
+
+
+int DeviceBindingService::RemoveIPAddressFilter(
+    _tds__RemoveIPAddressFilter         *tds__RemoveIPAddressFilter,
+    _tds__RemoveIPAddressFilterResponse &tds__RemoveIPAddressFilterResponse)
+{
+    UNUSED(tds__RemoveIPAddressFilterResponse);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+
+    std::vector<IpPrefix> prefixes;
+
+    if( get_ip_prefixes(soap, tds__RemoveIPAddressFilter->IPAddressFilter, prefixes) != SOAP_OK )
+        return SOAP_FAULT;
+
+
+    size_t failed = 0;
+    auto   res    = ctx->get_ip_filter()->remove(prefixes, &failed);
+
+    if( res != IpFilter::IP_FILTER_OK )
+        return ip_filter_fault(soap, res, is_failed_ipv6(prefixes, failed));
+
+    return SOAP_OK;
+}
+
+
+
 int DeviceBindingService::GetCapabilities(
     _tds__GetCapabilities         *tds__GetCapabilities,
     _tds__GetCapabilitiesResponse &tds__GetCapabilitiesResponse)
 {
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx   = (ServiceContext*)soap->user;
     auto XAddr = ctx->getXAddr(soap);
@@ -246,8 +615,7 @@ int DeviceBindingService::GetCapabilities(
 
         if( (category == tt__CapabilityCategory::All) || (category == tt__CapabilityCategory::Events) )
         {
-            tds__GetCapabilitiesResponse.Capabilities->Events = soap_new_req_tt__EventCapabilities(
-                soap, XAddr, false, true, false);
+            tds__GetCapabilitiesResponse.Capabilities->Events = ctx->getEventCapabilities(soap, XAddr);
         }
     }
 
@@ -263,7 +631,7 @@ int DeviceBindingService::GetNetworkInterfaces(
     _tds__GetNetworkInterfacesResponse &tds__GetNetworkInterfacesResponse)
 {
     UNUSED(tds__GetNetworkInterfaces);
-    DEBUG_MSG("Device: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Device: %s", __FUNCTION__);
 
     auto ctx = (ServiceContext*)soap->user;
 
@@ -299,9 +667,6 @@ SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetDPAddresses)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetEndpointReference)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetRemoteUser)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetRemoteUser)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, CreateUsers)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, DeleteUsers)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetUser)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetDPAddresses)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetHostname)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetHostname)
@@ -319,10 +684,6 @@ SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetNetworkDefaultGateway)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetNetworkDefaultGateway)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetZeroConfiguration)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetZeroConfiguration)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetIPAddressFilter)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetIPAddressFilter)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, AddIPAddressFilter)
-SOAP_EMPTY_HANDLER(DeviceBindingService, tds, RemoveIPAddressFilter)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, GetAccessPolicy)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, SetAccessPolicy)
 SOAP_EMPTY_HANDLER(DeviceBindingService, tds, CreateCertificate)
@@ -0,0 +1,512 @@
+/*
+ --------------------------------------------------------------------------
+ ServiceEvents.cpp
+
+ Implementation of functions (methods) for the service:
+ ONVIF event.wsdl server side (PullPoint and Notify subscriptions)
+-----------------------------------------------------------------------------
+*/
+
+#include <ctime>
+#include <string.h>
+#include <stdlib.h>
+
+#include "soapEventBindingService.h"
+#include "soapPullPointSubscriptionBindingService.h"
+#include "soapSubscriptionManagerBindingService.h"
+#include "soapNotificationProducerBindingService.h"
+#include "ServiceContext.h"
+#include "smacros.h"
+#include "stools.h"
+
+
+
+
+
+static const char *EVENTS_PATH       = "/onvif/events/";
+static const char *PULLPOINT_PATH    = "/onvif/events/pullpoint/";
+static const char *SUBSCRIPTION_PATH = "/onvif/events/subscription/";
+
+
+static const time_t DEFAULT_TERMINATION_TIME = 60;    // sec
+static const time_t MAX_TERMINATION_TIME     = 3600;  // sec
+static const LONG64 MAX_PULL_TIMEOUT         = 60000; // ms
+static const int    MAX_PULL_MESSAGES        = 64;
+
+
+
+
+
+static std::string get_subscription_address(struct soap *soap, const char *path, uint32_t handle)
+{
+    auto ctx = (ServiceContext*)soap->user;
+
+    return ctx->getXAddr(soap) + path + std::to_string(handle);
+}
+
+
+
+// handle of subscription from the HTTP path of request:
+// /onvif/events/pullpoint/<handle> or /onvif/events/subscription/<handle>
+static uint32_t get_subscription_handle(struct soap *soap)
+{
+    const char *ptr = strstr(soap->path, EVENTS_PATH);
+    if( !ptr )
+        return 0;
+
+    ptr = strrchr(ptr, '/');
+
+    return strtoul(ptr + 1, nullptr, 10);
+}
+
+
+
+/*
+ * Termination time can be absolute (xs:dateTime) or relative (xs:duration).
+ * If it is not set, the default is used, the result is limited by MAX_TERMINATION_TIME.
+ */
+static bool get_termination_time(struct soap *soap, const std::string *value, time_t now, time_t *termination)
+{
+    *termination = now + DEFAULT_TERMINATION_TIME;
+
+    if( !value || value->empty() )
+        return true;
+
+
+    if( (*value)[0] == 'P' || (*value)[0] == '-' )
+    {
+        LONG64 duration;
+        if( soap_s2xsd__duration(soap, value->c_str(), &duration) || (duration <= 0) )
+            return false;
+
+        *termination = now + duration/1000;
+    }
+    else
+    {
+        if( soap_s2dateTime(soap, value->c_str(), termination) || (*termination <= now) )
+            return false;
+    }
+
+
+    if( *termination > now + MAX_TERMINATION_TIME )
+        *termination = now + MAX_TERMINATION_TIME;
+
+    return true;
+}
+
+
+
+// local part of QName: "wsnt:TopicExpression" -> "TopicExpression"
+static const char* local_part(const char *qname)
+{
+    if( !qname )
+        return "";
+
+    const char *colon = strchr(qname, ':');
+
+    return colon ? colon + 1 : qname;
+}
+
+
+
+// Compile wsnt:Filter (TopicExpression and MessageContent elements) of request.
+// Returns SOAP_OK or fault.
+static int get_event_filter(struct soap *soap, const wsnt__FilterType *filter_type, EventFilter &filter)
+{
+    static EventFilterCompiler compiler; // topic tree is interned once
+
+    filter.clear();
+
+    if( !filter_type )
+        return SOAP_OK;
+
+
+    for(const auto &elt : filter_type->__any)
+    {
+        const char *name    = local_part(elt.name);
+        const char *dialect = nullptr;
+
+        for(const soap_dom_attribute *att = elt.atts; att; att = att->next)
+        {
+            if( !strcmp(local_part(att->name), "Dialect") )
+                dialect = att->text;
+        }
+
+
+        bool ok;
+
+        if( !strcmp(name, "TopicExpression") )
+            ok = compiler.add_topic_expression(filter, dialect, elt.text);
+        else if( !strcmp(name, "MessageContent") )
+            ok = compiler.add_message_content(filter, dialect, elt.text);
+        else
+            return soap_sender_fault(soap, "Unsupported filter", nullptr);
+
+
+        if( !ok )
+        {
+            std::string err = std::string("Invalid filter: ") + compiler.get_str_err();
+            return soap_sender_fault(soap, soap_strdup(soap, err.c_str()), nullptr);
+        }
+    }
+
+
+    return SOAP_OK;
+}
+
+
+
+static soap_dom_element& add_topic(struct soap *soap, std::vector<xsd__anyType> &topic_set, const char *path)
+{
+    char buf[128];
+    strncpy(buf, path, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+
+    char *save_ptr;
+    char *name = strtok_r(buf, "/", &save_ptr);
+
+
+    // root of topic tree is qualified (tns1:VideoSource), other levels are not
+    soap_dom_element *node = nullptr;
+
+    for(auto &root : topic_set)
+    {
+        if( root.name && !strcmp(root.name, name) )
+            node = &root;
+    }
+
+    if( !node )
+    {
+        topic_set.emplace_back(soap, EVENT_TOPIC_NAMESPACE, name);
+        node = &topic_set.back();
+    }
+
+
+    while( (name = strtok_r(nullptr, "/", &save_ptr)) )
+        node = &node->elt(nullptr, name);
+
+
+    node->att(SOAP_NAMESPACE_OF_wstop, "wstop:topic") = "true";
+
+    return *node;
+}
+
+
+
+static void add_item_descriptions(struct soap *soap, soap_dom_element &parent, const char *tag,
+                                  const EventItemDescr *items)
+{
+    if( !items[0].name )
+        return;
+
+    soap_dom_element &list = parent.elt(SOAP_NAMESPACE_OF_tt, tag);
+
+    for(int i = 0; (i < EVENT_MAX_ITEMS) && items[i].name; i++)
+    {
+        soap_dom_element item(soap, SOAP_NAMESPACE_OF_tt, "tt:SimpleItemDescription");
+        item.att(nullptr, "Name") = items[i].name;
+        item.att(nullptr, "Type") = items[i].type;
+
+        list.add(item);
+    }
+}
+
+
+
+
+
+int EventBindingService::GetServiceCapabilities(
+    _tev__GetServiceCapabilities         *tev__GetServiceCapabilities,
+    _tev__GetServiceCapabilitiesResponse &tev__GetServiceCapabilitiesResponse)
+{
+    UNUSED(tev__GetServiceCapabilities);
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+    tev__GetServiceCapabilitiesResponse.Capabilities = ctx->getEventServiceCapabilities(soap);
+
+    return SOAP_OK;
+}
+
+
+
+int EventBindingService::CreatePullPointSubscription(
+    _tev__CreatePullPointSubscription         *tev__CreatePullPointSubscription,
+    _tev__CreatePullPointSubscriptionResponse &tev__CreatePullPointSubscriptionResponse)
+{
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto        ctx = (ServiceContext*)soap->user;
+    time_t      now = time(NULL);
+    time_t      termination;
+    EventFilter filter;
+
+
+    if( !get_termination_time(soap, tev__CreatePullPointSubscription->InitialTerminationTime, now, &termination) )
+        return soap_sender_fault(soap, "Invalid InitialTerminationTime", nullptr);
+
+    int ret = get_event_filter(soap, tev__CreatePullPointSubscription->Filter, filter);
+    if( ret != SOAP_OK )
+        return ret;
+
+
+    ctx->get_event_broker()->expire(now);
+
+    uint32_t handle = ctx->get_event_broker()->subscribe(termination, EventBroker::PULL_POINT, &filter);
+    if( !handle )
+        return soap_receiver_fault(soap, "Maximum number of PullPoints reached", nullptr);
+
+
+    auto addr = get_subscription_address(soap, PULLPOINT_PATH, handle);
+
+    tev__CreatePullPointSubscriptionResponse.SubscriptionReference.Address = soap_strdup(soap, addr.c_str());
+    tev__CreatePullPointSubscriptionResponse.wsnt__CurrentTime             = now;
+    tev__CreatePullPointSubscriptionResponse.wsnt__TerminationTime         = soap_new_ptr(soap, termination);
+
+    return SOAP_OK;
+}
+
+
+
+int EventBindingService::GetEventProperties(
+    _tev__GetEventProperties         *tev__GetEventProperties,
+    _tev__GetEventPropertiesResponse &tev__GetEventPropertiesResponse)
+{
+    UNUSED(tev__GetEventProperties);
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto &rsp = tev__GetEventPropertiesResponse;
+
+    rsp.TopicNamespaceLocation.push_back("http://www.onvif.org/onvif/ver10/topics/topicns.xml");
+    rsp.wsnt__FixedTopicSet = true;
+    rsp.wsnt__TopicExpressionDialect.push_back(TOPIC_DIALECT_CONCRETE_SET);
+    rsp.wsnt__TopicExpressionDialect.push_back(TOPIC_DIALECT_CONCRETE);
+    rsp.MessageContentFilterDialect.push_back(CONTENT_DIALECT_ITEM_FILTER);
+    rsp.MessageContentSchemaLocation.push_back("http://www.onvif.org/onvif/ver10/schema/onvif.xsd");
+
+
+    rsp.wstop__TopicSet = soap_new_wstop__TopicSetType(soap);
+    if( !rsp.wstop__TopicSet )
+        return SOAP_FAULT;
+
+    // DOM children keep pointers to their parent, the roots must not be moved
+    rsp.wstop__TopicSet->__any.reserve(EVENT_TOPIC_CNT);
+
+    for(const auto &topic : event_topics)
+    {
+        auto &node  = add_topic(soap, rsp.wstop__TopicSet->__any, topic.path);
+        auto &descr = node.elt(SOAP_NAMESPACE_OF_tt, "tt:MessageDescription");
+
+        descr.att(nullptr, "IsProperty") = topic.is_property ? "true" : "false";
+
+        add_item_descriptions(soap, descr, "tt:Source", topic.source);
+        add_item_descriptions(soap, descr, "tt:Data",   topic.data);
+    }
+
+
+    return SOAP_OK;
+}
+
+
+
+
+
+int PullPointSubscriptionBindingService::PullMessages(
+    _tev__PullMessages         *tev__PullMessages,
+    _tev__PullMessagesResponse &tev__PullMessagesResponse)
+{
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto     ctx    = (ServiceContext*)soap->user;
+    auto     broker = ctx->get_event_broker();
+    uint32_t handle = get_subscription_handle(soap);
+
+
+    int    limit   = tev__PullMessages->MessageLimit;
+    LONG64 timeout = tev__PullMessages->Timeout;
+
+    if( limit < 1 )
+        limit = 1;
+
+    if( limit > MAX_PULL_MESSAGES )
+        limit = MAX_PULL_MESSAGES;
+
+    if( timeout < 0 )
+        timeout = 0;
+
+    if( timeout > MAX_PULL_TIMEOUT )
+        timeout = MAX_PULL_TIMEOUT;
+
+
+    auto msgs = (EventMessage*)soap_malloc(soap, limit * sizeof(EventMessage));
+    if( !msgs )
+        return SOAP_EOM;
+
+
+    // The wait is interrupted by everything the main loop waits for (a new
+    // connection of HTTP or HTTPS, SIGHUP, the control socket),
+    // so a long poll of one client does not block the others.
+    int cnt = broker->pull(handle, msgs, limit, (int)timeout, ctx->wake_fds.data(), ctx->wake_fds.size());
+    if( cnt < 0 )
+        return soap_sender_fault(soap, "Unknown subscription", nullptr);
+
+
+    // each PullMessages keeps the subscription alive
+    time_t now = time(NULL);
+    time_t termination;
+
+    broker->get_termination(handle, &termination);
+    if( termination < now + DEFAULT_TERMINATION_TIME )
+    {
+        termination = now + DEFAULT_TERMINATION_TIME;
+        broker->renew(handle, termination);
+    }
+
+
+    tev__PullMessagesResponse.CurrentTime     = now;
+    tev__PullMessagesResponse.TerminationTime = termination;
+
+    for(int i = 0; i < cnt; i++)
+    {
+        auto msg = ctx->getNotificationMessage(soap, msgs[i]);
+        if( msg )
+            tev__PullMessagesResponse.wsnt__NotificationMessage.push_back(msg);
+    }
+
+
+    return SOAP_OK;
+}
+
+
+
+int PullPointSubscriptionBindingService::SetSynchronizationPoint(
+    _tev__SetSynchronizationPoint         *tev__SetSynchronizationPoint,
+    _tev__SetSynchronizationPointResponse &tev__SetSynchronizationPointResponse)
+{
+    UNUSED(tev__SetSynchronizationPoint);
+    UNUSED(tev__SetSynchronizationPointResponse);
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+
+    if( !ctx->get_event_broker()->synchronize(get_subscription_handle(soap)) )
+        return soap_sender_fault(soap, "Unknown subscription", nullptr);
+
+    return SOAP_OK;
+}
+
+
+
+SOAP_EMPTY_HANDLER(PullPointSubscriptionBindingService, tev, Seek)
+
+
+
+
+
+int SubscriptionManagerBindingService::Renew(
+    _wsnt__Renew         *wsnt__Renew,
+    _wsnt__RenewResponse &wsnt__RenewResponse)
+{
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto     ctx    = (ServiceContext*)soap->user;
+    uint32_t handle = get_subscription_handle(soap);
+    time_t   now    = time(NULL);
+    time_t   termination;
+
+
+    if( !get_termination_time(soap, wsnt__Renew->TerminationTime, now, &termination) )
+        return soap_sender_fault(soap, "Invalid TerminationTime", nullptr);
+
+    if( !ctx->get_event_broker()->renew(handle, termination) )
+        return soap_sender_fault(soap, "Unknown subscription", nullptr);
+
+
+    wsnt__RenewResponse.wsnt__TerminationTime = soap_new_ptr(soap, termination);
+    wsnt__RenewResponse.wsnt__CurrentTime     = soap_new_ptr(soap, now);
+
+    return SOAP_OK;
+}
+
+
+
+int SubscriptionManagerBindingService::Unsubscribe(
+    _wsnt__Unsubscribe         *wsnt__Unsubscribe,
+    _wsnt__UnsubscribeResponse &wsnt__UnsubscribeResponse)
+{
+    UNUSED(wsnt__Unsubscribe);
+    UNUSED(wsnt__UnsubscribeResponse);
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto ctx = (ServiceContext*)soap->user;
+
+    if( !ctx->get_event_broker()->unsubscribe(get_subscription_handle(soap)) )
+        return soap_sender_fault(soap, "Unknown subscription", nullptr);
+
+    return SOAP_OK;
+}
+
+
+
+
+
+int NotificationProducerBindingService::Subscribe(
+    _wsnt__Subscribe         *wsnt__Subscribe,
+    _wsnt__SubscribeResponse &wsnt__SubscribeResponse)
+{
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    auto        ctx = (ServiceContext*)soap->user;
+    const char *url = wsnt__Subscribe->ConsumerReference.Address;
+    time_t      now = time(NULL);
+    time_t      termination;
+    EventFilter filter;
+
+
+    if( !url || strncmp(url, "http://", 7) )
+        return soap_sender_fault(soap, "Invalid ConsumerReference", nullptr);
+
+    if( !get_termination_time(soap, wsnt__Subscribe->InitialTerminationTime, now, &termination) )
+        return soap_sender_fault(soap, "Invalid InitialTerminationTime", nullptr);
+
+    int ret = get_event_filter(soap, wsnt__Subscribe->Filter, filter);
+    if( ret != SOAP_OK )
+        return ret;
+
+
+    ctx->get_event_broker()->expire(now);
+
+    uint32_t handle = ctx->get_event_broker()->subscribe(termination, EventBroker::PUSH, &filter);
+    if( !handle )
+        return soap_receiver_fault(soap, "Maximum number of subscriptions reached", nullptr);
+
+
+    auto addr = get_subscription_address(soap, SUBSCRIPTION_PATH, handle);
+
+    if( !ctx->get_event_pusher()->add_consumer(handle, url, addr) )
+    {
+        ctx->get_event_broker()->unsubscribe(handle);
+        return soap_receiver_fault(soap, ctx->get_event_pusher()->get_cstr_err(), nullptr);
+    }
+
+
+    wsnt__SubscribeResponse.SubscriptionReference.Address = soap_strdup(soap, addr.c_str());
+    wsnt__SubscribeResponse.wsnt__CurrentTime             = soap_new_ptr(soap, now);
+    wsnt__SubscribeResponse.wsnt__TerminationTime         = soap_new_ptr(soap, termination);
+
+    return SOAP_OK;
+}
+
+
+
+int NotificationProducerBindingService::GetCurrentMessage(
+    _wsnt__GetCurrentMessage         *wsnt__GetCurrentMessage,
+    _wsnt__GetCurrentMessageResponse &wsnt__GetCurrentMessageResponse)
+{
+    UNUSED(wsnt__GetCurrentMessage);
+    UNUSED(wsnt__GetCurrentMessageResponse);
+    LOG_D(LOG_MOD_EVENT, "Event: %s", __FUNCTION__);
+
+    return soap_sender_fault(soap, "No current message on topic", nullptr);
+}
@@ -21,7 +21,7 @@ int MediaBindingService::GetServiceCapabilities(
     _trt__GetServiceCapabilitiesResponse &trt__GetServiceCapabilitiesResponse)
 {
     UNUSED(trt__GetServiceCapabilities);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
 
     auto ctx = (ServiceContext*)soap->user;
@@ -38,7 +38,7 @@ int MediaBindingService::GetVideoSources(
     _trt__GetVideoSourcesResponse &trt__GetVideoSourcesResponse)
 {
     UNUSED(trt__GetVideoSources);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
 
     auto ctx      = (ServiceContext*)soap->user;
@@ -59,7 +59,7 @@ int MediaBindingService::GetProfile(
     _trt__GetProfile         *trt__GetProfile,
     _trt__GetProfileResponse &trt__GetProfileResponse)
 {
-    DEBUG_MSG("Media: %s   get profile:%s\n", __FUNCTION__, trt__GetProfile->ProfileToken.c_str());
+    LOG_D(LOG_MOD_SERVICE, "Media: %s   get profile:%s", __FUNCTION__, trt__GetProfile->ProfileToken.c_str());
 
     int ret       = SOAP_FAULT;
     auto ctx      = (ServiceContext*)soap->user;
@@ -84,7 +84,7 @@ int MediaBindingService::GetProfiles(
     _trt__GetProfilesResponse &trt__GetProfilesResponse)
 {
     UNUSED(trt__GetProfiles);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx      = (ServiceContext*)soap->user;
     auto profiles = ctx->get_profiles();
@@ -103,7 +103,7 @@ int MediaBindingService::GetStreamUri(
     _trt__GetStreamUri         *trt__GetStreamUri,
     _trt__GetStreamUriResponse &trt__GetStreamUriResponse)
 {
-    DEBUG_MSG("Media: %s   for profile:%s\n", __FUNCTION__, trt__GetStreamUri->ProfileToken.c_str());
+    LOG_D(LOG_MOD_SERVICE, "Media: %s   for profile:%s", __FUNCTION__, trt__GetStreamUri->ProfileToken.c_str());
 
     int  ret      = SOAP_FAULT;
     auto ctx      = (ServiceContext*)soap->user;
@@ -134,7 +134,7 @@ int MediaBindingService::GetSnapshotUri(
     _trt__GetSnapshotUri         *trt__GetSnapshotUri,
     _trt__GetSnapshotUriResponse &trt__GetSnapshotUriResponse)
 {
-    DEBUG_MSG("Media: %s   for profile:%s\n", __FUNCTION__, trt__GetSnapshotUri->ProfileToken.c_str());
+    LOG_D(LOG_MOD_SERVICE, "Media: %s   for profile:%s", __FUNCTION__, trt__GetSnapshotUri->ProfileToken.c_str());
 
     int ret       = SOAP_FAULT;
     auto ctx      = (ServiceContext*)soap->user;
@@ -166,7 +166,7 @@ int MediaBindingService::GetVideoSourceConfigurations(
     _trt__GetVideoSourceConfigurationsResponse &trt__GetVideoSourceConfigurationsResponse)
 {
     UNUSED(trt__GetVideoSourceConfigurations);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx      = (ServiceContext*)soap->user;
     auto profiles = ctx->get_profiles();
@@ -187,7 +187,7 @@ int MediaBindingService::GetVideoEncoderConfigurations(
     _trt__GetVideoEncoderConfigurationsResponse &trt__GetVideoEncoderConfigurationsResponse)
 {
     UNUSED(trt__GetVideoEncoderConfigurations);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx      = (ServiceContext*)soap->user;
     auto profiles = ctx->get_profiles();
@@ -207,7 +207,7 @@ int MediaBindingService::GetVideoSourceConfiguration(
     _trt__GetVideoSourceConfiguration         *trt__GetVideoSourceConfiguration,
     _trt__GetVideoSourceConfigurationResponse &trt__GetVideoSourceConfigurationResponse)
 {
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx      = (ServiceContext*)soap->user;
     auto profiles = ctx->get_profiles();
@@ -232,7 +232,7 @@ int MediaBindingService::GetVideoEncoderConfiguration(
     _trt__GetVideoEncoderConfiguration         *trt__GetVideoEncoderConfiguration,
     _trt__GetVideoEncoderConfigurationResponse &trt__GetVideoEncoderConfigurationResponse)
 {
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx      = (ServiceContext*)soap->user;
     auto profiles = ctx->get_profiles();
@@ -258,7 +258,7 @@ int MediaBindingService::GetGuaranteedNumberOfVideoEncoderInstances(
     _trt__GetGuaranteedNumberOfVideoEncoderInstancesResponse &trt__GetGuaranteedNumberOfVideoEncoderInstancesResponse)
 {
     UNUSED(trt__GetGuaranteedNumberOfVideoEncoderInstances);
-    DEBUG_MSG("Media: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "Media: %s", __FUNCTION__);
 
     auto ctx                = (ServiceContext*)soap->user;
     auto profiles           = ctx->get_profiles();
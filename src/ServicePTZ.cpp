@@ -48,7 +48,7 @@ static void ensure_preset_dir() {
 static int run_system_cmd(const char* cmd, unsigned int timeout_usec = 0)
 {
     int ret = system(cmd);
-    DEBUG_MSG("PTZ cmd:%s  ret:%d\n", cmd, ret);
+    LOG_D(LOG_MOD_SERVICE, "PTZ cmd:%s  ret:%d", cmd, ret);
     if (timeout_usec) usleep(timeout_usec);
     return ret;
 }
@@ -82,7 +82,7 @@ static void goto_current_pt() {
     snprintf(cmd, sizeof(cmd),
              "curl -s http://127.0.0.1:7777/rotatePT/%.0f/%.0f", pan, tilt);
     run_system_cmd(cmd, 0);
-    DEBUG_MSG("PTZ[MOVE]: goto pan=%.2f tilt=%.2f\n", pan, tilt);
+    LOG_D(LOG_MOD_SERVICE, "PTZ[MOVE]: goto pan=%.2f tilt=%.2f", pan, tilt);
 }
 // ===== 프리셋 저장소 =====
 struct PresetRec {
@@ -201,7 +201,7 @@ int PTZBindingService::GetNodes(
     _tptz__GetNodesResponse &tptz__GetNodesResponse)
 {
     UNUSED(tptz__GetNodes);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     soap_default_std__vectorTemplateOfPointerTott__PTZNode(
         soap, &tptz__GetNodesResponse._tptz__GetNodesResponse::PTZNode);
@@ -218,7 +218,7 @@ int PTZBindingService::GetNode(
     _tptz__GetNodeResponse &tptz__GetNodeResponse)
 {
     UNUSED(tptz__GetNode);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     tptz__GetNodeResponse.PTZNode = soap_new_tt__PTZNode(soap);
     GetPTZNode(soap, tptz__GetNodeResponse.PTZNode);
@@ -232,7 +232,7 @@ int PTZBindingService::GetPresets(
     _tptz__GetPresetsResponse &tptz__GetPresetsResponse)
 {
     UNUSED(tptz__GetPresets);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     load_presets_from_file();
 
@@ -263,7 +263,7 @@ int PTZBindingService::SetPreset(
     _tptz__SetPreset         *tptz__SetPreset,
     _tptz__SetPresetResponse &tptz__SetPresetResponse)
 {
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
     if (!tptz__SetPreset || tptz__SetPreset->ProfileToken.empty())
         return SOAP_OK;
 
@@ -302,7 +302,7 @@ int PTZBindingService::RemovePreset(
     _tptz__RemovePresetResponse &tptz__RemovePresetResponse)
 {
     UNUSED(tptz__RemovePresetResponse);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     if (!tptz__RemovePreset ||
         tptz__RemovePreset->ProfileToken.empty() ||
@@ -323,7 +323,7 @@ int PTZBindingService::GotoPreset(
     _tptz__GotoPresetResponse &tptz__GotoPresetResponse)
 {
     UNUSED(tptz__GotoPresetResponse);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     if (!tptz__GotoPreset ||
         tptz__GotoPreset->ProfileToken.empty() ||
@@ -337,7 +337,7 @@ int PTZBindingService::GotoPreset(
         std::map<std::string, PresetRec>::const_iterator it =
             g_presets.find(tptz__GotoPreset->PresetToken); // 값 타입
         if (it == g_presets.end()) {
-            DEBUG_MSG("PTZ: preset not found: %s\n",
+            LOG_D(LOG_MOD_SERVICE, "PTZ: preset not found: %s",
                       tptz__GotoPreset->PresetToken.c_str());
             return SOAP_OK;
         }
@@ -366,7 +366,7 @@ int PTZBindingService::AbsoluteMove(
     _tptz__AbsoluteMoveResponse &res)
 {
     UNUSED(res);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     if (!req || req->ProfileToken.empty()) return SOAP_OK;
     if (!req->Position || !req->Position->PanTilt) return SOAP_OK;
@@ -386,7 +386,7 @@ int PTZBindingService::ContinuousMove(
 {
     UNUSED(tptz__ContinuousMove);
     UNUSED(tptz__ContinuousMoveResponse);
-    DEBUG_MSG("PTZ: %s (unused)\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s (unused)", __FUNCTION__);
     return SOAP_OK;
 }
 
@@ -395,7 +395,7 @@ int PTZBindingService::RelativeMove(
     _tptz__RelativeMoveResponse &res)
 {
     UNUSED(res);
-    DEBUG_MSG("PTZ: %s\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s", __FUNCTION__);
 
     if (!req || req->ProfileToken.empty()) return SOAP_OK;
     if (!req->Translation || !req->Translation->PanTilt) return SOAP_OK;
@@ -409,7 +409,7 @@ int PTZBindingService::RelativeMove(
     if (dpan != 0.0f || dtilt != 0.0f) {
         adjust_current_pt(dpan, dtilt);  // 누적/클램프
         goto_current_pt();               // 절대 이동 호출
-        DEBUG_MSG("PTZ[REL]: rx=%.3f ry=%.3f -> dpan=%.2f dtilt=%.2f\n", rx, ry, dpan, dtilt);
+        LOG_D(LOG_MOD_SERVICE, "PTZ[REL]: rx=%.3f ry=%.3f -> dpan=%.2f dtilt=%.2f", rx, ry, dpan, dtilt);
     }
     return SOAP_OK;
 }
@@ -417,7 +417,7 @@ int PTZBindingService::Stop(_tptz__Stop *tptz__Stop, _tptz__StopResponse &tptz__
 {
     UNUSED(tptz__Stop);
     UNUSED(tptz__StopResponse);
-    DEBUG_MSG("PTZ: %s (noop)\n", __FUNCTION__);
+    LOG_D(LOG_MOD_SERVICE, "PTZ: %s (noop)", __FUNCTION__);
     return SOAP_OK;
 }
 
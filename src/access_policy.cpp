@@ -0,0 +1,186 @@
+#include <string.h>
+#include <algorithm>
+
+#include "access_policy.h"
+
+
+
+
+
+struct OperationAccess
+{
+    const char  *name;
+    AccessClass  access_class;
+};
+
+
+
+// sorted by name (strcmp), see get_access_class
+static const OperationAccess operations[] =
+{
+    { "AddIPAddressFilter",            ACCESS_WRITE_SYSTEM },
+    { "AddScopes",                     ACCESS_WRITE_SYSTEM },
+    { "CreateCertificate",             ACCESS_WRITE_SYSTEM },
+    { "CreatePullPointSubscription",   ACCESS_READ_MEDIA },
+    { "CreateStorageConfiguration",    ACCESS_WRITE_SYSTEM },
+    { "CreateUsers",                   ACCESS_WRITE_SYSTEM },
+    { "DeleteCertificates",            ACCESS_WRITE_SYSTEM },
+    { "DeleteGeoLocation",             ACCESS_WRITE_SYSTEM },
+    { "DeleteStorageConfiguration",    ACCESS_WRITE_SYSTEM },
+    { "DeleteUsers",                   ACCESS_WRITE_SYSTEM },
+    { "GetAccessPolicy",               ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetCACertificates",             ACCESS_READ_SYSTEM },
+    { "GetCapabilities",               ACCESS_PRE_AUTH },
+    { "GetCertificateInformation",     ACCESS_READ_SYSTEM },
+    { "GetCertificates",               ACCESS_READ_SYSTEM },
+    { "GetCertificatesStatus",         ACCESS_READ_SYSTEM },
+    { "GetClientCertificateMode",      ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetDNS",                        ACCESS_READ_SYSTEM },
+    { "GetDPAddresses",                ACCESS_READ_SYSTEM },
+    { "GetDeviceInformation",          ACCESS_READ_SYSTEM },
+    { "GetDiscoveryMode",              ACCESS_READ_SYSTEM },
+    { "GetDynamicDNS",                 ACCESS_READ_SYSTEM },
+    { "GetEndpointReference",          ACCESS_PRE_AUTH },
+    { "GetGeoLocation",                ACCESS_READ_SYSTEM },
+    { "GetHostname",                   ACCESS_PRE_AUTH },
+    { "GetIPAddressFilter",            ACCESS_READ_SYSTEM },
+    { "GetNTP",                        ACCESS_READ_SYSTEM },
+    { "GetNetworkDefaultGateway",      ACCESS_READ_SYSTEM },
+    { "GetNetworkInterfaces",          ACCESS_READ_SYSTEM },
+    { "GetNetworkProtocols",           ACCESS_READ_SYSTEM },
+    { "GetRelayOutputs",               ACCESS_READ_SYSTEM },
+    { "GetRemoteDiscoveryMode",        ACCESS_READ_SYSTEM },
+    { "GetRemoteUser",                 ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetScopes",                     ACCESS_READ_SYSTEM },
+    { "GetServiceCapabilities",        ACCESS_PRE_AUTH },
+    { "GetServices",                   ACCESS_PRE_AUTH },
+    { "GetStorageConfiguration",       ACCESS_READ_SYSTEM },
+    { "GetStorageConfigurations",      ACCESS_READ_SYSTEM },
+    { "GetSystemBackup",               ACCESS_READ_SYSTEM_SECRET },
+    { "GetSystemDateAndTime",          ACCESS_PRE_AUTH },
+    { "GetSystemLog",                  ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetSystemSupportInformation",   ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetSystemUris",                 ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetUsers",                      ACCESS_READ_SYSTEM_SENSITIVE },
+    { "GetWsdlUrl",                    ACCESS_PRE_AUTH },
+    { "GetZeroConfiguration",          ACCESS_READ_SYSTEM },
+    { "LoadCACertificates",            ACCESS_UNRECOVERABLE },
+    { "LoadCertificateWithPrivateKey", ACCESS_UNRECOVERABLE },
+    { "LoadCertificates",              ACCESS_UNRECOVERABLE },
+    { "PullMessages",                  ACCESS_READ_MEDIA },
+    { "RemoveIPAddressFilter",         ACCESS_WRITE_SYSTEM },
+    { "RemoveScopes",                  ACCESS_WRITE_SYSTEM },
+    { "Renew",                         ACCESS_READ_MEDIA },
+    { "RestoreSystem",                 ACCESS_UNRECOVERABLE },
+    { "Seek",                          ACCESS_READ_MEDIA },
+    { "SetAccessPolicy",               ACCESS_UNRECOVERABLE },
+    { "SetCertificatesStatus",         ACCESS_WRITE_SYSTEM },
+    { "SetClientCertificateMode",      ACCESS_WRITE_SYSTEM },
+    { "SetDNS",                        ACCESS_WRITE_SYSTEM },
+    { "SetDPAddresses",                ACCESS_WRITE_SYSTEM },
+    { "SetDiscoveryMode",              ACCESS_WRITE_SYSTEM },
+    { "SetDynamicDNS",                 ACCESS_WRITE_SYSTEM },
+    { "SetGeoLocation",                ACCESS_WRITE_SYSTEM },
+    { "SetHostname",                   ACCESS_WRITE_SYSTEM },
+    { "SetHostnameFromDHCP",           ACCESS_WRITE_SYSTEM },
+    { "SetIPAddressFilter",            ACCESS_WRITE_SYSTEM },
+    { "SetNTP",                        ACCESS_WRITE_SYSTEM },
+    { "SetNetworkDefaultGateway",      ACCESS_WRITE_SYSTEM },
+    { "SetNetworkInterfaces",          ACCESS_WRITE_SYSTEM },
+    { "SetNetworkProtocols",           ACCESS_WRITE_SYSTEM },
+    { "SetRelayOutputSettings",        ACCESS_WRITE_SYSTEM },
+    { "SetRemoteDiscoveryMode",        ACCESS_WRITE_SYSTEM },
+    { "SetRemoteUser",                 ACCESS_WRITE_SYSTEM },
+    { "SetScopes",                     ACCESS_WRITE_SYSTEM },
+    { "SetStorageConfiguration",       ACCESS_WRITE_SYSTEM },
+    { "SetSynchronizationPoint",       ACCESS_READ_MEDIA },
+    { "SetSystemDateAndTime",          ACCESS_WRITE_SYSTEM },
+    { "SetSystemFactoryDefault",       ACCESS_UNRECOVERABLE },
+    { "SetUser",                       ACCESS_WRITE_SYSTEM },
+    { "SetZeroConfiguration",          ACCESS_WRITE_SYSTEM },
+    { "StartFirmwareUpgrade",          ACCESS_UNRECOVERABLE },
+    { "StartSystemRestore",            ACCESS_UNRECOVERABLE },
+    { "Subscribe",                     ACCESS_ACTUATE },    // the device sends Notify to any given http:// address
+    { "SystemReboot",                  ACCESS_UNRECOVERABLE },
+    { "Unsubscribe",                   ACCESS_READ_MEDIA },
+    { "UpgradeSystemFirmware",         ACCESS_UNRECOVERABLE },
+};
+
+
+
+// allowed access classes of user levels (bit per AccessClass)
+static const uint32_t level_access[USER_LEVEL_CNT] =
+{
+    // Administrator
+    (1u << ACCESS_CLASS_CNT) - 1,
+
+    // Operator
+    (1u << ACCESS_PRE_AUTH)    | (1u << ACCESS_READ_SYSTEM)  | (1u << ACCESS_READ_SYSTEM_SENSITIVE) |
+    (1u << ACCESS_READ_MEDIA)  | (1u << ACCESS_ACTUATE),
+
+    // User
+    (1u << ACCESS_PRE_AUTH)    | (1u << ACCESS_READ_SYSTEM)  | (1u << ACCESS_READ_MEDIA),
+
+    // Anonymous
+    (1u << ACCESS_PRE_AUTH)
+};
+
+
+
+static const char *access_class_names[ACCESS_CLASS_CNT] =
+{
+    "PRE_AUTH",
+    "READ_SYSTEM",
+    "READ_SYSTEM_SENSITIVE",
+    "READ_SYSTEM_SECRET",
+    "WRITE_SYSTEM",
+    "UNRECOVERABLE",
+    "READ_MEDIA",
+    "ACTUATE"
+};
+
+
+
+
+
+AccessClass get_access_class(const char *operation)
+{
+    if( !operation )
+        return ACCESS_UNRECOVERABLE;
+
+    const char *colon = strchr(operation, ':');
+    if( colon )
+        operation = colon + 1;
+
+
+    auto end = operations + sizeof(operations)/sizeof(operations[0]);
+    auto it  = std::lower_bound(operations, end, operation,
+                                [](const OperationAccess &op, const char *name)
+                                { return strcmp(op.name, name) < 0; });
+
+    if( (it != end) && !strcmp(it->name, operation) )
+        return it->access_class;
+
+
+    return strncmp(operation, "Get", 3) ? ACCESS_ACTUATE : ACCESS_READ_MEDIA;
+}
+
+
+
+bool is_access_allowed(UserLevel level, AccessClass access_class)
+{
+    if( (level >= USER_LEVEL_CNT) || (access_class >= ACCESS_CLASS_CNT) )
+        return false;
+
+    return level_access[level] & (1u << access_class);
+}
+
+
+
+const char* get_access_class_name(AccessClass access_class)
+{
+    if( access_class >= ACCESS_CLASS_CNT )
+        return "unknown";
+
+    return access_class_names[access_class];
+}
@@ -0,0 +1,58 @@
+#ifndef ACCESS_POLICY_H
+#define ACCESS_POLICY_H
+
+#include <stdint.h>
+
+
+
+
+
+// Access classes of operations (ONVIF Core Specification, 5.9.4)
+enum AccessClass : uint8_t
+{
+    ACCESS_PRE_AUTH,                // no authentication (GetSystemDateAndTime, ...)
+    ACCESS_READ_SYSTEM,
+    ACCESS_READ_SYSTEM_SENSITIVE,
+    ACCESS_READ_SYSTEM_SECRET,
+    ACCESS_WRITE_SYSTEM,
+    ACCESS_UNRECOVERABLE,
+    ACCESS_READ_MEDIA,
+    ACCESS_ACTUATE,
+
+    ACCESS_CLASS_CNT                //Its not class! Its counter for use in code (max index)
+};
+
+
+
+// User levels (tt:UserLevel) + not authenticated client
+enum UserLevel : uint8_t
+{
+    USER_LEVEL_ADMINISTRATOR,
+    USER_LEVEL_OPERATOR,
+    USER_LEVEL_USER,
+    USER_LEVEL_ANONYMOUS,
+
+    USER_LEVEL_CNT                  //Its not level! Its counter for use in code (max index)
+};
+
+
+
+/*
+ * Access class of operation by its local name (without namespace prefix),
+ * e.g. "GetSystemDateAndTime" or "tds:GetSystemDateAndTime".
+ * The names that are not in the table are classified by the verb:
+ * Get* - ACCESS_READ_MEDIA, the rest - ACCESS_ACTUATE.
+ */
+AccessClass get_access_class(const char *operation);
+
+
+bool is_access_allowed(UserLevel level, AccessClass access_class);
+
+
+const char* get_access_class_name(AccessClass access_class);
+
+
+
+
+
+#endif // ACCESS_POLICY_H
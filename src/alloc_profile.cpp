@@ -0,0 +1,78 @@
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "alloc_profile.h"
+
+
+
+
+
+AllocProfiler::AllocProfiler():
+    enabled(false)
+{
+    reset();
+}
+
+
+
+void AllocProfiler::record(size_t op, const RequestStat &stat, uint64_t objects)
+{
+    OpProfile &profile = ops[(op < Metrics::MAX_OPS) ? op : (size_t)Metrics::UNKNOWN_OP];
+
+    profile.requests++;
+    profile.allocs  += stat.arena_allocs;
+    profile.bytes   += stat.arena_bytes;
+    profile.objects += objects;
+
+    profile.peak_bytes  = std::max(profile.peak_bytes,  stat.arena_bytes);
+    profile.peak_allocs = std::max(profile.peak_allocs, stat.arena_allocs);
+}
+
+
+
+void AllocProfiler::reset()
+{
+    memset(ops, 0, sizeof(ops));
+}
+
+
+
+void AllocProfiler::render(std::string &out, const Metrics &metrics) const
+{
+    std::vector<size_t> order;
+
+    for(size_t op = 0; op < Metrics::MAX_OPS; op++)
+    {
+        if( ops[op].requests )
+            order.push_back(op);
+    }
+
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return ops[a].bytes / ops[a].requests > ops[b].bytes / ops[b].requests;
+    });
+
+
+    char line[256];
+
+    snprintf(line, sizeof(line), "# allocation profile is %s, per request: soap_malloc (allocs, bytes) and C++ objects\n"
+             "%-40s %10s %10s %10s %10s %10s %10s\n", enabled ? "on" : "off",
+             "# operation", "requests", "allocs", "bytes", "objects", "max_allocs", "max_bytes");
+    out += line;
+
+    for(size_t op : order)
+    {
+        const OpProfile &profile = ops[op];
+        std::string      name    = std::string(metrics.get_service_name(op)) + "." + metrics.get_operation_name(op);
+
+        snprintf(line, sizeof(line), "%-40s %10llu %10.1f %10.1f %10.1f %10llu %10llu\n", name.c_str(),
+                 (unsigned long long)profile.requests,
+                 (double)profile.allocs  / profile.requests,
+                 (double)profile.bytes   / profile.requests,
+                 (double)profile.objects / profile.requests,
+                 (unsigned long long)profile.peak_allocs,
+                 (unsigned long long)profile.peak_bytes);
+        out += line;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "metrics.h"
+
+
+
+
+
+/*
+ * Profile of the gSOAP arena per operation: how much every request
+ * allocates by soap_malloc (soap_new_ptr, strings, arrays: the fmalloc hook)
+ * and how many C++ objects (soap_new_*) are deleted by its soap_destroy
+ * (the list of soap->clist is counted before it).
+ *
+ * It is toggled at runtime (--alloc_profile, command "alloc" of the control
+ * socket), when it is off the hook is not installed and nothing is counted.
+ * Operations are the ids of Metrics (the same names), it is used only
+ * by the main loop, so there are no locks.
+ */
+class AllocProfiler
+{
+    public:
+
+        AllocProfiler();
+
+
+        //methods for parsing opt from cmd
+        void set_enabled(bool new_val) { enabled = new_val; }
+        bool is_enabled() const { return enabled; }
+
+
+        // stat: soap_malloc of the request, objects: soap->clist before soap_destroy
+        void record(size_t op, const RequestStat &stat, uint64_t objects);
+        void reset();
+
+
+        // text report, the operations with most bytes per request first
+        void render(std::string &out, const Metrics &metrics) const;
+
+
+    private:
+
+        struct OpProfile
+        {
+            uint64_t requests;
+            uint64_t allocs;
+            uint64_t bytes;
+            uint64_t objects;
+            uint64_t peak_bytes;    // the biggest request
+            uint64_t peak_allocs;
+        };
+
+
+        bool       enabled;
+        OpProfile  ops[Metrics::MAX_OPS];
+};
+
+
+
+
+
+#endif // ALLOC_PROFILE_H
@@ -0,0 +1,203 @@
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control_socket.h"
+
+
+
+
+
+ControlSocket::ControlSocket():
+    sock(-1)
+{
+}
+
+
+
+ControlSocket::~ControlSocket()
+{
+    stop();
+}
+
+
+
+bool ControlSocket::start(const char *new_path)
+{
+    if( !new_path || !*new_path )
+    {
+        str_err = "path is empty";
+        return false;
+    }
+
+    if( strlen(new_path) >= sizeof(((struct sockaddr_un *)0)->sun_path) )
+    {
+        str_err = "path is too long";
+        return false;
+    }
+
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( sock < 0 )
+    {
+        str_err = std::string("can't create socket: ") + strerror(errno);
+        return false;
+    }
+
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, new_path);
+
+    unlink(new_path); // stale socket of the previous run
+
+
+    // only the owner (root) can control the daemon
+    mode_t old_mask = umask(0077);
+    int    res      = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if( (res < 0) || (listen(sock, 4) < 0) )
+    {
+        str_err = std::string("can't bind socket ") + new_path + ": " + strerror(errno);
+        close(sock);
+        sock = -1;
+        return false;
+    }
+
+
+    path = new_path;
+
+    return true;
+}
+
+
+
+void ControlSocket::stop()
+{
+    if( sock < 0 )
+        return;
+
+    close(sock);
+    unlink(path.c_str());
+    sock = -1;
+}
+
+
+
+void ControlSocket::serve(const Handler &handler)
+{
+    for(;;)
+    {
+        int fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if( fd < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return; // EAGAIN - all are served
+        }
+
+
+        std::string line;
+
+        if( read_line(fd, line) )
+        {
+            // "command args", spaces around are dropped
+            size_t begin = line.find_first_not_of(" \t");
+            size_t end   = line.find_last_not_of(" \t");
+
+            line = (begin == std::string::npos) ? "" : line.substr(begin, end - begin + 1);
+
+            size_t space = line.find_first_of(" \t");
+            size_t args  = line.find_first_not_of(" \t", space);
+
+            std::string reply;
+            handler(line.substr(0, space), (space == std::string::npos) ? "" : line.substr(args), reply);
+
+            write_all(fd, reply);
+        }
+
+        close(fd);
+    }
+}
+
+
+
+bool ControlSocket::read_line(int fd, std::string &line)
+{
+    char buf[MAX_CMD_LEN];
+
+    while( line.size() < MAX_CMD_LEN )
+    {
+        ssize_t len = read(fd, buf, sizeof(buf));
+
+        if( len > 0 )
+        {
+            line.append(buf, len);
+
+            size_t eol = line.find_first_of("\r\n");
+            if( eol != std::string::npos )
+            {
+                line.resize(eol);
+                return true;
+            }
+
+            continue;
+        }
+
+
+        if( len == 0 )
+            return !line.empty(); // the last line without '\n'
+
+        if( errno == EINTR )
+            continue;
+
+        if( errno != EAGAIN )
+            return false;
+
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if( poll(&pfd, 1, IO_TIMEOUT_MS) <= 0 )
+            return false;
+    }
+
+    return false; // too long
+}
+
+
+
+void ControlSocket::write_all(int fd, const std::string &data)
+{
+    size_t sent = 0;
+
+    while( sent < data.size() )
+    {
+        ssize_t len = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if( len > 0 )
+        {
+            sent += len;
+            continue;
+        }
+
+
+        if( (len < 0) && (errno == EINTR) )
+            continue;
+
+        if( (len < 0) && (errno != EAGAIN) )
+            return;
+
+
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+
+        if( poll(&pfd, 1, IO_TIMEOUT_MS) <= 0 )
+            return;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <stddef.h>
+#include <string>
+#include <functional>
+
+
+
+
+
+/*
+ * Local control endpoint of the daemon: a Unix stream socket (mode 0600),
+ * a client sends one line "command [args]" and gets the text reply,
+ * then the connection is closed:
+ *
+ *   echo metrics | socat - UNIX-CONNECT:/var/run/onvif_srvd.ctl
+ *
+ * The socket is polled by the main loop together with the listeners,
+ * so commands are run between requests: they never race with a handler
+ * and need no locks. A slow client can't hold the loop longer than
+ * IO_TIMEOUT_MS (per read/write).
+ */
+class ControlSocket
+{
+    public:
+
+        enum
+        {
+            MAX_CMD_LEN   = 256,
+            IO_TIMEOUT_MS = 500
+        };
+
+
+        // cmd is the first word, args are the rest of the line (without spaces around)
+        typedef std::function<void(const std::string &cmd, const std::string &args, std::string &reply)> Handler;
+
+
+        ControlSocket();
+       ~ControlSocket();
+
+        ControlSocket(const ControlSocket&) = delete;
+        ControlSocket& operator=(const ControlSocket&) = delete;
+
+
+        // must be called after daemonize (chdir)
+        bool start(const char *path);
+        void stop();
+
+        bool is_enabled() const { return sock >= 0; }
+        int  get_fd()     const { return sock;      }
+
+
+        // serve all pending clients (the socket is readable)
+        void serve(const Handler &handler);
+
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        int          sock;
+        std::string  path;
+
+        std::string  str_err;
+
+
+        bool read_line(int fd, std::string &line);
+        void write_all(int fd, const std::string &data);
+};
+
+
+
+
+
+#endif // CONTROL_SOCKET_H
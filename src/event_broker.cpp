@@ -0,0 +1,655 @@
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "event_broker.h"
+#include "smacros.h"
+
+
+
+
+
+const EventTopic event_topics[EVENT_TOPIC_CNT] =
+{
+    {
+        "tns1:VideoSource/MotionAlarm", true,
+        { {"VideoSourceToken", "tt:ReferenceToken"} },
+        { {"State",            "xs:boolean"       } }
+    },
+    {
+        "tns1:RuleEngine/CellMotionDetector/Motion", true,
+        { {"VideoSourceConfigurationToken",     "tt:ReferenceToken"},
+          {"VideoAnalyticsConfigurationToken",  "tt:ReferenceToken"},
+          {"Rule",                              "xs:string"        } },
+        { {"IsMotion",                          "xs:boolean"       } }
+    },
+    {
+        "tns1:VideoSource/GlobalSceneChange/ImagingService", true,
+        { {"Source", "tt:ReferenceToken"} },
+        { {"State",  "xs:boolean"       } }
+    },
+    {
+        "tns1:Device/Trigger/DigitalInput", true,
+        { {"InputToken",   "tt:ReferenceToken"} },
+        { {"LogicalState", "xs:boolean"       } }
+    },
+    {
+        "tns1:Device/Trigger/Relay", true,
+        { {"RelayToken",   "tt:ReferenceToken" } },
+        { {"LogicalState", "tt:RelayLogicalState"} }
+    }
+};
+
+
+
+
+
+void EventMessage::clear(uint16_t new_topic, time_t time)
+{
+    memset(this, 0, sizeof(*this));
+
+    topic    = new_topic;
+    utc_time = time ? time : ::time(NULL);
+
+    if( (topic < EVENT_TOPIC_CNT) && event_topics[topic].is_property )
+        property_op = PROP_CHANGED;
+}
+
+
+
+static bool set_item(EventItem &item, const char *name, const char *value)
+{
+    if( !name || !value )
+        return false;
+
+    if( (strlen(name)  >= sizeof(item.name)) ||
+        (strlen(value) >= sizeof(item.value)) )
+        return false;
+
+    strcpy(item.name,  name);
+    strcpy(item.value, value);
+
+    return true;
+}
+
+
+
+bool EventMessage::add_source(const char *name, const char *value)
+{
+    // Source items must go before Data items
+    if( (item_cnt >= EVENT_MAX_ITEMS) || (item_cnt != source_cnt) )
+        return false;
+
+    if( !set_item(items[item_cnt], name, value) )
+        return false;
+
+    item_cnt++;
+    source_cnt++;
+
+    return true;
+}
+
+
+
+bool EventMessage::add_data(const char *name, const char *value)
+{
+    if( item_cnt >= EVENT_MAX_ITEMS )
+        return false;
+
+    if( !set_item(items[item_cnt], name, value) )
+        return false;
+
+    item_cnt++;
+
+    return true;
+}
+
+
+
+bool EventMessage::same_source(const EventMessage &other) const
+{
+    if( (topic != other.topic) || (source_cnt != other.source_cnt) )
+        return false;
+
+    for(int i = 0; i < source_cnt; i++)
+    {
+        if( strcmp(items[i].name,  other.items[i].name)  ||
+            strcmp(items[i].value, other.items[i].value) )
+            return false;
+    }
+
+    return true;
+}
+
+
+
+
+
+EventBroker::EventBroker():
+    props_cnt(0),
+    dropped_total(0)
+{
+    for(uint32_t i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &sub = slots[i];
+
+        sub.state.store(SLOT_FREE);
+        sub.users.store(0);
+        sub.waiting.store(false);
+        sub.termination.store(0);
+        sub.dropped.store(0);
+
+        sub.handle     = 0;
+        sub.generation = 0;
+        sub.kind       = PULL_POINT;
+        sub.efd        = -1;
+        sub.queue      = nullptr;
+        sub.filter.clear();
+    }
+
+
+    for(int t = 0; t < EVENT_TOPIC_CNT; t++)
+        for(int w = 0; w < SLOT_WORDS; w++)
+            topic_subs[t][w].store(0);
+}
+
+
+
+EventBroker::~EventBroker()
+{
+    for(uint32_t i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        if( slots[i].efd >= 0 )
+            close(slots[i].efd);
+
+        delete slots[i].queue;
+    }
+}
+
+
+
+uint32_t EventBroker::subscribe(time_t termination, Kind kind, const EventFilter *filter)
+{
+    for(uint32_t i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &sub = slots[i];
+        uint32_t state    = SLOT_FREE;
+
+        if( !sub.state.compare_exchange_strong(state, SLOT_INIT) )
+            continue;
+
+
+        // queue and eventfd are created on first use of the slot and then reused
+        if( !sub.queue )
+            sub.queue = new RingBuffer<EventMessage>(QUEUE_SIZE);
+
+        if( sub.efd < 0 )
+            sub.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if( sub.efd < 0 )
+        {
+            sub.state.store(SLOT_FREE);
+            return 0;
+        }
+
+
+        // generation is 24 bits, handle 0 is never used
+        sub.generation = (sub.generation + 1) & 0xFFFFFF;
+        if( !sub.generation )
+            sub.generation = 1;
+
+        sub.handle = (sub.generation << 8) | i;
+        sub.kind   = kind;
+        sub.termination.store(termination);
+        sub.dropped.store(0);
+        sub.waiting.store(false);
+
+        if( filter )
+            sub.filter = *filter;
+        else
+            sub.filter.clear();
+
+        sub.state.store(SLOT_ACTIVE);
+
+        set_topic_bits(i, sub.filter.topics, true);
+
+
+        synchronize(sub.handle);
+
+        return sub.handle;
+    }
+
+
+    return 0;
+}
+
+
+
+bool EventBroker::unsubscribe(uint32_t handle)
+{
+    Subscription *sub = find(handle);
+    if( !sub )
+        return false;
+
+    uint32_t state = SLOT_ACTIVE;
+    if( !sub->state.compare_exchange_strong(state, SLOT_CLOSING) )
+        return false;
+
+    release(*sub);
+
+    return true;
+}
+
+
+
+bool EventBroker::renew(uint32_t handle, time_t termination)
+{
+    Subscription *sub = find(handle);
+    if( !sub )
+        return false;
+
+    sub->termination.store(termination);
+
+    return true;
+}
+
+
+
+bool EventBroker::get_termination(uint32_t handle, time_t *termination) const
+{
+    const Subscription *sub = find(handle);
+    if( !sub )
+        return false;
+
+    if( termination )
+        *termination = sub->termination.load();
+
+    return true;
+}
+
+
+
+bool EventBroker::synchronize(uint32_t handle)
+{
+    Subscription *sub = find(handle);
+    if( !sub )
+        return false;
+
+
+    std::lock_guard<std::mutex> lock(props_mutex);
+
+    for(size_t i = 0; i < props_cnt; i++)
+    {
+        if( !sub->filter.match(props[i]) )
+            continue;
+
+        EventMessage msg = props[i];
+        msg.property_op  = EventMessage::PROP_INITIALIZED;
+
+        enqueue(*sub, msg);
+    }
+
+    return true;
+}
+
+
+
+void EventBroker::publish(const EventMessage &msg)
+{
+    if( msg.property_op != EventMessage::PROP_NONE )
+        update_property(msg);
+
+
+    if( msg.topic >= EVENT_TOPIC_CNT )
+        return;
+
+
+    time_t now = time(NULL);
+
+    for(uint32_t w = 0; w < SLOT_WORDS; w++)
+    {
+        uint64_t bits = topic_subs[msg.topic][w].load(std::memory_order_relaxed);
+
+        while( bits )
+        {
+            uint32_t i = w*64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            Subscription &sub = slots[i];
+
+            sub.users.fetch_add(1);
+
+            // recheck: unsubscribe() waits for users == 0 after leaving SLOT_ACTIVE
+            if( (sub.state.load() == SLOT_ACTIVE) && (sub.termination.load() >= now) &&
+                sub.filter.match(msg) )
+                enqueue(sub, msg);
+
+            sub.users.fetch_sub(1);
+        }
+    }
+}
+
+
+
+int EventBroker::pull(uint32_t handle, EventMessage *msgs, int max_cnt, int timeout_ms,
+                      const int *wake_fds, size_t wake_cnt)
+{
+    Subscription *sub = find(handle);
+    if( !sub || (sub->kind != PULL_POINT) )
+        return -1;
+
+
+    if( wake_cnt > MAX_WAKE_FDS )
+        wake_cnt = MAX_WAKE_FDS;
+
+
+    struct pollfd fds[1 + MAX_WAKE_FDS];
+
+    fds[0].fd     = sub->efd;
+    fds[0].events = POLLIN;
+
+    for(size_t i = 0; i < wake_cnt; i++)
+    {
+        fds[1 + i].fd     = wake_fds[i];   // poll ignores negative fd
+        fds[1 + i].events = POLLIN;
+    }
+
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+
+    for(;;)
+    {
+        int cnt = drain(*sub, msgs, max_cnt);
+        if( cnt > 0 )
+            return cnt;
+
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int elapsed = (now.tv_sec - start.tv_sec)*1000 + (now.tv_nsec - start.tv_nsec)/1000000;
+        if( elapsed >= timeout_ms )
+            return 0;
+
+
+        // Announce that we are going to sleep and check the queue again,
+        // the publisher pushes first and then checks the flag (see enqueue)
+        sub->waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if( !sub->queue->empty() )
+        {
+            sub->waiting.store(false);
+            continue;
+        }
+
+
+        for(size_t i = 0; i <= wake_cnt; i++)
+            fds[i].revents = 0;
+
+        int ret = poll(fds, 1 + wake_cnt, timeout_ms - elapsed);
+
+        sub->waiting.store(false);
+
+        if( (ret < 0) && (errno != EINTR) )
+            return 0;
+
+
+        if( fds[0].revents & POLLIN )
+        {
+            eventfd_t val;
+            eventfd_read(sub->efd, &val);
+        }
+
+
+        for(size_t i = 1; i <= wake_cnt; i++)
+        {
+            if( fds[i].revents & POLLIN )
+                return drain(*sub, msgs, max_cnt);
+        }
+    }
+}
+
+
+
+int EventBroker::take(uint32_t handle, EventMessage *msgs, int max_cnt)
+{
+    Subscription &sub = slots[handle & 0xFF];
+
+    // hold the slot, so it can not be released (and reused) while we read the queue
+    sub.users.fetch_add(1);
+
+    int cnt = -1;
+
+    if( (sub.state.load() == SLOT_ACTIVE) && (sub.handle == handle) && handle )
+        cnt = drain(sub, msgs, max_cnt);
+
+    sub.users.fetch_sub(1);
+
+    return cnt;
+}
+
+
+
+int EventBroker::get_wait_fd(uint32_t handle) const
+{
+    const Subscription *sub = find(handle);
+
+    return sub ? sub->efd : -1;
+}
+
+
+
+bool EventBroker::prepare_wait(uint32_t handle)
+{
+    Subscription *sub = find(handle);
+    if( !sub )
+        return false;
+
+    // see pull()
+    sub->waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if( !sub->queue->empty() )
+    {
+        sub->waiting.store(false);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+void EventBroker::expire(time_t now)
+{
+    for(uint32_t i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &sub = slots[i];
+
+        if( (sub.state.load() != SLOT_ACTIVE) || (sub.termination.load() >= now) )
+            continue;
+
+        uint32_t state = SLOT_ACTIVE;
+        if( sub.state.compare_exchange_strong(state, SLOT_CLOSING) )
+        {
+            LOG_D(LOG_MOD_EVENT, "Event: subscription %u expired", sub.handle);
+            release(sub);
+        }
+    }
+}
+
+
+
+size_t EventBroker::active_count() const
+{
+    size_t cnt = 0;
+
+    for(uint32_t i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        if( slots[i].state.load(std::memory_order_relaxed) == SLOT_ACTIVE )
+            cnt++;
+    }
+
+    return cnt;
+}
+
+
+
+size_t EventBroker::get_handles(uint32_t *handles, size_t max_cnt) const
+{
+    size_t cnt = 0;
+
+    for(uint32_t i = 0; (i < MAX_SUBSCRIPTIONS) && (cnt < max_cnt); i++)
+    {
+        const Subscription &sub = slots[i];
+
+        if( sub.state.load() == SLOT_ACTIVE )
+            handles[cnt++] = sub.handle;
+    }
+
+    return cnt;
+}
+
+
+
+uint64_t EventBroker::get_dropped(uint32_t handle) const
+{
+    const Subscription *sub = find(handle);
+
+    return sub ? sub->dropped.load() : 0;
+}
+
+
+
+EventBroker::Subscription* EventBroker::find(uint32_t handle)
+{
+    return const_cast<Subscription*>( static_cast<const EventBroker*>(this)->find(handle) );
+}
+
+
+
+const EventBroker::Subscription* EventBroker::find(uint32_t handle) const
+{
+    if( !handle )
+        return nullptr;
+
+    const Subscription &sub = slots[handle & 0xFF];
+
+    if( (sub.state.load() != SLOT_ACTIVE) || (sub.handle != handle) )
+        return nullptr;
+
+    return &sub;
+}
+
+
+
+void EventBroker::enqueue(Subscription &sub, const EventMessage &msg)
+{
+    // High-water mark: drop the oldest messages, the new one is the current state
+    EventMessage old;
+    uint64_t     dropped = 0;
+
+    while( (sub.queue->size() >= QUEUE_HIGH_WATER) && sub.queue->pop(old) )
+        dropped++;
+
+
+    // the headroom is full too (other publishers)
+    bool queued = sub.queue->push(msg);
+    if( !queued )
+        dropped++;
+
+    if( dropped )
+    {
+        sub.dropped.fetch_add(dropped, std::memory_order_relaxed);
+        dropped_total.fetch_add(dropped, std::memory_order_relaxed);
+    }
+
+    if( !queued )
+        return;
+
+
+    // pairs with the fence in pull(): either the consumer sees
+    // the new message or we see its waiting flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if( sub.waiting.load(std::memory_order_relaxed) && sub.waiting.exchange(false) )
+        eventfd_write(sub.efd, 1);
+}
+
+
+
+int EventBroker::drain(Subscription &sub, EventMessage *msgs, int max_cnt)
+{
+    int cnt = 0;
+
+    while( (cnt < max_cnt) && sub.queue->pop(msgs[cnt]) )
+        cnt++;
+
+    return cnt;
+}
+
+
+
+void EventBroker::release(Subscription &sub)
+{
+    set_topic_bits(&sub - slots, sub.filter.topics, false);
+
+    // wait for publishers which are inside the queue right now
+    while( sub.users.load() )
+        sched_yield();
+
+
+    sub.queue->clear();
+
+    eventfd_t val;
+    eventfd_read(sub.efd, &val); // reset counter (efd is non-blocking)
+
+    sub.handle = 0;
+    sub.state.store(SLOT_FREE);
+}
+
+
+
+void EventBroker::set_topic_bits(uint32_t slot, uint64_t topics, bool set)
+{
+    uint64_t bit = 1ull << (slot % 64);
+
+    for(int t = 0; t < EVENT_TOPIC_CNT; t++)
+    {
+        if( !(topics & (1ull << t)) )
+            continue;
+
+        if( set )
+            topic_subs[t][slot / 64].fetch_or(bit);
+        else
+            topic_subs[t][slot / 64].fetch_and(~bit);
+    }
+}
+
+
+
+void EventBroker::update_property(const EventMessage &msg)
+{
+    std::lock_guard<std::mutex> lock(props_mutex);
+
+    for(size_t i = 0; i < props_cnt; i++)
+    {
+        if( !props[i].same_source(msg) )
+            continue;
+
+        if( msg.property_op == EventMessage::PROP_DELETED )
+            props[i] = props[--props_cnt];
+        else
+            props[i] = msg;
+
+        return;
+    }
+
+
+    if( (msg.property_op != EventMessage::PROP_DELETED) && (props_cnt < MAX_PROPERTIES) )
+        props[props_cnt++] = msg;
+}
@@ -0,0 +1,270 @@
+#ifndef EVENT_BROKER_H
+#define EVENT_BROKER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+
+#include "ring_buffer.h"
+#include "event_filter.h"
+
+
+
+
+
+// ONVIF topic namespace (prefix of topics in event_topics)
+#define EVENT_TOPIC_PREFIX     "tns1"
+#define EVENT_TOPIC_NAMESPACE  "http://www.onvif.org/ver10/topics"
+
+
+#define EVENT_MAX_ITEMS        4   // Source + Data items in one message
+#define EVENT_ITEM_NAME_LEN   32
+#define EVENT_ITEM_VALUE_LEN  64
+
+
+
+// Topics of the device (index in event_topics[])
+enum EventTopicId : uint16_t
+{
+    EVENT_TOPIC_MOTION_ALARM,   // tns1:VideoSource/MotionAlarm
+    EVENT_TOPIC_CELL_MOTION,    // tns1:RuleEngine/CellMotionDetector/Motion
+    EVENT_TOPIC_TAMPER,         // tns1:VideoSource/GlobalSceneChange/ImagingService
+    EVENT_TOPIC_DIGITAL_INPUT,  // tns1:Device/Trigger/DigitalInput
+    EVENT_TOPIC_RELAY,          // tns1:Device/Trigger/Relay
+
+    EVENT_TOPIC_CNT             //Its not topic! Its counter for use in code (max index)
+};
+
+
+
+struct EventItemDescr
+{
+    const char *name;
+    const char *type;   // QName of the XML schema type, e.g. "xs:boolean"
+};
+
+
+
+// Description of topic for GetEventProperties (tt:MessageDescription)
+struct EventTopic
+{
+    const char     *path;   // ConcreteSet expression, e.g. "tns1:VideoSource/MotionAlarm"
+    bool            is_property;
+    EventItemDescr  source[EVENT_MAX_ITEMS]; // ends with {nullptr, nullptr}
+    EventItemDescr  data  [EVENT_MAX_ITEMS]; // ends with {nullptr, nullptr}
+};
+
+
+extern const EventTopic event_topics[EVENT_TOPIC_CNT];
+
+
+
+struct EventItem
+{
+    char name [EVENT_ITEM_NAME_LEN];
+    char value[EVENT_ITEM_VALUE_LEN];
+};
+
+
+
+/*
+ * One notification (tt:Message) in a flat form.
+ * It is copied by value into the queues of subscribers,
+ * so it has no pointers and a fixed size.
+ * items[0 .. source_cnt) are Source items, items[source_cnt .. item_cnt) are Data items.
+ */
+struct EventMessage
+{
+    enum PropertyOperation : uint8_t
+    {
+        PROP_NONE,         // not a property event
+        PROP_INITIALIZED,
+        PROP_CHANGED,
+        PROP_DELETED
+    };
+
+    time_t    utc_time;
+    uint16_t  topic;
+    uint8_t   property_op;
+    uint8_t   source_cnt;
+    uint8_t   item_cnt;
+    EventItem items[EVENT_MAX_ITEMS];
+
+
+    void clear(uint16_t new_topic, time_t time = 0);
+
+    bool add_source(const char *name, const char *value);
+    bool add_data  (const char *name, const char *value);
+
+    // is it the same property instance (topic + Source items)
+    bool same_source(const EventMessage &other) const;
+};
+
+
+
+
+
+/*
+ * Pull point subscriptions.
+ *
+ * Every subscription is a slot in a fixed table with its own bounded
+ * lock-free queue, so publishers never block and never allocate.
+ * When a queue fills up to QUEUE_HIGH_WATER, the oldest messages are dropped
+ * (and counted) to make room for the new one: all topics of the device are
+ * properties (ONVIF IsProperty), so a slow client loses old changes but gets
+ * the current state. The headroom above the mark is for publishers which
+ * race for the last cells; if it is full too, the new message is dropped.
+ *
+ * A consumer that waits for messages sleeps in poll() on the eventfd of its
+ * subscription, publishers signal the eventfd only if somebody is waiting.
+ *
+ * Every subscription has a precompiled EventFilter. Besides, the table is
+ * indexed by topic: a bitset of subscribed slots per topic, so publish()
+ * visits only the slots interested in the topic of the message
+ * (64 slots per word) and evaluates only their MessageContent filters.
+ *
+ * PullPoint subscriptions are read by pull() (PullMessages).
+ * Push (Notify) subscriptions are read by the delivery thread with
+ * take() and it waits on many subscriptions at once with
+ * prepare_wait()/get_wait_fd().
+ */
+class EventBroker
+{
+    public:
+
+        enum
+        {
+            MAX_SUBSCRIPTIONS = 256,
+            QUEUE_SIZE        = 64,  // must be a power of two
+            QUEUE_HIGH_WATER  = 48,  // drop the oldest messages from here
+            MAX_PROPERTIES    = 64,  // cached property states for Initialized events
+            MAX_WAKE_FDS      = 8    // see pull()
+        };
+
+
+        enum Kind : uint8_t
+        {
+            PULL_POINT,
+            PUSH
+        };
+
+
+        EventBroker();
+       ~EventBroker();
+
+        EventBroker(const EventBroker&) = delete;
+        EventBroker& operator=(const EventBroker&) = delete;
+
+
+        // returns handle of subscription or 0 if there are no free slots
+        // filter == nullptr - all messages
+        uint32_t subscribe(time_t termination, Kind kind = PULL_POINT, const EventFilter *filter = nullptr);
+        bool     unsubscribe(uint32_t handle);
+
+        bool     renew(uint32_t handle, time_t termination);
+        bool     get_termination(uint32_t handle, time_t *termination) const;
+
+
+        // queue current state of all properties (as Initialized) to subscriber
+        bool     synchronize(uint32_t handle);
+
+        // can be called from any thread
+        void     publish(const EventMessage &msg);
+
+
+        /*
+         * Take up to max_cnt messages from the queue of subscriber.
+         * If the queue is empty, waits for messages up to timeout_ms.
+         * The wait is interrupted (with 0 messages) when one of wake_fds
+         * (up to MAX_WAKE_FDS) becomes readable, so the caller can serve other clients.
+         * Returns: count of messages or -1 if handle is unknown.
+         */
+        int      pull(uint32_t handle, EventMessage *msgs, int max_cnt, int timeout_ms,
+                      const int *wake_fds = nullptr, size_t wake_cnt = 0);
+
+
+        // Take up to max_cnt messages without waiting (any kind of subscription).
+        // Returns: count of messages or -1 if handle is unknown.
+        int      take(uint32_t handle, EventMessage *msgs, int max_cnt);
+
+        // eventfd of subscription (-1 if handle is unknown)
+        int      get_wait_fd(uint32_t handle) const;
+
+        // Ask publishers to signal the eventfd on the next message.
+        // Returns false if there are messages already (don't sleep) or handle is unknown.
+        bool     prepare_wait(uint32_t handle);
+
+
+        // remove subscriptions with termination time before now
+        void     expire(time_t now);
+
+        size_t   active_count() const;
+
+        // handles of active subscriptions (up to max_cnt), returns count of them
+        size_t   get_handles(uint32_t *handles, size_t max_cnt) const;
+
+        // dropped messages of the subscription / of all subscriptions (ever)
+        uint64_t get_dropped(uint32_t handle) const;
+        uint64_t get_dropped_total() const { return dropped_total.load(std::memory_order_relaxed); }
+
+
+    private:
+
+        enum SlotState : uint32_t
+        {
+            SLOT_FREE,
+            SLOT_INIT,     // is being set up by subscribe()
+            SLOT_ACTIVE,
+            SLOT_CLOSING   // is being released by unsubscribe()
+        };
+
+
+        struct Subscription
+        {
+            std::atomic<uint32_t> state;
+            std::atomic<uint32_t> users;       // threads inside the queue (publishers, take)
+            std::atomic<bool>     waiting;     // consumer sleeps on efd
+            std::atomic<time_t>   termination;
+            std::atomic<uint64_t> dropped;
+
+            uint32_t              handle;
+            uint32_t              generation;
+            Kind                  kind;
+            int                   efd;
+            RingBuffer<EventMessage> *queue;
+            EventFilter           filter;
+        };
+
+
+        Subscription  slots[MAX_SUBSCRIPTIONS];
+
+        // bit per slot which is subscribed to the topic
+        enum { SLOT_WORDS = MAX_SUBSCRIPTIONS / 64 };
+        std::atomic<uint64_t> topic_subs[EVENT_TOPIC_CNT][SLOT_WORDS];
+
+
+        std::mutex    props_mutex;
+        EventMessage  props[MAX_PROPERTIES];
+        size_t        props_cnt;
+
+        std::atomic<uint64_t> dropped_total;
+
+
+        Subscription*       find(uint32_t handle);
+        const Subscription* find(uint32_t handle) const;
+
+        void enqueue(Subscription &sub, const EventMessage &msg);
+        int  drain  (Subscription &sub, EventMessage *msgs, int max_cnt);
+        void release(Subscription &sub);
+
+        void set_topic_bits(uint32_t slot, uint64_t topics, bool set);
+
+        void update_property(const EventMessage &msg);
+};
+
+
+
+
+
+#endif // EVENT_BROKER_H
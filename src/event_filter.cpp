@@ -0,0 +1,603 @@
+#include <string.h>
+#include <ctype.h>
+
+#include "event_filter.h"
+#include "event_broker.h"
+
+
+
+
+
+static_assert(EVENT_TOPIC_CNT <= 64, "topic bitset of EventFilter is uint64_t");
+static_assert(EVENT_FILTER_NAME_LEN  == EVENT_ITEM_NAME_LEN,  "see EventFilterNode");
+static_assert(EVENT_FILTER_VALUE_LEN == EVENT_ITEM_VALUE_LEN, "see EventFilterNode");
+
+
+
+void EventFilter::clear()
+{
+    topics   = (EVENT_TOPIC_CNT == 64) ? ~0ull : ((1ull << EVENT_TOPIC_CNT) - 1);
+    node_cnt = 0;
+}
+
+
+
+bool EventFilter::match(const EventMessage &msg) const
+{
+    return match_topic(msg.topic) && match_content(msg);
+}
+
+
+
+bool EventFilter::match_content(const EventMessage &msg) const
+{
+    if( !node_cnt )
+        return true;
+
+
+    bool stack[EVENT_FILTER_MAX_NODES];
+    int  sp = 0;
+
+    for(int n = 0; n < node_cnt; n++)
+    {
+        const EventFilterNode &node = nodes[n];
+
+        switch(node.op)
+        {
+            case EventFilterNode::ITEM:
+            {
+                int first = (node.scope == EventFilterNode::DATA)   ? msg.source_cnt : 0;
+                int last  = (node.scope == EventFilterNode::SOURCE) ? msg.source_cnt : msg.item_cnt;
+                bool res  = false;
+
+                for(int i = first; (i < last) && !res; i++)
+                {
+                    res = ( !node.name[0]   || !strcmp(node.name,  msg.items[i].name)  ) &&
+                          ( !node.has_value || !strcmp(node.value, msg.items[i].value) );
+                }
+
+                stack[sp++] = res;
+                break;
+            }
+
+            case EventFilterNode::AND:
+                sp--;
+                stack[sp-1] = stack[sp-1] && stack[sp];
+                break;
+
+            case EventFilterNode::OR:
+                sp--;
+                stack[sp-1] = stack[sp-1] || stack[sp];
+                break;
+
+            case EventFilterNode::NOT:
+                stack[sp-1] = !stack[sp-1];
+                break;
+        }
+    }
+
+
+    return stack[0];
+}
+
+
+
+
+
+// length of name token (letters, digits, '_', '-', '.', ':')
+static size_t name_len(const char *str)
+{
+    size_t len = 0;
+
+    while( isalnum((unsigned char)str[len]) || strchr("_-.:", str[len]) )
+    {
+        if( !str[len] )
+            break;
+
+        len++;
+    }
+
+    return len;
+}
+
+
+
+// skip namespace prefix of QName: "tns1:VideoSource" -> "VideoSource"
+static const char* local_name(const char *name, size_t *len)
+{
+    const char *colon = (const char*)memchr(name, ':', *len);
+    if( !colon )
+        return name;
+
+    *len -= colon + 1 - name;
+
+    return colon + 1;
+}
+
+
+
+
+
+EventFilterCompiler::EventFilterCompiler():
+    pos(nullptr)
+{
+    nodes.push_back({"", -1, 0, 0});
+
+
+    // intern topic tree
+    for(int t = 0; t < EVENT_TOPIC_CNT; t++)
+    {
+        const char *path = event_topics[t].path;
+        int         node = 0;
+
+        while( *path )
+        {
+            size_t      len  = strcspn(path, "/");
+            size_t      llen = len;
+            const char *name = local_name(path, &llen);
+
+            int child = find_child(node, name, llen);
+            if( child < 0 )
+            {
+                nodes.push_back({std::string(name, llen), node, 0, 0});
+                child = nodes.size() - 1;
+            }
+
+            node  = child;
+            path += len;
+
+            if( *path == '/' )
+                path++;
+        }
+
+
+        nodes[node].topic = 1ull << t;
+
+        for( ; node >= 0; node = nodes[node].parent)
+            nodes[node].subtree |= 1ull << t;
+    }
+}
+
+
+
+bool EventFilterCompiler::add_topic_expression(EventFilter &filter, const char *dialect, const char *expr)
+{
+    bool concrete_set;
+
+    if( !dialect || !strcmp(dialect, TOPIC_DIALECT_CONCRETE_SET) )
+        concrete_set = true;
+    else if( !strcmp(dialect, TOPIC_DIALECT_CONCRETE) || !strcmp(dialect, TOPIC_DIALECT_SIMPLE) )
+        concrete_set = false;
+    else
+    {
+        str_err = std::string("unsupported topic expression dialect: ") + dialect;
+        return false;
+    }
+
+
+    if( !expr )
+    {
+        str_err = "empty topic expression";
+        return false;
+    }
+
+
+    uint64_t topics = 0;
+
+    for(;;)
+    {
+        size_t len = concrete_set ? strcspn(expr, "|") : strlen(expr);
+
+        if( !resolve_path(expr, len, concrete_set, &topics) )
+            return false;
+
+        expr += len;
+        if( *expr != '|' )
+            break;
+
+        expr++;
+    }
+
+
+    if( !topics )
+    {
+        str_err = "topic expression does not match any topic";
+        return false;
+    }
+
+
+    filter.topics &= topics;
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::add_message_content(EventFilter &filter, const char *dialect, const char *expr)
+{
+    if( dialect && strcmp(dialect, CONTENT_DIALECT_ITEM_FILTER) )
+    {
+        str_err = std::string("unsupported message content dialect: ") + dialect;
+        return false;
+    }
+
+
+    if( !expr )
+    {
+        str_err = "empty message content expression";
+        return false;
+    }
+
+
+    uint8_t old_cnt = filter.node_cnt;
+    pos = expr;
+
+    bool ok;
+
+    if( accept("boolean(") )
+        ok = parse_or(filter) && accept(")");
+    else
+        ok = parse_or(filter);
+
+    skip_ws();
+
+    if( ok && *pos )
+    {
+        str_err = std::string("unexpected text in message content expression: ") + pos;
+        ok = false;
+    }
+
+
+    // several expressions must all match
+    if( ok && old_cnt )
+    {
+        EventFilterNode node;
+        memset(&node, 0, sizeof(node));
+        node.op = EventFilterNode::AND;
+
+        ok = emit(filter, node);
+    }
+
+
+    if( !ok )
+        filter.node_cnt = old_cnt;
+
+    return ok;
+}
+
+
+
+int EventFilterCompiler::find_child(int parent, const char *name, size_t len) const
+{
+    for(size_t i = 1; i < nodes.size(); i++)
+    {
+        if( (nodes[i].parent == parent) && (nodes[i].name.size() == len) &&
+            !nodes[i].name.compare(0, len, name, len) )
+            return i;
+    }
+
+    return -1;
+}
+
+
+
+bool EventFilterCompiler::resolve_path(const char *path, size_t len, bool allow_wildcards, uint64_t *topics)
+{
+    // trim
+    while( len && isspace((unsigned char)*path) ) { path++; len--; }
+    while( len && isspace((unsigned char)path[len-1]) ) len--;
+
+
+    bool subtree = false;
+
+    if( (len > 3) && !strncmp(path + len - 3, "//.", 3) )
+    {
+        if( !allow_wildcards )
+        {
+            str_err = "'//.' is not allowed in Concrete topic expression";
+            return false;
+        }
+
+        subtree = true;
+        len    -= 3;
+    }
+
+
+    if( !len )
+    {
+        str_err = "empty topic expression";
+        return false;
+    }
+
+
+    // set of nodes matched by the path so far ('*' can match many)
+    std::vector<int> cur(1, 0), next;
+
+    while( len )
+    {
+        size_t seg_len = 0;
+        while( (seg_len < len) && (path[seg_len] != '/') )
+            seg_len++;
+
+        size_t      llen = seg_len;
+        const char *name = local_name(path, &llen);
+        bool        any  = (llen == 1) && (*name == '*');
+
+        if( any && !allow_wildcards )
+        {
+            str_err = "'*' is not allowed in Concrete topic expression";
+            return false;
+        }
+
+
+        next.clear();
+
+        for(int parent : cur)
+        {
+            for(size_t i = 1; i < nodes.size(); i++)
+            {
+                if( nodes[i].parent != parent )
+                    continue;
+
+                if( any || ((nodes[i].name.size() == llen) && !nodes[i].name.compare(0, llen, name, llen)) )
+                    next.push_back(i);
+            }
+        }
+
+        cur.swap(next);
+
+
+        path += seg_len;
+        len  -= seg_len;
+
+        if( len )   // skip '/'
+        {
+            path++;
+            len--;
+        }
+    }
+
+
+    for(int node : cur)
+        *topics |= subtree ? nodes[node].subtree : nodes[node].topic;
+
+    return true;
+}
+
+
+
+
+
+bool EventFilterCompiler::parse_or(EventFilter &filter)
+{
+    if( !parse_and(filter) )
+        return false;
+
+    while( accept("or") )
+    {
+        EventFilterNode node;
+        memset(&node, 0, sizeof(node));
+        node.op = EventFilterNode::OR;
+
+        if( !parse_and(filter) || !emit(filter, node) )
+            return false;
+    }
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::parse_and(EventFilter &filter)
+{
+    if( !parse_unary(filter) )
+        return false;
+
+    while( accept("and") )
+    {
+        EventFilterNode node;
+        memset(&node, 0, sizeof(node));
+        node.op = EventFilterNode::AND;
+
+        if( !parse_unary(filter) || !emit(filter, node) )
+            return false;
+    }
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::parse_unary(EventFilter &filter)
+{
+    if( accept("not(") )
+    {
+        EventFilterNode node;
+        memset(&node, 0, sizeof(node));
+        node.op = EventFilterNode::NOT;
+
+        if( !parse_or(filter) || !accept(")") )
+        {
+            str_err = "bad not() in message content expression";
+            return false;
+        }
+
+        return emit(filter, node);
+    }
+
+
+    if( accept("boolean(") || accept("(") )
+    {
+        if( !parse_or(filter) || !accept(")") )
+        {
+            str_err = "unbalanced parentheses in message content expression";
+            return false;
+        }
+
+        return true;
+    }
+
+
+    return parse_item(filter);
+}
+
+
+
+bool EventFilterCompiler::parse_item(EventFilter &filter)
+{
+    EventFilterNode node;
+    memset(&node, 0, sizeof(node));
+    node.op    = EventFilterNode::ITEM;
+    node.scope = EventFilterNode::ANY;
+
+
+    if( !accept("//") )
+    {
+        str_err = std::string("expected //tt:SimpleItem in message content expression: ") + pos;
+        return false;
+    }
+
+
+    size_t      len  = name_len(pos);
+    size_t      llen = len;
+    const char *name = local_name(pos, &llen);
+
+
+    if( ((llen == 6) && !strncmp(name, "Source", 6)) ||
+        ((llen == 4) && !strncmp(name, "Data",   4)) )
+    {
+        node.scope = (*name == 'S') ? EventFilterNode::SOURCE : EventFilterNode::DATA;
+        pos += len;
+
+        if( *pos++ != '/' )
+        {
+            str_err = "expected tt:SimpleItem after tt:Source or tt:Data";
+            return false;
+        }
+
+        len  = name_len(pos);
+        llen = len;
+        name = local_name(pos, &llen);
+    }
+
+
+    if( (llen != 10) || strncmp(name, "SimpleItem", 10) )
+    {
+        str_err = std::string("expected tt:SimpleItem in message content expression: ") + pos;
+        return false;
+    }
+
+    pos += len;
+
+
+    if( !accept("[") || !parse_pred(node) || !accept("]") )
+    {
+        if( str_err.empty() )
+            str_err = "bad predicate of tt:SimpleItem in message content expression";
+
+        return false;
+    }
+
+
+    return emit(filter, node);
+}
+
+
+
+// [@Name="name" and @Value="value"] (without brackets), any order, any of them
+bool EventFilterCompiler::parse_pred(EventFilterNode &node)
+{
+    do
+    {
+        if( accept("@Name") )
+        {
+            if( !accept("=") || !parse_str(node.name, sizeof(node.name)) )
+                return false;
+        }
+        else if( accept("@Value") )
+        {
+            if( !accept("=") || !parse_str(node.value, sizeof(node.value)) )
+                return false;
+
+            node.has_value = true;
+        }
+        else
+        {
+            return false;
+        }
+
+    } while( accept("and") );
+
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::parse_str(char *buf, size_t size)
+{
+    skip_ws();
+
+    char quote = *pos;
+    if( (quote != '"') && (quote != '\'') )
+        return false;
+
+    const char *end = strchr(pos + 1, quote);
+    if( !end )
+        return false;
+
+    size_t len = end - pos - 1;
+    if( len >= size )
+    {
+        str_err = "too long value in message content expression";
+        return false;
+    }
+
+    memcpy(buf, pos + 1, len);
+    buf[len] = '\0';
+    pos      = end + 1;
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::emit(EventFilter &filter, const EventFilterNode &node)
+{
+    if( filter.node_cnt >= EVENT_FILTER_MAX_NODES )
+    {
+        str_err = "message content expression is too complex";
+        return false;
+    }
+
+    filter.nodes[filter.node_cnt++] = node;
+
+    return true;
+}
+
+
+
+bool EventFilterCompiler::accept(const char *token)
+{
+    skip_ws();
+
+    size_t len = strlen(token);
+    if( strncmp(pos, token, len) )
+        return false;
+
+    // words (and, or, @Name) must not be a prefix of a longer name
+    if( isalpha((unsigned char)token[len-1]) && (isalnum((unsigned char)pos[len]) || pos[len] == '_') )
+        return false;
+
+    pos += len;
+
+    return true;
+}
+
+
+
+void EventFilterCompiler::skip_ws()
+{
+    while( isspace((unsigned char)*pos) )
+        pos++;
+}
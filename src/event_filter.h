@@ -0,0 +1,151 @@
+#ifndef EVENT_FILTER_H
+#define EVENT_FILTER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+
+struct EventMessage;
+
+
+
+
+
+#define EVENT_FILTER_MAX_NODES  16
+#define EVENT_FILTER_NAME_LEN   32  // == EVENT_ITEM_NAME_LEN
+#define EVENT_FILTER_VALUE_LEN  64  // == EVENT_ITEM_VALUE_LEN
+
+
+
+// Topic expression dialects
+#define TOPIC_DIALECT_CONCRETE_SET  "http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet"
+#define TOPIC_DIALECT_CONCRETE      "http://docs.oasis-open.org/wsn/t-1/TopicExpression/Concrete"
+#define TOPIC_DIALECT_SIMPLE        "http://docs.oasis-open.org/wsn/t-1/TopicExpression/Simple"
+
+// Message content dialect
+#define CONTENT_DIALECT_ITEM_FILTER "http://www.onvif.org/ver10/tev/messageContentFilter/ItemFilter"
+
+
+
+// One step of compiled MessageContent expression (postfix form)
+struct EventFilterNode
+{
+    enum Op : uint8_t
+    {
+        ITEM,   // push: is there a SimpleItem with name (and value)
+        AND,    // pop 2, push a && b
+        OR,     // pop 2, push a || b
+        NOT     // pop 1, push !a
+    };
+
+    enum Scope : uint8_t
+    {
+        ANY,    // //tt:SimpleItem
+        SOURCE, // //tt:Source/tt:SimpleItem
+        DATA    // //tt:Data/tt:SimpleItem
+    };
+
+    uint8_t op;
+    uint8_t scope;
+    bool    has_value;
+    char    name [EVENT_FILTER_NAME_LEN];
+    char    value[EVENT_FILTER_VALUE_LEN];
+};
+
+
+
+/*
+ * Compiled filter of subscription.
+ * Topic expressions are resolved to a bitset of topics (bit per EventTopicId),
+ * so the check of topic is one AND. MessageContent expressions are compiled
+ * into a small postfix program over Source/Data items of message.
+ */
+struct EventFilter
+{
+    uint64_t        topics;     // bit per EventTopicId
+    uint8_t         node_cnt;   // 0 - no MessageContent filter
+    EventFilterNode nodes[EVENT_FILTER_MAX_NODES];
+
+
+    void clear();
+
+    bool match_topic  (uint16_t topic) const { return topics & (1ull << topic); }
+    bool match_content(const EventMessage &msg) const;
+    bool match        (const EventMessage &msg) const;
+};
+
+
+
+// Compiler of filters.
+// The topic tree is built (interned) once from event_topics, topic expressions
+// are resolved against it at subscribe time and never evaluated per event.
+//
+// Supported topic expressions (ConcreteSet, Concrete and Simple dialects):
+//   tns1:VideoSource/MotionAlarm                   - one topic
+//   tns1:RuleEngine//.                             - topic and all its descendants
+//   tns1:Device/Trigger/*                          - any child (ConcreteSet only)
+//   tns1:VideoSource/MotionAlarm|tns1:Device//.    - union (ConcreteSet only)
+// The namespace prefix of topics is not checked (clients use own prefixes).
+//
+// Supported MessageContent expressions (ItemFilter dialect):
+//   boolean(//tt:SimpleItem[@Name="Rule" and @Value="MyRule"])
+//   //tt:Source/tt:SimpleItem[@Name="InputToken"] and not(//tt:Data/tt:SimpleItem[@Value="false"])
+// with and, or, not() and parentheses.
+//
+// Several expressions in one filter are combined with AND.
+class EventFilterCompiler
+{
+    public:
+
+        EventFilterCompiler();
+
+
+        bool add_topic_expression(EventFilter &filter, const char *dialect, const char *expr);
+        bool add_message_content (EventFilter &filter, const char *dialect, const char *expr);
+
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        struct TopicNode
+        {
+            std::string  name;       // local name (without prefix)
+            int          parent;
+            uint64_t     topic;      // bit of topic if the node is a topic (leaf), else 0
+            uint64_t     subtree;    // bits of all topics in subtree
+        };
+
+        std::vector<TopicNode> nodes;   // nodes[0] - root (not a topic)
+
+        std::string  str_err;
+
+
+        int  find_child(int parent, const char *name, size_t len) const;
+        bool resolve_path(const char *path, size_t len, bool allow_wildcards, uint64_t *topics);
+
+
+        // parser of MessageContent expressions
+        const char *pos;
+
+        bool parse_or   (EventFilter &filter);
+        bool parse_and  (EventFilter &filter);
+        bool parse_unary(EventFilter &filter);
+        bool parse_item (EventFilter &filter);
+        bool parse_pred (EventFilterNode &node);
+        bool parse_str  (char *buf, size_t size);
+
+        bool emit(EventFilter &filter, const EventFilterNode &node);
+        bool accept(const char *token);
+        void skip_ws();
+};
+
+
+
+
+
+#endif // EVENT_FILTER_H
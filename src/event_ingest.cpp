@@ -0,0 +1,330 @@
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+
+#include "event_ingest.h"
+#include "smacros.h"
+
+
+
+
+
+size_t event_record_encode(const EventMessage &msg, void *buf, size_t size)
+{
+    if( size < sizeof(EventRecordHeader) )
+        return 0;
+
+
+    EventRecordHeader hdr;
+
+    hdr.magic       = EVENT_RECORD_MAGIC;
+    hdr.version     = EVENT_RECORD_VERSION;
+    hdr.topic       = msg.topic;
+    hdr.property_op = msg.property_op;
+    hdr.source_cnt  = msg.source_cnt;
+    hdr.item_cnt    = msg.item_cnt;
+    hdr.reserved    = 0;
+    hdr.utc_time    = msg.utc_time;
+
+    uint8_t *ptr = (uint8_t *)buf;
+    uint8_t *end = ptr + size;
+
+    memcpy(ptr, &hdr, sizeof(hdr));
+    ptr += sizeof(hdr);
+
+
+    for(int i = 0; i < msg.item_cnt; i++)
+    {
+        size_t name_len  = strlen(msg.items[i].name);
+        size_t value_len = strlen(msg.items[i].value);
+
+        if( (size_t)(end - ptr) < 2 + name_len + value_len )
+            return 0;
+
+        *ptr++ = name_len;
+        *ptr++ = value_len;
+
+        memcpy(ptr, msg.items[i].name, name_len);
+        ptr += name_len;
+
+        memcpy(ptr, msg.items[i].value, value_len);
+        ptr += value_len;
+    }
+
+
+    return ptr - (uint8_t *)buf;
+}
+
+
+
+bool event_record_decode(const void *buf, size_t size, EventMessage &msg)
+{
+    EventRecordHeader hdr;
+
+    if( size < sizeof(hdr) )
+        return false;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+
+    if( (hdr.magic      != EVENT_RECORD_MAGIC)   ||
+        (hdr.version    != EVENT_RECORD_VERSION) ||
+        (hdr.topic      >= EVENT_TOPIC_CNT)      ||
+        (hdr.property_op > EventMessage::PROP_DELETED) ||
+        (hdr.item_cnt   >  EVENT_MAX_ITEMS)      ||
+        (hdr.source_cnt >  hdr.item_cnt) )
+        return false;
+
+
+    msg.clear(hdr.topic, hdr.utc_time);
+
+    if( hdr.property_op != EventMessage::PROP_NONE )
+        msg.property_op = hdr.property_op;
+
+
+    const uint8_t *ptr = (const uint8_t *)buf + sizeof(hdr);
+    const uint8_t *end = (const uint8_t *)buf + size;
+
+    for(int i = 0; i < hdr.item_cnt; i++)
+    {
+        if( end - ptr < 2 )
+            return false;
+
+        size_t name_len  = *ptr++;
+        size_t value_len = *ptr++;
+
+        if( (name_len  >= EVENT_ITEM_NAME_LEN)  ||
+            (value_len >= EVENT_ITEM_VALUE_LEN) ||
+            ((size_t)(end - ptr) < name_len + value_len) )
+            return false;
+
+        // msg is zeroed by clear(), so the strings are terminated
+        memcpy(msg.items[i].name, ptr, name_len);
+        ptr += name_len;
+
+        memcpy(msg.items[i].value, ptr, value_len);
+        ptr += value_len;
+    }
+
+
+    msg.source_cnt = hdr.source_cnt;
+    msg.item_cnt   = hdr.item_cnt;
+
+    return ptr == end;
+}
+
+
+
+
+
+EventIngest::EventIngest():
+    sock        (-1),
+    wake_fd     (-1),
+    broker      (nullptr),
+    running     (false),
+    ingested_cnt(0),
+    dropped_cnt (0)
+{
+}
+
+
+
+EventIngest::~EventIngest()
+{
+    stop();
+}
+
+
+
+bool EventIngest::set_socket_path(const char *new_val)
+{
+    if( !new_val || !*new_val )
+    {
+        str_err = "path is empty";
+        return false;
+    }
+
+
+    if( strlen(new_val) >= sizeof(((struct sockaddr_un *)0)->sun_path) )
+    {
+        str_err = "path is too long";
+        return false;
+    }
+
+
+    socket_path = new_val;
+
+    return true;
+}
+
+
+
+bool EventIngest::start(EventBroker *event_broker)
+{
+    broker = event_broker;
+
+
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( sock < 0 )
+    {
+        str_err = std::string("can't create socket: ") + strerror(errno);
+        return false;
+    }
+
+
+    int rcvbuf = RCVBUF;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    unlink(socket_path.c_str()); // stale socket of the previous run
+
+
+    // only the owner of the daemon can inject events (the daemon runs with umask 0)
+    mode_t old_mask = umask(0077);
+    int    res      = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if( res < 0 )
+    {
+        str_err = "can't bind socket " + socket_path + ": " + strerror(errno);
+        close(sock);
+        sock = -1;
+        return false;
+    }
+
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if( wake_fd < 0 )
+    {
+        str_err = "can't create eventfd";
+        return false;
+    }
+
+
+    running = true;
+
+    try
+    {
+        thread = std::thread(&EventIngest::run, this);
+    }
+    catch(const std::system_error &e)
+    {
+        running = false;
+        str_err = e.what();
+        return false;
+    }
+
+
+    return true;
+}
+
+
+
+void EventIngest::stop()
+{
+    if( thread.joinable() )
+    {
+        running = false;
+        eventfd_write(wake_fd, 1);
+
+        thread.join();
+    }
+
+
+    if( sock >= 0 )
+    {
+        close(sock);
+        unlink(socket_path.c_str());
+        sock = -1;
+    }
+
+    if( wake_fd >= 0 )
+    {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+}
+
+
+
+void EventIngest::run()
+{
+    static uint8_t  bufs[BATCH_SIZE][EVENT_RECORD_MAX_SIZE + 1]; // +1 to detect too long records
+    struct iovec    iovs[BATCH_SIZE];
+    struct mmsghdr  msgs[BATCH_SIZE];
+
+
+    for(int i = 0; i < BATCH_SIZE; i++)
+    {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len  = sizeof(bufs[i]);
+    }
+
+
+    struct pollfd fds[2];
+    fds[0].fd     = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd     = wake_fd;
+    fds[1].events = POLLIN;
+
+
+    while( running.load() )
+    {
+        // headers are updated by the kernel, set them again for every batch
+        memset(msgs, 0, sizeof(msgs));
+
+        for(int i = 0; i < BATCH_SIZE; i++)
+        {
+            msgs[i].msg_hdr.msg_iov    = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+
+        int cnt = recvmmsg(sock, msgs, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+        if( cnt > 0 )
+        {
+            EventMessage msg;
+
+            for(int i = 0; i < cnt; i++)
+            {
+                if( !(msgs[i].msg_hdr.msg_flags & MSG_TRUNC) &&
+                    event_record_decode(bufs[i], msgs[i].msg_len, msg) )
+                {
+                    broker->publish(msg);
+                    ingested_cnt.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    dropped_cnt.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            continue;
+        }
+
+
+        if( (cnt < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+        {
+            LOG_W(LOG_MOD_EVENT, "Event: ingest socket error: %s", strerror(errno));
+            break;
+        }
+
+
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+
+        poll(fds, 2, -1);
+    }
+}
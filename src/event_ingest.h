@@ -0,0 +1,123 @@
+#ifndef EVENT_INGEST_H
+#define EVENT_INGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "event_broker.h"
+
+
+
+
+
+/*
+ * Binary event record (one record per datagram), host byte order:
+ *
+ *   EventRecordHeader
+ *   item_cnt times:
+ *     uint8_t name_len, uint8_t value_len, name, value  (without '\0')
+ *
+ * Items [0 .. source_cnt) are Source items, the rest are Data items.
+ * utc_time == 0 means "time of reception".
+ * property_op == PROP_NONE for a property topic means PROP_CHANGED.
+ */
+#define EVENT_RECORD_MAGIC    0x5645  // "EV"
+#define EVENT_RECORD_VERSION  1
+#define EVENT_RECORD_MAX_SIZE (sizeof(EventRecordHeader) + EVENT_MAX_ITEMS*(2 + EVENT_ITEM_NAME_LEN + EVENT_ITEM_VALUE_LEN))
+
+
+
+struct __attribute__((packed)) EventRecordHeader
+{
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  topic;         // EventTopicId
+    uint8_t  property_op;   // EventMessage::PropertyOperation
+    uint8_t  source_cnt;
+    uint8_t  item_cnt;
+    uint8_t  reserved;
+    int64_t  utc_time;
+};
+
+
+
+// Encode/decode of record.
+// encode returns size of record or 0 if buf is too small.
+size_t event_record_encode(const EventMessage &msg, void *buf, size_t size);
+bool   event_record_decode(const void *buf, size_t size, EventMessage &msg);
+
+
+
+
+
+/*
+ * Local ingestion endpoint for events of the video pipeline
+ * (motion, tamper, IO) on a Unix datagram socket.
+ *
+ * Own thread reads datagrams in batches (recvmmsg), decodes the records
+ * straight into EventMessage and publishes them to EventBroker,
+ * so there is no XML on the way from the pipeline to subscribers.
+ */
+class EventIngest
+{
+    public:
+
+        enum
+        {
+            BATCH_SIZE = 32,          // datagrams per recvmmsg
+            RCVBUF     = 256 * 1024   // socket receive buffer, bytes
+        };
+
+
+        EventIngest();
+       ~EventIngest();
+
+        EventIngest(const EventIngest&) = delete;
+        EventIngest& operator=(const EventIngest&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_socket_path(const char *new_val);
+
+        bool is_enabled(void) const { return !socket_path.empty(); }
+
+
+        // must be called after daemonize (fork)
+        bool start(EventBroker *broker);
+        void stop();
+
+
+        uint64_t get_ingested_cnt() const { return ingested_cnt.load(); }
+        uint64_t get_dropped_cnt()  const { return dropped_cnt.load();  } // malformed records
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        std::string              socket_path;
+        int                      sock;
+        int                      wake_fd;     // eventfd to stop the thread
+
+        EventBroker             *broker;
+        std::thread              thread;
+        std::atomic<bool>        running;
+
+        std::atomic<uint64_t>    ingested_cnt;
+        std::atomic<uint64_t>    dropped_cnt;
+
+        std::string              str_err;
+
+
+        void run();
+};
+
+
+
+
+
+#endif // EVENT_INGEST_H
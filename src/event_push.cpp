@@ -0,0 +1,355 @@
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <algorithm>
+#include <system_error>
+
+#include "event_push.h"
+#include "ServiceContext.h"
+#include "smacros.h"
+
+
+
+
+
+static const char *NOTIFY_ACTION = "http://docs.oasis-open.org/wsn/bw-2/NotificationConsumer/Notify";
+
+
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+
+
+
+EventPusher::Consumer::Consumer():
+    handle        (0),
+    soap          (nullptr),
+    batch_cnt     (0),
+    batch_deadline(0),
+    retry_time    (0),
+    backoff       (0),
+    done          (false)
+{
+}
+
+
+
+EventPusher::Consumer::~Consumer()
+{
+    if(soap)
+    {
+        soap_destroy(soap);
+        soap_end(soap);
+        soap_free(soap); // closes keep-alive connection
+    }
+}
+
+
+
+EventPusher::EventPusher():
+    ctx          (nullptr),
+    namespaces   (nullptr),
+    running      (false),
+    stop_fd      (-1),
+    sent_cnt     (0),
+    failed_cnt   (0),
+    dropped_cnt  (0)
+{
+}
+
+
+
+EventPusher::~EventPusher()
+{
+    stop();
+
+    if(stop_fd >= 0)
+        close(stop_fd);
+}
+
+
+
+bool EventPusher::start(ServiceContext *context, const struct Namespace *nsmap)
+{
+    ctx        = context;
+    namespaces = nsmap;
+
+
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(stop_fd < 0)
+    {
+        str_err = "can't create eventfd";
+        return false;
+    }
+
+
+    running = true;
+
+    return true;
+}
+
+
+
+void EventPusher::stop()
+{
+    if( !running.exchange(false) )
+        return;
+
+    // it is never read: all workers see it
+    eventfd_write(stop_fd, 1);
+
+    for(auto &c : consumers)
+        c->thread.join();
+
+    consumers.clear();
+}
+
+
+
+bool EventPusher::add_consumer(uint32_t handle, const std::string &consumer_url, const std::string &sub_address)
+{
+    if( !running )
+    {
+        str_err = "event delivery is not started";
+        return false;
+    }
+
+
+    join_done();
+
+    if( consumers.size() >= MAX_CONSUMERS )
+    {
+        str_err = "maximum number of consumers reached";
+        return false;
+    }
+
+
+    std::unique_ptr<Consumer> c(new Consumer);
+
+    c->handle      = handle;
+    c->url         = consumer_url;
+    c->sub_address = sub_address;
+    c->soap        = soap_new1(SOAP_IO_KEEPALIVE);
+
+    if( !c->soap )
+    {
+        str_err = "can't get mem for SOAP";
+        return false;
+    }
+
+
+    soap_set_namespaces(c->soap, namespaces);
+
+    c->soap->connect_timeout = IO_TIMEOUT;
+    c->soap->send_timeout    = IO_TIMEOUT;
+    c->soap->recv_timeout    = IO_TIMEOUT;
+    c->soap->socket_flags    = MSG_NOSIGNAL; // dead consumer must not kill us by SIGPIPE
+    c->soap->user            = ctx;
+
+
+    try
+    {
+        c->thread = std::thread(&EventPusher::run, this, c.get());
+    }
+    catch(const std::system_error &e)
+    {
+        str_err = e.what();
+        return false;
+    }
+
+    consumers.push_back(std::move(c));
+
+    return true;
+}
+
+
+
+// the worker of one consumer, up to the end of its subscription
+void EventPusher::run(Consumer *consumer)
+{
+    Consumer    &c      = *consumer;
+    EventBroker *broker = ctx->get_event_broker();
+
+    struct pollfd fds[2] =
+    {
+        { stop_fd,                      POLLIN, 0 },
+        { broker->get_wait_fd(c.handle), POLLIN, 0 }
+    };
+
+
+    // check for removed subscription at least once per second
+    while( running.load() && broker->get_termination(c.handle, nullptr) )
+    {
+        int64_t now     = now_ms();
+        int64_t timeout = 1000;
+        nfds_t  fds_cnt = 1;
+
+
+        if( c.retry_time > now )
+        {
+            timeout = std::min(timeout, c.retry_time - now);
+        }
+        else
+        {
+            if( c.batch_cnt < MAX_BATCH )
+            {
+                int cnt = broker->take(c.handle, c.batch + c.batch_cnt, MAX_BATCH - c.batch_cnt);
+                if( cnt > 0 )
+                {
+                    if( !c.batch_cnt )
+                        c.batch_deadline = now + BATCH_WINDOW_MS;
+
+                    c.batch_cnt += cnt;
+                }
+            }
+
+
+            if( c.batch_cnt && ((c.batch_cnt == MAX_BATCH) || (now >= c.batch_deadline)) )
+            {
+                if( send_notify(c) )
+                {
+                    sent_cnt     += c.batch_cnt;
+                    c.backoff     = 0;
+                    c.retry_time  = 0;
+                }
+                else
+                {
+                    failed_cnt++;
+                    dropped_cnt  += c.batch_cnt;
+                    c.backoff     = c.backoff ? std::min(c.backoff*2, (int)BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+                    c.retry_time  = now_ms() + c.backoff;
+
+                    LOG_W(LOG_MOD_EVENT, "Event: Notify to %s failed, retry in %d ms", c.url.c_str(), c.backoff);
+                }
+
+                c.batch_cnt      = 0;
+                c.batch_deadline = 0;
+                continue; // there may be more messages in the queue
+            }
+
+
+            if( c.batch_cnt )
+                timeout = std::min(timeout, c.batch_deadline - now); // collect messages until the end of the batch window
+            else if( broker->prepare_wait(c.handle) )
+                fds_cnt = 2;
+            else
+                continue;
+        }
+
+
+        fds[1].revents = 0;
+
+        if( (poll(fds, fds_cnt, (int)std::max(timeout, (int64_t)0)) > 0) && (fds[1].revents & POLLIN) )
+        {
+            eventfd_t val;
+            eventfd_read(fds[1].fd, &val);
+        }
+    }
+
+
+    soap_closesock(c.soap);
+    c.done = true;
+}
+
+
+
+// join the workers of removed subscriptions
+void EventPusher::join_done()
+{
+    auto it = std::remove_if(consumers.begin(), consumers.end(),
+                             [](const std::unique_ptr<Consumer> &c)
+                             {
+                                 if( !c->done.load() )
+                                     return false;
+
+                                 c->thread.join();
+                                 return true;
+                             });
+
+    consumers.erase(it, consumers.end());
+}
+
+
+
+bool EventPusher::send_notify(Consumer &c)
+{
+    struct soap *soap = c.soap;
+    _wsnt__Notify notify;
+
+
+    for(int i = 0; i < c.batch_cnt; i++)
+    {
+        auto msg = ctx->getNotificationMessage(soap, c.batch[i]);
+        if( !msg )
+            continue;
+
+        msg->SubscriptionReference = soap_new_wsa5__EndpointReferenceType(soap);
+        if( msg->SubscriptionReference )
+            msg->SubscriptionReference->Address = soap_strdup(soap, c.sub_address.c_str());
+
+        notify.wsnt__NotificationMessage.push_back(msg);
+    }
+
+
+    // the same steps as in the generated client stub of one-way operation
+    soap_begin(soap);
+    soap->encodingStyle = NULL;
+    soap_serializeheader(soap);
+    notify.soap_serialize(soap);
+
+    if( soap_begin_count(soap) )
+        goto error;
+
+    if( soap->mode & SOAP_IO_LENGTH )
+    {
+        if( soap_envelope_begin_out(soap)                  ||
+            soap_putheader(soap)                           ||
+            soap_body_begin_out(soap)                      ||
+            notify.soap_put(soap, "wsnt:Notify", nullptr)  ||
+            soap_body_end_out(soap)                        ||
+            soap_envelope_end_out(soap) )
+            goto error;
+    }
+
+    if( soap_end_count(soap) )
+        goto error;
+
+
+    if( soap_connect(soap, c.url.c_str(), NOTIFY_ACTION)   ||
+        soap_envelope_begin_out(soap)                      ||
+        soap_putheader(soap)                               ||
+        soap_body_begin_out(soap)                          ||
+        notify.soap_put(soap, "wsnt:Notify", nullptr)      ||
+        soap_body_end_out(soap)                            ||
+        soap_envelope_end_out(soap)                        ||
+        soap_end_send(soap) )
+        goto error;
+
+
+    // consumer replies with HTTP 200/202 without (or with empty) body
+    if( soap_recv_empty_response(soap) )
+        goto error;
+
+
+    soap_destroy(soap);
+    soap_end(soap);
+
+    return true;
+
+
+error:
+    soap_closesock(soap); // connection can be broken, next time we make a new one
+    soap_destroy(soap);
+    soap_end(soap);
+
+    return false;
+}
@@ -0,0 +1,123 @@
+#ifndef EVENT_PUSH_H
+#define EVENT_PUSH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include "soapH.h"
+#include "event_broker.h"
+
+
+
+class ServiceContext;
+
+
+
+
+
+/*
+ * Delivery of events to WS-BaseNotification consumers (Notify).
+ *
+ * Every consumer has own worker thread (blocking gSOAP IO with IO_TIMEOUT),
+ * so a slow or dead consumer delays neither the processing of SOAP requests
+ * in the main loop nor the delivery to other consumers.
+ * The outbound queue of a consumer is the queue of its subscription in
+ * EventBroker. Every consumer has own gSOAP context with keep-alive
+ * HTTP connection. Messages that arrive within BATCH_WINDOW_MS are sent
+ * in one Notify. After a failed delivery the consumer is retried with
+ * exponential backoff (the failed batch is dropped).
+ * The worker ends with the subscription (unsubscribed or expired), it is
+ * joined by the next add_consumer or by stop().
+ */
+class EventPusher
+{
+    public:
+
+        enum
+        {
+            MAX_CONSUMERS    = 32,
+            MAX_BATCH        = 32,    // NotificationMessages in one Notify
+            BATCH_WINDOW_MS  = 50,
+            BACKOFF_MIN_MS   = 500,
+            BACKOFF_MAX_MS   = 60000,
+            IO_TIMEOUT       = 2      // sec, connect/send/recv
+        };
+
+
+        EventPusher();
+       ~EventPusher();
+
+        EventPusher(const EventPusher&) = delete;
+        EventPusher& operator=(const EventPusher&) = delete;
+
+
+        // must be called after daemonize (fork), the workers are started by add_consumer
+        bool start(ServiceContext *ctx, const struct Namespace *namespaces);
+        void stop();
+
+
+        // consumer_url - Address of ConsumerReference
+        // sub_address  - Address of SubscriptionReference (it is sent in NotificationMessage)
+        bool add_consumer(uint32_t handle, const std::string &consumer_url, const std::string &sub_address);
+
+
+        uint64_t get_sent_cnt()    const { return sent_cnt.load();    }
+        uint64_t get_failed_cnt()  const { return failed_cnt.load();  }
+        uint64_t get_dropped_cnt() const { return dropped_cnt.load(); }
+
+        std::string get_str_err() const { return str_err;         }
+        const char* get_cstr_err()const { return str_err.c_str(); }
+
+
+    private:
+
+        struct Consumer
+        {
+            uint32_t      handle;
+            std::string   url;
+            std::string   sub_address;
+            struct soap  *soap;
+
+            EventMessage  batch[MAX_BATCH];
+            int           batch_cnt;
+            int64_t       batch_deadline;  // ms, 0 - batch is not started
+            int64_t       retry_time;      // ms, 0 - no backoff
+            int           backoff;         // ms
+
+            std::thread       thread;
+            std::atomic<bool> done;        // the worker is finished
+
+             Consumer();
+            ~Consumer();
+        };
+
+
+        ServiceContext          *ctx;
+        const struct Namespace  *namespaces;
+
+        std::atomic<bool>        running;
+        int                      stop_fd;   // eventfd, it is readable after stop()
+
+        std::vector<std::unique_ptr<Consumer>> consumers;  // of main thread
+
+        std::atomic<uint64_t>    sent_cnt;
+        std::atomic<uint64_t>    failed_cnt;
+        std::atomic<uint64_t>    dropped_cnt;
+
+        std::string              str_err;
+
+
+        void run(Consumer *c);
+        void join_done();
+        bool send_notify(Consumer &c);
+};
+
+
+
+
+
+#endif // EVENT_PUSH_H
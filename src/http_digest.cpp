@@ -0,0 +1,377 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/random.h>
+
+#include "http_digest.h"
+
+
+
+
+
+// one parameter of Digest header: pointer into the header + length
+struct DigestParam
+{
+    const char *ptr;
+    size_t      len;
+
+    bool equals(const char *str) const { return (strlen(str) == len) && !strncmp(ptr, str, len); }
+};
+
+
+
+struct DigestParams
+{
+    DigestParam username;
+    DigestParam realm;
+    DigestParam nonce;
+    DigestParam uri;
+    DigestParam response;
+    DigestParam qop;
+    DigestParam nc;
+    DigestParam cnonce;
+    DigestParam algorithm;
+};
+
+
+
+// one pass over: Digest key="value", key=token, ...
+static bool parse_digest_header(const char *str, DigestParams &params)
+{
+    memset(&params, 0, sizeof(params));
+
+
+    if( strncasecmp(str, "Digest", 6) )
+        return false;
+
+    str += 6;
+
+
+    for(;;)
+    {
+        while( *str == ' ' || *str == '\t' || *str == ',' )
+            str++;
+
+        if( !*str )
+            return true;
+
+
+        const char *key = str;
+        while( *str && *str != '=' && *str != ' ' )
+            str++;
+
+        size_t key_len = str - key;
+
+        if( *str++ != '=' )
+            return false;
+
+
+        DigestParam value;
+
+        if( *str == '"' )
+        {
+            value.ptr = ++str;
+            str = strchr(str, '"');
+            if( !str )
+                return false;
+
+            value.len = str++ - value.ptr;
+        }
+        else
+        {
+            value.ptr = str;
+            while( *str && *str != ',' && *str != ' ' )
+                str++;
+
+            value.len = str - value.ptr;
+        }
+
+
+        #define DIGEST_PARAM(name) \
+            if( (key_len == sizeof(#name) - 1) && !strncasecmp(key, #name, key_len) ) params.name = value;
+
+        DIGEST_PARAM(username)
+        DIGEST_PARAM(realm)
+        DIGEST_PARAM(nonce)
+        DIGEST_PARAM(uri)
+        DIGEST_PARAM(response)
+        DIGEST_PARAM(qop)
+        DIGEST_PARAM(nc)
+        DIGEST_PARAM(cnonce)
+        DIGEST_PARAM(algorithm)
+
+        #undef DIGEST_PARAM
+    }
+}
+
+
+
+static bool parse_hex(const char *ptr, size_t len, uint64_t *val)
+{
+    *val = 0;
+
+    if( !len || len > 16 )
+        return false;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        char ch = ptr[i];
+        int  digit;
+
+        if(      ch >= '0' && ch <= '9' ) digit = ch - '0';
+        else if( ch >= 'a' && ch <= 'f' ) digit = ch - 'a' + 10;
+        else if( ch >= 'A' && ch <= 'F' ) digit = ch - 'A' + 10;
+        else return false;
+
+        *val = (*val << 4) | digit;
+    }
+
+    return true;
+}
+
+
+
+
+
+HttpDigest::HttpDigest():
+    next_slot    (0),
+    users        (nullptr),
+    request_level(USER_LEVEL_ANONYMOUS),
+    ok_cnt       (0),
+    failed_cnt   (0),
+    replay_cnt   (0)
+{
+    for(uint32_t i = 0; i < NONCE_SLOTS; i++)
+    {
+        slots[i].token.store(0);
+        slots[i].issued.store(0);
+        slots[i].nc.store(0);
+    }
+}
+
+
+
+bool HttpDigest::init(const char *new_realm)
+{
+    if( !new_realm || !*new_realm || strchr(new_realm, '"') )
+    {
+        str_err = "bad realm";
+        return false;
+    }
+
+    realm = new_realm;
+
+
+    challenge_prefix = "HTTP/1.1 401 Unauthorized\r\n"
+                       "WWW-Authenticate: Digest realm=\"" + realm + "\", qop=\"auth\", algorithm=MD5, nonce=\"";
+
+    challenge_suffix       = "\"\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: close\r\n\r\n";
+
+    challenge_suffix_stale = "\", stale=true\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: close\r\n\r\n";
+
+    return true;
+}
+
+
+
+HttpDigest::Result HttpDigest::verify(const char *method, const char *uri, const char *header, time_t now)
+{
+    DigestParams p;
+
+
+    if( !header || (strlen(header) > MAX_HEADER) || !parse_digest_header(header, p) ||
+        !p.username.ptr || !p.realm.ptr || !p.nonce.ptr || !p.uri.ptr || !p.cnonce.ptr ||
+        (p.response.len != MD5_DIGEST_SIZE*2) || !p.qop.equals("auth") ||
+        (p.algorithm.ptr && !p.algorithm.equals("MD5")) ||
+        !p.realm.equals(realm.c_str()) || !p.uri.equals(uri) || (p.nonce.len != NONCE_LEN) )
+    {
+        failed_cnt++;
+        return DIGEST_BAD;
+    }
+
+
+    const UserAccount *account = users ? users->find(p.username.ptr, p.username.len) : nullptr;
+    if( !account )
+    {
+        failed_cnt++;
+        return DIGEST_BAD;
+    }
+
+
+    uint64_t slot_idx, token, nc;
+
+    if( !parse_hex(p.nonce.ptr, 4, &slot_idx) || (slot_idx >= NONCE_SLOTS) ||
+        !parse_hex(p.nonce.ptr + 4, 16, &token) || !parse_hex(p.nc.ptr, p.nc.len, &nc) ||
+        !nc || (nc > UINT32_MAX) )
+    {
+        failed_cnt++;
+        return DIGEST_BAD;
+    }
+
+
+    NonceSlot &slot = slots[slot_idx];
+
+    if( (slot.token.load() != token) || (slot.issued.load() + NONCE_TTL < now) )
+    {
+        failed_cnt++;
+        return DIGEST_STALE;
+    }
+
+
+    // HA2 = MD5(method:uri)
+    char ha2[MD5_DIGEST_SIZE*2 + 1];
+    Md5  md5;
+    md5.update(method, strlen(method));
+    md5.update(":", 1);
+    md5.update(p.uri.ptr, p.uri.len);
+    md5.final_hex(ha2);
+
+
+    // response = MD5(HA1:nonce:nc:cnonce:qop:HA2)
+    char response[MD5_DIGEST_SIZE*2 + 1];
+    md5.update(account->ha1, MD5_DIGEST_SIZE*2);
+    md5.update(":", 1);
+    md5.update(p.nonce.ptr, p.nonce.len);
+    md5.update(":", 1);
+    md5.update(p.nc.ptr, p.nc.len);
+    md5.update(":", 1);
+    md5.update(p.cnonce.ptr, p.cnonce.len);
+    md5.update(":", 1);
+    md5.update(p.qop.ptr, p.qop.len);
+    md5.update(":", 1);
+    md5.update(ha2, MD5_DIGEST_SIZE*2);
+    md5.final_hex(response);
+
+
+    uint8_t diff = 0;
+    for(int i = 0; i < MD5_DIGEST_SIZE*2; i++)
+        diff |= response[i] ^ (p.response.ptr[i] | 0x20); // hex is case-insensitive
+
+    if( diff )
+    {
+        failed_cnt++;
+        return DIGEST_BAD;
+    }
+
+
+    // nonce-count must grow, only a valid response can move it
+    uint32_t last = slot.nc.load();
+    do
+    {
+        if( nc <= last )
+        {
+            replay_cnt++;
+            return DIGEST_REPLAY;
+        }
+
+    } while( !slot.nc.compare_exchange_weak(last, nc) );
+
+
+    ok_cnt++;
+    request_level = account->level;
+
+    return DIGEST_OK;
+}
+
+
+
+bool HttpDigest::parse_request_line(const char *line, char *method, char *uri)
+{
+    const char *sp = strchr(line, ' ');
+    if( !sp || (sp == line) || (sp - line >= MAX_METHOD) )
+        return false;
+
+    memcpy(method, line, sp - line);
+    method[sp - line] = '\0';
+
+
+    const char *start = sp + 1;
+    const char *end   = strchr(start, ' ');
+    if( !end || (end == start) || (end - start >= MAX_URI) )
+        return false;
+
+    memcpy(uri, start, end - start);
+    uri[end - start] = '\0';
+
+    return true;
+}
+
+
+
+bool HttpDigest::send_challenge(int fd, bool stale, time_t now)
+{
+    char nonce[NONCE_LEN + 1];
+
+    if( !issue_nonce(nonce, now) )
+        return false;
+
+
+    const std::string &suffix = stale ? challenge_suffix_stale : challenge_suffix;
+
+    struct iovec iov[3];
+    iov[0].iov_base = (void *)challenge_prefix.data();
+    iov[0].iov_len  = challenge_prefix.size();
+    iov[1].iov_base = nonce;
+    iov[1].iov_len  = NONCE_LEN;
+    iov[2].iov_base = (void *)suffix.data();
+    iov[2].iov_len  = suffix.size();
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 3;
+
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(iov[0].iov_len + iov[1].iov_len + iov[2].iov_len);
+}
+
+
+
+size_t HttpDigest::render_challenge(char *buf, size_t size, bool stale, time_t now)
+{
+    const std::string &suffix = stale ? challenge_suffix_stale : challenge_suffix;
+
+    size_t len = challenge_prefix.size() + NONCE_LEN + suffix.size();
+
+    if( (len > size) || !issue_nonce(buf + challenge_prefix.size(), now) )
+        return 0;
+
+
+    memcpy(buf, challenge_prefix.data(), challenge_prefix.size());
+    memcpy(buf + challenge_prefix.size() + NONCE_LEN, suffix.data(), suffix.size());
+
+    return len;
+}
+
+
+
+bool HttpDigest::issue_nonce(char nonce[NONCE_LEN + 1], time_t now)
+{
+    uint64_t token;
+
+    if( getrandom(&token, sizeof(token), 0) != sizeof(token) )
+        return false;
+
+    if( !token )
+        token = 1;  // 0 - free slot
+
+
+    uint32_t   idx  = next_slot.fetch_add(1) & (NONCE_SLOTS - 1);
+    NonceSlot &slot = slots[idx];
+
+    slot.token.store(0);        // the old nonce is invalid from now
+    slot.nc.store(0);
+    slot.issued.store(now);
+    slot.token.store(token);
+
+
+    snprintf(nonce, NONCE_LEN + 1, "%04x%016llx", idx, (unsigned long long)token);
+
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef HTTP_DIGEST_H
+#define HTTP_DIGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+
+#include "md5.h"
+#include "access_policy.h"
+#include "user_store.h"
+
+
+
+
+
+/*
+ * HTTP Digest authentication (RFC 2617, qop=auth, MD5).
+ *
+ * The Authorization header is checked while gSOAP parses the HTTP headers
+ * (see fparsehdr in onvif_srvd.cpp), so a bad or replayed request is
+ * rejected before any XML is read.
+ *
+ * Nonces live in a fixed table of slots, a nonce is "<slot><random token>".
+ * A slot is reused round-robin (the client of an evicted nonce gets
+ * stale=true and just repeats the request). Every slot keeps the last
+ * nonce-count, a request with nc <= last is a replay.
+ * The slots are atomics, so the table has no locks.
+ *
+ * The 401 reply is rendered once, only the nonce is inserted per reply.
+ * HA1 of users is precomputed by UserStore (the realm is the same).
+ */
+class HttpDigest
+{
+    public:
+
+        enum
+        {
+            NONCE_SLOTS = 1024,   // must be a power of two
+            NONCE_TTL   = 300,    // sec
+            NONCE_LEN   = 20,     // hex chars: 4 (slot) + 16 (token)
+            MAX_HEADER  = 1024,   // max length of Authorization header
+            MAX_METHOD  = 16,     // buffers of parse_request_line
+            MAX_URI     = 512
+        };
+
+
+        enum Result
+        {
+            DIGEST_OK,
+            DIGEST_BAD,       // malformed header, unknown user, bad response
+            DIGEST_STALE,     // nonce is expired or evicted
+            DIGEST_REPLAY     // nonce-count is used already
+        };
+
+
+        HttpDigest();
+
+
+        bool init(const char *realm);
+        void set_user_store(const UserStore *new_users) { users = new_users; }
+
+        const std::string& get_realm() const { return realm; }
+
+
+        // method, uri - of HTTP request line, header - value of Authorization header
+        Result verify(const char *method, const char *uri, const char *header, time_t now);
+
+        // method and uri of the request line "GET /metrics HTTP/1.1" (sizes MAX_METHOD, MAX_URI):
+        // in fparsehdr gsoap has the line in soap->msgbuf, soap->status and soap->path are not set yet
+        static bool parse_request_line(const char *line, char *method, char *uri);
+
+        // 401 with WWW-Authenticate: Digest (a new nonce)
+        bool   send_challenge(int fd, bool stale, time_t now);
+
+        // the same 401 into buf (for TLS it is sent by soap), returns length or 0
+        size_t render_challenge(char *buf, size_t size, bool stale, time_t now);
+
+
+        // level of the client of current request by the Authorization header
+        void      begin_request()           { request_level = USER_LEVEL_ANONYMOUS; }
+        UserLevel get_request_level() const { return request_level;             }
+
+
+        uint64_t get_ok_cnt()     const { return ok_cnt.load();     }
+        uint64_t get_failed_cnt() const { return failed_cnt.load(); }
+        uint64_t get_replay_cnt() const { return replay_cnt.load(); }
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        struct NonceSlot
+        {
+            std::atomic<uint64_t> token;    // 0 - free
+            std::atomic<time_t>   issued;
+            std::atomic<uint32_t> nc;       // last nonce-count
+        };
+
+
+        NonceSlot              slots[NONCE_SLOTS];
+        std::atomic<uint32_t>  next_slot;
+
+        std::string            realm;
+        const UserStore       *users;
+
+        std::string            challenge_prefix;        // ... nonce="
+        std::string            challenge_suffix;        // " ... \r\n\r\n
+        std::string            challenge_suffix_stale;
+
+        UserLevel              request_level;
+
+        std::atomic<uint64_t>  ok_cnt;
+        std::atomic<uint64_t>  failed_cnt;
+        std::atomic<uint64_t>  replay_cnt;
+
+        std::string            str_err;
+
+
+        bool issue_nonce(char nonce[NONCE_LEN + 1], time_t now);
+};
+
+
+
+
+
+#endif // HTTP_DIGEST_H
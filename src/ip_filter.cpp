@@ -0,0 +1,304 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "ip_filter.h"
+
+
+
+
+
+static const uint8_t v4_mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xFF,0xFF };
+
+
+
+// length of prefix in IPv6 space
+static int get_bits(const IpPrefix &prefix)
+{
+    return prefix.ipv6 ? prefix.prefix_len : prefix.prefix_len + 96;
+}
+
+
+
+static int get_bit(const uint8_t addr[16], int idx)
+{
+    return (addr[idx >> 3] >> (7 - (idx & 7))) & 1;
+}
+
+
+
+static bool is_same(const IpPrefix &a, const IpPrefix &b)
+{
+    return (get_bits(a) == get_bits(b)) && !memcmp(a.addr, b.addr, sizeof(a.addr));
+}
+
+
+
+static bool is_loopback(const uint8_t addr[16])
+{
+    static const uint8_t v6_loopback[16] = { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,1 };
+
+    return !memcmp(addr, v6_loopback, 16) || (!memcmp(addr, v4_mapped, 12) && (addr[12] == 127));
+}
+
+
+
+
+
+bool get_ip6_addr(const struct sockaddr *addr, uint8_t ip6[16])
+{
+    if( addr->sa_family == AF_INET )
+    {
+        memcpy(ip6, v4_mapped, sizeof(v4_mapped));
+        memcpy(&ip6[12], &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        return true;
+    }
+
+
+    if( addr->sa_family == AF_INET6 )
+    {
+        memcpy(ip6, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+        return true;
+    }
+
+
+    return false;
+}
+
+
+
+
+
+bool IpFilterTable::match(const uint8_t addr[16]) const
+{
+    uint32_t idx = 0;
+
+    for(int i = 0; i < 128; i++)
+    {
+        if( nodes[idx].terminal )
+            return true;
+
+        idx = nodes[idx].child[get_bit(addr, i)];
+
+        if( idx == NO_CHILD )
+            return false;
+    }
+
+    return nodes[idx].terminal;
+}
+
+
+
+void IpFilterTable::build(const std::vector<IpPrefix> &prefixes)
+{
+    nodes.assign(1, Node{ {NO_CHILD, NO_CHILD}, 0 });
+
+
+    for(const IpPrefix &prefix : prefixes)
+    {
+        uint32_t idx  = 0;
+        int      bits = get_bits(prefix);
+
+        // a shorter prefix is already here, the longer one adds nothing
+        for(int i = 0; (i < bits) && !nodes[idx].terminal; i++)
+        {
+            int bit = get_bit(prefix.addr, i);
+
+            if( nodes[idx].child[bit] == NO_CHILD )
+            {
+                nodes[idx].child[bit] = nodes.size();
+                nodes.push_back(Node{ {NO_CHILD, NO_CHILD}, 0 });
+            }
+
+            idx = nodes[idx].child[bit];
+        }
+
+        nodes[idx].terminal = 1;
+    }
+}
+
+
+
+
+
+IpFilter::IpFilter():
+    allow     (false),
+    current   (nullptr),
+    active    (new IpFilterTable),
+    denied_cnt(0)
+{
+    active->allow = false;
+    active->build(prefixes);
+
+    current.store(active.get());
+}
+
+
+
+IpFilter::Result IpFilter::parse_prefix(const std::string &str, int prefix_len, bool ipv6, IpPrefix &prefix)
+{
+    memset(prefix.addr, 0, sizeof(prefix.addr));
+
+    if( ipv6 )
+    {
+        if( inet_pton(AF_INET6, str.c_str(), prefix.addr) != 1 )
+            return IP_FILTER_BAD_ADDRESS;
+
+        if( (prefix_len < 0) || (prefix_len > 128) )
+            return IP_FILTER_BAD_PREFIX;
+    }
+    else
+    {
+        memcpy(prefix.addr, v4_mapped, sizeof(v4_mapped));
+
+        if( inet_pton(AF_INET, str.c_str(), &prefix.addr[12]) != 1 )
+            return IP_FILTER_BAD_ADDRESS;
+
+        if( (prefix_len < 0) || (prefix_len > 32) )
+            return IP_FILTER_BAD_PREFIX;
+    }
+
+
+    prefix.ipv6       = ipv6;
+    prefix.prefix_len = prefix_len;
+    prefix.str        = str;
+
+
+    // host bits are not a part of the rule
+    int bits = get_bits(prefix);
+
+    for(int i = bits; i < 128; i++)
+        prefix.addr[i >> 3] &= ~(0x80 >> (i & 7));
+
+
+    return IP_FILTER_OK;
+}
+
+
+
+bool IpFilter::is_allowed(const struct sockaddr *addr)
+{
+    uint8_t peer[16];
+
+    if( !get_ip6_addr(addr, peer) )
+        return true; // not IP (Unix socket)
+
+
+    if( is_loopback(peer) )
+        return true;
+
+
+    const IpFilterTable *table = current.load(std::memory_order_acquire);
+
+    if( table->match(peer) == table->allow )
+        return true;
+
+
+    denied_cnt++;
+
+    return false;
+}
+
+
+
+IpFilter::Result IpFilter::set(bool new_allow, const std::vector<IpPrefix> &new_prefixes, size_t *failed)
+{
+    if( failed )
+        *failed = MAX_RULES;
+
+    return publish(new_allow, new_prefixes);
+}
+
+
+
+IpFilter::Result IpFilter::add(const std::vector<IpPrefix> &new_prefixes, size_t *failed)
+{
+    std::vector<IpPrefix> tmp = prefixes;
+
+    for(size_t i = 0; i < new_prefixes.size(); i++)
+    {
+        bool found = false;
+
+        for(const IpPrefix &old_prefix : tmp)
+            found = found || is_same(new_prefixes[i], old_prefix);
+
+        if( found )
+            continue;
+
+        tmp.push_back(new_prefixes[i]);
+
+        if( failed && (tmp.size() == (size_t)MAX_RULES + 1) )
+            *failed = i;    // the first one over the limit
+    }
+
+
+    return publish(allow, std::move(tmp));
+}
+
+
+
+IpFilter::Result IpFilter::remove(const std::vector<IpPrefix> &old_prefixes, size_t *failed)
+{
+    std::vector<IpPrefix> tmp = prefixes;
+
+    for(size_t i = 0; i < old_prefixes.size(); i++)
+    {
+        auto it = tmp.begin();
+
+        while( (it != tmp.end()) && !is_same(old_prefixes[i], *it) )
+            ++it;
+
+        if( it == tmp.end() )
+        {
+            if( failed )
+                *failed = i;
+
+            return IP_FILTER_NOT_FOUND;
+        }
+
+        tmp.erase(it);
+    }
+
+
+    return publish(allow, std::move(tmp));
+}
+
+
+
+const char* IpFilter::get_result_str(Result result)
+{
+    switch(result)
+    {
+        case IP_FILTER_OK:          return "ok";
+        case IP_FILTER_BAD_ADDRESS: return "bad IP address";
+        case IP_FILTER_BAD_PREFIX:  return "bad prefix length";
+        case IP_FILTER_NOT_FOUND:   return "address is not in the filter";
+        case IP_FILTER_TOO_MANY:    return "too many addresses in the filter";
+    }
+
+    return "unknown";
+}
+
+
+
+IpFilter::Result IpFilter::publish(bool new_allow, std::vector<IpPrefix> new_prefixes)
+{
+    if( new_prefixes.size() > MAX_RULES )
+        return IP_FILTER_TOO_MANY;
+
+
+    std::unique_ptr<IpFilterTable> table(new IpFilterTable);
+    table->allow = new_allow;
+    table->build(new_prefixes);
+
+
+    allow    = new_allow;
+    prefixes = std::move(new_prefixes);
+
+    retired = std::move(active);
+    active  = std::move(table);
+
+    current.store(active.get(), std::memory_order_release);
+
+    return IP_FILTER_OK;
+}
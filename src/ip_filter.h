@@ -0,0 +1,140 @@
+#ifndef IP_FILTER_H
+#define IP_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+#include <sys/socket.h>
+
+
+
+
+
+// address of IP peer in IPv6 space (IPv4 -> ::ffff:a.b.c.d), false - it is not IP
+bool get_ip6_addr(const struct sockaddr *addr, uint8_t ip6[16]);
+
+
+
+// address of a rule, IPv4 is kept as IPv4-mapped IPv6 (::ffff:a.b.c.d)
+struct IpPrefix
+{
+    bool        ipv6;           // how it was given (for tds:GetIPAddressFilter)
+    uint8_t     addr[16];       // bits after the prefix are zero
+    int         prefix_len;     // 0-32 for IPv4, 0-128 for IPv6 (as it was given)
+    std::string str;            // the address as it was given
+};
+
+
+
+/*
+ * Compiled rules: binary trie by bits of the address (all in IPv6 space).
+ * A node is a bit, a terminal node is the end of a prefix, so the lookup
+ * is at most 128 steps over a small array and stops at the first terminal.
+ * Immutable, every change compiles a new one.
+ */
+struct IpFilterTable
+{
+    enum
+    {
+        NO_CHILD = 0    // the root (node 0) is never a child
+    };
+
+    struct Node
+    {
+        uint32_t child[2];
+        uint32_t terminal;
+    };
+
+
+    bool              allow;    // Allow: only matched are allowed, Deny: matched are denied
+    std::vector<Node> nodes;
+
+
+    bool match(const uint8_t addr[16]) const;
+    void build(const std::vector<IpPrefix> &prefixes);
+};
+
+
+
+
+
+/*
+ * IP address filter of the device (tds:Get/Set/Add/RemoveIPAddressFilter).
+ *
+ * It is checked right after accept by the address of peer, before
+ * the TLS handshake and before any byte of HTTP is read, so a filtered
+ * client costs one lookup and a close.
+ *
+ * The table is published by an atomic pointer (like UserStore), changes
+ * never stop the main loop. The old table is freed by the next change.
+ * Loopback is always allowed: a wrong filter must not lock out the local
+ * tools. Without rules the filter is off (Deny with no addresses).
+ */
+class IpFilter
+{
+    public:
+
+        enum Result
+        {
+            IP_FILTER_OK,
+            IP_FILTER_BAD_ADDRESS,
+            IP_FILTER_BAD_PREFIX,
+            IP_FILTER_NOT_FOUND,     // Remove of an address that is not in the filter
+            IP_FILTER_TOO_MANY
+        };
+
+        enum
+        {
+            MAX_RULES = 64
+        };
+
+
+        IpFilter();
+
+        IpFilter(const IpFilter&) = delete;
+        IpFilter& operator=(const IpFilter&) = delete;
+
+
+        static Result parse_prefix(const std::string &str, int prefix_len, bool ipv6, IpPrefix &prefix);
+
+
+        bool is_allowed(const struct sockaddr *addr);
+
+        bool                         is_allow_type() const { return allow;    }
+        const std::vector<IpPrefix>& get_prefixes()  const { return prefixes; }
+        uint64_t                     get_denied_cnt() const { return denied_cnt; }
+
+
+        // failed - index of the entry that failed (over MAX_RULES, not found)
+        Result set   (bool allow, const std::vector<IpPrefix> &new_prefixes, size_t *failed = nullptr);
+        Result add   (const std::vector<IpPrefix> &new_prefixes, size_t *failed = nullptr);
+        Result remove(const std::vector<IpPrefix> &old_prefixes, size_t *failed = nullptr);
+
+
+        static const char* get_result_str(Result result);
+
+
+    private:
+
+        bool                  allow;
+        std::vector<IpPrefix> prefixes;     // config, it is changed only by the main loop
+
+        std::atomic<const IpFilterTable*> current;
+        std::unique_ptr<IpFilterTable>    active;    // owner of current
+        std::unique_ptr<IpFilterTable>    retired;   // previous table
+
+        uint64_t              denied_cnt;
+
+
+        Result publish(bool new_allow, std::vector<IpPrefix> new_prefixes);
+};
+
+
+
+
+
+#endif // IP_FILTER_H
@@ -0,0 +1,698 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include <memory>
+
+#include "logger.h"
+
+
+
+
+
+Logger logger;
+
+
+
+static const char *level_names[LOG_LEVEL_CNT] = { "error", "warn", "info", "debug" };
+
+static const char *module_names[LOG_MOD_CNT]  = { "main", "net", "auth", "service", "event" };
+
+
+
+static bool parse_name(const char *str, size_t len, const char * const *names, int cnt, int *idx)
+{
+    for(int i = 0; i < cnt; i++)
+    {
+        if( (strlen(names[i]) == len) && !strncmp(names[i], str, len) )
+        {
+            *idx = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while( len )
+    {
+        ssize_t n = write(fd, data, len);
+        if( n < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        data += n;
+        len  -= n;
+    }
+
+    return true;
+}
+
+
+
+// the crash handler can't use snprintf: the digits of val, returns their count
+static size_t put_uint(char *buf, size_t size, unsigned long long val, size_t width = 0, unsigned base = 10)
+{
+    char   digits[24];
+    size_t cnt = 0;
+
+    do
+    {
+        digits[cnt++] = "0123456789abcdef"[val % base];
+        val /= base;
+    }
+    while( val || (cnt < width) );
+
+
+    size_t len = 0;
+
+    while( cnt && (len + 1 < size) )
+        buf[len++] = digits[--cnt];
+
+    return len;
+}
+
+
+
+static size_t put_str(char *buf, size_t size, const char *str)
+{
+    size_t len = 0;
+
+    while( str[len] && (len + 1 < size) )
+    {
+        buf[len] = str[len];
+        len++;
+    }
+
+    return len;
+}
+
+
+
+static void crash_handler(int sig)
+{
+    logger.crash_flush();
+
+    // SA_RESETHAND: the default action (core dump)
+    raise(sig);
+}
+
+
+
+
+
+void LogRecord::add(const char *str)
+{
+    Arg &arg = set(ARG_STR);
+
+    if( !str )
+        str = "(null)";
+
+
+    size_t room = STR_BUF_SIZE - str_len;
+    size_t len  = strnlen(str, room ? room - 1 : 0);
+
+    arg.str = str_len;
+
+    if( room )
+    {
+        memcpy(&str_buf[str_len], str, len);
+        str_buf[str_len + len] = '\0';
+        str_len += len + 1;
+    }
+    else
+    {
+        arg.str = STR_BUF_SIZE - 1;  // the last '\0', an empty string
+    }
+}
+
+
+
+LogRecord::Arg& LogRecord::set(ArgType type)
+{
+    // the calls with more args are stopped by static_assert in Logger::write
+    types[args_cnt] = type;
+    return args[args_cnt++];
+}
+
+
+
+/*
+ * printf of the format with the saved args: every conversion is given
+ * to snprintf alone, the length modifiers of the format are replaced
+ * by the type of the saved arg. '*' width/precision is not supported.
+ */
+size_t LogRecord::format_text(char *buf, size_t size) const
+{
+    size_t      len = 0;
+    size_t      arg = 0;
+    const char *p   = format;
+
+    while( *p && (len + 1 < size) )
+    {
+        if( *p != '%' )
+        {
+            if( *p != '\n' )
+                buf[len++] = *p;
+
+            p++;
+            continue;
+        }
+
+
+        if( p[1] == '%' )
+        {
+            buf[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+
+        // %[flags][width][.precision][length]conversion
+        char        spec[32];
+        size_t      spec_len = 0;
+        const char *s        = p + 1;
+
+        spec[spec_len++] = '%';
+
+        while( *s && strchr("-+ #0123456789.", *s) && (spec_len < sizeof(spec) - 4) )
+            spec[spec_len++] = *s++;
+
+        while( *s && strchr("hlLqjzt", *s) )
+            s++;
+
+        char conv = *s;
+        if( !conv )
+            break;
+
+        p = s + 1;
+
+
+        int n;
+
+        if( arg >= args_cnt )
+        {
+            n = snprintf(buf + len, size - len, "<?>");
+        }
+        else if( strchr("diouxXc", conv) && (conv != 'c') )
+        {
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = conv;
+            spec[spec_len]   = '\0';
+
+            n = snprintf(buf + len, size - len, spec, args[arg].u);
+        }
+        else
+        {
+            spec[spec_len++] = conv;
+            spec[spec_len]   = '\0';
+
+            switch(types[arg])
+            {
+                case ARG_DOUBLE: n = snprintf(buf + len, size - len, strchr("eEfFgGaA", conv) ? spec : "%g", args[arg].d); break;
+                case ARG_STR:    n = snprintf(buf + len, size - len, (conv == 's') ? spec : "%s", &str_buf[args[arg].str]); break;
+                case ARG_PTR:    n = snprintf(buf + len, size - len, "%p", args[arg].p); break;
+                default:         n = snprintf(buf + len, size - len, (conv == 'c') ? spec : "%lld", args[arg].i); break;
+            }
+        }
+
+        arg++;
+
+        if( n < 0 )
+            break;
+
+        len += ((size_t)n < size - len) ? (size_t)n : size - len - 1;
+    }
+
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+
+
+size_t LogRecord::format_raw(char *buf, size_t size) const
+{
+    size_t      len = 0;
+    size_t      arg = 0;
+    const char *p   = format;
+
+    while( *p && (len + 1 < size) )
+    {
+        if( *p != '%' )
+        {
+            if( *p != '\n' )
+                buf[len++] = *p;
+
+            p++;
+            continue;
+        }
+
+
+        if( p[1] == '%' )
+        {
+            buf[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+
+        const char *s = p + 1;
+
+        while( *s && strchr("-+ #0123456789.hlLqjzt", *s) )
+            s++;
+
+        char conv = *s;
+        if( !conv )
+            break;
+
+        p = s + 1;
+
+
+        if( arg >= args_cnt )
+        {
+            len += put_str(buf + len, size - len, "<?>");
+            continue;
+        }
+
+        long long val = args[arg].i;
+
+        switch(types[arg])
+        {
+            case ARG_STR:    len += put_str (buf + len, size - len, &str_buf[args[arg].str]); break;
+            case ARG_UINT:   len += put_uint(buf + len, size - len, args[arg].u); break;
+            case ARG_PTR:    len += put_str (buf + len, size - len, "0x");
+                             len += put_uint(buf + len, size - len, (uintptr_t)args[arg].p, 0, 16); break;
+            case ARG_DOUBLE: val  = (long long)args[arg].d;
+                             /* fall through */
+            default:
+                if( (val < 0) && (len + 2 < size) )
+                {
+                    buf[len++] = '-';
+                    len += put_uint(buf + len, size - len, -(unsigned long long)val);
+                }
+                else
+                {
+                    len += put_uint(buf + len, size - len, (unsigned long long)val);
+                }
+                break;
+        }
+
+        arg++;
+    }
+
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+
+
+
+
+Logger::Logger():
+    ring       (RING_SIZE),
+    dropped_cnt(0),
+    fd         (STDERR_FILENO),
+    running    (false),
+    sleeping   (false),
+    wake_fd    (-1)
+{
+    busy.clear();
+
+    for(int i = 0; i < LOG_MOD_CNT; i++)
+        levels[i].store(LOG_LEVEL_INFO);
+}
+
+
+
+Logger::~Logger()
+{
+    stop();
+}
+
+
+
+bool Logger::set_level(const char *new_val)
+{
+    const char *colon = strchr(new_val, ':');
+    const char *level = colon ? colon + 1 : new_val;
+    int         module_idx = -1;
+    int         level_idx;
+
+
+    if( colon && !parse_name(new_val, colon - new_val, module_names, LOG_MOD_CNT, &module_idx) )
+    {
+        str_err = "module is bad, correct: main|net|auth|service|event";
+        return false;
+    }
+
+    if( !parse_name(level, strlen(level), level_names, LOG_LEVEL_CNT, &level_idx) )
+    {
+        str_err = "level is bad, correct: error|warn|info|debug";
+        return false;
+    }
+
+
+    for(int i = 0; i < LOG_MOD_CNT; i++)
+    {
+        if( (module_idx < 0) || (module_idx == i) )
+            levels[i].store(level_idx, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+
+
+bool Logger::start(const char *new_file)
+{
+    if( new_file )
+    {
+        fd = open(new_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if( fd < 0 )
+        {
+            str_err = std::string("can't open log file: ") + new_file + " - " + strerror(errno);
+            fd = STDERR_FILENO;
+            return false;
+        }
+
+        file = new_file;
+    }
+
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if( wake_fd < 0 )
+    {
+        str_err = std::string("can't create eventfd: ") + strerror(errno);
+        return false;
+    }
+
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags   = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+
+    for(int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT })
+        sigaction(sig, &sa, nullptr);
+
+
+    running = true;
+    thread  = std::thread(&Logger::run, this);
+
+    return true;
+}
+
+
+
+void Logger::stop()
+{
+    if( !running.exchange(false) )
+        return;
+
+    wake();
+
+    if( thread.joinable() )
+        thread.join();
+
+    close(wake_fd);
+    wake_fd = -1;
+
+    flush();
+}
+
+
+
+bool Logger::reopen()
+{
+    if( file.empty() )
+        return true; // stderr
+
+
+    int new_fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if( new_fd < 0 )
+    {
+        str_err = "can't open log file: " + file + " - " + strerror(errno);
+        return false;
+    }
+
+
+    // the thread keeps writing to the same fd, now it is the new file
+    int res = dup3(new_fd, fd, O_CLOEXEC);
+    close(new_fd);
+
+    if( res < 0 )
+    {
+        str_err = "can't reopen log file: " + file + " - " + strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+void Logger::flush()
+{
+    static char buf[WRITE_BUF];
+
+    if( busy.test_and_set() )
+        return;
+
+    drain(buf, sizeof(buf));
+
+    busy.clear();
+}
+
+
+
+void Logger::crash_flush()
+{
+    // the stack can be overflowed (SIGSEGV), so the buffer is not on it
+    static char buf[WRITE_BUF];
+
+    // the thread is draining the ring: it is waited for a while, not for
+    // ever (the crash can be in the drain of the thread itself)
+    struct timespec ts = { 0, 1000000 };
+    int             tries = CRASH_WAIT_MS;
+
+    while( busy.test_and_set() )
+    {
+        if( !tries-- )
+            return;
+
+        nanosleep(&ts, nullptr);
+    }
+
+    drain_raw(buf, sizeof(buf));
+
+    busy.clear();
+}
+
+
+
+std::string Logger::get_levels() const
+{
+    std::string str;
+
+    for(int i = 0; i < LOG_MOD_CNT; i++)
+    {
+        str += module_names[i];
+        str += ':';
+        str += level_names[levels[i].load(std::memory_order_relaxed)];
+        str += (i + 1 < LOG_MOD_CNT) ? " " : "";
+    }
+
+    return str;
+}
+
+
+
+const char* Logger::get_level_name(LogLevel level)
+{
+    return (level < LOG_LEVEL_CNT) ? level_names[level] : "unknown";
+}
+
+
+
+const char* Logger::get_module_name(LogModule module)
+{
+    return (module < LOG_MOD_CNT) ? module_names[module] : "unknown";
+}
+
+
+
+void Logger::begin_record(LogRecord &record, LogLevel level, LogModule module, const char *format)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);   // a few ns (vDSO), the resolution is a tick
+
+    record.time_ns  = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    record.format   = format;
+    record.level    = level;
+    record.module   = module;
+    record.args_cnt = 0;
+    record.str_len  = 0;
+}
+
+
+
+void Logger::push(const LogRecord &record)
+{
+    if( !ring.push(record) )
+    {
+        dropped_cnt.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+
+    // pairs with the fence of run(): either the thread sees the record
+    // or we see that it sleeps (only the first push wakes it)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if( sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false) )
+        wake();
+}
+
+
+
+void Logger::wake()
+{
+    eventfd_write(wake_fd, 1);
+}
+
+
+
+// pop all records, format them into buf and write it when it is full
+void Logger::drain(char *buf, size_t size)
+{
+    LogRecord record;
+    size_t    len = 0;
+
+    while( ring.pop(record) )
+    {
+        // "2024-01-31 12:00:00.123456 info  service: text\n"
+        time_t    sec = record.time_ns / 1000000000ull;
+        struct tm tm;
+        localtime_r(&sec, &tm);
+
+        if( size - len < 512 )
+        {
+            write_all(fd, buf, len);
+            len = 0;
+        }
+
+        len += strftime(buf + len, size - len, "%Y-%m-%d %H:%M:%S", &tm);
+        len += snprintf(buf + len, size - len, ".%06u %-5s %s: ",
+                        (unsigned)(record.time_ns % 1000000000ull / 1000),
+                        get_level_name(record.level), get_module_name(record.module));
+
+        len += record.format_text(buf + len, size - len - 1);
+        buf[len++] = '\n';
+    }
+
+
+    if( len )
+        write_all(fd, buf, len);
+}
+
+
+
+// "1706702400.123456 error main: text\n", the raw time: localtime_r is not async-signal-safe
+void Logger::drain_raw(char *buf, size_t size)
+{
+    LogRecord record;
+    size_t    len = 0;
+
+    while( ring.pop(record) )
+    {
+        if( size - len < 512 )
+        {
+            write_all(fd, buf, len);
+            len = 0;
+        }
+
+        len += put_uint(buf + len, size - len, record.time_ns / 1000000000ull);
+        buf[len++] = '.';
+        len += put_uint(buf + len, size - len, record.time_ns % 1000000000ull / 1000, 6);
+        buf[len++] = ' ';
+        len += put_str(buf + len, size - len, get_level_name(record.level));
+        buf[len++] = ' ';
+        len += put_str(buf + len, size - len, get_module_name(record.module));
+        len += put_str(buf + len, size - len, ": ");
+
+        len += record.format_raw(buf + len, size - len - 1);
+        buf[len++] = '\n';
+    }
+
+
+    if( len )
+        write_all(fd, buf, len);
+}
+
+
+
+void Logger::run()
+{
+    std::unique_ptr<char[]> buf(new char[WRITE_BUF]);
+    uint64_t                last_dropped = 0;
+    eventfd_t               val;
+
+    while( running.load() )
+    {
+        if( ring.empty() )
+        {
+            sleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // a push after the check above sees sleeping and wakes us
+            if( ring.empty() && running.load() )
+            {
+                if( (eventfd_read(wake_fd, &val) < 0) && (errno != EINTR) )
+                    break;
+            }
+
+            sleeping.store(false);
+            continue;
+        }
+
+
+        // the crash handler drains the ring now: the process is finished by it
+        if( busy.test_and_set() )
+        {
+            sched_yield();
+            continue;
+        }
+
+        drain(buf.get(), WRITE_BUF);
+
+        busy.clear();
+
+
+        uint64_t dropped = dropped_cnt.load(std::memory_order_relaxed);
+        if( dropped != last_dropped )
+        {
+            LOG_W(LOG_MOD_MAIN, "log: %llu records are dropped (ring is full)", (unsigned long long)(dropped - last_dropped));
+            last_dropped = dropped;
+        }
+    }
+}
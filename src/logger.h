@@ -0,0 +1,265 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+#include "ring_buffer.h"
+
+
+
+
+
+enum LogLevel : uint8_t
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+
+    LOG_LEVEL_CNT       //Its not level! Its counter for use in code (max index)
+};
+
+
+
+enum LogModule : uint8_t
+{
+    LOG_MOD_MAIN,       // main loop, options
+    LOG_MOD_NET,        // accept, IP filter, rate limits, TLS
+    LOG_MOD_AUTH,       // WS-UsernameToken, HTTP Digest, access classes
+    LOG_MOD_SERVICE,    // handlers of Device, Media, PTZ
+    LOG_MOD_EVENT,      // broker, push, ingestion
+
+    LOG_MOD_CNT         //Its not module! Its counter for use in code (max index)
+};
+
+
+
+// calls of higher levels are not compiled at all
+#ifndef LOG_COMPILE_LEVEL
+    #ifdef DEBUG
+        #define LOG_COMPILE_LEVEL  LOG_LEVEL_DEBUG
+    #else
+        #define LOG_COMPILE_LEVEL  LOG_LEVEL_INFO
+    #endif
+#endif
+
+
+
+#define LOG_MSG(level, module, ...)                                           \
+        do {                                                                  \
+            if( ((level) <= LOG_COMPILE_LEVEL) && logger.is_enabled(level, module) ) \
+                logger.write(level, module, __VA_ARGS__);                     \
+        } while(0)
+
+
+#define LOG_E(module, ...)  LOG_MSG(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_W(module, ...)  LOG_MSG(LOG_LEVEL_WARN,  module, __VA_ARGS__)
+#define LOG_I(module, ...)  LOG_MSG(LOG_LEVEL_INFO,  module, __VA_ARGS__)
+#define LOG_D(module, ...)  LOG_MSG(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+
+
+
+
+
+/*
+ * A message as it is queued: the format is not applied on the hot path.
+ * The format must be a string literal (it is kept by pointer), the args
+ * are copied (strings into str_buf, cut if there is no room), the text
+ * is made by the thread of Logger.
+ */
+struct LogRecord
+{
+    enum
+    {
+        MAX_ARGS     = 10,
+        STR_BUF_SIZE = 120
+    };
+
+    enum ArgType : uint8_t
+    {
+        ARG_INT,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_STR,
+        ARG_PTR
+    };
+
+    union Arg
+    {
+        long long           i;
+        unsigned long long  u;
+        double              d;
+        const void         *p;
+        uint32_t            str;    // offset in str_buf
+    };
+
+
+    uint64_t     time_ns;           // CLOCK_REALTIME_COARSE
+    const char  *format;
+    LogLevel     level;
+    LogModule    module;
+    uint8_t      args_cnt;
+    uint8_t      str_len;
+    ArgType      types[MAX_ARGS];
+    Arg          args [MAX_ARGS];
+    char         str_buf[STR_BUF_SIZE];
+
+
+    void add(const char *str);
+    void add(const std::string &str) { add(str.c_str()); }
+    void add(char *str)              { add((const char *)str); }
+    void add(double val)             { set(ARG_DOUBLE).d = val; }
+    void add(float  val)             { set(ARG_DOUBLE).d = val; }
+    void add(const void *ptr)        { set(ARG_PTR).p    = ptr; }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    add(T val)
+    {
+        if( std::is_signed<T>::value )
+            set(ARG_INT).i  = (long long)val;
+        else
+            set(ARG_UINT).u = (unsigned long long)val;
+    }
+
+
+    Arg& set(ArgType type);
+
+    // the text without '\n', returns its length
+    size_t format_text(char *buf, size_t size) const;
+
+    // the same by the crash handler: no snprintf (it is not async-signal-safe),
+    // the args are put without width/precision, doubles by the integer part
+    size_t format_raw(char *buf, size_t size) const;
+};
+
+
+
+
+
+/*
+ * Asynchronous logger.
+ *
+ * LOG_x(module, "fmt", args...) checks the level of the module (one relaxed
+ * load), copies the args into a LogRecord and pushes it into a lock-free
+ * MPMC ring (RingBuffer), so a call takes a fraction of usec and never
+ * blocks: if the ring is full the record is dropped (and counted).
+ * The thread of Logger drains the ring, formats the records and writes
+ * them to the log file (see --log_file) or stderr in big writes. When the
+ * ring is empty it sleeps on an eventfd, the push that finds it asleep
+ * wakes it (a busy log costs no syscall per record).
+ *
+ * Levels: compile-time LOG_COMPILE_LEVEL (debug in debug builds, info
+ * otherwise) and runtime per module (--log_level).
+ * On a crash signal (SEGV, BUS, FPE, ILL, ABRT) the ring is flushed by
+ * the signal handler before the default action: the records are written
+ * by write() with the raw time (see format_raw) after the drain of the
+ * thread (if any) is finished.
+ */
+class Logger
+{
+    public:
+
+        enum
+        {
+            RING_SIZE     = 4096,     // records, must be a power of two
+            WRITE_BUF     = 64 * 1024,
+            CRASH_WAIT_MS = 100       // the crash handler waits for the drain of the thread
+        };
+
+
+        Logger();
+       ~Logger();
+
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_level(const char *new_val);    // "level" or "module:level"
+
+
+        bool is_enabled(LogLevel level, LogModule module) const
+        {
+            return level <= levels[module].load(std::memory_order_relaxed);
+        }
+
+        template<typename... Args>
+        void write(LogLevel level, LogModule module, const char *format, Args... args)
+        {
+            static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "too many args for LOG");
+
+            LogRecord record;
+            begin_record(record, level, module, format);
+
+            int dummy[] = { 0, (record.add(args), 0)... };
+            (void)dummy;
+
+            push(record);
+        }
+
+
+        // file is nullptr - stderr
+        bool start(const char *file);
+        void stop();
+
+        // open the log file again (it is rotated, see SIGHUP)
+        bool reopen();
+
+        // write all queued records now
+        void flush();
+
+        // the same for the crash handler, async-signal-safe
+        void crash_flush();
+
+
+        uint64_t    get_dropped_cnt() const { return dropped_cnt.load(); }
+        std::string get_levels()      const;
+
+        static const char* get_level_name (LogLevel  level);
+        static const char* get_module_name(LogModule module);
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        std::atomic<uint8_t>   levels[LOG_MOD_CNT];
+
+        RingBuffer<LogRecord>  ring;
+        std::atomic<uint64_t>  dropped_cnt;
+
+        int                    fd;
+        std::string            file;
+        std::thread            thread;
+        std::atomic<bool>      running;
+        std::atomic<bool>      sleeping;    // the thread waits on wake_fd
+        int                    wake_fd;     // eventfd
+        std::atomic_flag       busy;        // the ring is drained (thread, flush, crash)
+
+        std::string            str_err;
+
+
+        void begin_record(LogRecord &record, LogLevel level, LogModule module, const char *format);
+        void push(const LogRecord &record);
+        void drain(char *buf, size_t size);
+        void drain_raw(char *buf, size_t size);
+        void wake();
+        void run();
+};
+
+
+
+extern Logger logger;
+
+
+
+
+
+#endif // LOGGER_H
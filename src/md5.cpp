@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "md5.h"
+
+
+
+
+
+static const uint32_t K[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+
+static const uint8_t R[64] =
+{
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+
+
+void Md5::reset()
+{
+    state[0]  = 0x67452301;
+    state[1]  = 0xefcdab89;
+    state[2]  = 0x98badcfe;
+    state[3]  = 0x10325476;
+    total     = 0;
+    block_len = 0;
+}
+
+
+
+void Md5::update(const void *data, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+
+    total += len;
+
+
+    if( block_len )
+    {
+        size_t n = MD5_BLOCK_SIZE - block_len;
+        if( n > len )
+            n = len;
+
+        memcpy(block + block_len, ptr, n);
+        block_len += n;
+        ptr       += n;
+        len       -= n;
+
+        if( block_len < MD5_BLOCK_SIZE )
+            return;
+
+        transform(block);
+        block_len = 0;
+    }
+
+
+    for( ; len >= MD5_BLOCK_SIZE; ptr += MD5_BLOCK_SIZE, len -= MD5_BLOCK_SIZE)
+        transform(ptr);
+
+
+    memcpy(block, ptr, len);
+    block_len = len;
+}
+
+
+
+void Md5::final(uint8_t digest[MD5_DIGEST_SIZE])
+{
+    uint64_t bits = total * 8;
+
+
+    block[block_len++] = 0x80;
+
+    if( block_len > MD5_BLOCK_SIZE - 8 )
+    {
+        memset(block + block_len, 0, MD5_BLOCK_SIZE - block_len);
+        transform(block);
+        block_len = 0;
+    }
+
+    memset(block + block_len, 0, MD5_BLOCK_SIZE - 8 - block_len);
+
+    for(int i = 0; i < 8; i++)
+        block[MD5_BLOCK_SIZE - 8 + i] = bits >> (i * 8);
+
+    transform(block);
+
+
+    for(int i = 0; i < 4; i++)
+    {
+        digest[i*4 + 0] = state[i];
+        digest[i*4 + 1] = state[i] >> 8;
+        digest[i*4 + 2] = state[i] >> 16;
+        digest[i*4 + 3] = state[i] >> 24;
+    }
+
+
+    reset();
+}
+
+
+
+void Md5::final_hex(char hex[MD5_DIGEST_SIZE*2 + 1])
+{
+    static const char digits[] = "0123456789abcdef";
+
+    uint8_t digest[MD5_DIGEST_SIZE];
+    final(digest);
+
+    for(int i = 0; i < MD5_DIGEST_SIZE; i++)
+    {
+        hex[i*2]     = digits[digest[i] >> 4];
+        hex[i*2 + 1] = digits[digest[i] & 0x0F];
+    }
+
+    hex[MD5_DIGEST_SIZE*2] = '\0';
+}
+
+
+
+void Md5::transform(const uint8_t *data)
+{
+    uint32_t m[16];
+
+    for(int i = 0; i < 16; i++)
+        m[i] = (uint32_t)data[i*4] | (uint32_t)data[i*4 + 1] << 8 |
+               (uint32_t)data[i*4 + 2] << 16 | (uint32_t)data[i*4 + 3] << 24;
+
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    for(int i = 0; i < 64; i++)
+    {
+        uint32_t f;
+        int      g;
+
+        if( i < 16 )      { f = (b & c) | (~b & d); g = i;              }
+        else if( i < 32 ) { f = (d & b) | (~d & c); g = (5*i + 1) % 16; }
+        else if( i < 48 ) { f = b ^ c ^ d;          g = (3*i + 5) % 16; }
+        else              { f = c ^ (b | ~d);       g = (7*i) % 16;     }
+
+        uint32_t tmp = d;
+        d = c;
+        c = b;
+        b = b + rol(a + f + K[i] + m[g], R[i]);
+        a = tmp;
+    }
+
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
@@ -0,0 +1,48 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+
+
+#define MD5_DIGEST_SIZE  16
+#define MD5_BLOCK_SIZE   64
+
+
+
+/*
+ * MD5 (RFC 1321) for HTTP Digest authentication (RFC 2617).
+ * The context lives on the stack of the caller, no heap is used.
+ */
+class Md5
+{
+    public:
+
+        Md5() { reset(); }
+
+        void reset();
+        void update(const void *data, size_t len);
+        void final(uint8_t digest[MD5_DIGEST_SIZE]);
+
+        // final() as lowercase hex string (MD5_DIGEST_SIZE*2 chars + '\0')
+        void final_hex(char hex[MD5_DIGEST_SIZE*2 + 1]);
+
+
+    private:
+
+        uint32_t state[4];
+        uint64_t total;                 // bytes
+        uint8_t  block[MD5_BLOCK_SIZE];
+        size_t   block_len;
+
+        void transform(const uint8_t *data);
+};
+
+
+
+
+
+#endif // MD5_H
@@ -0,0 +1,352 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include "metrics.h"
+
+
+
+
+
+static uint64_t get(const std::atomic<uint64_t> &counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+
+
+// only the thread of the shard writes, so no atomic RMW is needed
+static void add(std::atomic<uint64_t> &counter, uint64_t val)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+}
+
+
+
+static void copy_name(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if( len >= size )
+        len = size - 1;
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+
+
+
+
+size_t LatencyHistogram::get_bucket(uint64_t us)
+{
+    if( us < SUB_BUCKETS )
+        return us;
+
+
+    int exp = 63 - __builtin_clzll(us);
+
+    if( exp >= MAX_EXP )
+        return BUCKETS - 1;
+
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + ((us >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+
+
+uint64_t LatencyHistogram::get_bucket_end(size_t idx)
+{
+    if( idx < SUB_BUCKETS )
+        return idx + 1;
+
+
+    int      exp   = idx / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub   = idx % SUB_BUCKETS;
+    uint64_t width = 1ull << (exp - SUB_BITS);
+
+    return ((SUB_BUCKETS + sub) << (exp - SUB_BITS)) + width;
+}
+
+
+
+
+
+Metrics::Metrics():
+    enabled   (false),
+    ops_cnt   (1),
+    shards_cnt(0)
+{
+    memset(op_names, 0, sizeof(op_names));
+    copy_name(op_names[UNKNOWN_OP].service,   "unknown", NAME_LEN);
+    copy_name(op_names[UNKNOWN_OP].operation, "unknown", NAME_LEN);
+
+    for(size_t i = 0; i < MAX_SHARDS; i++)
+        shards[i].store(nullptr);
+}
+
+
+
+Metrics::~Metrics()
+{
+    for(size_t i = 0; i < MAX_SHARDS; i++)
+        free(shards[i].load()); // Shard is trivially destructible
+}
+
+
+
+size_t Metrics::get_op(const char *service, const char *operation)
+{
+    if( !service || !operation )
+        return UNKNOWN_OP;
+
+
+    const char *colon = strchr(operation, ':');
+    if( colon )
+        operation = colon + 1;
+
+    size_t service_len = strlen(service);
+    const char *suffix = strstr(service, "BindingService");
+    if( suffix )
+        service_len = suffix - service;
+
+
+    size_t cnt = ops_cnt.load(std::memory_order_acquire);
+
+    for(size_t i = 1; i < cnt; i++)
+    {
+        if( !strncmp(op_names[i].service, service, service_len) && !op_names[i].service[service_len] &&
+            !strcmp(op_names[i].operation, operation) )
+            return i;
+    }
+
+
+    // a new operation (once per operation for all time)
+    std::lock_guard<std::mutex> lock(ops_mutex);
+
+    cnt = ops_cnt.load(std::memory_order_relaxed);
+    if( cnt >= MAX_OPS )
+        return UNKNOWN_OP;
+
+
+    copy_name(op_names[cnt].service, service, (service_len < NAME_LEN) ? service_len + 1 : (size_t)NAME_LEN);
+    copy_name(op_names[cnt].operation, operation, NAME_LEN);
+
+    ops_cnt.store(cnt + 1, std::memory_order_release);
+
+    return cnt;
+}
+
+
+
+void Metrics::connection_opened()
+{
+    if( enabled )
+        add(get_shard()->conn_opened, 1);
+}
+
+
+
+void Metrics::connection_closed()
+{
+    if( enabled )
+        add(get_shard()->conn_closed, 1);
+}
+
+
+
+void Metrics::record(size_t op, const RequestStat &stat, bool fault, uint64_t now_us)
+{
+    if( !enabled )
+        return;
+
+
+    OpCounters &counters = get_shard()->ops[(op < MAX_OPS) ? op : (size_t)UNKNOWN_OP];
+    uint64_t    time_us  = now_us - stat.start_us;
+
+    add(counters.requests,    1);
+    add(counters.faults,      fault);
+    add(counters.bytes_in,    stat.bytes_in);
+    add(counters.bytes_out,   stat.bytes_out);
+    add(counters.arena_bytes, stat.arena_bytes);
+    add(counters.time_us,     time_us);
+    add(counters.hist[LatencyHistogram::get_bucket(time_us)], 1);
+}
+
+
+
+void Metrics::render_value(std::string &out, const char *name, const char *type,
+                           const char *help, uint64_t val)
+{
+    char buf[256];
+
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+             name, help, name, type, name, (unsigned long long)val);
+
+    out += buf;
+}
+
+
+
+void Metrics::render(std::string &out) const
+{
+    char   buf[256];
+    size_t cnt        = ops_cnt.load(std::memory_order_acquire);
+    size_t shards_num = shards_cnt.load(std::memory_order_acquire);
+
+    if( shards_num > MAX_SHARDS )
+        shards_num = MAX_SHARDS;
+
+
+    uint64_t opened = 0, closed = 0;
+
+    for(size_t s = 0; s < shards_num; s++)
+    {
+        const Shard *shard = shards[s].load(std::memory_order_acquire);
+        if( shard )
+        {
+            opened += get(shard->conn_opened);
+            closed += get(shard->conn_closed);
+        }
+    }
+
+    render_value(out, "onvif_connections_total", "counter", "Accepted connections.", opened);
+    render_value(out, "onvif_connections_active", "gauge",  "Connections in progress.", opened - closed);
+
+
+    // counters of operations: sum of shards
+    static const struct
+    {
+        const char *name;
+        const char *help;
+        size_t      offset;
+    } op_values[] =
+    {
+        { "onvif_requests_total",       "Requests by operation.",                         offsetof(OpCounters, requests)    },
+        { "onvif_faults_total",         "Requests that ended with a SOAP fault.",         offsetof(OpCounters, faults)      },
+        { "onvif_request_bytes_total",  "Bytes received (HTTP header + body).",           offsetof(OpCounters, bytes_in)    },
+        { "onvif_response_bytes_total", "Bytes sent.",                                    offsetof(OpCounters, bytes_out)   },
+        { "onvif_arena_bytes_total",    "Bytes allocated by soap_malloc for requests.",   offsetof(OpCounters, arena_bytes) },
+    };
+
+
+    for(const auto &value : op_values)
+    {
+        snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s counter\n", value.name, value.help, value.name);
+        out += buf;
+
+        for(size_t op = 0; op < cnt; op++)
+        {
+            uint64_t sum = 0;
+
+            for(size_t s = 0; s < shards_num; s++)
+            {
+                const Shard *shard = shards[s].load(std::memory_order_acquire);
+                if( shard )
+                    sum += get(*(const std::atomic<uint64_t> *)((const char *)&shard->ops[op] + value.offset));
+            }
+
+            if( !sum && (value.offset != offsetof(OpCounters, requests)) )
+                continue;
+
+            snprintf(buf, sizeof(buf), "%s{service=\"%s\",operation=\"%s\"} %llu\n", value.name,
+                     op_names[op].service, op_names[op].operation, (unsigned long long)sum);
+            out += buf;
+        }
+    }
+
+
+    // latency histograms, "le" are the powers of two of usec (they are bounds of buckets)
+    out += "# HELP onvif_request_duration_seconds Time from accept to the sent response.\n"
+           "# TYPE onvif_request_duration_seconds histogram\n";
+
+    for(size_t op = 0; op < cnt; op++)
+    {
+        uint64_t hist[LatencyHistogram::BUCKETS] = {};
+        uint64_t total = 0, time_us = 0;
+
+        for(size_t s = 0; s < shards_num; s++)
+        {
+            const Shard *shard = shards[s].load(std::memory_order_acquire);
+            if( !shard )
+                continue;
+
+            for(size_t i = 0; i < LatencyHistogram::BUCKETS; i++)
+                hist[i] += get(shard->ops[op].hist[i]);
+
+            time_us += get(shard->ops[op].time_us);
+        }
+
+        for(size_t i = 0; i < LatencyHistogram::BUCKETS; i++)
+            total += hist[i];
+
+        if( !total )
+            continue;
+
+
+        uint64_t cumulative = 0;
+
+        for(size_t i = 0; i < LatencyHistogram::BUCKETS - 1; i++)
+        {
+            cumulative += hist[i];
+
+            uint64_t end = LatencyHistogram::get_bucket_end(i);
+
+            if( (end < 128) || (end & (end - 1)) )
+                continue;
+
+            snprintf(buf, sizeof(buf), "onvif_request_duration_seconds_bucket{service=\"%s\",operation=\"%s\",le=\"%.6f\"} %llu\n",
+                     op_names[op].service, op_names[op].operation, end / 1e6, (unsigned long long)cumulative);
+            out += buf;
+        }
+
+        snprintf(buf, sizeof(buf), "onvif_request_duration_seconds_bucket{service=\"%s\",operation=\"%s\",le=\"+Inf\"} %llu\n",
+                 op_names[op].service, op_names[op].operation, (unsigned long long)total);
+        out += buf;
+
+        snprintf(buf, sizeof(buf), "onvif_request_duration_seconds_sum{service=\"%s\",operation=\"%s\"} %.6f\n",
+                 op_names[op].service, op_names[op].operation, time_us / 1e6);
+        out += buf;
+
+        snprintf(buf, sizeof(buf), "onvif_request_duration_seconds_count{service=\"%s\",operation=\"%s\"} %llu\n",
+                 op_names[op].service, op_names[op].operation, (unsigned long long)total);
+        out += buf;
+    }
+}
+
+
+
+Metrics::Shard* Metrics::get_shard()
+{
+    static thread_local Shard *shard = nullptr;
+
+    if( shard )
+        return shard;
+
+
+    // the first record of the thread, the last shard is shared if there are too many threads
+    size_t idx = shards_cnt.fetch_add(1);
+
+    if( idx >= MAX_SHARDS )
+    {
+        while( !(shard = shards[MAX_SHARDS - 1].load(std::memory_order_acquire)) )
+            ; // its thread is allocating it
+
+        return shard;
+    }
+
+
+    // new of C++11 does not know the alignment of Shard
+    void *mem = nullptr;
+
+    if( posix_memalign(&mem, alignof(Shard), sizeof(Shard)) )
+        abort();
+
+    memset(mem, 0, sizeof(Shard));
+
+    Shard *new_shard = new(mem) Shard;
+    shards[idx].store(new_shard, std::memory_order_release);
+
+    shard = new_shard;
+
+    return shard;
+}
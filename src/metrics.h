@@ -0,0 +1,147 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+
+
+
+
+// what is known about the current request, it is filled by the main loop and the soap hooks
+struct RequestStat
+{
+    uint64_t start_us;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t arena_bytes;   // soap_malloc of the request (fmalloc)
+    uint64_t arena_allocs;
+};
+
+
+
+/*
+ * Latency histogram, HDR-like: log2 ranges of usec, every range is split into
+ * SUB_BUCKETS linear buckets, so the error of a value is < 1/SUB_BUCKETS
+ * of the value at any scale (1 usec .. MAX_EXP sec range).
+ */
+struct LatencyHistogram
+{
+    enum
+    {
+        SUB_BITS    = 2,
+        SUB_BUCKETS = 1 << SUB_BITS,
+        MAX_EXP     = 26,                           // 2^26 usec = 67 sec, longer ones are in the last
+        BUCKETS     = (MAX_EXP - SUB_BITS + 1) * SUB_BUCKETS
+    };
+
+    static size_t   get_bucket(uint64_t us);
+    static uint64_t get_bucket_end(size_t idx);     // first usec after the bucket
+};
+
+
+
+
+
+/*
+ * Counters of the daemon for Prometheus (text format 0.0.4), see GET /metrics.
+ *
+ * Operations get an id on the first request (service + name, the table is
+ * fixed: MAX_OPS), the unknown ones are counted as "unknown".
+ *
+ * Counters are written only by their thread: every thread that records
+ * gets its own Shard (cache-line aligned, allocated on the first record),
+ * a counter is a relaxed atomic with load + store (no lock prefix),
+ * the render sums the shards. So the hot path is a few plain stores.
+ */
+class Metrics
+{
+    public:
+
+        enum
+        {
+            MAX_OPS    = 64,
+            MAX_SHARDS = 8,         // threads that record
+            UNKNOWN_OP = 0,
+            NAME_LEN   = 48
+        };
+
+
+        Metrics();
+       ~Metrics();
+
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+
+        //methods for parsing opt from cmd
+        void set_enabled(bool new_val) { enabled = new_val; }
+        bool is_enabled() const { return enabled; }
+
+
+        // id of operation, service is like "MediaBindingService" (the suffix is cut)
+        size_t get_op(const char *service, const char *operation);
+
+        const char* get_service_name  (size_t op) const { return op_names[(op < MAX_OPS) ? op : (size_t)UNKNOWN_OP].service;   }
+        const char* get_operation_name(size_t op) const { return op_names[(op < MAX_OPS) ? op : (size_t)UNKNOWN_OP].operation; }
+
+        void   connection_opened();
+        void   connection_closed();
+        void   record(size_t op, const RequestStat &stat, bool fault, uint64_t now_us);
+
+
+        // the counters of operations and connections, others are added by the caller
+        void render(std::string &out) const;
+
+        static void render_value(std::string &out, const char *name, const char *type,
+                                 const char *help, uint64_t val);
+
+
+    private:
+
+        struct OpCounters
+        {
+            std::atomic<uint64_t> requests;
+            std::atomic<uint64_t> faults;
+            std::atomic<uint64_t> bytes_in;
+            std::atomic<uint64_t> bytes_out;
+            std::atomic<uint64_t> arena_bytes;
+            std::atomic<uint64_t> time_us;
+            std::atomic<uint64_t> hist[LatencyHistogram::BUCKETS];
+        };
+
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> conn_opened;
+            std::atomic<uint64_t> conn_closed;
+            OpCounters            ops[MAX_OPS];
+        };
+
+        struct OpName
+        {
+            char service  [NAME_LEN];
+            char operation[NAME_LEN];
+        };
+
+
+        bool                 enabled;
+
+        OpName               op_names[MAX_OPS];
+        std::atomic<size_t>  ops_cnt;
+        std::mutex           ops_mutex;         // only for a new operation
+
+        std::atomic<Shard*>  shards[MAX_SHARDS];
+        std::atomic<size_t>  shards_cnt;
+
+
+        Shard* get_shard();
+};
+
+
+
+
+
+#endif // METRICS_H
@@ -4,17 +4,29 @@
 #include <errno.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <vector>
 
 
 #include "daemon.h"
 #include "smacros.h"
 #include "ServiceContext.h"
+#include "control_socket.h"
+#include "soap_dispatch.h"
 
 // ---- gsoap ----
 #include "DeviceBinding.nsmap"
 #include "soapDeviceBindingService.h"
 #include "soapMediaBindingService.h"
 #include "soapPTZBindingService.h"
+#include "soapEventBindingService.h"
+#include "soapPullPointSubscriptionBindingService.h"
+#include "soapSubscriptionManagerBindingService.h"
+#include "soapNotificationProducerBindingService.h"
 
 
 
@@ -40,10 +52,32 @@ static const char *help_str =
         "       --no_fork              Don't do fork\n"
         "       --no_close             Don't close standart IO files\n"
         "       --pid_file     [value] Set pid file name\n"
-        "       --log_file     [value] Set log file name\n\n"
+        "       --log_file     [value] Set log file name\n"
+        "       --log_level    [value] Set log level: [module:]level (default = info)\n"
+        "                              module: main|net|auth|service|event, level: error|warn|info|debug\n"
+        "       --cmd_pipe     [value] Set control socket name (Unix socket, see help command)\n\n"
         "       --port         [value] Set socket port for Services   (default = 1000)\n"
         "       --user         [value] Set user name for Services     (default = admin)\n"
         "       --password     [value] Set user password for Services (default = admin)\n"
+        "       --users_file   [value] Set file of users (CreateUsers, ...) (default don't set)\n"
+        "                              if it does not exist, it is created with --user/--password\n"
+        "       --no_auth              Don't check credentials (WS-UsernameToken, HTTP Digest) of requests\n"
+        "       --tls_port     [value] Set socket port for HTTPS listener (default don't set)\n"
+        "       --tls_cert     [value] Set cert file (PEM, chain) for HTTPS listener\n"
+        "       --tls_key      [value] Set private key file (PEM) for HTTPS (default = in cert file)\n"
+        "       --tls_only             Don't listen HTTP (only --tls_port)\n"
+        "       --rate_limit   [value] Set limit of requests per client IP: class:rate[:burst] (per sec)\n"
+        "                              class: connect|discovery|media|control|system (default no limits)\n"
+        "       --metrics              Enable counters of requests (Prometheus text: GET /metrics)\n"
+        "       --trace                Keep timings of phases of last requests (Chrome JSON: GET /trace.json)\n"
+        "       --trace_slow   [value] Log timings of phases of requests slower than value ms (default don't set)\n"
+        "       --alloc_profile        Count soap_malloc and C++ objects of requests by operation (see cmd_pipe)\n"
+        "       --arena_cap    [value] Keep slabs of soap_malloc between requests up to value KB (default don't use)\n"
+        "       --record       [value] Append raw requests to file for onvif_replay (default don't set)\n"
+        "       --reject_unimplemented Answer unimplemented operations with ActionNotSupported (default empty OK)\n"
+        "       --limit        [value] Set limit of one request: type:value (body, arena in KB) (default no limits)\n"
+        "                              type: body|depth|elements|arena, the option can be repeated\n"
+        "       --single_send          Send every response (HTTP header + body) by one send()\n"
         "       --model        [value] Set model device for Services  (default = Model)\n"
         "       --scope        [value] Set scope for Services         (default don't set)\n"
         "       --ifs          [value] Set Net interfaces for work    (default don't set)\n"
@@ -66,7 +100,8 @@ static const char *help_str =
         "       --move_up      [value] Set process to call for PTZ tilt up movement\n"
         "       --move_down    [value] Set process to call for PTZ tilt down movement\n"
         "       --move_stop    [value] Set process to call for PTZ stop movement\n"
-        "       --move_preset  [value] Set process to call for PTZ goto preset movement\n"
+        "       --move_preset  [value] Set process to call for PTZ goto preset movement\n\n"
+        "       --event_socket [value] Set Unix socket path for ingestion of events (default don't set)\n"
         "  -v,  --version              Display daemon version\n"
         "  -h,  --help                 Display this help\n\n";
 
@@ -87,11 +122,29 @@ namespace LongOpts
         no_close,
         pid_file,
         log_file,
+        log_level,
+        cmd_pipe,
 
         //ONVIF Service options (context)
         port,
         user,
         password,
+        users_file,
+        no_auth,
+        tls_port,
+        tls_cert,
+        tls_key,
+        tls_only,
+        rate_limit,
+        metrics,
+        trace,
+        trace_slow,
+        alloc_profile,
+        arena_cap,
+        record,
+        reject_unimplemented,
+        limit,
+        single_send,
         manufacturer,
         model,
         firmware_ver,
@@ -116,7 +169,10 @@ namespace LongOpts
         move_up,
         move_down,
         move_stop,
-        move_preset
+        move_preset,
+
+        //Events
+        event_socket
     };
 }
 
@@ -136,11 +192,29 @@ static const struct option long_opts[] =
     { "no_close",     no_argument,       NULL, LongOpts::no_close      },
     { "pid_file",     required_argument, NULL, LongOpts::pid_file      },
     { "log_file",     required_argument, NULL, LongOpts::log_file      },
+    { "log_level",    required_argument, NULL, LongOpts::log_level     },
+    { "cmd_pipe",     required_argument, NULL, LongOpts::cmd_pipe      },
 
     //ONVIF Service options (context)
     { "port",         required_argument, NULL, LongOpts::port          },
     { "user",         required_argument, NULL, LongOpts::user          },
     { "password",     required_argument, NULL, LongOpts::password      },
+    { "users_file",   required_argument, NULL, LongOpts::users_file    },
+    { "no_auth",      no_argument,       NULL, LongOpts::no_auth       },
+    { "tls_port",     required_argument, NULL, LongOpts::tls_port      },
+    { "tls_cert",     required_argument, NULL, LongOpts::tls_cert      },
+    { "tls_key",      required_argument, NULL, LongOpts::tls_key       },
+    { "tls_only",     no_argument,       NULL, LongOpts::tls_only      },
+    { "rate_limit",   required_argument, NULL, LongOpts::rate_limit    },
+    { "metrics",      no_argument,       NULL, LongOpts::metrics       },
+    { "trace",        no_argument,       NULL, LongOpts::trace         },
+    { "trace_slow",   required_argument, NULL, LongOpts::trace_slow    },
+    { "alloc_profile",no_argument,       NULL, LongOpts::alloc_profile },
+    { "arena_cap",    required_argument, NULL, LongOpts::arena_cap     },
+    { "record",       required_argument, NULL, LongOpts::record        },
+    { "reject_unimplemented", no_argument, NULL, LongOpts::reject_unimplemented },
+    { "limit",        required_argument, NULL, LongOpts::limit         },
+    { "single_send",  no_argument,       NULL, LongOpts::single_send   },
     { "manufacturer", required_argument, NULL, LongOpts::manufacturer  },
     { "model",        required_argument, NULL, LongOpts::model         },
     { "firmware_ver", required_argument, NULL, LongOpts::firmware_ver  },
@@ -167,6 +241,9 @@ static const struct option long_opts[] =
     { "move_stop",     required_argument, NULL, LongOpts::move_stop    },
     { "move_preset",   required_argument, NULL, LongOpts::move_preset  },
 
+    //Events
+    { "event_socket",  required_argument, NULL, LongOpts::event_socket },
+
     { NULL,           no_argument,       NULL,  0                      }
 };
 
@@ -178,6 +255,10 @@ static const struct option long_opts[] =
         APPLY(DeviceBindingService, soap)               \
         APPLY(MediaBindingService, soap)                \
         APPLY(PTZBindingService, soap)                  \
+        APPLY(EventBindingService, soap)                \
+        APPLY(PullPointSubscriptionBindingService, soap)\
+        APPLY(SubscriptionManagerBindingService, soap)  \
+        APPLY(NotificationProducerBindingService, soap) \
 
 
 /*
@@ -196,22 +277,26 @@ static const struct option long_opts[] =
         APPLY(SearchBindingService, soap)                \
         APPLY(ReceiverBindingService, soap)              \
         APPLY(DisplayBindingService, soap)               \
-        APPLY(EventBindingService, soap)                 \
-        APPLY(PullPointSubscriptionBindingService, soap) \
-        APPLY(NotificationProducerBindingService, soap)  \
-        APPLY(SubscriptionManagerBindingService, soap)   \
 */
 
 
 #define DECLARE_SERVICE(service, soap) service service ## _inst(soap);
 
+// the tables are appended to the generated services (cmake/dispatch_table.cmake)
+#define DECLARE_OPERATIONS(service, soap) extern const SoapOperation service ## _operations[];
+
+#define REGISTER_SERVICE(service, soap) dispatcher.add_service(#service, &service ## _inst, service ## _operations);
+
 #define DISPATCH_SERVICE(service, soap)                                  \
-                else if (service ## _inst.dispatch() != SOAP_NO_METHOD) {\
-                    soap_send_fault(soap);                               \
-                    soap_stream_fault(soap, std::cerr);                  \
+                else if ((dispatch_err = service ## _inst.dispatch()) != SOAP_NO_METHOD) {\
+                    dispatch_service = #service;                         \
+                    send_fault(soap);                                    \
                 }
 
 
+FOREACH_SERVICE(DECLARE_OPERATIONS, soap)
+
+
 
 
 static struct soap *soap;
@@ -219,6 +304,40 @@ static struct soap *soap;
 ServiceContext service_ctx;
 
 
+// namespaces of gsoap + namespaces that are used only in text (topics of events)
+static std::vector<struct Namespace> service_namespaces;
+
+
+// default parser of HTTP headers of gsoap and our one (checks HTTP Digest)
+static int (*http_parse_header)(struct soap*, const char*, const char*);
+static int   parse_http_header (struct soap*, const char*, const char*);
+static void  send_challenge    (struct soap*, bool, time_t);
+
+
+// default I/O and allocator of gsoap and our ones (they count and trace the current request)
+static int    (*soap_fsend)  (struct soap*, const char*, size_t);
+static size_t (*soap_frecv)  (struct soap*, char*, size_t);
+static int    (*soap_fget)   (struct soap*);
+static int    (*soap_fpreparefinalrecv)(struct soap*);
+static int    (*soap_fprepareinitsend) (struct soap*);
+
+// output of gsoap under the counting hooks: the response is sent by one send() (see response_writer.h)
+static int    (*raw_fsend)     (struct soap*, const char*, size_t);
+static int    (*soap_fresponse)(struct soap*, int, ULONG64);
+static int    (*soap_fpreparefinalsend)(struct soap*);
+static int    (*soap_fclose)   (struct soap*);
+
+// default close of gsoap under drain_close (a fault to a request that is not read)
+static int    (*unread_fclose) (struct soap*);
+static bool   drain_on_close;
+
+static RequestStat request_stat;
+
+static ControlSocket  control_socket;
+static SoapDispatcher dispatcher;       // operations of all services (FOREACH_SERVICE)
+static int            hup_fd = -1;      // signalfd of SIGHUP
+
+
 
 
 
@@ -232,8 +351,14 @@ void daemon_exit_handler(int sig)
     soap_free(soap);    // free the context
 
 
+    service_ctx.get_recorder()->stop(); // the buffered records are written
+
     unlink(daemon_info.pid_file);
 
+    control_socket.stop();
+
+    logger.stop();      // the queued messages are written
+
 
     exit(EXIT_SUCCESS); // good job (we interrupted (finished) main loop)
 }
@@ -249,7 +374,17 @@ void init_signals(void)
     set_sig_handler(SIGTSTP, SIG_IGN); // ignore tty signals
     set_sig_handler(SIGTTOU, SIG_IGN);
     set_sig_handler(SIGTTIN, SIG_IGN);
-    set_sig_handler(SIGHUP,  SIG_IGN);
+
+
+    // SIGHUP - reload, it is read by the main loop from signalfd, so it never interrupts a request,
+    // it is blocked before any thread is started (the threads inherit the mask)
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+
+    if( (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) ||
+        ((hup_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) )
+        daemon_error_exit("Can't create signalfd for SIGHUP: %m\n");
 }
 
 
@@ -298,6 +433,16 @@ void processing_cmd(int argc, char *argv[])
                         daemon_info.log_file = optarg;
                         break;
 
+            case LongOpts::log_level:
+                        if( !logger.set_level(optarg) )
+                            daemon_error_exit("Can't set log level: %s\n", logger.get_cstr_err());
+
+                        break;
+
+            case LongOpts::cmd_pipe:
+                        daemon_info.cmd_pipe = optarg;
+                        break;
+
 
             //ONVIF Service options (context)
             case LongOpts::port:
@@ -312,6 +457,88 @@ void processing_cmd(int argc, char *argv[])
                         service_ctx.password = optarg;
                         break;
 
+            case LongOpts::users_file:
+                        if( !service_ctx.get_user_store()->set_file(optarg) )
+                            daemon_error_exit("Can't set users file: %s\n", service_ctx.get_user_store()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::no_auth:
+                        service_ctx.auth = false;
+                        break;
+
+            case LongOpts::tls_port:
+                        if( !service_ctx.get_tls_server()->set_port(optarg) )
+                            daemon_error_exit("Can't set TLS port: %s\n", service_ctx.get_tls_server()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::tls_cert:
+                        if( !service_ctx.get_tls_server()->set_cert_file(optarg) )
+                            daemon_error_exit("Can't set TLS cert: %s\n", service_ctx.get_tls_server()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::tls_key:
+                        if( !service_ctx.get_tls_server()->set_key_file(optarg) )
+                            daemon_error_exit("Can't set TLS key: %s\n", service_ctx.get_tls_server()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::tls_only:
+                        service_ctx.get_tls_server()->set_only(true);
+                        break;
+
+            case LongOpts::rate_limit:
+                        if( !service_ctx.get_rate_limiter()->set_limit(optarg) )
+                            daemon_error_exit("Can't set rate limit: %s\n", service_ctx.get_rate_limiter()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::metrics:
+                        service_ctx.get_metrics()->set_enabled(true);
+                        break;
+
+            case LongOpts::trace:
+                        service_ctx.get_tracer()->set_enabled(true);
+                        break;
+
+            case LongOpts::trace_slow:
+                        if( !service_ctx.get_tracer()->set_slow_ms(optarg) )
+                            daemon_error_exit("Can't set threshold of slow requests: %s\n", service_ctx.get_tracer()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::alloc_profile:
+                        service_ctx.get_alloc_profiler()->set_enabled(true);
+                        break;
+
+            case LongOpts::arena_cap:
+                        if( !service_ctx.get_arena()->set_cap(optarg) )
+                            daemon_error_exit("Can't set cap of arena: %s\n", service_ctx.get_arena()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::record:
+                        if( !service_ctx.get_recorder()->set_file(optarg) )
+                            daemon_error_exit("Can't set record file: %s\n", service_ctx.get_recorder()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::reject_unimplemented:
+                        dispatcher.set_reject_unimplemented(true);
+                        break;
+
+            case LongOpts::limit:
+                        if( !service_ctx.get_request_limits()->set_limit(optarg) )
+                            daemon_error_exit("Can't set limit of request: %s\n", service_ctx.get_request_limits()->get_cstr_err());
+
+                        break;
+
+            case LongOpts::single_send:
+                        service_ctx.get_response_writer()->set_enabled(true);
+                        break;
+
             case LongOpts::manufacturer:
                         service_ctx.manufacturer = optarg;
                         break;
@@ -447,6 +674,14 @@ void processing_cmd(int argc, char *argv[])
                         break;
 
 
+            //Events
+            case LongOpts::event_socket:
+                        if( !service_ctx.get_event_ingest()->set_socket_path(optarg) )
+                            daemon_error_exit("Can't set event socket: %s\n", service_ctx.get_event_ingest()->get_cstr_err());
+
+                        break;
+
+
             default:
                         puts("for more detail see help\n\n");
                         exit_if_not_daemonized(EXIT_FAILURE);
@@ -469,76 +704,1220 @@ void check_service_ctx(void)
 
     if(service_ctx.get_profiles().empty())
         daemon_error_exit("Error: not set no one profile more details see --help\n");
+
+
+    auto tls = service_ctx.get_tls_server();
+
+    if(tls->is_enabled() && !tls->is_only() && (tls->get_port() == service_ctx.port))
+        daemon_error_exit("Error: --tls_port must differ from --port\n");
 }
 
 
 
-void init_gsoap(void)
+void init_namespaces(void)
 {
-    soap = soap_new();
+    for(const struct Namespace *ns = namespaces; ns->id; ns++)
+        service_namespaces.push_back(*ns);
 
-    if(!soap)
-        daemon_error_exit("Can't get mem for SOAP\n");
+    service_namespaces.push_back({EVENT_TOPIC_PREFIX, EVENT_TOPIC_NAMESPACE, nullptr, nullptr});
+    service_namespaces.push_back({"ter", "http://www.onvif.org/ver10/error", nullptr, nullptr});
+    service_namespaces.push_back({nullptr, nullptr, nullptr, nullptr});
+
+    soap_set_namespaces(soap, service_namespaces.data());
+}
 
 
-    soap->bind_flags = SO_REUSEADDR;
 
-    if( !soap_valid_socket(soap_bind(soap, NULL, service_ctx.port, 10)) )
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+
+static uint64_t now_ms(void)
+{
+    return now_us() / 1000;
+}
+
+
+
+static int count_send(struct soap *soap, const char *buf, size_t len)
+{
+    request_stat.bytes_out += len;
+    service_ctx.get_tracer()->mark(TRACE_SEND, now_us());
+    return soap_fsend(soap, buf, len);
+}
+
+
+
+static int store_response(struct soap *soap, int status, ULONG64 count)
+{
+    service_ctx.get_response_writer()->begin();
+    return soap_fresponse(soap, status, count);
+}
+
+
+
+static int store_send(struct soap *soap, const char *buf, size_t len)
+{
+    auto writer = service_ctx.get_response_writer();
+
+    if( !writer->is_storing() )
+        return raw_fsend(soap, buf, len);
+
+    writer->append(buf, len);
+    return SOAP_OK;
+}
+
+
+
+// plain HTTP: one send() of the whole response, over TLS (or the rest of a big one) - fsend of gsoap
+static int flush_response(struct soap *soap)
+{
+    auto writer = service_ctx.get_response_writer();
+
+    if( !writer->is_pending() )
     {
-        soap_stream_fault(soap, std::cerr);
-        exit(EXIT_FAILURE);
+        writer->clear();
+        return SOAP_OK;
     }
 
-    soap->send_timeout = 3; // timeout in sec
-    soap->recv_timeout = 3; // timeout in sec
+    size_t sent = TlsServer::is_secure(soap) ? 0 : writer->send(soap->socket);
+    int    err  = SOAP_OK;
 
+    if( sent < writer->size() )
+        err = raw_fsend(soap, writer->data() + sent, writer->size() - sent);
 
-    //save pointer of service_ctx in soap
-    soap->user = (void*)&service_ctx;
+    writer->clear();
+
+    return err;
 }
 
 
 
-void init(void *data)
+static int flush_final_send(struct soap *soap)
 {
-    UNUSED(data);
-    init_signals();
-    check_service_ctx();
-    init_gsoap();
+    int err = flush_response(soap);
+    if( err != SOAP_OK )
+        return err;
+
+    return soap_fpreparefinalsend ? soap_fpreparefinalsend(soap) : SOAP_OK;
 }
 
 
 
-int main(int argc, char *argv[])
+static int flush_close(struct soap *soap)
 {
-    processing_cmd(argc, argv);
-    daemonize2(init, nullptr);
+    flush_response(soap);
+    return soap_fclose ? soap_fclose(soap) : SOAP_OK;
+}
 
-    FOREACH_SERVICE(DECLARE_SERVICE, soap)
 
-    while( true )
+
+/*
+ * The rest of a request that is answered without reading it is read and dropped
+ * (up to DRAIN_MAX bytes, DRAIN_MS or EOF of the client) after shutdown(SHUT_WR):
+ * close() with unread data sends RST and the client can lose the reply.
+ */
+static void drain_request(int sd)
+{
+    enum
     {
-        // wait new client
-        if( !soap_valid_socket(soap_accept(soap)) )
-        {
-            soap_stream_fault(soap, std::cerr);
-            return EXIT_FAILURE;
-        }
+        DRAIN_MAX = 256 * 1024,
+        DRAIN_MS  = 100
+    };
 
+    char     buf[4096];
+    size_t   total    = 0;
+    uint64_t deadline = now_us() + DRAIN_MS * 1000;
 
-        // process service
-        if( soap_begin_serve(soap) )
-        {
-            soap_stream_fault(soap, std::cerr);
-        }
-        FOREACH_SERVICE(DISPATCH_SERVICE, soap)
-        else
-        {
-            DEBUG_MSG("Unknown service\n");
-        }
+    while( total < DRAIN_MAX )
+    {
+        uint64_t now = now_us();
+        if( now >= deadline )
+            break;
 
-        soap_destroy(soap); // delete managed C++ objects
-        soap_end(soap);     // delete managed memory
+        struct pollfd pfd = { sd, POLLIN, 0 };
+        if( poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) <= 0 )
+            break;
+
+        ssize_t len = recv(sd, buf, sizeof(buf), MSG_DONTWAIT);
+        if( len <= 0 )
+            break;
+
+        total += len;
+    }
+}
+
+
+
+// the reply to a request that is not read is sent: shut down the write side and drain
+static void drain_unread(struct soap *soap)
+{
+    // over TLS the write side stays open: close_notify (SSL_shutdown) after it would raise SIGPIPE
+    if( !TlsServer::is_secure(soap) )
+        shutdown(soap->socket, SHUT_WR);
+
+    drain_request(soap->socket);
+}
+
+
+
+/*
+ * 413 of a request over a limit (pre-rendered), it is sent at once from the hook
+ * that found it. The fault of gsoap (EOF, EOM) can't follow the reply: send_fault
+ * skips it and the write side is shut down (not over TLS, see drain_unread).
+ * The rest of the request is drained, so the close does not reset the
+ * connection before the client reads the 413.
+ */
+static void reject_request(struct soap *soap)
+{
+    auto limits = service_ctx.get_request_limits();
+
+    LOG_D(LOG_MOD_NET, "Limits: request of %s is over the %s limit", soap->host,
+          RequestLimits::get_type_name(limits->get_exceeded()));
+
+    service_ctx.get_response_writer()->clear(); // the stored part of a response is dropped
+
+    const std::string &reply = limits->get_reply();
+    soap->fsend(soap, reply.data(), reply.size());
+
+    drain_unread(soap);
+}
+
+
+
+/*
+ * The fault of soap_send_fault is closed by gsoap itself (keep-alive off),
+ * so a request answered unread is drained from fclose: after the stored
+ * response is flushed (flush_close) and before the socket is closed.
+ */
+static int drain_close(struct soap *soap)
+{
+    if( drain_on_close && soap_valid_socket(soap->socket) )
+        drain_unread(soap);
+
+    drain_on_close = false;
+
+    return unread_fclose ? unread_fclose(soap) : SOAP_OK;
+}
+
+
+
+static size_t count_recv(struct soap *soap, char *buf, size_t len)
+{
+    auto limits = service_ctx.get_request_limits();
+    if( limits->is_exceeded() )
+        return 0;   // EOF for gsoap
+
+    size_t res = soap_frecv(soap, buf, len);
+    request_stat.bytes_in += res;
+    service_ctx.get_recorder()->append(buf, res);
+
+    if( limits->is_enabled() && !limits->check_recv(buf, res) )
+    {
+        reject_request(soap);
+        return 0;
+    }
+
+    return res;
+}
+
+
+
+static void* count_malloc(struct soap *soap, size_t size)
+{
+    auto limits = service_ctx.get_request_limits();
+    if( limits->is_exceeded() )
+        return nullptr; // EOM for gsoap
+
+    if( limits->is_enabled() && !limits->check_alloc(size) )
+    {
+        reject_request(soap);
+        return nullptr;
+    }
+
+    request_stat.arena_bytes += size;
+    request_stat.arena_allocs++;
+
+    auto arena = service_ctx.get_arena();
+    if( arena->is_enabled() )
+        return arena->alloc(size);  // reset() rewinds it after soap_end
+
+
+    // a block of fmalloc is not chained into soap->alist, soap_end would not free it:
+    // it is taken by soap_malloc itself (the hook is off for the call)
+    soap->fmalloc = nullptr;
+    void *ptr     = soap_malloc(soap, size);
+    soap->fmalloc = count_malloc;
+
+    return ptr;
+}
+
+
+
+// soap_malloc is hooked only if somebody needs it (the profile can be toggled at runtime)
+static void update_malloc_hook(void)
+{
+    bool need = service_ctx.get_metrics()->is_enabled() || service_ctx.get_alloc_profiler()->is_enabled() ||
+                service_ctx.get_arena()->is_enabled()   || service_ctx.get_request_limits()->is_enabled();
+
+    soap->fmalloc = need ? count_malloc : nullptr;
+}
+
+
+
+// C++ objects of the request (soap_new_*), soap_destroy deletes them
+static uint64_t count_objects(struct soap *soap)
+{
+    uint64_t cnt = 0;
+
+    for(const struct soap_clist *cp = soap->clist; cp; cp = cp->next)
+        cnt++;
+
+    return cnt;
+}
+
+
+
+// soap_end_recv: the request is read, the handler is next
+static int trace_final_recv(struct soap *soap)
+{
+    service_ctx.get_tracer()->mark(TRACE_HANDLER, now_us());
+    return soap_fpreparefinalrecv ? soap_fpreparefinalrecv(soap) : SOAP_OK;
+}
+
+
+
+// soap_begin_count/soap_begin_send: the handler is done, the response is serialized
+static int trace_init_send(struct soap *soap)
+{
+    service_ctx.get_tracer()->mark(TRACE_SERIALIZE, now_us());
+    return soap_fprepareinitsend ? soap_fprepareinitsend(soap) : SOAP_OK;
+}
+
+
+
+static void render_metrics(std::string &out)
+{
+    service_ctx.get_metrics()->render(out);
+
+
+    auto ip_filter = service_ctx.get_ip_filter();
+    Metrics::render_value(out, "onvif_ip_filter_denied_total", "counter", "Connections closed by the IP filter.", ip_filter->get_denied_cnt());
+
+
+    auto limiter = service_ctx.get_rate_limiter();
+
+    out += "# HELP onvif_rate_limited_total Requests (connections) over the rate limit.\n"
+           "# TYPE onvif_rate_limited_total counter\n";
+
+    for(int i = 0; i < RATE_CLASS_CNT; i++)
+    {
+        auto rate_class = static_cast<RateClass>(i);
+        out += std::string("onvif_rate_limited_total{class=\"") + RateLimiter::get_rate_class_name(rate_class) + "\"} " +
+               std::to_string(limiter->get_limited_cnt(rate_class)) + "\n";
+    }
+
+
+    auto tls = service_ctx.get_tls_server();
+    if( tls->is_enabled() )
+    {
+        out += "# HELP onvif_tls_handshakes_total TLS handshakes.\n"
+               "# TYPE onvif_tls_handshakes_total counter\n"
+               "onvif_tls_handshakes_total{type=\"full\"} "    + std::to_string(tls->get_full_cnt())    + "\n"
+               "onvif_tls_handshakes_total{type=\"resumed\"} " + std::to_string(tls->get_resumed_cnt()) + "\n"
+               "onvif_tls_handshakes_total{type=\"failed\"} "  + std::to_string(tls->get_failed_cnt())  + "\n";
+    }
+
+
+    auto digest = service_ctx.get_http_digest();
+
+    out += "# HELP onvif_http_digest_total HTTP Digest authentications (replay - a reused nonce-count).\n"
+           "# TYPE onvif_http_digest_total counter\n"
+           "onvif_http_digest_total{result=\"ok\"} "     + std::to_string(digest->get_ok_cnt())     + "\n"
+           "onvif_http_digest_total{result=\"failed\"} " + std::to_string(digest->get_failed_cnt()) + "\n"
+           "onvif_http_digest_total{result=\"replay\"} " + std::to_string(digest->get_replay_cnt()) + "\n";
+
+
+    auto wsse = service_ctx.get_wsse_auth();
+
+    out += "# HELP onvif_wsse_auth_total WS-UsernameToken authentications (replay - a reused Nonce and Created).\n"
+           "# TYPE onvif_wsse_auth_total counter\n"
+           "onvif_wsse_auth_total{result=\"ok\"} "     + std::to_string(wsse->get_ok_cnt())     + "\n"
+           "onvif_wsse_auth_total{result=\"failed\"} " + std::to_string(wsse->get_failed_cnt()) + "\n"
+           "onvif_wsse_auth_total{result=\"replay\"} " + std::to_string(wsse->get_replay_cnt()) + "\n";
+
+
+    Metrics::render_value(out, "onvif_log_dropped_total", "counter", "Log messages dropped (the ring of logger is full).", logger.get_dropped_cnt());
+
+
+    auto ingest = service_ctx.get_event_ingest();
+    if( ingest->is_enabled() )
+    {
+        Metrics::render_value(out, "onvif_event_ingested_total", "counter", "Events published from the event socket.", ingest->get_ingested_cnt());
+        Metrics::render_value(out, "onvif_event_ingest_dropped_total", "counter", "Malformed records of the event socket.", ingest->get_dropped_cnt());
+    }
+
+
+    auto pusher = service_ctx.get_event_pusher();
+
+    out += "# HELP onvif_event_push_total Notify to push consumers (sent, dropped - messages; failed - Notify requests).\n"
+           "# TYPE onvif_event_push_total counter\n"
+           "onvif_event_push_total{result=\"sent\"} "    + std::to_string(pusher->get_sent_cnt())    + "\n"
+           "onvif_event_push_total{result=\"failed\"} "  + std::to_string(pusher->get_failed_cnt())  + "\n"
+           "onvif_event_push_total{result=\"dropped\"} " + std::to_string(pusher->get_dropped_cnt()) + "\n";
+
+
+    auto broker = service_ctx.get_event_broker();
+    Metrics::render_value(out, "onvif_event_dropped_total", "counter", "Events dropped at the high-water mark of subscription queues.", broker->get_dropped_total());
+
+    uint32_t handles[EventBroker::MAX_SUBSCRIPTIONS];
+    size_t   handle_cnt = broker->get_handles(handles, EventBroker::MAX_SUBSCRIPTIONS);
+    if( handle_cnt )
+    {
+        out += "# HELP onvif_event_subscription_dropped_total Events dropped by the active subscription.\n"
+               "# TYPE onvif_event_subscription_dropped_total counter\n";
+
+        for(size_t i = 0; i < handle_cnt; i++)
+            out += "onvif_event_subscription_dropped_total{subscription=\"" + std::to_string(handles[i]) + "\"} " +
+                   std::to_string(broker->get_dropped(handles[i])) + "\n";
+    }
+
+
+    auto arena = service_ctx.get_arena();
+    if( arena->is_enabled() )
+    {
+        Metrics::render_value(out, "onvif_arena_retained_bytes", "gauge", "Slabs of the arena kept between requests.", arena->get_retained_bytes());
+        Metrics::render_value(out, "onvif_arena_slab_allocs_total", "counter", "Slabs of the arena allocated by malloc.", arena->get_slab_allocs());
+        Metrics::render_value(out, "onvif_arena_slab_frees_total", "counter", "Slabs of the arena freed over the cap (after spikes).", arena->get_slab_frees());
+    }
+
+
+    auto recorder = service_ctx.get_recorder();
+    if( recorder->is_enabled() )
+        Metrics::render_value(out, "onvif_record_requests_total", "counter", "Requests written to the record file.", recorder->get_records_cnt());
+
+
+    auto limits = service_ctx.get_request_limits();
+    if( limits->is_enabled() )
+    {
+        out += "# HELP onvif_request_limit_exceeded_total Requests stopped over a limit of request (413).\n"
+               "# TYPE onvif_request_limit_exceeded_total counter\n";
+
+        for(int i = 0; i < LIMIT_TYPE_CNT; i++)
+        {
+            auto type = static_cast<RequestLimitType>(i);
+            out += std::string("onvif_request_limit_exceeded_total{limit=\"") + RequestLimits::get_type_name(type) + "\"} " +
+                   std::to_string(limits->get_exceeded_cnt(type)) + "\n";
+        }
+    }
+
+
+    auto writer = service_ctx.get_response_writer();
+    if( writer->is_enabled() )
+    {
+        Metrics::render_value(out, "onvif_single_send_responses_total", "counter", "Responses sent by one send() (plain HTTP).", writer->get_responses_cnt());
+        Metrics::render_value(out, "onvif_single_send_partial_total", "counter", "Responses over the socket buffer, the rest is sent by gsoap.", writer->get_partial_cnt());
+    }
+}
+
+
+
+// HTTP GET of the listener: only /metrics and /trace.json, the rest is for gsoap (405)
+/*
+ * The statistics of GET are for an Administrator (by HTTP Digest, it is checked
+ * in parse_http_header): without credentials - 401 with a challenge, a lower level - 403.
+ * Returns false if the reply is sent.
+ */
+static bool authorize_get(struct soap *soap)
+{
+    static const char forbidden[] = "HTTP/1.1 403 Forbidden\r\n"
+                                    "Content-Length: 0\r\n"
+                                    "Connection: close\r\n\r\n";
+
+    if( !service_ctx.auth )
+        return true;
+
+
+    UserLevel level = service_ctx.get_http_digest()->get_request_level();
+    if( level == USER_LEVEL_ADMINISTRATOR )
+        return true;
+
+
+    LOG_D(LOG_MOD_AUTH, "Auth: GET %s of %s is not authorized", soap->path, soap->host);
+
+    if( level == USER_LEVEL_ANONYMOUS )
+    {
+        send_challenge(soap, false, time(NULL));
+        return false;
+    }
+
+
+    soap->fsend(soap, forbidden, sizeof(forbidden) - 1);
+    drain_unread(soap);
+
+    return false;
+}
+
+
+
+static int http_get(struct soap *soap)
+{
+    std::string out;
+
+    bool is_metrics = service_ctx.get_metrics()->is_enabled() && !strcmp(soap->path, "/metrics");
+    bool is_trace   = service_ctx.get_tracer()->is_enabled()  && !strcmp(soap->path, "/trace.json");
+
+    if( (is_metrics || is_trace) && !authorize_get(soap) )
+        return SOAP_STOP; // the reply is sent
+
+
+    if( is_metrics )
+    {
+        render_metrics(out);
+        soap->http_content = "text/plain; version=0.0.4; charset=utf-8";
+    }
+    else if( is_trace )
+    {
+        service_ctx.get_tracer()->render_json(out);
+        soap->http_content = "application/json";
+    }
+    else
+    {
+        return soap_fget(soap);
+    }
+
+    if( soap_response(soap, SOAP_FILE) ||
+        soap_send_raw(soap, out.data(), out.size()) ||
+        soap_end_send(soap) )
+        return soap_closesock(soap);
+
+    return SOAP_OK;
+}
+
+
+
+// the fault of soap (as soap_stream_fault prints it) to the log, in one line
+static void log_fault(struct soap *soap, LogModule module)
+{
+    char buf[LogRecord::STR_BUF_SIZE] = "";
+
+    if( !soap->error )
+        return;
+
+    soap_sprint_fault(soap, buf, sizeof(buf));
+
+    for(char *p = buf; *p; p++)
+        if( (*p == '\n') || (*p == '\r') )
+            *p = ' ';
+
+    LOG_E(module, "SOAP fault: %s", buf);
+}
+
+
+
+void init_gsoap(void)
+{
+    soap = soap_new();
+
+    if(!soap)
+        daemon_error_exit("Can't get mem for SOAP\n");
+
+
+    soap->bind_flags = SO_REUSEADDR;
+
+    if( !service_ctx.get_tls_server()->is_only() &&
+        !soap_valid_socket(soap_bind(soap, NULL, service_ctx.port, 10)) )
+    {
+        log_fault(soap, LOG_MOD_NET);
+        exit(EXIT_FAILURE);
+    }
+
+
+    if( service_ctx.get_tls_server()->is_enabled() &&
+        !service_ctx.get_tls_server()->init(soap, DAEMON_NAME) )
+        daemon_error_exit("Can't init HTTPS listener: %s\n", service_ctx.get_tls_server()->get_cstr_err());
+
+    soap->send_timeout = 3; // timeout in sec
+    soap->recv_timeout = 3; // timeout in sec
+
+
+    service_ctx.get_rate_limiter()->init();
+
+
+    http_parse_header = soap->fparsehdr;
+    soap->fparsehdr   = parse_http_header;
+
+    // under flush_close (if any): the stored response goes first, then the drain
+    unread_fclose = soap->fclose;
+    soap->fclose  = drain_close;
+
+
+    // after daemonize: the relative path is from the dir of the daemon
+    if( service_ctx.get_recorder()->is_enabled() &&
+        !service_ctx.get_recorder()->start() )
+        daemon_error_exit("Can't start recording: %s\n", service_ctx.get_recorder()->get_cstr_err());
+
+
+    // one pass of serialization (no counting of Content-Length), the stored response goes by one send()
+    if( service_ctx.get_response_writer()->is_enabled() )
+    {
+        soap_set_omode(soap, SOAP_IO_STORE);
+
+        raw_fsend                = soap->fsend;
+        soap_fresponse           = soap->fresponse;
+        soap_fpreparefinalsend   = soap->fpreparefinalsend;
+        soap_fclose              = soap->fclose;
+        soap->fsend              = store_send;
+        soap->fresponse          = store_response;
+        soap->fpreparefinalsend  = flush_final_send;
+        soap->fclose             = flush_close;
+    }
+
+
+    if( service_ctx.get_metrics()->is_enabled() || service_ctx.get_tracer()->is_active() ||
+        service_ctx.get_recorder()->is_enabled() || service_ctx.get_request_limits()->is_enabled() )
+    {
+        soap_fsend    = soap->fsend;
+        soap_frecv    = soap->frecv;
+        soap_fget     = soap->fget;
+        soap->fsend   = count_send;
+        soap->frecv   = count_recv;
+        soap->fget    = http_get;
+    }
+
+    update_malloc_hook();
+
+
+    if( service_ctx.get_tracer()->is_active() )
+    {
+        soap_fpreparefinalrecv  = soap->fpreparefinalrecv;
+        soap_fprepareinitsend   = soap->fprepareinitsend;
+        soap->fpreparefinalrecv = trace_final_recv;
+        soap->fprepareinitsend  = trace_init_send;
+    }
+
+
+    //save pointer of service_ctx in soap
+    soap->user = (void*)&service_ctx;
+
+    init_namespaces();
+}
+
+
+
+void init_events(void)
+{
+    // thread of push delivery, it must be started after fork
+    if( !service_ctx.get_event_pusher()->start(&service_ctx, service_namespaces.data()) )
+        daemon_error_exit("Can't start delivery of events: %s\n", service_ctx.get_event_pusher()->get_cstr_err());
+
+
+    // events of the video pipeline
+    if( service_ctx.get_event_ingest()->is_enabled() &&
+        !service_ctx.get_event_ingest()->start(service_ctx.get_event_broker()) )
+        daemon_error_exit("Can't start ingestion of events: %s\n", service_ctx.get_event_ingest()->get_cstr_err());
+}
+
+
+
+
+// reread what can be changed without restart: users file, TLS cert, log file (it is rotated)
+static void reload(std::string &reply)
+{
+    auto users = service_ctx.get_user_store();
+
+    if( !users->get_file().empty() )
+        reply += users->reload() ? "users: reloaded\n" : "users: " + users->get_str_err() + "\n";
+
+
+    auto tls = service_ctx.get_tls_server();
+
+    if( tls->is_enabled() )
+        reply += tls->reload_cert(soap) ? "tls cert: reloaded\n" : "tls cert: " + tls->get_str_err() + "\n";
+
+
+    reply += logger.reopen() ? "log: reopened\n" : "log: " + logger.get_str_err() + "\n";
+
+
+    auto recorder = service_ctx.get_recorder();
+
+    if( recorder->is_enabled() )
+        reply += recorder->reopen() ? "record: reopened\n" : "record: " + recorder->get_str_err() + "\n";
+
+
+    for(size_t pos = 0, eol; (eol = reply.find('\n', pos)) != std::string::npos; pos = eol + 1)
+        LOG_I(LOG_MOD_MAIN, "Reload: %s", reply.substr(pos, eol - pos));
+}
+
+
+
+// forget what is cached about clients (the next ones do everything from scratch)
+static void flush_caches(std::string &reply)
+{
+    auto tls = service_ctx.get_tls_server();
+
+    if( tls->is_enabled() )
+        reply += tls->flush_sessions(soap, time(NULL)) ? "tls sessions: flushed\n" : "tls sessions: " + tls->get_str_err() + "\n";
+
+
+    service_ctx.get_rate_limiter()->clear();
+    reply += "rate limit clients: flushed\n";
+
+    service_ctx.get_tracer()->clear();
+    reply += "traces: flushed\n";
+
+    if( service_ctx.get_recorder()->is_enabled() )
+    {
+        service_ctx.get_recorder()->flush();
+        reply += "record: flushed\n";
+    }
+}
+
+
+
+static void render_connections(std::string &reply)
+{
+    char line[256];
+
+    if( soap_valid_socket(soap->master) )
+    {
+        snprintf(line, sizeof(line), "listen http port %d\n", service_ctx.port);
+        reply += line;
+    }
+
+    if( service_ctx.get_tls_server()->is_enabled() )
+    {
+        snprintf(line, sizeof(line), "listen https port %d\n", service_ctx.get_tls_server()->get_port());
+        reply += line;
+    }
+
+
+    // the main loop serves one connection at a time, it is done when a command is run
+    snprintf(line, sizeof(line), "event subscriptions %zu\n", service_ctx.get_event_broker()->active_count());
+    reply += line;
+
+
+    if( service_ctx.get_rate_limiter()->is_enabled() )
+    {
+        reply += "clients (address idle_ms):\n";
+        service_ctx.get_rate_limiter()->render_clients(reply, now_ms());
+    }
+}
+
+
+
+static void handle_command(const std::string &cmd, const std::string &args, std::string &reply)
+{
+    LOG_D(LOG_MOD_MAIN, "Control: %s %s", cmd, args);
+
+    if( cmd == "metrics" )
+    {
+        if( !service_ctx.get_metrics()->is_enabled() )
+            reply += "# counters of requests are disabled (see --metrics)\n";
+
+        render_metrics(reply);
+    }
+    else if( cmd == "connections" )
+    {
+        render_connections(reply);
+    }
+    else if( cmd == "flush" )
+    {
+        flush_caches(reply);
+    }
+    else if( cmd == "reload" )
+    {
+        reload(reply);
+    }
+    else if( cmd == "alloc" )
+    {
+        auto profiler = service_ctx.get_alloc_profiler();
+
+        if( (args == "on") || (args == "off") )
+        {
+            profiler->set_enabled(args == "on");
+            update_malloc_hook();
+        }
+        else if( args == "reset" )
+        {
+            profiler->reset();
+        }
+
+        profiler->render(reply, *service_ctx.get_metrics());
+    }
+    else if( cmd == "log_level" )
+    {
+        if( !args.empty() && !logger.set_level(args.c_str()) )
+            reply += "error: " + logger.get_str_err() + "\n";
+        else
+            reply += logger.get_levels() + "\n";
+    }
+    else
+    {
+        reply += "commands:\n"
+                 "  metrics                      counters in Prometheus text format\n"
+                 "  connections                  listeners, subscriptions and recent clients\n"
+                 "  flush                        flush TLS sessions, clients of rate limits, traces, record file\n"
+                 "  reload                       reread users file, TLS cert, reopen log and record files (SIGHUP)\n"
+                 "  alloc [on|off|reset]         allocations of the gsoap arena by operation\n"
+                 "  log_level [[module:]level]   show or set log levels\n";
+    }
+}
+
+
+
+void init_control(void)
+{
+    if( daemon_info.cmd_pipe && !control_socket.start(daemon_info.cmd_pipe) )
+        daemon_error_exit("Can't create control socket: %s\n", control_socket.get_cstr_err());
+}
+
+
+
+// wait for a client of listeners, commands of the control socket and SIGHUP are run meanwhile
+static void wait_client(void)
+{
+    for(;;)
+    {
+        struct pollfd fds[4];
+        nfds_t        nfds      = 0;
+        nfds_t        listeners = 0;
+
+        if( soap_valid_socket(soap->master) )
+            fds[nfds++] = { soap->master, POLLIN, 0 };
+
+        if( service_ctx.get_tls_server()->is_enabled() )
+            fds[nfds++] = { service_ctx.get_tls_server()->get_master(), POLLIN, 0 };
+
+        listeners = nfds;
+
+        fds[nfds++] = { hup_fd, POLLIN, 0 };
+
+        if( control_socket.is_enabled() )
+            fds[nfds++] = { control_socket.get_fd(), POLLIN, 0 };
+
+
+        if( poll(fds, nfds, -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return; // the error is reported by accept
+        }
+
+
+        if( fds[listeners].revents )
+        {
+            struct signalfd_siginfo info;
+
+            while( read(hup_fd, &info, sizeof(info)) == sizeof(info) )
+                ; // several SIGHUP - one reload
+
+            std::string reply;
+            reload(reply);
+        }
+
+        if( control_socket.is_enabled() && fds[listeners + 1].revents )
+            control_socket.serve(handle_command);
+
+
+        for(nfds_t i = 0; i < listeners; i++)
+        {
+            if( fds[i].revents )
+                return;
+        }
+    }
+}
+
+
+
+// 401 with a Digest challenge, over TLS it must go through soap (SSL_write)
+static void send_challenge(struct soap *soap, bool stale, time_t now)
+{
+    auto digest = service_ctx.get_http_digest();
+
+    if( !TlsServer::is_secure(soap) )
+    {
+        digest->send_challenge(soap->socket, stale, now);
+    }
+    else
+    {
+        char   buf[HttpDigest::MAX_HEADER];
+        size_t len = digest->render_challenge(buf, sizeof(buf), stale, now);
+
+        if( len )
+            soap->fsend(soap, buf, len);
+    }
+
+
+    // the request is not read (the rest of the header and the body): no RST before the 401 is read
+    drain_unread(soap);
+}
+
+
+
+// 503 with ter:ServerBusy (pre-rendered), over TLS it goes through soap too
+static void send_busy(struct soap *soap)
+{
+    const std::string &reply = service_ctx.get_rate_limiter()->get_busy_reply();
+
+    soap->fsend(soap, reply.data(), reply.size());
+
+    // the request is not read: no RST before the 503 is read
+    drain_unread(soap);
+}
+
+
+
+// fault of the dispatched operation, a request over a limit is answered already (reject_request)
+static void send_fault(struct soap *soap)
+{
+    if( service_ctx.get_request_limits()->is_exceeded() )
+    {
+        soap_closesock(soap);
+        return;
+    }
+
+    soap_send_fault(soap);
+    log_fault(soap, LOG_MOD_SERVICE);
+}
+
+
+
+/*
+ * HTTP Digest is checked here, while gsoap parses the HTTP headers,
+ * so a bad or replayed request is rejected before any XML is read.
+ */
+static int parse_http_header(struct soap *soap, const char *key, const char *val)
+{
+    // the declared body is checked before a byte of it is read
+    auto limits = service_ctx.get_request_limits();
+    if( limits->is_enabled() && !soap_tag_cmp(key, "Content-Length") &&
+        !limits->check_length(strtoull(val, nullptr, 10)) )
+    {
+        reject_request(soap);
+        return SOAP_STOP;
+    }
+
+
+    if( !service_ctx.auth || soap_tag_cmp(key, "Authorization") || soap_tag_cmp(val, "Digest *") )
+        return http_parse_header(soap, key, val);
+
+
+    // the request line is read, but not parsed yet (soap->path is of the previous request)
+    char   method[HttpDigest::MAX_METHOD];
+    char   uri[HttpDigest::MAX_URI];
+    auto   digest = service_ctx.get_http_digest();
+    time_t now    = time(NULL);
+    auto   res    = HttpDigest::parse_request_line(soap->msgbuf, method, uri) ? digest->verify(method, uri, val, now)
+                                                                             : HttpDigest::DIGEST_BAD;
+
+    if( res == HttpDigest::DIGEST_OK )
+        return SOAP_OK;
+
+
+    LOG_D(LOG_MOD_AUTH, "Auth: HTTP Digest is rejected (%d)", res);
+
+    send_challenge(soap, res == HttpDigest::DIGEST_STALE, now);
+
+    return SOAP_STOP; // the reply is sent, gsoap must not send a fault
+}
+
+
+
+/*
+ * Check the access class of the requested operation against the level of the client.
+ * It is called after soap_begin_serve (SOAP Header is parsed) and before
+ * the deserialization of Body, so a denied request costs only the header.
+ * If the request is denied, the reply is sent here:
+ * 401 (Digest challenge) if there are no credentials at all, else ter:NotAuthorized fault.
+ */
+static bool authorize(struct soap *soap)
+{
+    if( !service_ctx.auth )
+        return true;
+
+
+    // element of operation, if there is no one, dispatch reports the error
+    if( soap_peek_element(soap) )
+        return true;
+
+
+    AccessClass access_class = get_access_class(soap->tag);
+    if( access_class == ACCESS_PRE_AUTH )
+        return true;
+
+
+    if( is_access_allowed(service_ctx.get_user_level(soap), access_class) )
+        return true;
+
+
+    LOG_D(LOG_MOD_AUTH, "Auth: %s (%s) is not authorized", soap->tag, get_access_class_name(access_class));
+
+    bool has_credentials = (soap->header && soap->header->wsse__Security) ||
+                           (service_ctx.get_http_digest()->get_request_level() != USER_LEVEL_ANONYMOUS);
+
+    if( !has_credentials )
+    {
+        send_challenge(soap, false, time(NULL));
+        return false;
+    }
+
+
+    soap_sender_fault_subcode(soap, "ter:NotAuthorized", "Sender not authorized", nullptr);
+
+    drain_on_close = true; // the Body is not read, see drain_close
+    soap_send_fault(soap);
+    drain_on_close = false;
+
+    return false;
+}
+
+
+
+/*
+ * Rate limit of the client for the class of the requested operation,
+ * like authorize it is called before the deserialization of Body.
+ */
+static bool check_rate(struct soap *soap)
+{
+    auto limiter = service_ctx.get_rate_limiter();
+
+    if( !limiter->is_enabled() || soap_peek_element(soap) )
+        return true;
+
+
+    RateClass rate_class = RateLimiter::get_rate_class(get_access_class(soap->tag));
+
+    if( limiter->check((const struct sockaddr *)&soap->peer, rate_class, now_ms()) )
+        return true;
+
+
+    LOG_D(LOG_MOD_NET, "Rate: %s (%s) of %s is limited", soap->tag, RateLimiter::get_rate_class_name(rate_class), soap->host);
+
+    send_busy(soap);
+
+    return false;
+}
+
+
+
+void init_auth(void)
+{
+    if( !service_ctx.get_http_digest()->init(DAEMON_NAME) )
+        daemon_error_exit("Can't init HTTP Digest: %s\n", service_ctx.get_http_digest()->get_cstr_err());
+
+
+    // HA1 of users is for the realm of HTTP Digest
+    if( !service_ctx.get_user_store()->init(service_ctx.get_http_digest()->get_realm(), service_ctx.user, service_ctx.password) )
+        daemon_error_exit("Can't init users: %s\n", service_ctx.get_user_store()->get_cstr_err());
+
+    service_ctx.get_http_digest()->set_user_store(service_ctx.get_user_store());
+}
+
+
+
+void init_logger(void)
+{
+    // after fork: the thread of logger must be in the daemon
+    if( !logger.start(daemon_info.log_file) )
+        daemon_error_exit("Can't start logger: %s\n", logger.get_cstr_err());
+
+    LOG_I(LOG_MOD_MAIN, DAEMON_NAME " " DAEMON_VERSION_STR " is started, log levels: %s", logger.get_levels());
+}
+
+
+
+void init(void *data)
+{
+    UNUSED(data);
+    init_signals();
+    init_logger();
+    check_service_ctx();
+    init_auth();
+    init_gsoap();
+    init_events();
+    init_control();
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    processing_cmd(argc, argv);
+    daemonize2(init, nullptr);
+
+    FOREACH_SERVICE(DECLARE_SERVICE, soap)
+
+    FOREACH_SERVICE(REGISTER_SERVICE, soap)
+
+    if( !dispatcher.build(soap) )
+        daemon_error_exit("Can't build dispatch table: %s\n", dispatcher.get_cstr_err());
+
+    LOG_I(LOG_MOD_MAIN, "Dispatch table: %zu operations in %zu slots, %zu unimplemented%s", dispatcher.get_ops_cnt(),
+          dispatcher.get_table_size(), dispatcher.get_unimplemented_cnt(), dispatcher.is_reject_unimplemented() ? " (rejected)" : "");
+
+    // the fds of wait_client: a long PullMessages returns for them
+    if( soap_valid_socket(soap->master) )
+        service_ctx.wake_fds.push_back(soap->master);
+
+    if( service_ctx.get_tls_server()->is_enabled() )
+        service_ctx.wake_fds.push_back(service_ctx.get_tls_server()->get_master());
+
+    service_ctx.wake_fds.push_back(hup_fd);
+
+    if( control_socket.is_enabled() )
+        service_ctx.wake_fds.push_back(control_socket.get_fd());
+
+
+    auto metrics  = service_ctx.get_metrics();
+    auto tracer   = service_ctx.get_tracer();
+    auto profiler = service_ctx.get_alloc_profiler();
+    auto arena    = service_ctx.get_arena();
+    auto recorder = service_ctx.get_recorder();
+    auto limits   = service_ctx.get_request_limits();
+
+    while( true )
+    {
+        wait_client();
+
+        // accept new client (of HTTP or HTTPS listener)
+        SOAP_SOCKET sock = service_ctx.get_tls_server()->is_enabled() ? service_ctx.get_tls_server()->accept(soap)
+                                                                      : soap_accept(soap);
+        if( !soap_valid_socket(sock) )
+        {
+            log_fault(soap, LOG_MOD_NET);
+            return EXIT_FAILURE;
+        }
+
+
+        request_stat = RequestStat();
+        request_stat.start_us = now_us();
+        tracer->begin(request_stat.start_us);
+        limits->begin();
+
+
+        // nothing is read from a filtered client
+        if( !service_ctx.get_ip_filter()->is_allowed((const struct sockaddr *)&soap->peer) )
+        {
+            LOG_D(LOG_MOD_NET, "IP filter: %s is denied", soap->host);
+            soap_closesock(soap);
+            continue;
+        }
+
+
+        // before the handshake: a TLS client can't get the plain 503, it is just closed
+        if( service_ctx.get_rate_limiter()->is_enabled() &&
+            !service_ctx.get_rate_limiter()->check((const struct sockaddr *)&soap->peer, RATE_CONNECT, now_ms()) )
+        {
+            LOG_D(LOG_MOD_NET, "Rate: connection of %s is limited", soap->host);
+
+            if( !service_ctx.get_tls_server()->is_handshake_pending() )
+                send_busy(soap);
+
+            soap_closesock(soap);
+            continue;
+        }
+
+
+        if( service_ctx.get_tls_server()->is_handshake_pending() &&
+            !service_ctx.get_tls_server()->handshake(soap) )
+        {
+            soap_closesock(soap);
+            continue;
+        }
+
+
+        tracer->mark(TRACE_PARSE, now_us());
+
+        recorder->begin((const struct sockaddr *)&soap->peer, TlsServer::is_secure(soap));
+
+        metrics->connection_opened();
+
+        service_ctx.get_http_digest()->begin_request();
+
+        const char *dispatch_service = nullptr;
+        int         dispatch_err     = SOAP_OK;
+        char        operation[Metrics::NAME_LEN] = "";
+
+        // process service
+        if( soap_begin_serve(soap) )
+        {
+            // STOP - the reply is sent already (401, 413, GET /metrics)
+            if( soap->error != SOAP_STOP && !limits->is_exceeded() )
+                log_fault(soap, LOG_MOD_NET);
+        }
+        else
+        {
+            tracer->mark(TRACE_DISPATCH, now_us());
+
+            // element of operation (for metrics, traces and profile), the Body is not read yet
+            if( (metrics->is_enabled() || tracer->is_active() || profiler->is_enabled()) && !soap_peek_element(soap) )
+                snprintf(operation, sizeof(operation), "%s", soap->tag);
+
+            if( !check_rate(soap) )
+            {
+                soap_closesock(soap); // the reply is sent by check_rate
+            }
+            else if( !authorize(soap) )
+            {
+                soap_closesock(soap); // the reply is sent by authorize
+            }
+            else if( auto entry = dispatcher.find(soap) )
+            {
+                if( entry->unimplemented && dispatcher.is_reject_unimplemented() )
+                {
+                    // SOAP_EMPTY_HANDLER: the Body is not read, the fault is ready
+                    const std::string &reply = dispatcher.get_not_supported_reply();
+                    soap->fsend(soap, reply.data(), reply.size());
+
+                    dispatch_err     = SOAP_FAULT;
+                    dispatch_service = entry->service_name;
+
+                    drain_unread(soap); // the unread Body: no RST before the fault is read
+                    soap_closesock(soap);
+                }
+                else
+                {
+                    // one hash lookup instead of dispatch() of every service
+                    dispatch_err     = entry->op->serve(soap, entry->service);
+                    dispatch_service = entry->service_name;
+                    send_fault(soap);
+                }
+            }
+            FOREACH_SERVICE(DISPATCH_SERVICE, soap) // not in the table: the errors of gsoap (no element, ...)
+            else
+            {
+                LOG_D(LOG_MOD_MAIN, "Unknown service");
+                metrics->record(Metrics::UNKNOWN_OP, request_stat, true, now_us());
+            }
+
+            if( dispatch_service && metrics->is_enabled() )
+                metrics->record(metrics->get_op(dispatch_service, operation), request_stat, dispatch_err != SOAP_OK, now_us());
+
+            if( dispatch_service && profiler->is_enabled() )
+                profiler->record(metrics->get_op(dispatch_service, operation), request_stat, count_objects(soap));
+        }
+
+        if( tracer->is_active() )
+            tracer->end(dispatch_service, operation, soap->host,
+                        dispatch_service ? (dispatch_err != SOAP_OK) : (soap->error != SOAP_OK && soap->error != SOAP_STOP),
+                        now_us());
+
+        metrics->connection_closed();
+
+        recorder->end(now_ms());
+
+        soap_destroy(soap); // delete managed C++ objects
+        soap_end(soap);     // delete managed memory
+        arena->reset();     // the blocks of the arena are skipped by soap_end, rewind it
+
+        service_ctx.get_event_broker()->expire(time(NULL));
     }
 
 
@@ -0,0 +1,364 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#include "rate_limiter.h"
+#include "ip_filter.h"
+
+
+
+
+
+static const char *rate_class_names[RATE_CLASS_CNT] =
+{
+    "connect",
+    "discovery",
+    "media",
+    "control",
+    "system"
+};
+
+
+
+static const char busy_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\""
+    " xmlns:ter=\"http://www.onvif.org/ver10/error\">"
+    "<SOAP-ENV:Body><SOAP-ENV:Fault>"
+    "<SOAP-ENV:Code><SOAP-ENV:Value>SOAP-ENV:Receiver</SOAP-ENV:Value>"
+    "<SOAP-ENV:Subcode><SOAP-ENV:Value>ter:Action</SOAP-ENV:Value>"
+    "<SOAP-ENV:Subcode><SOAP-ENV:Value>ter:ServerBusy</SOAP-ENV:Value></SOAP-ENV:Subcode>"
+    "</SOAP-ENV:Subcode></SOAP-ENV:Code>"
+    "<SOAP-ENV:Reason><SOAP-ENV:Text xml:lang=\"en\">Too many requests, retry later</SOAP-ENV:Text></SOAP-ENV:Reason>"
+    "</SOAP-ENV:Fault></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+
+
+static uint32_t hash_addr(const uint8_t addr[16])
+{
+    uint32_t hash = 0x811C9DC5;
+
+    for(int i = 0; i < 16; i++)
+    {
+        hash ^= addr[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+
+
+static bool parse_uint(const char *str, char **end, uint32_t *val)
+{
+    if( (*str < '0') || (*str > '9') )
+        return false;
+
+    unsigned long tmp = strtoul(str, end, 10);
+    if( tmp > 1000000 )
+        return false;
+
+    *val = tmp;
+    return true;
+}
+
+
+
+
+
+RateLimiter::RateLimiter():
+    enabled    (false),
+    lru_head   (NO_IDX),
+    lru_tail   (NO_IDX),
+    clients_cnt(0),
+    evicted_cnt(0)
+{
+    memset(limits,      0, sizeof(limits));
+    memset(clients,     0, sizeof(clients));
+    memset(limited_cnt, 0, sizeof(limited_cnt));
+
+    for(size_t i = 0; i < HASH_SIZE; i++)
+        hash[i] = NO_IDX;
+}
+
+
+
+bool RateLimiter::set_limit(const char *new_val)
+{
+    const char *colon = strchr(new_val, ':');
+    if( !colon )
+    {
+        str_err = "format is class:rate[:burst]";
+        return false;
+    }
+
+
+    int rate_class = 0;
+
+    while( (rate_class < RATE_CLASS_CNT) &&
+           ((strlen(rate_class_names[rate_class]) != (size_t)(colon - new_val)) ||
+            strncmp(rate_class_names[rate_class], new_val, colon - new_val)) )
+        rate_class++;
+
+    if( rate_class == RATE_CLASS_CNT )
+    {
+        str_err = "class is bad, correct: connect|discovery|media|control|system";
+        return false;
+    }
+
+
+    Limit limit;
+    char *end;
+
+    if( !parse_uint(colon + 1, &end, &limit.rate) )
+    {
+        str_err = "rate is bad, correct range: 0-1000000";
+        return false;
+    }
+
+    limit.burst = limit.rate;
+
+    if( *end == ':' )
+    {
+        if( !parse_uint(end + 1, &end, &limit.burst) || !limit.burst )
+        {
+            str_err = "burst is bad, correct range: 1-1000000";
+            return false;
+        }
+    }
+
+    if( *end )
+    {
+        str_err = "format is class:rate[:burst]";
+        return false;
+    }
+
+
+    limits[rate_class] = limit;
+
+    return true;
+}
+
+
+
+void RateLimiter::init()
+{
+    enabled = false;
+
+    for(int i = 0; i < RATE_CLASS_CNT; i++)
+        enabled = enabled || limits[i].rate;
+
+
+    busy_reply = "HTTP/1.1 503 Service Unavailable\r\n"
+                 "Content-Type: application/soap+xml; charset=utf-8\r\n"
+                 "Content-Length: " + std::to_string(sizeof(busy_body) - 1) + "\r\n"
+                 "Retry-After: 1\r\n"
+                 "Connection: close\r\n\r\n";
+
+    busy_reply += busy_body;
+}
+
+
+
+bool RateLimiter::check(const struct sockaddr *addr, RateClass rate_class, uint64_t now_ms)
+{
+    const Limit &limit = limits[rate_class];
+
+    if( !limit.rate )
+        return true;
+
+
+    uint8_t ip6[16];
+
+    if( !get_ip6_addr(addr, ip6) )
+        return true;
+
+
+    Bucket &bucket = get_client(ip6, now_ms)->buckets[rate_class];
+
+    uint64_t max_tokens = (uint64_t)limit.burst * TOKEN;
+    uint64_t tokens     = bucket.tokens + (now_ms - bucket.last_ms) * limit.rate;  // rate*TOKEN per 1000 ms
+
+    bucket.tokens  = (tokens > max_tokens) ? max_tokens : tokens;
+    bucket.last_ms = now_ms;
+
+
+    if( bucket.tokens < TOKEN )
+    {
+        limited_cnt[rate_class]++;
+        return false;
+    }
+
+
+    bucket.tokens -= TOKEN;
+
+    return true;
+}
+
+
+
+void RateLimiter::clear()
+{
+    memset(clients, 0, sizeof(clients));
+
+    for(size_t i = 0; i < HASH_SIZE; i++)
+        hash[i] = NO_IDX;
+
+    lru_head    = NO_IDX;
+    lru_tail    = NO_IDX;
+    clients_cnt = 0;
+}
+
+
+
+void RateLimiter::render_clients(std::string &out, uint64_t now_ms) const
+{
+    static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+
+    char addr[INET6_ADDRSTRLEN];
+    char line[INET6_ADDRSTRLEN + 32];
+
+    for(uint16_t idx = lru_head; idx != NO_IDX; idx = clients[idx].lru_next)
+    {
+        const Client &client = clients[idx];
+
+        if( !memcmp(client.addr, v4_mapped, sizeof(v4_mapped)) )
+            inet_ntop(AF_INET, &client.addr[12], addr, sizeof(addr));
+        else
+            inet_ntop(AF_INET6, client.addr, addr, sizeof(addr));
+
+
+        uint64_t last_ms = 0;
+
+        for(int i = 0; i < RATE_CLASS_CNT; i++)
+        {
+            if( client.buckets[i].last_ms > last_ms )
+                last_ms = client.buckets[i].last_ms;
+        }
+
+        snprintf(line, sizeof(line), "%s %llu\n", addr, (unsigned long long)(now_ms - last_ms));
+        out += line;
+    }
+}
+
+
+
+RateClass RateLimiter::get_rate_class(AccessClass access_class)
+{
+    switch(access_class)
+    {
+        case ACCESS_PRE_AUTH:   return RATE_DISCOVERY;
+        case ACCESS_READ_MEDIA: return RATE_MEDIA;
+        case ACCESS_ACTUATE:    return RATE_CONTROL;
+        default:                return RATE_SYSTEM;
+    }
+}
+
+
+
+const char* RateLimiter::get_rate_class_name(RateClass rate_class)
+{
+    if( rate_class >= RATE_CLASS_CNT )
+        return "unknown";
+
+    return rate_class_names[rate_class];
+}
+
+
+
+RateLimiter::Client* RateLimiter::get_client(const uint8_t addr[16], uint64_t now_ms)
+{
+    uint32_t h = hash_addr(addr) & (HASH_SIZE - 1);
+
+    for(uint16_t idx = hash[h]; idx != NO_IDX; idx = clients[idx].hash_next)
+    {
+        if( memcmp(clients[idx].addr, addr, 16) )
+            continue;
+
+        lru_unlink(idx);
+        lru_push(idx);
+
+        return &clients[idx];
+    }
+
+
+    // a new client takes a free entry or the least recently seen one
+    uint16_t idx;
+
+    if( clients_cnt < MAX_CLIENTS )
+    {
+        idx = clients_cnt++;
+    }
+    else
+    {
+        idx = lru_tail;
+        lru_unlink(idx);
+        hash_unlink(idx);
+        evicted_cnt++;
+    }
+
+
+    Client &client = clients[idx];
+
+    memcpy(client.addr, addr, 16);
+
+    for(int i = 0; i < RATE_CLASS_CNT; i++)
+    {
+        client.buckets[i].tokens  = limits[i].burst * TOKEN;
+        client.buckets[i].last_ms = now_ms;
+    }
+
+    client.hash_next = hash[h];
+    hash[h]          = idx;
+
+    lru_push(idx);
+
+    return &client;
+}
+
+
+
+void RateLimiter::lru_unlink(uint16_t idx)
+{
+    Client &client = clients[idx];
+
+    if( client.lru_prev != NO_IDX )
+        clients[client.lru_prev].lru_next = client.lru_next;
+    else
+        lru_head = client.lru_next;
+
+    if( client.lru_next != NO_IDX )
+        clients[client.lru_next].lru_prev = client.lru_prev;
+    else
+        lru_tail = client.lru_prev;
+}
+
+
+
+void RateLimiter::lru_push(uint16_t idx)
+{
+    Client &client = clients[idx];
+
+    client.lru_prev = NO_IDX;
+    client.lru_next = lru_head;
+
+    if( lru_head != NO_IDX )
+        clients[lru_head].lru_prev = idx;
+    else
+        lru_tail = idx;
+
+    lru_head = idx;
+}
+
+
+
+void RateLimiter::hash_unlink(uint16_t idx)
+{
+    uint16_t *link = &hash[hash_addr(clients[idx].addr) & (HASH_SIZE - 1)];
+
+    while( *link != idx )
+        link = &clients[*link].hash_next;
+
+    *link = clients[idx].hash_next;
+}
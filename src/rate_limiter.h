@@ -0,0 +1,147 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include <sys/socket.h>
+
+#include "access_policy.h"
+
+
+
+
+
+// classes of limits, a request is classified by the access class of its operation
+enum RateClass : uint8_t
+{
+    RATE_CONNECT,       // new connections (checked at accept)
+    RATE_DISCOVERY,     // PRE_AUTH: GetSystemDateAndTime, GetCapabilities, GetServices, ...
+    RATE_MEDIA,         // READ_MEDIA: GetProfiles, GetStreamUri, ...
+    RATE_CONTROL,       // ACTUATE: PTZ moves, presets, ...
+    RATE_SYSTEM,        // the rest (READ_SYSTEM*, WRITE_SYSTEM, UNRECOVERABLE)
+
+    RATE_CLASS_CNT      //Its not class! Its counter for use in code (max index)
+};
+
+
+
+
+
+/*
+ * Per client (source IP) token buckets, one bucket per RateClass.
+ *
+ * The main loop is single-threaded, so one client in a tight loop
+ * (a misconfigured VMS polling GetSystemDateAndTime) takes the whole daemon.
+ * A client over the limit gets a pre-rendered 503 with a SOAP fault
+ * (env:Receiver/ter:Action/ter:ServerBusy) and its connection is closed,
+ * it costs one send: the reply is rendered once by init.
+ *
+ * Clients live in a fixed table (MAX_CLIENTS) with a hash index by address
+ * and an LRU list: a new client evicts the least recently seen one, so
+ * a scan from many addresses can't grow the memory.
+ *
+ * A limit is "rate[:burst]" tokens per second, 0 - no limit (default).
+ * The daemon serves one connection at a time, so the connection limit is
+ * a rate (new connections per second), not a count of open ones.
+ */
+class RateLimiter
+{
+    public:
+
+        enum
+        {
+            MAX_CLIENTS = 256,
+            HASH_SIZE   = 512,      // must be a power of two
+            NO_IDX      = 0xFFFF,
+            TOKEN       = 1000      // tokens are in 1/1000, the refill is by msec
+        };
+
+
+        RateLimiter();
+
+        RateLimiter(const RateLimiter&) = delete;
+        RateLimiter& operator=(const RateLimiter&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_limit(const char *new_val);   // "class:rate[:burst]"
+
+
+        void init();
+        bool is_enabled() const { return enabled; }
+
+
+        // false - the client is over the limit of the class (the reply is not sent)
+        bool check(const struct sockaddr *addr, RateClass rate_class, uint64_t now_ms);
+
+        const std::string& get_busy_reply() const { return busy_reply; }
+
+
+        // forget all clients (their buckets are full again)
+        void clear();
+
+        // a line "address idle_ms" per tracked client, the last seen first
+        void render_clients(std::string &out, uint64_t now_ms) const;
+
+
+        static RateClass   get_rate_class(AccessClass access_class);
+        static const char* get_rate_class_name(RateClass rate_class);
+
+        uint64_t get_limited_cnt(RateClass rate_class) const { return limited_cnt[rate_class]; }
+        uint64_t get_evicted_cnt()                     const { return evicted_cnt;             }
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        struct Limit
+        {
+            uint32_t rate;      // tokens per sec, 0 - no limit
+            uint32_t burst;
+        };
+
+        struct Bucket
+        {
+            uint32_t tokens;    // in 1/TOKEN
+            uint64_t last_ms;
+        };
+
+        struct Client
+        {
+            uint8_t  addr[16];
+            uint16_t hash_next;             // chain of hash index
+            uint16_t lru_prev, lru_next;
+            Bucket   buckets[RATE_CLASS_CNT];
+        };
+
+
+        bool        enabled;
+        Limit       limits[RATE_CLASS_CNT];
+
+        Client      clients[MAX_CLIENTS];
+        uint16_t    hash[HASH_SIZE];        // first client of chain or NO_IDX
+        uint16_t    lru_head, lru_tail;     // head - the last seen
+        uint16_t    clients_cnt;
+
+        uint64_t    limited_cnt[RATE_CLASS_CNT];
+        uint64_t    evicted_cnt;
+
+        std::string busy_reply;
+        std::string str_err;
+
+
+        Client* get_client(const uint8_t addr[16], uint64_t now_ms);
+        void    lru_unlink(uint16_t idx);
+        void    lru_push  (uint16_t idx);
+        void    hash_unlink(uint16_t idx);
+};
+
+
+
+
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "request_limits.h"
+
+
+
+
+
+static const char *limit_type_names[LIMIT_TYPE_CNT] =
+{
+    "body",
+    "depth",
+    "elements",
+    "arena"
+};
+
+
+
+static const char limit_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\""
+    " xmlns:ter=\"http://www.onvif.org/ver10/error\">"
+    "<SOAP-ENV:Body><SOAP-ENV:Fault>"
+    "<SOAP-ENV:Code><SOAP-ENV:Value>SOAP-ENV:Sender</SOAP-ENV:Value>"
+    "<SOAP-ENV:Subcode><SOAP-ENV:Value>ter:InvalidArgs</SOAP-ENV:Value></SOAP-ENV:Subcode>"
+    "</SOAP-ENV:Code>"
+    "<SOAP-ENV:Reason><SOAP-ENV:Text xml:lang=\"en\">Request exceeds the limits of the device</SOAP-ENV:Text></SOAP-ENV:Reason>"
+    "</SOAP-ENV:Fault></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+
+
+
+
+RequestLimits::RequestLimits():
+    enabled(false)
+{
+    memset(limits,       0, sizeof(limits));
+    memset(exceeded_cnt, 0, sizeof(exceeded_cnt));
+
+    begin();
+
+
+    reply = "HTTP/1.1 413 Request Entity Too Large\r\n"
+            "Content-Type: application/soap+xml; charset=utf-8\r\n"
+            "Content-Length: " + std::to_string(sizeof(limit_body) - 1) + "\r\n"
+            "Connection: close\r\n\r\n";
+
+    reply += limit_body;
+}
+
+
+
+bool RequestLimits::set_limit(const char *new_val)
+{
+    const char *colon = strchr(new_val, ':');
+    if( !colon )
+    {
+        str_err = "format is type:value";
+        return false;
+    }
+
+
+    int type = 0;
+
+    while( (type < LIMIT_TYPE_CNT) &&
+           ((strlen(limit_type_names[type]) != (size_t)(colon - new_val)) ||
+            strncmp(limit_type_names[type], new_val, colon - new_val)) )
+        type++;
+
+    if( type == LIMIT_TYPE_CNT )
+    {
+        str_err = "type is bad, correct: body|depth|elements|arena";
+        return false;
+    }
+
+
+    char *end;
+    unsigned long val = strtoul(colon + 1, &end, 10);
+
+    if( (colon[1] < '0') || (colon[1] > '9') || *end || (val > 1000000) )
+    {
+        str_err = "value is bad, correct range: 0-1000000";
+        return false;
+    }
+
+
+    limits[type] = ((type == LIMIT_BODY) || (type == LIMIT_ARENA)) ? val * 1024 : val;
+
+    enabled = false;
+    for(int i = 0; i < LIMIT_TYPE_CNT; i++)
+        enabled = enabled || limits[i];
+
+    return true;
+}
+
+
+
+void RequestLimits::begin()
+{
+    recv_bytes  = 0;
+    arena_bytes = 0;
+    elements    = 0;
+    depth       = 0;
+    prev        = '\0';
+    in_tag      = false;
+    exceeded    = LIMIT_TYPE_CNT;
+}
+
+
+
+bool RequestLimits::check_length(uint64_t content_length)
+{
+    if( limits[LIMIT_BODY] && (content_length > limits[LIMIT_BODY]) )
+        return set_exceeded(LIMIT_BODY);
+
+    return true;
+}
+
+
+
+bool RequestLimits::check_recv(const char *buf, size_t len)
+{
+    if( is_exceeded() )
+        return false;
+
+
+    recv_bytes += len;
+
+    if( limits[LIMIT_BODY] && (recv_bytes > limits[LIMIT_BODY] + HEADER_SIZE) )
+        return set_exceeded(LIMIT_BODY);
+
+    if( !limits[LIMIT_DEPTH] && !limits[LIMIT_ELEMENTS] )
+        return true;
+
+
+    for(size_t i = 0; i < len; i++)
+    {
+        char c = buf[i];
+
+        if( prev == '<' )
+        {
+            if( c == '/' )
+            {
+                if( depth )
+                    depth--;
+            }
+            else if( (c != '?') && (c != '!') )
+            {
+                elements++;
+                depth++;
+                in_tag = true;
+
+                if( limits[LIMIT_ELEMENTS] && (elements > limits[LIMIT_ELEMENTS]) )
+                    return set_exceeded(LIMIT_ELEMENTS);
+
+                if( limits[LIMIT_DEPTH] && (depth > limits[LIMIT_DEPTH]) )
+                    return set_exceeded(LIMIT_DEPTH);
+            }
+        }
+        else if( (c == '>') && in_tag )
+        {
+            if( (prev == '/') && depth )
+                depth--;    // <tag/>
+
+            in_tag = false;
+        }
+
+        prev = c;
+    }
+
+    return true;
+}
+
+
+
+bool RequestLimits::check_alloc(size_t size)
+{
+    if( is_exceeded() )
+        return false;
+
+    arena_bytes += size;
+
+    if( limits[LIMIT_ARENA] && (arena_bytes > limits[LIMIT_ARENA]) )
+        return set_exceeded(LIMIT_ARENA);
+
+    return true;
+}
+
+
+
+const char* RequestLimits::get_type_name(RequestLimitType type)
+{
+    if( type >= LIMIT_TYPE_CNT )
+        return "unknown";
+
+    return limit_type_names[type];
+}
+
+
+
+bool RequestLimits::set_exceeded(RequestLimitType type)
+{
+    exceeded = type;
+    exceeded_cnt[type]++;
+
+    return false;
+}
@@ -0,0 +1,114 @@
+#ifndef REQUEST_LIMITS_H
+#define REQUEST_LIMITS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+
+
+
+enum RequestLimitType : uint8_t
+{
+    LIMIT_BODY,         // bytes of the HTTP body (Content-Length and the bytes read)
+    LIMIT_DEPTH,        // nesting of XML elements
+    LIMIT_ELEMENTS,     // XML elements of the request
+    LIMIT_ARENA,        // bytes of soap_malloc of the request
+
+    LIMIT_TYPE_CNT      //Its not type! Its counter for use in code (max index)
+};
+
+
+
+
+
+/*
+ * Hard limits of one request, they are checked while it is read
+ * (the frecv and fmalloc hooks and the parser of HTTP headers), so an oversized
+ * or deeply nested request is stopped before gsoap builds it in memory.
+ *
+ * The XML is scanned as it comes (a '<' that is not '</', '<?' or '<!' opens
+ * an element, '</' and '/>' close it): it is not a parser, comments and CDATA
+ * with '<' are counted too, which can only make a request look bigger.
+ * The HTTP header is skipped by its size (HEADER_SIZE): the body limit is
+ * checked exactly by Content-Length, the read bytes catch chunked bodies.
+ *
+ * A request over a limit gets a pre-rendered 413 with a SOAP fault
+ * (env:Sender/ter:InvalidArgs) and its connection is closed.
+ * A limit is "type:value", 0 - no limit (default), body and arena in KB.
+ */
+class RequestLimits
+{
+    public:
+
+        enum
+        {
+            HEADER_SIZE = 8 * 1024      // allowance of the HTTP header in the read bytes
+        };
+
+
+        RequestLimits();
+
+        RequestLimits(const RequestLimits&) = delete;
+        RequestLimits& operator=(const RequestLimits&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_limit(const char *new_val);    // "body|depth|elements|arena:value"
+
+        bool is_enabled() const { return enabled; }
+
+        uint64_t get_limit(RequestLimitType type) const { return limits[type]; }
+
+
+        // the state of the current request
+        void begin();
+
+        // false - a limit is over (see get_exceeded), the read must stop
+        bool check_length(uint64_t content_length);
+        bool check_recv(const char *buf, size_t len);
+        bool check_alloc(size_t size);
+
+        bool             is_exceeded()  const { return exceeded != LIMIT_TYPE_CNT; }
+        RequestLimitType get_exceeded() const { return exceeded; }
+
+
+        const std::string& get_reply() const { return reply; }
+
+        uint64_t get_exceeded_cnt(RequestLimitType type) const { return exceeded_cnt[type]; }
+
+        static const char* get_type_name(RequestLimitType type);
+
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        bool             enabled;
+        uint64_t         limits[LIMIT_TYPE_CNT];      // 0 - no limit
+        uint64_t         exceeded_cnt[LIMIT_TYPE_CNT];
+
+        // the current request
+        uint64_t         recv_bytes;
+        uint64_t         arena_bytes;
+        uint64_t         elements;
+        uint32_t         depth;
+        char             prev;       // the last byte of the previous read (a tag can be split)
+        bool             in_tag;     // between '<' of an opening tag and '>'
+        RequestLimitType exceeded;
+
+        std::string      reply;
+        std::string      str_err;
+
+
+        bool set_exceeded(RequestLimitType type);
+};
+
+
+
+
+
+#endif // REQUEST_LIMITS_H
@@ -0,0 +1,185 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "request_trace.h"
+#include "logger.h"
+
+
+
+
+
+static const char *phase_names[TRACE_PHASE_CNT] =
+{
+    "accept",
+    "parse",
+    "dispatch",
+    "handler",
+    "serialize",
+    "send"
+};
+
+
+
+static void copy_name(char *dst, const char *src, size_t len, size_t size)
+{
+    if( len >= size )
+        len = size - 1;
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+
+
+
+
+RequestTracer::RequestTracer():
+    enabled   (false),
+    slow_us   (0),
+    traces_cnt(0)
+{
+    memset(&current, 0, sizeof(current));
+}
+
+
+
+bool RequestTracer::set_slow_ms(const char *new_val)
+{
+    char *end;
+    long  ms = strtol(new_val, &end, 10);
+
+    if( (*new_val < '0') || (*new_val > '9') || *end || (ms < 1) || (ms > 3600000) )
+    {
+        str_err = "threshold is bad, correct range: 1-3600000 ms";
+        return false;
+    }
+
+    slow_us = (uint64_t)ms * 1000;
+
+    return true;
+}
+
+
+
+void RequestTracer::begin(uint64_t now_us)
+{
+    memset(current.marks, 0, sizeof(current.marks));
+    current.marks[TRACE_ACCEPT] = now_us;
+}
+
+
+
+void RequestTracer::end(const char *service, const char *operation, const char *host, bool fault, uint64_t now_us)
+{
+    current.marks[TRACE_END] = now_us;
+
+    // a mark that is not passed: the previous phase lasts until the next mark
+    for(int i = TRACE_END - 1; i > TRACE_ACCEPT; i--)
+    {
+        if( !current.marks[i] )
+            current.marks[i] = current.marks[i + 1];
+    }
+
+    // a hook of a later phase is called early (e.g. 401 of HTTP Digest)
+    for(int i = 1; i < TRACE_MARK_CNT; i++)
+    {
+        if( current.marks[i] < current.marks[i - 1] )
+            current.marks[i] = current.marks[i - 1];
+    }
+
+
+    size_t service_len = service ? strlen(service) : 0;
+    const char *suffix = service ? strstr(service, "BindingService") : nullptr;
+    if( suffix )
+        service_len = suffix - service;
+
+    const char *colon = operation ? strchr(operation, ':') : nullptr;
+    if( colon )
+        operation = colon + 1;
+
+    copy_name(current.service,   service   ? service   : "", service_len, sizeof(current.service));
+    copy_name(current.operation, operation ? operation : "", operation ? strlen(operation) : 0, sizeof(current.operation));
+    copy_name(current.host,      host      ? host      : "", host      ? strlen(host)      : 0, sizeof(current.host));
+    current.fault = fault;
+
+
+    if( slow_us && (current.get_total_us() >= slow_us) )
+        log_slow(current);
+
+
+    if( !enabled )
+        return;
+
+    if( traces.empty() )
+        traces.resize(MAX_TRACES);
+
+    traces[traces_cnt++ % MAX_TRACES] = current;
+}
+
+
+
+void RequestTracer::render_json(std::string &out) const
+{
+    char   buf[512];
+    size_t cnt   = (traces_cnt < MAX_TRACES) ? traces_cnt : (size_t)MAX_TRACES;
+    bool   first = true;
+
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+
+    // from the oldest one, a request is an event with the nested events of its phases
+    for(size_t n = traces_cnt - cnt; n < traces_cnt; n++)
+    {
+        const RequestTrace &trace = traces[n % MAX_TRACES];
+
+        snprintf(buf, sizeof(buf), "%s\n{\"name\":\"%s%s%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                 "\"pid\":1,\"tid\":1,\"args\":{\"client\":\"%s\",\"fault\":%s}}",
+                 first ? "" : ",",
+                 trace.service[0] ? trace.service : "unknown", trace.operation[0] ? "." : "", trace.operation,
+                 (unsigned long long)trace.marks[TRACE_ACCEPT], (unsigned long long)trace.get_total_us(),
+                 trace.host, trace.fault ? "true" : "false");
+        out  += buf;
+        first = false;
+
+        for(int i = 0; i < TRACE_PHASE_CNT; i++)
+        {
+            TraceMark phase = static_cast<TraceMark>(i);
+
+            if( !trace.get_phase_us(phase) )
+                continue;
+
+            snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":1}",
+                     phase_names[i], (unsigned long long)trace.marks[i], (unsigned long long)trace.get_phase_us(phase));
+            out += buf;
+        }
+    }
+
+
+    out += "\n]}\n";
+}
+
+
+
+const char* RequestTracer::get_phase_name(TraceMark phase)
+{
+    if( phase >= TRACE_PHASE_CNT )
+        return "unknown";
+
+    return phase_names[phase];
+}
+
+
+
+void RequestTracer::log_slow(const RequestTrace &trace) const
+{
+    char name[RequestTrace::NAME_LEN * 2];
+
+    snprintf(name, sizeof(name), "%s%s%s", trace.service[0] ? trace.service : "unknown",
+             trace.operation[0] ? "." : "", trace.operation);
+
+    LOG_W(LOG_MOD_MAIN, "Slow request: %s of %s %llu us: accept %llu parse %llu dispatch %llu handler %llu serialize %llu send %llu",
+          name, trace.host, trace.get_total_us(),
+          trace.get_phase_us(TRACE_ACCEPT),  trace.get_phase_us(TRACE_PARSE),     trace.get_phase_us(TRACE_DISPATCH),
+          trace.get_phase_us(TRACE_HANDLER), trace.get_phase_us(TRACE_SERIALIZE), trace.get_phase_us(TRACE_SEND));
+}
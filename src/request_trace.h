@@ -0,0 +1,129 @@
+#ifndef REQUEST_TRACE_H
+#define REQUEST_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+
+
+
+// marks of a request, a phase is from its mark to the next one
+enum TraceMark
+{
+    TRACE_ACCEPT,       // accept returned: IP filter, rate of connections, TLS handshake
+    TRACE_PARSE,        // soap_begin_serve: HTTP header, auth of HTTP, SOAP Envelope and Header
+    TRACE_DISPATCH,     // rate, access class, FOREACH_SERVICE chain and the Body of the operation
+    TRACE_HANDLER,      // soap_end_recv is done: the handler of the operation
+    TRACE_SERIALIZE,    // the response (or fault) is counted and serialized
+    TRACE_SEND,         // the first write to the socket
+    TRACE_END,          // the response is sent
+
+    TRACE_MARK_CNT,     //Its not mark! Its counter for use in code (max index)
+    TRACE_PHASE_CNT = TRACE_END
+};
+
+
+
+struct RequestTrace
+{
+    enum
+    {
+        NAME_LEN = 48,
+        HOST_LEN = 46       // INET6_ADDRSTRLEN
+    };
+
+    uint64_t marks[TRACE_MARK_CNT];     // usec of CLOCK_MONOTONIC, 0 - not passed
+    char     service  [NAME_LEN];       // like "Media", "" - not dispatched
+    char     operation[NAME_LEN];
+    char     host     [HOST_LEN];
+    bool     fault;
+
+    uint64_t get_phase_us(TraceMark phase) const { return marks[phase + 1] - marks[phase]; }
+    uint64_t get_total_us()                const { return marks[TRACE_END] - marks[TRACE_ACCEPT]; }
+};
+
+
+
+
+
+/*
+ * Timings of phases of requests of the main loop.
+ *
+ * The main loop and the soap hooks call mark() when a phase begins
+ * (only the first call of a mark counts), end() finishes the request:
+ * a missing mark gets the time of the next one (the previous phase lasts
+ * until then, e.g. a fault of parse is "dispatch" up to the send).
+ *
+ * With --trace the last MAX_TRACES requests are kept and can be exported
+ * in Chrome trace-event JSON (GET /trace.json, open it in chrome://tracing
+ * or Perfetto), with --trace_slow the phases of the requests slower than
+ * the threshold are logged.
+ * Everything is done by the thread of the main loop, so there are no locks.
+ */
+class RequestTracer
+{
+    public:
+
+        enum
+        {
+            MAX_TRACES = 1024
+        };
+
+
+        RequestTracer();
+
+
+        //methods for parsing opt from cmd
+        void set_enabled(bool new_val) { enabled = new_val; }
+        bool set_slow_ms(const char *new_val);
+
+
+        bool is_enabled() const { return enabled;            } // traces are kept
+        bool is_active()  const { return enabled || slow_us; } // marks are needed
+
+
+        void begin(uint64_t now_us);
+
+        void mark(TraceMark mark, uint64_t now_us)
+        {
+            if( !current.marks[mark] )
+                current.marks[mark] = now_us;
+        }
+
+        // service is like "MediaBindingService" (the suffix is cut), nullptr - not dispatched
+        void end(const char *service, const char *operation, const char *host, bool fault, uint64_t now_us);
+
+
+        void render_json(std::string &out) const;
+        void clear() { traces_cnt = 0; }
+
+        static const char* get_phase_name(TraceMark phase);
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        bool                       enabled;
+        uint64_t                   slow_us;
+
+        RequestTrace               current;
+
+        std::vector<RequestTrace>  traces;      // ring of the last ones
+        size_t                     traces_cnt;  // all ended, next index is traces_cnt % MAX_TRACES
+
+        std::string                str_err;
+
+
+        void log_slow(const RequestTrace &trace) const;
+};
+
+
+
+
+
+#endif // REQUEST_TRACE_H
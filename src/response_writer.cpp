@@ -0,0 +1,51 @@
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "response_writer.h"
+
+
+
+
+
+ResponseWriter::ResponseWriter():
+    enabled(false),
+    storing(false),
+    responses_cnt(0),
+    partial_cnt(0)
+{
+}
+
+
+
+size_t ResponseWriter::send(int fd)
+{
+    ssize_t res;
+
+    do
+    {
+        res = ::send(fd, buf.data(), buf.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    while( (res < 0) && (errno == EINTR) );
+
+
+    responses_cnt++;
+
+    size_t sent = (res > 0) ? (size_t)res : 0;
+
+    if( sent < buf.size() )
+        partial_cnt++;
+
+    return sent;
+}
+
+
+
+void ResponseWriter::clear()
+{
+    storing = false;
+
+    if( buf.capacity() > KEEP_CAP )
+        std::string().swap(buf);
+    else
+        buf.clear();
+}
@@ -0,0 +1,83 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+
+
+/*
+ * Output of one response by one send().
+ *
+ * gsoap serializes the response in SOAP_IO_STORE mode (one pass, the
+ * Content-Length is the size of the stored blocks) and then writes the HTTP
+ * header and every block by its own fsend. From the HTTP header (the fresponse
+ * hook calls begin) the fsend hook appends them here and the whole response is
+ * sent at the end of the message (fpreparefinalsend) or of the connection
+ * (fclose): the header and the body leave in one segment train, a client never
+ * waits for the ACK of the header (Nagle, delayed ACK). The pre-rendered replies
+ * (503, 401, 413) do not go through fresponse, they are sent at once.
+ *
+ * The buffer is kept between responses up to KEEP_CAP (no malloc per request),
+ * after a bigger response it is freed.
+ */
+class ResponseWriter
+{
+    public:
+
+        enum
+        {
+            KEEP_CAP = 256 * 1024
+        };
+
+
+        ResponseWriter();
+
+        ResponseWriter(const ResponseWriter&) = delete;
+        ResponseWriter& operator=(const ResponseWriter&) = delete;
+
+
+        //methods for parsing opt from cmd
+        void set_enabled(bool enable) { enabled = enable; }
+        bool is_enabled() const       { return enabled;   }
+
+
+        // the response of gsoap is started: fsend is stored up to clear()
+        void begin()            { storing = true;   }
+        bool is_storing() const { return storing;   }
+
+        void append(const char *data, size_t len) { buf.append(data, len); }
+
+        bool        is_pending() const { return !buf.empty(); }
+        const char* data()       const { return buf.data();   }
+        size_t      size()       const { return buf.size();   }
+
+
+        // one send() of the buffer to the (non-blocking) socket,
+        // returns the sent bytes: the rest does not fit the socket buffer
+        size_t send(int fd);
+
+        void clear();   // the response is sent (or dropped)
+
+
+        uint64_t get_responses_cnt() const { return responses_cnt; }
+        uint64_t get_partial_cnt()   const { return partial_cnt;   }  // the rest was sent by fsend
+
+
+    private:
+
+        bool        enabled;
+        bool        storing;
+        std::string buf;
+
+        uint64_t    responses_cnt;
+        uint64_t    partial_cnt;
+};
+
+
+
+
+
+#endif // RESPONSE_WRITER_H
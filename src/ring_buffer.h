@@ -0,0 +1,154 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+
+
+
+
+/*
+ * Bounded lock-free queue (D. Vyukov's MPMC array queue).
+ *
+ * Every cell carries a sequence number, so producers and the consumer
+ * only contend on the head/tail counters and never take a lock.
+ * The capacity is fixed at construction and must be a power of two.
+ * push() never blocks: a full queue is reported to the caller, which
+ * decides what to drop.
+ */
+template<typename T>
+class RingBuffer
+{
+    public:
+
+        explicit RingBuffer(size_t capacity):
+            mask  (capacity - 1),
+            cells (new Cell[capacity]),
+            head  (0),
+            tail  (0)
+        {
+            for(size_t i = 0; i < capacity; i++)
+                cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        ~RingBuffer() { delete [] cells; }
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+
+        size_t capacity() const { return mask + 1; }
+
+        // approximate number of queued elements (exact if nobody is running)
+        size_t size() const
+        {
+            size_t h = head.load(std::memory_order_acquire);
+            size_t t = tail.load(std::memory_order_acquire);
+            return (h > t) ? (h - t) : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+
+        bool push(const T& value)
+        {
+            Cell  *cell;
+            size_t pos = head.load(std::memory_order_relaxed);
+
+            for(;;)
+            {
+                cell = &cells[pos & mask];
+                size_t   seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+                if(dif == 0)
+                {
+                    if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(dif < 0)
+                {
+                    return false; // full
+                }
+                else
+                {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->data = value;
+            cell->seq.store(pos + 1, std::memory_order_release);
+
+            return true;
+        }
+
+
+        bool pop(T& value)
+        {
+            Cell  *cell;
+            size_t pos = tail.load(std::memory_order_relaxed);
+
+            for(;;)
+            {
+                cell = &cells[pos & mask];
+                size_t   seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+                if(dif == 0)
+                {
+                    if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(dif < 0)
+                {
+                    return false; // empty
+                }
+                else
+                {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            value = cell->data;
+            cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+            return true;
+        }
+
+
+        // drop all queued elements (consumer side)
+        void clear()
+        {
+            T tmp;
+            while( pop(tmp) ) {}
+        }
+
+
+    private:
+
+        enum { CACHE_LINE = 64 };
+
+        struct Cell
+        {
+            std::atomic<size_t> seq;
+            T                   data;
+        };
+
+        const size_t mask;
+        Cell * const cells;
+
+        // head and tail live on their own cache lines
+        char                pad0[CACHE_LINE];
+        std::atomic<size_t> head;
+        char                pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> tail;
+        char                pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+
+
+
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "sha1.h"
+
+
+
+
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+
+
+void Sha1::reset()
+{
+    state[0]  = 0x67452301;
+    state[1]  = 0xEFCDAB89;
+    state[2]  = 0x98BADCFE;
+    state[3]  = 0x10325476;
+    state[4]  = 0xC3D2E1F0;
+    total     = 0;
+    block_len = 0;
+}
+
+
+
+void Sha1::update(const void *data, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+
+    total += len;
+
+
+    if( block_len )
+    {
+        size_t n = SHA1_BLOCK_SIZE - block_len;
+        if( n > len )
+            n = len;
+
+        memcpy(block + block_len, ptr, n);
+        block_len += n;
+        ptr       += n;
+        len       -= n;
+
+        if( block_len < SHA1_BLOCK_SIZE )
+            return;
+
+        transform(block);
+        block_len = 0;
+    }
+
+
+    for( ; len >= SHA1_BLOCK_SIZE; ptr += SHA1_BLOCK_SIZE, len -= SHA1_BLOCK_SIZE)
+        transform(ptr);
+
+
+    memcpy(block, ptr, len);
+    block_len = len;
+}
+
+
+
+void Sha1::final(uint8_t digest[SHA1_DIGEST_SIZE])
+{
+    uint64_t bits = total * 8;
+
+
+    block[block_len++] = 0x80;
+
+    if( block_len > SHA1_BLOCK_SIZE - 8 )
+    {
+        memset(block + block_len, 0, SHA1_BLOCK_SIZE - block_len);
+        transform(block);
+        block_len = 0;
+    }
+
+    memset(block + block_len, 0, SHA1_BLOCK_SIZE - 8 - block_len);
+
+    for(int i = 0; i < 8; i++)
+        block[SHA1_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+
+    transform(block);
+
+
+    for(int i = 0; i < 5; i++)
+    {
+        digest[i*4 + 0] = state[i] >> 24;
+        digest[i*4 + 1] = state[i] >> 16;
+        digest[i*4 + 2] = state[i] >> 8;
+        digest[i*4 + 3] = state[i];
+    }
+
+
+    reset();
+}
+
+
+
+void Sha1::transform(const uint8_t *data)
+{
+    uint32_t w[80];
+
+    for(int i = 0; i < 16; i++)
+        w[i] = (uint32_t)data[i*4] << 24 | (uint32_t)data[i*4 + 1] << 16 |
+               (uint32_t)data[i*4 + 2] << 8 | data[i*4 + 3];
+
+    for(int i = 16; i < 80; i++)
+        w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    for(int i = 0; i < 80; i++)
+    {
+        uint32_t f, k;
+
+        if( i < 20 )      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if( i < 40 ) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if( i < 60 ) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else              { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+        uint32_t tmp = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
@@ -0,0 +1,46 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+
+
+#define SHA1_DIGEST_SIZE  20
+#define SHA1_BLOCK_SIZE   64
+
+
+
+/*
+ * SHA-1 (FIPS 180-4).
+ * The context lives on the stack of the caller, no heap is used.
+ * It is used for the digests of WS-UsernameToken, not for signatures.
+ */
+class Sha1
+{
+    public:
+
+        Sha1() { reset(); }
+
+        void reset();
+        void update(const void *data, size_t len);
+        void final(uint8_t digest[SHA1_DIGEST_SIZE]);
+
+
+    private:
+
+        uint32_t state[5];
+        uint64_t total;                  // bytes
+        uint8_t  block[SHA1_BLOCK_SIZE];
+        size_t   block_len;
+
+        void transform(const uint8_t *data);
+};
+
+
+
+
+
+#endif // SHA1_H
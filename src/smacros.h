@@ -103,15 +103,8 @@
 
 
 
-#ifdef  DEBUG
-        #include <stdio.h>
-
-        #define  DEBUG_MSG(...)       printf(__VA_ARGS__)
-        #define  FDEBUG_MSG(fp, ...) fprintf(fp, __VA_ARGS__)
-#else
-        #define  DEBUG_MSG(...)       ({})
-        #define  FDEBUG_MSG(fp, ...)  ({})
-#endif
+// messages: LOG_E/W/I/D(module, ...), see logger.h
+#include "logger.h"
 
 
 
@@ -121,8 +114,12 @@
  * the second is named the first_name + Response.
  * This macro allows you to write the basic behavior in one line:
  * Disable the compiler warning about unused arguments and
- * display a message for the Debug mode.
+ * log a debug message.
+ * The operation is registered as unimplemented (before main),
+ * see register_unimplemented_op in soap_dispatch.h.
  */
+bool register_unimplemented_op(const char *service, const char *tag);
+
 #define SOAP_REQ_ARG(_prefix, _handler) _prefix##__##_handler
 #define SOAP_RSP_ARG(_prefix, _handler) _prefix##__##_handler##Response
 #define SOAP_EMPTY_HANDLER(_class, _prefix, _handler)                       \
@@ -132,9 +129,11 @@ int _class::_handler(                                                       \
     {                                                                       \
         UNUSED(SOAP_REQ_ARG(_prefix, _handler));                            \
         UNUSED(SOAP_RSP_ARG(_prefix, _handler));                            \
-        DEBUG_MSG(#_class ": %s\n", __FUNCTION__);                          \
+        LOG_D(LOG_MOD_SERVICE, #_class ": %s", __FUNCTION__);               \
         return SOAP_OK;                                                     \
-    }
+    }                                                                       \
+static const bool _class##_##_handler##_unimplemented =                     \
+        register_unimplemented_op(#_class, #_prefix ":" #_handler);
 
 
 
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+
+#include "soap_arena.h"
+
+
+
+
+
+SoapArena::SoapArena():
+    cap_slabs(0),
+    used(0),
+    offset(0),
+    slab_allocs(0),
+    slab_frees(0)
+{
+}
+
+
+
+SoapArena::~SoapArena()
+{
+    reset();
+
+    for(char *slab : slabs)
+        free(slab);
+}
+
+
+
+bool SoapArena::set_cap(const char *new_val)
+{
+    char *end;
+    long  kb = strtol(new_val, &end, 10);
+
+    if( (*new_val < '0') || (*new_val > '9') || *end || (kb < 1) || (kb > 1024 * 1024) )
+    {
+        str_err = "cap is bad, correct range: 1-1048576 KB";
+        return false;
+    }
+
+    // at least one slab is kept
+    cap_slabs = ((size_t)kb * 1024 + SLAB_SIZE - 1) / SLAB_SIZE;
+
+    return true;
+}
+
+
+
+void* SoapArena::alloc(size_t size)
+{
+    if( size > MAX_BLOCK )
+    {
+        void *ptr = malloc(size);
+
+        if( ptr )
+            large.push_back(ptr);   // reset() frees it
+
+        return ptr;
+    }
+
+
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+    if( !used || (offset + size > SLAB_SIZE) )
+    {
+        if( used == slabs.size() )
+        {
+            char *slab = static_cast<char *>(malloc(SLAB_SIZE));
+            if( !slab )
+                return nullptr;
+
+            slabs.push_back(slab);
+            slab_allocs++;
+        }
+
+        used++;
+        offset = 0;
+    }
+
+
+    void *ptr = slabs[used - 1] + offset;
+    offset   += size;
+
+    return ptr;
+}
+
+
+
+void SoapArena::reset()
+{
+    for(void *ptr : large)
+        free(ptr);
+
+    large.clear();
+
+    // the spike is over: the slabs over the cap are returned to malloc
+    while( slabs.size() > cap_slabs )
+    {
+        free(slabs.back());
+        slabs.pop_back();
+        slab_frees++;
+    }
+
+    used   = 0;
+    offset = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef SOAP_ARENA_H
+#define SOAP_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+
+
+/*
+ * Region allocator of the soap context of a worker (the main loop).
+ *
+ * The fmalloc hook takes the blocks of soap_malloc (soap_new_ptr, strings,
+ * arrays) from big slabs by a bump pointer. soap_malloc does not chain a block
+ * of fmalloc into soap->alist, so soap_end does not touch them and reset()
+ * after soap_end rewinds the slabs for the next request.
+ * So the same shapes of every request are not malloc'ed and freed again.
+ *
+ * After a spike (a big request) the slabs over the cap are freed by reset(),
+ * a block bigger than MAX_BLOCK is not kept in a slab: it is malloc'ed
+ * and freed by reset() too.
+ * The C++ objects (soap_new_*) are not in the arena, they are deleted by soap_destroy.
+ */
+class SoapArena
+{
+    public:
+
+        enum
+        {
+            SLAB_SIZE = 64 * 1024,
+            MAX_BLOCK = SLAB_SIZE / 4,
+            ALIGN     = 16
+        };
+
+
+        SoapArena();
+       ~SoapArena();
+
+        SoapArena(const SoapArena&) = delete;
+        SoapArena& operator=(const SoapArena&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_cap(const char *new_val);  // KB, the arena is off if it is not set
+        bool is_enabled() const { return cap_slabs != 0; }
+
+
+        void* alloc(size_t size);
+        void  reset();          // after soap_end: all blocks are free
+
+
+        uint64_t get_retained_bytes() const { return (uint64_t)slabs.size() * SLAB_SIZE; }
+        uint64_t get_slab_allocs()    const { return slab_allocs; }  // malloc of slabs
+        uint64_t get_slab_frees()     const { return slab_frees;  }  // over the cap
+
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        size_t              cap_slabs;   // kept by reset(), 0 - off
+
+        std::vector<char*>  slabs;
+        size_t              used;        // slabs of the current request
+        size_t              offset;      // in slabs[used - 1]
+
+        std::vector<void*>  large;       // blocks over MAX_BLOCK of the current request
+
+        uint64_t            slab_allocs;
+        uint64_t            slab_frees;
+
+        std::string         str_err;
+};
+
+
+
+
+
+#endif // SOAP_ARENA_H
@@ -0,0 +1,282 @@
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "soap_dispatch.h"
+#include "soapH.h"
+
+
+
+
+
+static const char not_supported_body[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\""
+    " xmlns:ter=\"http://www.onvif.org/ver10/error\">"
+    "<SOAP-ENV:Body><SOAP-ENV:Fault>"
+    "<SOAP-ENV:Code><SOAP-ENV:Value>SOAP-ENV:Receiver</SOAP-ENV:Value>"
+    "<SOAP-ENV:Subcode><SOAP-ENV:Value>ter:ActionNotSupported</SOAP-ENV:Value></SOAP-ENV:Subcode>"
+    "</SOAP-ENV:Code>"
+    "<SOAP-ENV:Reason><SOAP-ENV:Text xml:lang=\"en\">Optional Action Not Implemented</SOAP-ENV:Text></SOAP-ENV:Reason>"
+    "</SOAP-ENV:Fault></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+
+
+// the operations of SOAP_EMPTY_HANDLER (service, tag), filled before main (the order of files is unknown)
+static std::vector<std::pair<const char *, const char *>>& unimplemented_ops(void)
+{
+    static std::vector<std::pair<const char *, const char *>> ops;
+    return ops;
+}
+
+
+
+bool register_unimplemented_op(const char *service, const char *tag)
+{
+    unimplemented_ops().push_back({ service, tag });
+    return true;
+}
+
+
+
+
+
+SoapDispatcher::SoapDispatcher():
+    mask(0),
+    bucket_mask(0),
+    reject_unimplemented(false),
+    unimplemented_cnt(0)
+{
+    not_supported_reply = "HTTP/1.1 500 Internal Server Error\r\n"
+                          "Content-Type: application/soap+xml; charset=utf-8\r\n"
+                          "Content-Length: " + std::to_string(sizeof(not_supported_body) - 1) + "\r\n"
+                          "Connection: close\r\n\r\n";
+
+    not_supported_reply += not_supported_body;
+}
+
+
+
+void SoapDispatcher::add_service(const char *service_name, void *service, const SoapOperation *ops)
+{
+    services.push_back({ service_name, service, ops });
+}
+
+
+
+bool SoapDispatcher::build(const struct soap *soap)
+{
+    entries.clear();
+    table.clear();
+    seeds.clear();
+    unimplemented_cnt = 0;
+
+
+    for(const Service &srv : services)
+    {
+        for(const SoapOperation *op = srv.ops; op && op->tag; op++)
+        {
+            const char *colon      = strchr(op->tag, ':');
+            size_t      prefix_len = colon ? colon - op->tag : 0;
+            short       ns_index   = -1;
+
+            for(short i = 0; soap->namespaces && soap->namespaces[i].id; i++)
+            {
+                if( !strncmp(soap->namespaces[i].id, op->tag, prefix_len) &&
+                    (soap->namespaces[i].id[prefix_len] == '\0') )
+                {
+                    ns_index = i;
+                    break;
+                }
+            }
+
+            if( ns_index < 0 )
+            {
+                str_err = std::string("namespace of operation is not in the table: ") + op->tag;
+                return false;
+            }
+
+
+            const char *name = colon ? colon + 1 : op->tag;
+            bool        dup  = false;
+
+            for(const Entry &entry : entries)
+                dup |= (entry.ns_index == ns_index) && !strcmp(entry.name, name);
+
+            if( dup )
+                continue;
+
+
+            bool unimplemented = false;
+
+            for(const auto &it : unimplemented_ops())
+                unimplemented |= !strcmp(it.first, srv.name) && !strcmp(it.second, op->tag);
+
+            unimplemented_cnt += unimplemented;
+
+            entries.push_back({ name, ns_index, op, srv.service, srv.name, unimplemented });
+        }
+    }
+
+
+    if( entries.empty() )
+        return true; // the services are dispatched by their dispatch()
+
+
+    for(size_t size = MIN_TABLE_SIZE; size <= MAX_TABLE_SIZE; size *= 2)
+    {
+        if( (size >= entries.size() * 2) && try_size(size) )
+            return true;
+    }
+
+
+    table.clear();
+    seeds.clear();
+    str_err = "can't find a perfect hash for " + std::to_string(entries.size()) + " operations";
+
+    return false;
+}
+
+
+
+const SoapDispatcher::Entry* SoapDispatcher::find(struct soap *soap) const
+{
+    if( table.empty() || soap_peek_element(soap) )
+        return nullptr;
+
+
+    const char *tag        = soap->tag;
+    const char *colon      = strchr(tag, ':');
+    size_t      prefix_len = colon ? colon - tag : 0;
+    const char *name       = colon ? colon + 1 : tag;
+    short       ns_index   = -1;
+
+    // the nearest declaration of the prefix (the default namespace has the empty id)
+    for(const struct soap_nlist *np = soap->nlist; np; np = np->next)
+    {
+        if( !strncmp(np->id, tag, prefix_len) && (np->id[prefix_len] == '\0') )
+        {
+            ns_index = np->index; // -1 - the URI is not in the namespace table
+            break;
+        }
+    }
+
+    if( ns_index < 0 )
+        return nullptr;
+
+
+    uint32_t h   = hash(name, ns_index);
+    uint16_t idx = table[mix(h, seeds[h & bucket_mask]) & mask];
+    if( !idx )
+        return nullptr;
+
+    const Entry &entry = entries[idx - 1];
+
+    return ((entry.ns_index == ns_index) && !strcmp(entry.name, name)) ? &entry : nullptr;
+}
+
+
+
+// FNV-1a of the local name and the namespace
+uint32_t SoapDispatcher::hash(const char *name, short ns_index)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    for(; *name; name++)
+    {
+        hash ^= (uint8_t)*name;
+        hash *= 0x01000193;
+    }
+
+    hash ^= (uint16_t)ns_index;
+    hash *= 0x01000193;
+
+    return hash;
+}
+
+
+
+// the slot of the hash for the seed of its bucket (the finalizer of MurmurHash3)
+uint32_t SoapDispatcher::mix(uint32_t hash, uint32_t seed)
+{
+    hash ^= seed * 0x9E3779B9;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+
+
+// hash and displace: the biggest buckets are placed first, while the table is empty
+bool SoapDispatcher::try_size(size_t size)
+{
+    size_t buckets_cnt = size / 4;
+
+    std::vector<std::vector<uint16_t>> buckets(buckets_cnt);
+    std::vector<uint32_t>              hashes(entries.size());
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        hashes[i] = hash(entries[i].name, entries[i].ns_index);
+        buckets[hashes[i] & (buckets_cnt - 1)].push_back(i);
+    }
+
+
+    std::vector<uint16_t> order(buckets_cnt);
+    for(size_t b = 0; b < buckets_cnt; b++)
+        order[b] = b;
+
+    std::stable_sort(order.begin(), order.end(), [&buckets](uint16_t a, uint16_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+
+    table.assign(size, 0);
+    seeds.assign(buckets_cnt, 0);
+
+    for(uint16_t b : order)
+    {
+        const std::vector<uint16_t> &bucket = buckets[b];
+        if( bucket.empty() )
+            break;
+
+        uint32_t s;
+
+        for(s = 0; s < MAX_SEEDS; s++)
+        {
+            size_t placed = 0;
+
+            for(; placed < bucket.size(); placed++)
+            {
+                uint16_t &slot = table[mix(hashes[bucket[placed]], s) & (size - 1)];
+                if( slot )
+                    break;
+
+                slot = bucket[placed] + 1;
+            }
+
+            if( placed == bucket.size() )
+                break;
+
+            // the slots of this try are freed
+            for(size_t i = 0; i < placed; i++)
+                table[mix(hashes[bucket[i]], s) & (size - 1)] = 0;
+        }
+
+        if( s == MAX_SEEDS )
+            return false;
+
+        seeds[b] = s;
+    }
+
+
+    mask        = size - 1;
+    bucket_mask = buckets_cnt - 1;
+
+    return true;
+}
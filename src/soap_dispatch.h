@@ -0,0 +1,147 @@
+#ifndef SOAP_DISPATCH_H
+#define SOAP_DISPATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+
+
+
+struct soap;
+struct Namespace;
+
+
+
+// operation of a generated service, the tables are appended to soap*Service.cpp
+// at build time (cmake/dispatch_table.cmake), the last one is { nullptr, nullptr }
+struct SoapOperation
+{
+    const char *tag;                                    // "tds:GetServices", prefix of the nsmap
+    int       (*serve)(struct soap *soap, void *service);
+};
+
+
+
+// SOAP_EMPTY_HANDLER (smacros.h) registers its operation ("PTZBindingService", "tptz:GetStatus"),
+// it is called by the static initialization, before main
+bool register_unimplemented_op(const char *service, const char *tag);
+
+
+
+
+
+/*
+ * One dispatch table of the operations of all services:
+ * (namespace, local name of the Body element) -> serve_ of the operation.
+ *
+ * The generated dispatch() of a service compares the element with its operations
+ * one by one and the main loop tries the services one by one, so a PTZ request was
+ * compared with all operations of Device and Media first. Here it is one hash
+ * of the name and one compare: the hash is perfect (hash and displace: the hash
+ * picks a bucket, the seed of the bucket is chosen by build so that every
+ * operation has its own slot), the table has 2-4 slots per operation.
+ *
+ * The namespace is the index in the namespace table of soap (gsoap maps the URI
+ * of the request to it, the prefix of the client does not matter).
+ * If an operation is in several services, the first added wins (like the order
+ * of dispatch of the main loop).
+ *
+ * With set_reject_unimplemented the operations of SOAP_EMPTY_HANDLER are
+ * answered by the pre-rendered ActionNotSupported fault (get_not_supported_reply)
+ * right after the SOAP Header: the Body is not read into objects and the client
+ * does not get an empty OK for an operation the device does not do.
+ */
+class SoapDispatcher
+{
+    public:
+
+        struct Entry
+        {
+            const char          *name;          // local name (after the prefix)
+            short                ns_index;      // in the namespace table of soap
+            const SoapOperation *op;
+            void                *service;
+            const char          *service_name;
+            bool                 unimplemented; // SOAP_EMPTY_HANDLER
+        };
+
+
+        SoapDispatcher();
+
+        SoapDispatcher(const SoapDispatcher&) = delete;
+        SoapDispatcher& operator=(const SoapDispatcher&) = delete;
+
+
+        //methods for parsing opt from cmd
+        void set_reject_unimplemented(bool new_val) { reject_unimplemented = new_val; }
+        bool is_reject_unimplemented() const { return reject_unimplemented; }
+
+
+        void add_service(const char *service_name, void *service, const SoapOperation *ops);
+
+        // after add_service of all services and soap_set_namespaces
+        bool build(const struct soap *soap);
+
+
+        // the element of Body is peeked (nothing is read if it is peeked already),
+        // nullptr - unknown operation (or no element)
+        const Entry* find(struct soap *soap) const;
+
+
+        size_t get_ops_cnt()    const { return entries.size(); }
+        size_t get_table_size() const { return table.size();   }
+        size_t get_unimplemented_cnt() const { return unimplemented_cnt; }
+
+        // HTTP 500 with env:Receiver/ter:ActionNotSupported, Connection: close
+        const std::string& get_not_supported_reply() const { return not_supported_reply; }
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        enum
+        {
+            MIN_TABLE_SIZE = 16,
+            MAX_TABLE_SIZE = 1 << 15,   // slots are uint16_t (idx + 1)
+            MAX_SEEDS      = 4096       // per bucket, then the size is doubled
+        };
+
+
+        struct Service
+        {
+            const char          *name;
+            void                *service;
+            const SoapOperation *ops;
+        };
+
+
+        std::vector<Service>  services;
+        std::vector<Entry>    entries;
+        std::vector<uint16_t> table;        // idx in entries + 1, 0 - free
+        std::vector<uint16_t> seeds;        // of the buckets
+
+        uint32_t              mask;         // of table
+        uint32_t              bucket_mask;  // of seeds
+
+        bool                  reject_unimplemented;
+        size_t                unimplemented_cnt;
+        std::string           not_supported_reply;
+
+        std::string           str_err;
+
+
+        static uint32_t hash(const char *name, short ns_index);
+        static uint32_t mix(uint32_t hash, uint32_t seed);
+        bool            try_size(size_t size);
+};
+
+
+
+
+
+#endif // SOAP_DISPATCH_H
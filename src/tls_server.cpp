@@ -0,0 +1,525 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <limits.h>
+
+#include "tls_server.h"
+
+#ifdef WITH_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#endif
+
+
+
+
+
+#ifdef WITH_OPENSSL
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX TicketMacCtx;   // HMAC_CTX is deprecated in OpenSSL 3
+#else
+typedef HMAC_CTX    TicketMacCtx;
+#endif
+
+
+
+static bool init_ticket_mac(TicketMacCtx *mac_ctx, const uint8_t *key)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void *)key, TlsServer::TICKET_KEY_LEN);
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+
+    return EVP_MAC_CTX_set_params(mac_ctx, params) == 1;
+#else
+    return HMAC_Init_ex(mac_ctx, key, TlsServer::TICKET_KEY_LEN, EVP_sha256(), NULL) == 1;
+#endif
+}
+
+
+
+/*
+ * enc == 1: encrypt a new ticket with the current key,
+ * enc == 0: find the key of the ticket by its name.
+ * Returns: 1 - ok, 2 - ok but renew the ticket (old key or TLS 1.3),
+ *          0 - unknown key (full handshake), -1 - error
+ */
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *cipher_ctx, TicketMacCtx *mac_ctx, int enc)
+{
+    auto tls = static_cast<const TlsServer *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if( !tls )
+        return -1;
+
+
+    if( enc )
+    {
+        const TlsServer::TicketKey *key = tls->get_ticket_key(0);
+
+        if( RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 )
+            return -1;
+
+        memcpy(key_name, key->name, TlsServer::TICKET_KEY_NAME_LEN);
+
+        if( !EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) ||
+            !init_ticket_mac(mac_ctx, key->hmac_key) )
+            return -1;
+
+        return 1;
+    }
+
+
+    for(int i = 0; i < TlsServer::TICKET_KEYS; i++)
+    {
+        const TlsServer::TicketKey *key = tls->get_ticket_key(i);
+
+        if( memcmp(key_name, key->name, TlsServer::TICKET_KEY_NAME_LEN) )
+            continue;
+
+        if( !init_ticket_mac(mac_ctx, key->hmac_key) ||
+            !EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) )
+            return -1;
+
+        // TLS 1.3 clients use a ticket once (RFC 8446, C.4), they need a new one every time
+        return (i == 0 && SSL_version(ssl) < TLS1_3_VERSION) ? 1 : 2;
+    }
+
+
+    return 0;
+}
+
+
+#endif // WITH_OPENSSL
+
+
+
+
+
+TlsServer::TlsServer():
+    port         (0),
+    only         (false),
+    master       (SOAP_INVALID_SOCKET),
+    handshake_pending(false),
+    next_rotation(0),
+    full_cnt     (0),
+    resumed_cnt  (0),
+    failed_cnt   (0),
+    full_us      (0),
+    resumed_us   (0),
+    rotation_cnt (0)
+{
+    memset(ticket_keys, 0, sizeof(ticket_keys));
+}
+
+
+
+TlsServer::~TlsServer()
+{
+#ifdef WITH_OPENSSL
+    OPENSSL_cleanse(ticket_keys, sizeof(ticket_keys));
+#endif
+}
+
+
+
+bool TlsServer::set_port(const char *new_val)
+{
+    char *end;
+    long  tmp_val = strtol(new_val, &end, 10);
+
+    if( *end || (tmp_val <= 0) || (tmp_val > 65535) )
+    {
+        str_err = "port is bad, correct range: 1-65535";
+        return false;
+    }
+
+
+#ifndef WITH_OPENSSL
+    str_err = "daemon is built without OpenSSL (see cmake TLS_ON)";
+    return false;
+#endif
+
+
+    port = tmp_val;
+    return true;
+}
+
+
+
+bool TlsServer::set_cert_file(const char *new_val)
+{
+    if( !new_val || !*new_val )
+    {
+        str_err = "cert file is empty";
+        return false;
+    }
+
+
+    cert_file = new_val;
+    return true;
+}
+
+
+
+bool TlsServer::set_key_file(const char *new_val)
+{
+    if( !new_val || !*new_val )
+    {
+        str_err = "key file is empty";
+        return false;
+    }
+
+
+    key_file = new_val;
+    return true;
+}
+
+
+
+bool TlsServer::init(struct soap *soap, const char *session_id_ctx)
+{
+#ifdef WITH_OPENSSL
+
+    if( cert_file.empty() )
+    {
+        str_err = "cert file is not set";
+        return false;
+    }
+
+
+    unsigned short flags = SOAP_SSL_NO_AUTHENTICATION | SOAP_TLSv1_2;
+#ifdef SOAP_TLSv1_3
+    flags |= SOAP_TLSv1_3;
+#endif
+
+
+    // the cert and key are loaded below, they can be in different files
+    if( soap_ssl_server_context(soap, flags, NULL, NULL, NULL, NULL, NULL, NULL, session_id_ctx) )
+    {
+        str_err = "can't create SSL context";
+        return false;
+    }
+
+
+    SSL_CTX *ctx = soap->ctx;
+
+    if( SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1 )
+    {
+        str_err = "can't load cert file: " + cert_file;
+        return false;
+    }
+
+    if( SSL_CTX_use_PrivateKey_file(ctx, key_file.empty() ? cert_file.c_str() : key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1 )
+    {
+        str_err = "can't load private key for cert: " + cert_file;
+        return false;
+    }
+
+
+    // resumption by session ID
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, TICKET_KEY_LIFETIME);
+
+
+    // resumption by ticket with our rotating keys
+    if( !rotate_ticket_keys(time(NULL)) || !rotate_ticket_keys(time(NULL)) ) // both slots are random
+    {
+        str_err = "can't generate session ticket key";
+        return false;
+    }
+
+    rotation_cnt = 0;
+
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_app_data(ctx, this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb);
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    SSL_CTX_set_num_tickets(ctx, 1); // one is enough, a VMS keeps only the last one
+#endif
+
+
+    // own listening socket, soap_bind must not close the HTTP one
+    SOAP_SOCKET http_master = soap->master;
+    soap->master = SOAP_INVALID_SOCKET;
+
+    master = soap_bind(soap, NULL, port, 10);
+
+    soap->master = http_master;
+
+    if( !soap_valid_socket(master) )
+    {
+        str_err = "can't bind TLS port: " + std::to_string(port);
+        return false;
+    }
+
+
+    return true;
+
+#else
+
+    (void)soap;
+    (void)session_id_ctx;
+    str_err = "daemon is built without OpenSSL (see cmake TLS_ON)";
+    return false;
+
+#endif
+}
+
+
+
+SOAP_SOCKET TlsServer::accept(struct soap *soap)
+{
+    handshake_pending = false;
+
+    for(;;)
+    {
+        struct pollfd fds[2];
+        nfds_t        nfds = 0;
+
+        if( soap_valid_socket(soap->master) )
+        {
+            fds[nfds].fd     = soap->master;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+
+        fds[nfds].fd     = master;
+        fds[nfds].events = POLLIN;
+        nfds++;
+
+
+        if( poll(fds, nfds, -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            soap->errnum = errno;
+            soap_set_receiver_error(soap, "poll failed", "TlsServer::accept", SOAP_TCP_ERROR);
+            return SOAP_INVALID_SOCKET;
+        }
+
+
+        // HTTP client first: it is cheap
+        if( (nfds == 2) && fds[0].revents )
+            return soap_accept(soap);
+
+
+        SOAP_SOCKET http_master = soap->master;
+        soap->master = master;
+
+        SOAP_SOCKET sock = soap_accept(soap);
+
+        soap->master = http_master;
+
+        handshake_pending = soap_valid_socket(sock);
+
+        return sock;
+    }
+}
+
+
+
+bool TlsServer::is_secure(const struct soap *soap)
+{
+#ifdef WITH_OPENSSL
+    return soap->ssl != NULL;
+#else
+    (void)soap;
+    return false;
+#endif
+}
+
+
+
+bool TlsServer::reload_cert(struct soap *soap)
+{
+#ifdef WITH_OPENSSL
+
+    if( !soap->ctx )
+    {
+        str_err = "SSL context is not created";
+        return false;
+    }
+
+
+    // the files are checked by a scratch context, a failed load must not break the served one
+    const char *key = key_file.empty() ? cert_file.c_str() : key_file.c_str();
+    SSL_CTX    *tmp = SSL_CTX_new(TLS_server_method());
+
+    bool ok = tmp &&
+              (SSL_CTX_use_certificate_chain_file(tmp, cert_file.c_str()) == 1) &&
+              (SSL_CTX_use_PrivateKey_file(tmp, key, SSL_FILETYPE_PEM) == 1) &&
+              (SSL_CTX_check_private_key(tmp) == 1);
+
+    SSL_CTX_free(tmp);
+
+    if( !ok )
+    {
+        str_err = "can't load cert and private key: " + cert_file;
+        return false;
+    }
+
+
+    if( (SSL_CTX_use_certificate_chain_file(soap->ctx, cert_file.c_str()) != 1) ||
+        (SSL_CTX_use_PrivateKey_file(soap->ctx, key, SSL_FILETYPE_PEM) != 1) )
+    {
+        str_err = "can't load cert and private key: " + cert_file;
+        return false;
+    }
+
+    return true;
+
+#else
+
+    (void)soap;
+    str_err = "daemon is built without OpenSSL (see cmake TLS_ON)";
+    return false;
+
+#endif
+}
+
+
+
+bool TlsServer::flush_sessions(struct soap *soap, time_t now)
+{
+#ifdef WITH_OPENSSL
+
+    if( !soap->ctx )
+    {
+        str_err = "SSL context is not created";
+        return false;
+    }
+
+
+    // all sessions of the cache are expired as of the far future
+    SSL_CTX_flush_sessions(soap->ctx, LONG_MAX);
+
+
+    // tickets of both keys are not accepted anymore
+    for(int i = 0; i < TICKET_KEYS; i++)
+    {
+        if( !rotate_ticket_keys(now) )
+        {
+            str_err = "can't generate session ticket key";
+            return false;
+        }
+    }
+
+    return true;
+
+#else
+
+    (void)soap;
+    (void)now;
+    str_err = "daemon is built without OpenSSL (see cmake TLS_ON)";
+    return false;
+
+#endif
+}
+
+
+
+bool TlsServer::rotate_ticket_keys(time_t now)
+{
+#ifdef WITH_OPENSSL
+
+    TicketKey new_key;
+
+    if( (RAND_bytes(new_key.name,     sizeof(new_key.name))     != 1) ||
+        (RAND_bytes(new_key.aes_key,  sizeof(new_key.aes_key))  != 1) ||
+        (RAND_bytes(new_key.hmac_key, sizeof(new_key.hmac_key)) != 1) )
+        return false;
+
+
+    // single-threaded: the handshake and the rotation are done by the main loop
+    for(int i = TICKET_KEYS - 1; i > 0; i--)
+        ticket_keys[i] = ticket_keys[i - 1];
+
+    ticket_keys[0] = new_key;
+    OPENSSL_cleanse(&new_key, sizeof(new_key));
+
+
+    next_rotation = now + TICKET_KEY_LIFETIME;
+    rotation_cnt++;
+
+    return true;
+
+#else
+
+    (void)now;
+    return false;
+
+#endif
+}
+
+
+
+bool TlsServer::handshake(struct soap *soap)
+{
+#ifdef WITH_OPENSSL
+
+    handshake_pending = false;
+
+    time_t now = time(NULL);
+
+    // if the rotation fails, the current key just lives longer
+    if( (now >= next_rotation) && !rotate_ticket_keys(now) )
+        next_rotation = now + 60;
+
+
+    uint64_t start = now_us();
+
+    if( soap_ssl_accept(soap) != SOAP_OK )
+    {
+        failed_cnt++;
+        return false;
+    }
+
+    uint64_t time_us = now_us() - start;
+
+
+    if( SSL_session_reused(soap->ssl) )
+    {
+        resumed_cnt++;
+        resumed_us += time_us;
+    }
+    else
+    {
+        full_cnt++;
+        full_us += time_us;
+    }
+
+
+    return true;
+
+#else
+
+    (void)soap;
+    return false;
+
+#endif
+}
@@ -0,0 +1,141 @@
+#ifndef TLS_SERVER_H
+#define TLS_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+
+#include "stdsoap2.h"
+
+
+
+
+
+/*
+ * HTTPS listener of Services (TLS 1.2+), it works alongside the HTTP listener
+ * (or instead of it, see opt --tls_only) in the same soap context:
+ * both listening sockets are polled, a client of the TLS socket is accepted
+ * by soap_accept + soap_ssl_accept, so the services do not know about TLS.
+ *
+ * A VMS reconnects to the device all the time, so the full handshake
+ * (RSA/ECDHE on a slow ARM core) is done once per client:
+ *  - TLS 1.2 clients without tickets resume by session ID (server cache),
+ *  - all others resume by a session ticket. Tickets are encrypted with
+ *    our own keys, they are rotated every TICKET_KEY_LIFETIME, a ticket
+ *    of the previous key is still accepted (and renewed with the current one).
+ *
+ * Without WITH_OPENSSL (see cmake TLS_ON) the listener can't be enabled.
+ */
+class TlsServer
+{
+    public:
+
+        enum
+        {
+            SESSION_CACHE_SIZE  = 1024,  // sessions in the server cache
+            TICKET_KEY_LIFETIME = 3600,  // sec, it is the lifetime of session too
+            TICKET_KEYS         = 2,     // current + previous
+            TICKET_KEY_NAME_LEN = 16,
+            TICKET_KEY_LEN      = 32     // AES-256 and HMAC-SHA256 keys
+        };
+
+
+        TlsServer();
+       ~TlsServer();
+
+        TlsServer(const TlsServer&) = delete;
+        TlsServer& operator=(const TlsServer&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_port(const char *new_val);
+        bool set_cert_file(const char *new_val);
+        bool set_key_file(const char *new_val);
+        void set_only(bool new_val) { only = new_val; }
+
+        bool is_enabled() const { return port != 0;       }
+        bool is_only()    const { return only && port;    }
+        int  get_port()   const { return port;            }
+
+
+        // create SSL context in soap and bind the TLS listening socket
+        bool init(struct soap *soap, const char *session_id_ctx);
+
+        // wait for a client on any listening socket,
+        // returns the socket of client or SOAP_INVALID_SOCKET (error of listener)
+        SOAP_SOCKET accept(struct soap *soap);
+
+        // the client is of TLS listener, its handshake is not done yet
+        // (it is done after the IP filter, so a filtered client costs no crypto)
+        bool is_handshake_pending() const { return handshake_pending; }
+        bool handshake(struct soap *soap);
+
+        // connection of current client is TLS
+        static bool is_secure(const struct soap *soap);
+
+        // TLS listening socket (the main loop polls it with others)
+        SOAP_SOCKET get_master() const { return master; }
+
+
+        // load the cert and key files again (a renewed cert) for new handshakes,
+        // the loaded ones are kept if the files are bad
+        bool reload_cert(struct soap *soap);
+
+        // forget all sessions: the server cache and both ticket keys
+        bool flush_sessions(struct soap *soap, time_t now);
+
+
+        uint64_t get_full_cnt()     const { return full_cnt;     }
+        uint64_t get_resumed_cnt()  const { return resumed_cnt;  }
+        uint64_t get_failed_cnt()   const { return failed_cnt;   }
+        uint64_t get_full_us()      const { return full_us;      }  // time of all full handshakes
+        uint64_t get_resumed_us()   const { return resumed_us;   }
+        uint64_t get_rotation_cnt() const { return rotation_cnt; }
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+        // used by the ticket key callback of OpenSSL
+        struct TicketKey
+        {
+            uint8_t name    [TICKET_KEY_NAME_LEN];
+            uint8_t aes_key [TICKET_KEY_LEN];
+            uint8_t hmac_key[TICKET_KEY_LEN];
+        };
+
+        const TicketKey* get_ticket_key(int idx) const { return &ticket_keys[idx]; }
+
+
+    private:
+
+        int          port;
+        bool         only;
+        std::string  cert_file;
+        std::string  key_file;
+
+        SOAP_SOCKET  master;    // TLS listening socket
+        bool         handshake_pending;
+
+        TicketKey    ticket_keys[TICKET_KEYS];   // [0] - current
+        time_t       next_rotation;
+
+        uint64_t     full_cnt;
+        uint64_t     resumed_cnt;
+        uint64_t     failed_cnt;
+        uint64_t     full_us;
+        uint64_t     resumed_us;
+        uint64_t     rotation_cnt;
+
+        std::string  str_err;
+
+
+        bool rotate_ticket_keys(time_t now);
+};
+
+
+
+
+
+#endif // TLS_SERVER_H
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "traffic_record.h"
+
+
+
+
+
+TrafficRecorder::TrafficRecorder():
+    fd(-1),
+    flush_ms(0),
+    records_cnt(0)
+{
+    memset(&record, 0, sizeof(record));
+}
+
+
+
+TrafficRecorder::~TrafficRecorder()
+{
+    stop();
+}
+
+
+
+bool TrafficRecorder::set_file(const char *new_val)
+{
+    if( !new_val || !*new_val )
+    {
+        str_err = "file name is empty";
+        return false;
+    }
+
+    file = new_val;
+
+    return true;
+}
+
+
+
+bool TrafficRecorder::start()
+{
+    if( !open_file() )
+        return false;
+
+    request.reserve(16 * 1024);
+    pending.reserve(FLUSH_SIZE * 2);
+
+    return true;
+}
+
+
+
+void TrafficRecorder::stop()
+{
+    if( fd < 0 )
+        return;
+
+    flush();
+    close(fd);
+    fd = -1;
+}
+
+
+
+bool TrafficRecorder::reopen()
+{
+    if( fd < 0 )
+        return true;
+
+    flush();
+    close(fd);
+
+    return open_file();
+}
+
+
+
+bool TrafficRecorder::open_file()
+{
+    fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if( fd < 0 )
+    {
+        str_err = "can't open record file: " + file + " - " + strerror(errno);
+        return false;
+    }
+
+
+    // a new (or rotated) file gets the header
+    struct stat st;
+    if( (fstat(fd, &st) == 0) && (st.st_size == 0) )
+    {
+        TrafficFileHeader header;
+        memcpy(header.magic, TRAFFIC_FILE_MAGIC, sizeof(header.magic));
+        header.version  = TRAFFIC_FILE_VERSION;
+        header.reserved = 0;
+
+        pending.append((const char *)&header, sizeof(header));
+    }
+
+    return true;
+}
+
+
+
+void TrafficRecorder::begin(const struct sockaddr *peer, bool tls)
+{
+    if( fd < 0 )
+        return;
+
+    // the wall clock: the replay keeps the intervals, the records of several runs are ordered
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    request.clear();
+    memset(&record, 0, sizeof(record));
+
+    record.flags   = tls ? TRAFFIC_TLS : 0;
+    record.time_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    record.family  = peer->sa_family;
+
+    if( peer->sa_family == AF_INET )
+    {
+        auto in = (const struct sockaddr_in *)peer;
+        memcpy(record.addr, &in->sin_addr, sizeof(in->sin_addr));
+        record.port = ntohs(in->sin_port);
+    }
+    else if( peer->sa_family == AF_INET6 )
+    {
+        auto in6 = (const struct sockaddr_in6 *)peer;
+        memcpy(record.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+        record.port = ntohs(in6->sin6_port);
+    }
+}
+
+
+
+void TrafficRecorder::end(uint64_t now_ms)
+{
+    if( (fd < 0) || request.empty() )
+        return;
+
+
+    record.len = request.size();
+
+    pending.append((const char *)&record, sizeof(record));
+    pending.append(request);
+    request.clear();
+
+    records_cnt++;
+
+
+    if( (pending.size() >= FLUSH_SIZE) || (now_ms - flush_ms >= FLUSH_MS) )
+    {
+        flush();
+        flush_ms = now_ms;
+    }
+}
+
+
+
+void TrafficRecorder::flush()
+{
+    size_t written = 0;
+
+    while( (fd >= 0) && (written < pending.size()) )
+    {
+        ssize_t len = write(fd, pending.data() + written, pending.size() - written);
+
+        if( len < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            break; // disk is full: the records are lost, the daemon must go on
+        }
+
+        written += len;
+    }
+
+    pending.clear();
+}
@@ -0,0 +1,150 @@
+#ifndef TRAFFIC_RECORD_H
+#define TRAFFIC_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include <sys/socket.h>
+
+
+
+
+
+/*
+ * Format of the capture file (--record), the byte order of the host:
+ *
+ *   TrafficFileHeader
+ *   TrafficRecordHeader + len bytes of the request (HTTP header and body)
+ *   TrafficRecordHeader + ...
+ *
+ * A file can be appended by several runs (the file header is written once).
+ * The replay tool (bench/replay.cpp) reads it.
+ */
+#define TRAFFIC_FILE_MAGIC    "ONVIFREC"
+#define TRAFFIC_FILE_VERSION  1
+
+
+struct TrafficFileHeader
+{
+    char     magic[8];      // TRAFFIC_FILE_MAGIC (without '\0')
+    uint32_t version;
+    uint32_t reserved;
+};
+
+
+enum TrafficFlags
+{
+    TRAFFIC_TLS       = 1 << 0,     // the request came to the HTTPS listener (it is plaintext here)
+    TRAFFIC_TRUNCATED = 1 << 1      // the request was longer than MAX_REQUEST
+};
+
+
+struct TrafficRecordHeader
+{
+    uint32_t len;           // bytes of the request after the header
+    uint32_t flags;         // TrafficFlags
+    uint64_t time_us;       // CLOCK_REALTIME of the accept
+    uint16_t family;        // AF_INET or AF_INET6 of the client
+    uint16_t port;          // of the client
+    uint8_t  addr[16];      // of the client, IPv4 in the first 4 bytes
+    uint32_t reserved;
+};
+
+
+static_assert(sizeof(TrafficFileHeader)   == 16, "TrafficFileHeader must be packed");
+static_assert(sizeof(TrafficRecordHeader) == 40, "TrafficRecordHeader must be packed");
+
+
+
+
+
+/*
+ * Capture of the raw requests of the main loop (--record FILE).
+ *
+ * The frecv hook appends what gSOAP reads (after TLS, so it is plaintext),
+ * end() writes the record of the request. The records are buffered and
+ * written at least every FLUSH_MS or by FLUSH_SIZE, so the capture costs
+ * no write per request. The file has mode 0600: it has the credentials
+ * of the clients (digests of WS-UsernameToken and HTTP Digest).
+ * Everything is done by the thread of the main loop, so there are no locks.
+ */
+class TrafficRecorder
+{
+    public:
+
+        enum
+        {
+            MAX_REQUEST = 1024 * 1024,
+            FLUSH_SIZE  = 64 * 1024,
+            FLUSH_MS    = 1000
+        };
+
+
+        TrafficRecorder();
+       ~TrafficRecorder();
+
+        TrafficRecorder(const TrafficRecorder&) = delete;
+        TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_file(const char *new_val);
+        bool is_enabled() const { return !file.empty(); }
+
+
+        // after daemonize (chdir)
+        bool start();
+        void stop();
+        bool reopen();      // logrotate (SIGHUP, command reload)
+
+
+        void begin(const struct sockaddr *peer, bool tls);    // after accept (and the handshake)
+
+        void append(const char *buf, size_t len)
+        {
+            if( fd < 0 )
+                return;
+
+            if( request.size() + len > MAX_REQUEST )
+            {
+                len = MAX_REQUEST - request.size();
+                record.flags |= TRAFFIC_TRUNCATED;
+            }
+
+            request.append(buf, len);
+        }
+
+        void end(uint64_t now_ms);          // nothing is written if nothing was read
+        void flush();
+
+
+        uint64_t get_records_cnt() const { return records_cnt; }
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        std::string          file;
+        int                  fd;
+
+        TrafficRecordHeader  record;        // of the current request
+        std::string          request;
+        std::string          pending;       // records, not written yet
+        uint64_t             flush_ms;      // the last write
+
+        uint64_t             records_cnt;
+
+        std::string          str_err;
+
+
+        bool open_file();
+};
+
+
+
+
+
+#endif // TRAFFIC_RECORD_H
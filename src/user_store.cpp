@@ -0,0 +1,545 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "user_store.h"
+
+
+
+
+
+static const char *level_names[] = { "Administrator", "Operator", "User" };
+
+
+
+static uint32_t hash_name(const char *name, size_t len)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+
+
+static bool parse_level(const char *str, size_t len, UserLevel *level)
+{
+    for(int i = USER_LEVEL_ADMINISTRATOR; i < USER_LEVEL_ANONYMOUS; i++)
+    {
+        if( (strlen(level_names[i]) == len) && !strncmp(level_names[i], str, len) )
+        {
+            *level = static_cast<UserLevel>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+static size_t admin_cnt(const UserList &list)
+{
+    size_t cnt = 0;
+
+    for(size_t i = 0; i < list.cnt; i++)
+        cnt += (list.users[i].level == USER_LEVEL_ADMINISTRATOR);
+
+    return cnt;
+}
+
+
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while( len )
+    {
+        ssize_t n = write(fd, data, len);
+        if( n < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        data += n;
+        len  -= n;
+    }
+
+    return true;
+}
+
+
+
+
+
+const UserAccount* UserList::find(const char *name, size_t len) const
+{
+    if( !name || !len || (len >= USER_NAME_LEN) )
+        return nullptr;
+
+
+    uint32_t idx = hash_name(name, len) & (INDEX_SIZE - 1);
+
+    for(;;) // there is always a free entry (INDEX_SIZE > MAX_USERS)
+    {
+        uint8_t user_idx = index[idx];
+
+        if( user_idx == INDEX_FREE )
+            return nullptr;
+
+        const UserAccount &account = users[user_idx];
+
+        if( !strncmp(account.name, name, len) && !account.name[len] )
+            return &account;
+
+        idx = (idx + 1) & (INDEX_SIZE - 1);
+    }
+}
+
+
+
+void UserList::build_index()
+{
+    memset(index, INDEX_FREE, sizeof(index));
+
+    for(size_t i = 0; i < cnt; i++)
+    {
+        uint32_t idx = hash_name(users[i].name, strlen(users[i].name)) & (INDEX_SIZE - 1);
+
+        while( index[idx] != INDEX_FREE )
+            idx = (idx + 1) & (INDEX_SIZE - 1);
+
+        index[idx] = i;
+    }
+}
+
+
+
+
+
+UserStore::UserStore():
+    current(nullptr),
+    active (new UserList)
+{
+    active->cnt = 0;
+    active->build_index();
+
+    current.store(active.get());
+}
+
+
+
+bool UserStore::set_file(const char *new_val)
+{
+    if( !new_val || !*new_val )
+    {
+        str_err = "file name is empty";
+        return false;
+    }
+
+
+    file = new_val;
+
+    return true;
+}
+
+
+
+bool UserStore::init(const std::string &new_realm, const std::string &admin, const std::string &password)
+{
+    realm = new_realm;
+
+
+    std::unique_ptr<UserList> list(new UserList);
+    list->cnt = 0;
+
+    if( !file.empty() && (access(file.c_str(), F_OK) == 0) )
+    {
+        if( !load(*list) )
+            return false;
+    }
+    else
+    {
+        Change change;
+        change.name         = admin;
+        change.password     = password;
+        change.has_password = true;
+        change.level        = USER_LEVEL_ADMINISTRATOR;
+
+        Result res = set_account(list->users[0], change);
+        if( res != USER_OK )
+        {
+            str_err = std::string("default user: ") + get_result_str(res);
+            return false;
+        }
+
+        list->cnt = 1;
+    }
+
+
+    Result res = publish(std::move(list));
+    if( res != USER_OK )
+    {
+        if( str_err.empty() )
+            str_err = get_result_str(res);
+
+        return false;
+    }
+
+    return true;
+}
+
+
+
+bool UserStore::reload()
+{
+    if( file.empty() )
+    {
+        str_err = "users file is not set";
+        return false;
+    }
+
+
+    std::unique_ptr<UserList> list(new UserList);
+
+    if( !load(*list) )
+        return false;
+
+
+    Result res = publish(std::move(list), false);
+    if( res != USER_OK )
+    {
+        str_err = std::string("users file: ") + get_result_str(res);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+const UserAccount* UserStore::find(const char *name) const
+{
+    return name ? find(name, strlen(name)) : nullptr;
+}
+
+
+
+UserStore::Result UserStore::create_users(const std::vector<Change> &changes)
+{
+    std::unique_ptr<UserList> list(new UserList(*get_users()));
+
+
+    for(const Change &change : changes)
+    {
+        if( list->find(change.name.c_str(), change.name.size()) )
+            return USER_EXISTS;
+
+        if( list->cnt >= UserList::MAX_USERS )
+            return USER_TOO_MANY;
+
+
+        Result res = set_account(list->users[list->cnt], change);
+        if( res != USER_OK )
+            return res;
+
+        list->cnt++;
+        list->build_index(); // a name can be twice in the request
+    }
+
+
+    return publish(std::move(list));
+}
+
+
+
+UserStore::Result UserStore::delete_users(const std::vector<std::string> &names)
+{
+    std::unique_ptr<UserList> list(new UserList(*get_users()));
+
+
+    for(const std::string &name : names)
+    {
+        const UserAccount *account = list->find(name.c_str(), name.size());
+        if( !account )
+            return USER_NOT_FOUND;
+
+
+        size_t idx = account - list->users;
+
+        memmove(&list->users[idx], &list->users[idx + 1], (list->cnt - idx - 1) * sizeof(UserAccount));
+        list->cnt--;
+        list->build_index();
+    }
+
+
+    return publish(std::move(list));
+}
+
+
+
+UserStore::Result UserStore::set_users(const std::vector<Change> &changes)
+{
+    std::unique_ptr<UserList> list(new UserList(*get_users()));
+
+
+    for(const Change &change : changes)
+    {
+        UserAccount *account = const_cast<UserAccount *>(list->find(change.name.c_str(), change.name.size()));
+        if( !account )
+            return USER_NOT_FOUND;
+
+
+        Change full_change = change;
+
+        if( !change.has_password )
+        {
+            full_change.password     = account->password;
+            full_change.has_password = true;
+        }
+
+
+        Result res = set_account(*account, full_change);
+        if( res != USER_OK )
+            return res;
+    }
+
+
+    return publish(std::move(list));
+}
+
+
+
+const char* UserStore::get_result_str(Result result)
+{
+    switch(result)
+    {
+        case USER_OK:                return "ok";
+        case USER_BAD_NAME:          return "bad user name";
+        case USER_NAME_TOO_LONG:     return "user name is too long";
+        case USER_BAD_PASSWORD:      return "bad password";
+        case USER_PASSWORD_TOO_LONG: return "password is too long";
+        case USER_BAD_LEVEL:         return "user level is not supported";
+        case USER_EXISTS:            return "user already exists";
+        case USER_NOT_FOUND:         return "user is not found";
+        case USER_TOO_MANY:          return "too many users";
+        case USER_FIXED:             return "the last Administrator can't be deleted or changed";
+        case USER_IO_ERROR:          return "can't write users file";
+    }
+
+    return "unknown";
+}
+
+
+
+const char* UserStore::get_level_name(UserLevel level)
+{
+    if( level < USER_LEVEL_ANONYMOUS )
+        return level_names[level];
+
+    return "Anonymous";
+}
+
+
+
+UserStore::Result UserStore::set_account(UserAccount &account, const Change &change) const
+{
+    // ':' is the separator in the file, the name goes into HTTP Digest header
+    if( change.name.empty() || (change.name.find_first_of(":\"\\ \t\r\n") != std::string::npos) )
+        return USER_BAD_NAME;
+
+    if( change.name.size() >= USER_NAME_LEN )
+        return USER_NAME_TOO_LONG;
+
+    if( !change.has_password || (change.password.find_first_of("\r\n") != std::string::npos) )
+        return USER_BAD_PASSWORD;
+
+    if( change.password.size() >= USER_PASSWORD_LEN )
+        return USER_PASSWORD_TOO_LONG;
+
+    if( change.level >= USER_LEVEL_ANONYMOUS )
+        return USER_BAD_LEVEL;
+
+
+    memset(&account, 0, sizeof(account));
+    memcpy(account.name,     change.name.data(),     change.name.size());
+    memcpy(account.password, change.password.data(), change.password.size());
+    account.level = change.level;
+
+
+    Md5 md5;
+    md5.update(change.name.data(),     change.name.size());
+    md5.update(":", 1);
+    md5.update(realm.data(),           realm.size());
+    md5.update(":", 1);
+    md5.update(change.password.data(), change.password.size());
+    md5.final_hex(account.ha1);
+
+    return USER_OK;
+}
+
+
+
+UserStore::Result UserStore::publish(std::unique_ptr<UserList> list, bool save_file)
+{
+    if( !admin_cnt(*list) )
+        return USER_FIXED;
+
+
+    list->build_index();
+
+    if( save_file && !file.empty() && !save(*list) )
+        return USER_IO_ERROR;
+
+
+    retired = std::move(active);
+    active  = std::move(list);
+
+    current.store(active.get(), std::memory_order_release);
+
+    return USER_OK;
+}
+
+
+
+bool UserStore::load(UserList &list)
+{
+    FILE *fp = fopen(file.c_str(), "r");
+    if( !fp )
+    {
+        str_err = "can't open users file: " + file + " - " + strerror(errno);
+        return false;
+    }
+
+
+    char line[USER_NAME_LEN + USER_PASSWORD_LEN + 32];
+    int  line_num = 0;
+
+    list.cnt = 0;
+    list.build_index();
+
+    while( fgets(line, sizeof(line), fp) )
+    {
+        line_num++;
+
+        size_t len = strcspn(line, "\r\n");
+        line[len]  = '\0';
+
+        if( !len || (line[0] == '#') )
+            continue;
+
+
+        // name:level:password (the password can have ':')
+        char *level = strchr(line, ':');
+        char *pass  = level ? strchr(level + 1, ':') : nullptr;
+
+        Change change;
+
+        if( !pass || !parse_level(level + 1, pass - level - 1, &change.level) )
+        {
+            fclose(fp);
+            str_err = file + ":" + std::to_string(line_num) + ": bad line";
+            return false;
+        }
+
+        change.name.assign(line, level - line);
+        change.password     = pass + 1;
+        change.has_password = true;
+
+
+        Result res = USER_OK;
+
+        if( list.cnt >= UserList::MAX_USERS )
+            res = USER_TOO_MANY;
+        else if( list.find(change.name.c_str(), change.name.size()) )
+            res = USER_EXISTS;
+        else
+            res = set_account(list.users[list.cnt], change);
+
+        if( res != USER_OK )
+        {
+            fclose(fp);
+            str_err = file + ":" + std::to_string(line_num) + ": " + get_result_str(res);
+            return false;
+        }
+
+        list.cnt++;
+        list.build_index();
+    }
+
+
+    fclose(fp);
+
+    return true;
+}
+
+
+
+bool UserStore::save(const UserList &list)
+{
+    std::string data = "# users of " + realm + ": name:level:password\n";
+
+    for(size_t i = 0; i < list.cnt; i++)
+    {
+        data += list.users[i].name;
+        data += ':';
+        data += get_level_name(list.users[i].level);
+        data += ':';
+        data += list.users[i].password;
+        data += '\n';
+    }
+
+
+    // the new file is complete on the disk before it replaces the old one
+    std::string tmp_file = file + ".tmp";
+
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if( fd < 0 )
+    {
+        str_err = "can't create " + tmp_file + " - " + strerror(errno);
+        return false;
+    }
+
+    if( !write_all(fd, data.data(), data.size()) || (fsync(fd) != 0) )
+    {
+        str_err = "can't write " + tmp_file + " - " + strerror(errno);
+        close(fd);
+        unlink(tmp_file.c_str());
+        return false;
+    }
+
+    close(fd);
+
+
+    if( rename(tmp_file.c_str(), file.c_str()) != 0 )
+    {
+        str_err = "can't rename " + tmp_file + " - " + strerror(errno);
+        unlink(tmp_file.c_str());
+        return false;
+    }
+
+
+    // and the rename itself
+    size_t      slash = file.rfind('/');
+    std::string dir   = (slash == std::string::npos) ? "." : (slash ? file.substr(0, slash) : "/");
+
+    fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if( fd >= 0 )
+    {
+        fsync(fd);
+        close(fd);
+    }
+
+
+    return true;
+}
@@ -0,0 +1,162 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+#include "md5.h"
+#include "access_policy.h"
+
+
+
+
+
+#define USER_NAME_LEN      32   // with '\0'
+#define USER_PASSWORD_LEN  64   // with '\0'
+
+
+
+struct UserAccount
+{
+    char      name[USER_NAME_LEN];
+    char      password[USER_PASSWORD_LEN];  // WS-UsernameToken digest is over the clear password
+    char      ha1[MD5_DIGEST_SIZE*2 + 1];   // MD5(name:realm:password) for HTTP Digest
+    UserLevel level;
+};
+
+
+
+/*
+ * Immutable list of users + hash index by name (open addressing).
+ * Every change builds a new list, so readers never see a half-made one.
+ */
+struct UserList
+{
+    enum
+    {
+        MAX_USERS  = 32,
+        INDEX_SIZE = 64,    // must be a power of two and > MAX_USERS
+        INDEX_FREE = 0xFF
+    };
+
+    size_t      cnt;
+    UserAccount users[MAX_USERS];
+    uint8_t     index[INDEX_SIZE];   // idx in users or INDEX_FREE
+
+
+    const UserAccount* find(const char *name, size_t len) const;
+    void               build_index();
+};
+
+
+
+
+
+/*
+ * Accounts of the device (tds:CreateUsers/DeleteUsers/SetUser/GetUsers).
+ *
+ * The lookup on the hot path (WS-UsernameToken, HTTP Digest) is one hash
+ * and a couple of probes in the current UserList, it takes no locks and
+ * never touches the disk: the list is published by an atomic pointer.
+ * Changes (rare) are all-or-nothing: a new list is built and written to
+ * the file (tmp file + fsync + rename) and only then published.
+ * The old list is freed by the next change, readers (the main loop)
+ * never hold a pointer longer than one request.
+ *
+ * File format: one user per line "name:level:password", level is
+ * Administrator|Operator|User, '#' - comment. The file is created with
+ * mode 0600, it holds the passwords in clear (see UserAccount).
+ * There is always at least one Administrator.
+ */
+class UserStore
+{
+    public:
+
+        enum Result
+        {
+            USER_OK,
+            USER_BAD_NAME,
+            USER_NAME_TOO_LONG,
+            USER_BAD_PASSWORD,
+            USER_PASSWORD_TOO_LONG,
+            USER_BAD_LEVEL,          // Anonymous/Extended
+            USER_EXISTS,
+            USER_NOT_FOUND,
+            USER_TOO_MANY,
+            USER_FIXED,              // the last Administrator can't be deleted/demoted
+            USER_IO_ERROR            // the file can't be written, nothing is changed
+        };
+
+
+        struct Change
+        {
+            std::string name;
+            std::string password;
+            bool        has_password;  // SetUser without Password keeps the old one
+            UserLevel   level;
+        };
+
+
+        UserStore();
+
+        UserStore(const UserStore&) = delete;
+        UserStore& operator=(const UserStore&) = delete;
+
+
+        //methods for parsing opt from cmd
+        bool set_file(const char *new_val);
+        const std::string& get_file() const { return file; }
+
+
+        // load the file, if it is not set or does not exist - one Administrator (it is saved)
+        bool init(const std::string &realm, const std::string &admin, const std::string &password);
+
+        // read the file again (it is changed by hand, see SIGHUP), the current list is kept on error
+        bool reload();
+
+
+        const UserList*    get_users() const { return current.load(std::memory_order_acquire); }
+
+        const UserAccount* find(const char *name, size_t len) const { return get_users()->find(name, len); }
+        const UserAccount* find(const char *name) const;
+
+
+        Result create_users(const std::vector<Change> &changes);
+        Result delete_users(const std::vector<std::string> &names);
+        Result set_users   (const std::vector<Change> &changes);
+
+
+        static const char* get_result_str(Result result);
+        static const char* get_level_name(UserLevel level);
+
+        std::string get_str_err()  const { return str_err;         }
+        const char* get_cstr_err() const { return str_err.c_str(); }
+
+
+    private:
+
+        std::string                file;
+        std::string                realm;
+
+        std::atomic<const UserList*> current;
+        std::unique_ptr<UserList>    active;    // owner of current
+        std::unique_ptr<UserList>    retired;   // previous list
+
+        std::string                str_err;
+
+
+        Result set_account(UserAccount &account, const Change &change) const;
+        Result publish(std::unique_ptr<UserList> list, bool save_file = true);
+        bool   load(UserList &list);
+        bool   save(const UserList &list);
+};
+
+
+
+
+
+#endif // USER_STORE_H
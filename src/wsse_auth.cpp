@@ -0,0 +1,299 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "wsse_auth.h"
+#include "sha1.h"
+
+
+
+
+
+static const char *PASSWORD_DIGEST = "#PasswordDigest";
+
+
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        hash ^= ptr[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+
+
+// compare without early exit, so the time does not tell how many bytes match
+static bool equal_const_time(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+
+    for(size_t i = 0; i < len; i++)
+        diff |= a[i] ^ b[i];
+
+    return !diff;
+}
+
+
+
+static bool ends_with(const char *str, const char *suffix)
+{
+    size_t len        = strlen(str);
+    size_t suffix_len = strlen(suffix);
+
+    return (len >= suffix_len) && !strcmp(str + len - suffix_len, suffix);
+}
+
+
+
+
+
+int base64_decode(const char *src, uint8_t *buf, size_t size)
+{
+    uint32_t acc  = 0;
+    int      bits = 0;
+    size_t   len  = 0;
+
+
+    for( ; *src && (*src != '='); src++)
+    {
+        int val;
+        char ch = *src;
+
+        if(      ch >= 'A' && ch <= 'Z' ) val = ch - 'A';
+        else if( ch >= 'a' && ch <= 'z' ) val = ch - 'a' + 26;
+        else if( ch >= '0' && ch <= '9' ) val = ch - '0' + 52;
+        else if( ch == '+' )              val = 62;
+        else if( ch == '/' )              val = 63;
+        else if( ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' ) continue;
+        else return -1;
+
+
+        acc   = (acc << 6) | val;
+        bits += 6;
+
+        if( bits >= 8 )
+        {
+            if( len >= size )
+                return -1;
+
+            bits -= 8;
+            buf[len++] = acc >> bits;
+        }
+    }
+
+
+    return len;
+}
+
+
+
+time_t parse_utc_time(const char *str)
+{
+    if( !str )
+        return -1;
+
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+
+    char *end;
+
+    tm.tm_year = strtol(str, &end, 10) - 1900;  if( *end != '-' ) return -1;
+    tm.tm_mon  = strtol(end+1, &end, 10) - 1;   if( *end != '-' ) return -1;
+    tm.tm_mday = strtol(end+1, &end, 10);       if( *end != 'T' ) return -1;
+    tm.tm_hour = strtol(end+1, &end, 10);       if( *end != ':' ) return -1;
+    tm.tm_min  = strtol(end+1, &end, 10);       if( *end != ':' ) return -1;
+    tm.tm_sec  = strtol(end+1, &end, 10);
+
+
+    if( *end == '.' ) // fraction of second
+    {
+        end++;
+        while( *end >= '0' && *end <= '9' )
+            end++;
+    }
+
+
+    time_t time = timegm(&tm);
+
+
+    // Z or [+|-]hh:mm
+    if( (*end == '+') || (*end == '-') )
+    {
+        int sign = (*end == '-') ? -1 : 1;
+        int hh   = strtol(end+1, &end, 10);
+        if( *end != ':' )
+            return -1;
+
+        int mm   = strtol(end+1, &end, 10);
+
+        time -= sign * (hh*3600 + mm*60);
+    }
+    else if( *end == 'Z' )
+    {
+        end++;
+    }
+
+
+    return *end ? -1 : time;
+}
+
+
+
+
+
+NonceCache::NonceCache()
+{
+    clear();
+}
+
+
+
+bool NonceCache::insert(uint64_t key, time_t expire, time_t now)
+{
+    if( !key )
+        key = 1; // 0 - free entry
+
+
+    Entry *free_entry = nullptr;
+    size_t idx        = key & (SIZE - 1);
+
+    for(int i = 0; i < MAX_PROBES; i++, idx = (idx + 1) & (SIZE - 1))
+    {
+        Entry &e = entries[idx];
+
+        if( e.key && (e.expire >= now) )
+        {
+            if( e.key == key )
+                return false;   // replay
+
+            continue;
+        }
+
+        if( !free_entry )
+            free_entry = &e;
+
+        if( !e.key )
+            break;              // the key can't be further
+    }
+
+
+    if( !free_entry )
+        return false;           // no room
+
+
+    free_entry->key    = key;
+    free_entry->expire = expire;
+
+    return true;
+}
+
+
+
+void NonceCache::clear()
+{
+    memset(entries, 0, sizeof(entries));
+}
+
+
+
+
+
+WsseAuth::WsseAuth():
+    ok_cnt    (0),
+    failed_cnt(0),
+    replay_cnt(0)
+{
+}
+
+
+
+WsseAuth::Result WsseAuth::verify(const char *password_type, const char *digest, const char *nonce,
+                                  const char *created, const char *password, time_t now)
+{
+    uint8_t nonce_buf[MAX_NONCE_LEN];
+    uint8_t client_digest[SHA1_DIGEST_SIZE + 1];  // +1 to detect too long digest
+    uint8_t our_digest[SHA1_DIGEST_SIZE];
+
+
+    // PasswordText is not accepted: the password must not travel in clear
+    if( !password_type || !ends_with(password_type, PASSWORD_DIGEST) ||
+        !digest || !nonce || !created || !password )
+    {
+        failed_cnt++;
+        return AUTH_BAD_TOKEN;
+    }
+
+
+    int nonce_len = base64_decode(nonce, nonce_buf, sizeof(nonce_buf));
+    if( (nonce_len <= 0) ||
+        (base64_decode(digest, client_digest, sizeof(client_digest)) != SHA1_DIGEST_SIZE) )
+    {
+        failed_cnt++;
+        return AUTH_BAD_TOKEN;
+    }
+
+
+    time_t created_time = parse_utc_time(created);
+    if( created_time < 0 )
+    {
+        failed_cnt++;
+        return AUTH_BAD_TOKEN;
+    }
+
+    if( (created_time < now - MAX_CLOCK_SKEW) || (created_time > now + MAX_CLOCK_SKEW) )
+    {
+        failed_cnt++;
+        return AUTH_STALE;
+    }
+
+
+    Sha1 sha1;
+    sha1.update(nonce_buf, nonce_len);
+    sha1.update(created,  strlen(created));
+    sha1.update(password, strlen(password));
+    sha1.final(our_digest);
+
+    if( !equal_const_time(our_digest, client_digest, SHA1_DIGEST_SIZE) )
+    {
+        failed_cnt++;
+        return AUTH_BAD_PASSWORD;
+    }
+
+
+    // only valid tokens get into the cache, so it can't be flooded by garbage
+    uint64_t key = fnv1a(0xCBF29CE484222325ull, nonce_buf, nonce_len);
+    key          = fnv1a(key, created, strlen(created));
+
+    if( !nonces.insert(key, created_time + MAX_CLOCK_SKEW, now) )
+    {
+        replay_cnt++;
+        return AUTH_REPLAY;
+    }
+
+
+    ok_cnt++;
+
+    return AUTH_OK;
+}
+
+
+
+const char* WsseAuth::get_result_str(Result result)
+{
+    switch(result)
+    {
+        case AUTH_OK:           return "ok";
+        case AUTH_BAD_TOKEN:    return "bad UsernameToken";
+        case AUTH_STALE:        return "Created is out of time window";
+        case AUTH_REPLAY:       return "nonce is replayed";
+        case AUTH_BAD_PASSWORD: return "bad user name or password";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,120 @@
+#ifndef WSSE_AUTH_H
+#define WSSE_AUTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+
+
+
+
+/*
+ * Replay cache of nonces.
+ * Open addressing (linear probing) in a fixed table, an entry is free
+ * when its expire time has passed, so there is no separate eviction pass
+ * and the memory never grows. When all probed entries are alive the nonce
+ * is rejected (fail closed): we can't prove it is not a replay.
+ */
+class NonceCache
+{
+    public:
+
+        enum
+        {
+            SIZE       = 16384,   // must be a power of two
+            MAX_PROBES = 32
+        };
+
+
+        NonceCache();
+
+
+        // returns false if the key is already in the cache or there is no room
+        bool insert(uint64_t key, time_t expire, time_t now);
+
+        void clear();
+
+
+    private:
+
+        struct Entry
+        {
+            uint64_t key;
+            time_t   expire;
+        };
+
+        Entry entries[SIZE];
+};
+
+
+
+
+
+/*
+ * WS-Security UsernameToken with PasswordDigest (OASIS WSS UsernameToken Profile 1.0):
+ *   Digest = Base64( SHA-1( Nonce + Created + Password ) )
+ *
+ * Created must be within MAX_CLOCK_SKEW of our clock, a nonce is
+ * remembered while its Created is acceptable, so it can't be replayed.
+ * Everything is done on the stack, no heap allocation per request.
+ */
+class WsseAuth
+{
+    public:
+
+        enum Result
+        {
+            AUTH_OK,
+            AUTH_BAD_TOKEN,     // missing/malformed fields or PasswordText
+            AUTH_STALE,         // Created is out of the time window
+            AUTH_REPLAY,        // nonce is seen already (or cache is full)
+            AUTH_BAD_PASSWORD
+        };
+
+
+        enum
+        {
+            MAX_CLOCK_SKEW = 300, // sec
+            MAX_NONCE_LEN  = 64   // bytes (decoded)
+        };
+
+
+        WsseAuth();
+
+
+        // fields of wsse:UsernameToken, password - password of the user
+        Result verify(const char *password_type, const char *digest, const char *nonce,
+                      const char *created, const char *password, time_t now);
+
+
+        uint64_t get_ok_cnt()     const { return ok_cnt;     }
+        uint64_t get_failed_cnt() const { return failed_cnt; }
+        uint64_t get_replay_cnt() const { return replay_cnt; }
+
+
+        static const char* get_result_str(Result result);
+
+
+    private:
+
+        NonceCache nonces;
+
+        uint64_t   ok_cnt;
+        uint64_t   failed_cnt;
+        uint64_t   replay_cnt;
+};
+
+
+
+// base64 decode into buf, returns length or -1 (bad input or too small buf)
+int    base64_decode(const char *src, uint8_t *buf, size_t size);
+
+// xsd:dateTime in UTC (YYYY-MM-DDThh:mm:ss[.fff]Z), returns -1 on error
+time_t parse_utc_time(const char *str);
+
+
+
+
+
+#endif // WSSE_AUTH_H